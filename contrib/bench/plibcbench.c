@@ -0,0 +1,1869 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/bench/plibcbench.c
+ * @brief Benchmarks for the I/O, file system and readiness paths of PlibC
+ *
+ * Runs on Windows and links against PlibC:
+ *   plibcbench [-a] [-s scale] [case...]
+ * Runs the given cases, all by default, and prints how long their hot loops
+ * took. Every case also checks the results it gets, the exit code is 1 if
+ * one of the checks failed. scale multiplies the number of iterations, -a
+ * initializes PlibC in ANSI instead of UTF-8 mode.
+ * Files and directory trees are created in %TEMP%\plibcbench. The large
+ * trees take a while to create and are kept for the next run.
+ */
+
+#include <plibc.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int (*TCaseProc) (unsigned long ulIterations);
+
+typedef struct
+{
+  const char *pszName;
+  TCaseProc pProc;
+  unsigned long ulIterations;
+} TCase;
+
+static char szWork[MAX_PATH];
+static const char *pszCase;
+static int iCaseFailed, iUtf8;
+static LARGE_INTEGER liFreq, liStart;
+
+#define CHECK(cond) \
+  if (!(cond)) \
+  { \
+    fprintf(stderr, "FAIL %s: %s (line %d)\n", pszCase, #cond, __LINE__); \
+    iCaseFailed = 1; \
+  }
+
+static void StartTimer()
+{
+  QueryPerformanceCounter(&liStart);
+}
+
+/**
+ * @brief Print the time since StartTimer()
+ * @param pszWhat what the loop did
+ * @param ulOps number of operations in the loop
+ * @return the time in ms
+ */
+static double StopTimer(const char *pszWhat, unsigned long ulOps)
+{
+  LARGE_INTEGER liNow;
+  double dMs;
+
+  QueryPerformanceCounter(&liNow);
+  dMs = (liNow.QuadPart - liStart.QuadPart) * 1000.0 / liFreq.QuadPart;
+  printf("%-10s %-32s %9lu ops %10.1f ms %10.0f ns/op\n", pszCase, pszWhat,
+    ulOps, dMs, ulOps ? dMs * 1e6 / ulOps : 0.0);
+
+  return dMs;
+}
+
+/* Handle values no real handle has */
+#define FAKE_HANDLE(ul) ((intptr_t) 0x40000000 + (intptr_t) (ul) * 4)
+
+/**
+ * @brief Descriptor registry: lookups with 10 to 100000 registered
+ *        descriptors, and descriptors that come and go
+ */
+static int Handles(unsigned long ulIterations)
+{
+  static const unsigned long aulCounts[] = {10, 100, 1000, 10000, 100000};
+  char szWhat[64];
+  unsigned long ul, ulIndex, ulCount, ulAllocs;
+  unsigned int ui, uiBefore;
+  int iMismatch;
+
+  uiBefore = plibc_get_handle_count();
+  ulCount = 0;
+  for (ui = 0; ui < sizeof(aulCounts) / sizeof(aulCounts[0]); ui++)
+  {
+    for (; ulCount < aulCounts[ui]; ulCount++)
+      __win_SetHandleBlockingMode(FAKE_HANDLE(ulCount), ulCount % 2);
+    CHECK(plibc_get_handle_count() == uiBefore + ulCount);
+
+    iMismatch = 0;
+    StartTimer();
+    for (ul = 0; ul < ulIterations; ul++)
+    {
+      ulIndex = ul * 7919 % ulCount;
+      if (__win_IsHandleMarkedAsBlocking(FAKE_HANDLE(ulIndex)) !=
+        (BOOL) (ulIndex % 2))
+        iMismatch++;
+    }
+    snprintf(szWhat, sizeof(szWhat), "lookup, %lu registered", ulCount);
+    StopTimer(szWhat, ulIterations);
+    CHECK(!iMismatch);
+  }
+
+  for (ul = 0; ul < ulCount; ul++)
+    __win_DiscardHandleBlockingMode(FAKE_HANDLE(ul));
+  CHECK(plibc_get_handle_count() == uiBefore);
+
+  /* Deleted slots are purged in place, only growing allocates */
+  ulAllocs = plibc_get_alloc_count();
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    __win_SetHandleBlockingMode(FAKE_HANDLE(ul), FALSE);
+    __win_DiscardHandleBlockingMode(FAKE_HANDLE(ul));
+  }
+  StopTimer("register and discard", ulIterations);
+  CHECK(plibc_get_handle_count() == uiBefore);
+  printf("%-10s %lu allocations while purging\n", pszCase,
+    plibc_get_alloc_count() - ulAllocs);
+
+  return 0;
+}
+
+#define FILE_CHUNK 4096
+
+/**
+ * @brief Fill a buffer with a pattern that depends on the stream offset
+ */
+static void Pattern(unsigned char *pBuf, size_t nLen, unsigned long ulOffset)
+{
+  size_t n;
+
+  for (n = 0; n < nLen; n++)
+    pBuf[n] = (unsigned char) ((ulOffset + n) * 2654435761UL >> 13);
+}
+
+static int CheckPattern(const unsigned char *pBuf, size_t nLen,
+  unsigned long ulOffset)
+{
+  unsigned char abExpected[FILE_CHUNK];
+  size_t n;
+
+  while (nLen)
+  {
+    n = nLen < FILE_CHUNK ? nLen : FILE_CHUNK;
+    Pattern(abExpected, n, ulOffset);
+    if (memcmp(pBuf, abExpected, n) != 0)
+      return 0;
+    pBuf += n;
+    nLen -= n;
+    ulOffset += n;
+  }
+
+  return 1;
+}
+
+typedef struct
+{
+  intptr_t fd;
+  unsigned long ulExpected;
+  unsigned long ulRead;
+  int iOk;
+} TDrain;
+
+/**
+ * @brief Read the pattern from a descriptor until ulExpected bytes arrived
+ */
+static DWORD WINAPI Drain(LPVOID lpParam)
+{
+  TDrain *pDrain = (TDrain *) lpParam;
+  unsigned char abBuf[FILE_CHUNK];
+  int iRead;
+
+  pDrain->ulRead = 0;
+  pDrain->iOk = 1;
+  while (pDrain->ulRead < pDrain->ulExpected &&
+    (iRead = READ(pDrain->fd, abBuf, sizeof(abBuf))) > 0)
+  {
+    if (!CheckPattern(abBuf, iRead, pDrain->ulRead))
+      pDrain->iOk = 0;
+    pDrain->ulRead += iRead;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Sustained small non-blocking writes to a pipe, queued for the
+ *        worker threads while another thread reads
+ */
+static int Aio(unsigned long ulIterations)
+{
+  static const int aiSizes[] = {16, 256};
+  unsigned char abBuf[FILE_CHUNK];
+  char szWhat[64];
+  intptr_t ah[2];
+  unsigned long ul, ulAgain, ulOffset;
+  unsigned int ui, uiThreads, uiPeak;
+  TDrain drain;
+  HANDLE hThread;
+  double dMs;
+  int iRet;
+
+  for (ui = 0; ui < sizeof(aiSizes) / sizeof(aiSizes[0]); ui++)
+  {
+    CHECK(PIPE(ah) == 0);
+    if (iCaseFailed)
+      return 0;
+    __win_SetHandleBlockingMode(ah[1], FALSE);
+
+    drain.fd = ah[0];
+    drain.ulExpected = ulIterations * aiSizes[ui];
+    hThread = CreateThread(NULL, 0, Drain, &drain, 0, NULL);
+    CHECK(hThread != NULL);
+    if (!hThread)
+      return 0;
+
+    ulAgain = ulOffset = 0;
+    StartTimer();
+    for (ul = 0; ul < ulIterations; ul++)
+    {
+      Pattern(abBuf, aiSizes[ui], ulOffset);
+      while ((iRet = WRITE(ah[1], abBuf, aiSizes[ui])) == -1 &&
+        errno == EAGAIN)
+      {
+        ulAgain++;
+        Sleep(0);
+      }
+      CHECK(iRet == aiSizes[ui]);
+      if (iRet != aiSizes[ui])
+        break;
+      ulOffset += iRet;
+    }
+    WaitForSingleObject(hThread, INFINITE);
+    snprintf(szWhat, sizeof(szWhat), "%d byte writes, read back", aiSizes[ui]);
+    dMs = StopTimer(szWhat, ulIterations);
+    CloseHandle(hThread);
+
+    plibc_get_aio_thread_count(&uiThreads, &uiPeak);
+    printf("%-10s %.1f MB/s, %lu EAGAIN, %u workers running, peak %u\n",
+      pszCase, dMs ? ulOffset / dMs / 1000.0 : 0.0, ulAgain, uiThreads,
+      uiPeak);
+    CHECK(drain.iOk && drain.ulRead == ulOffset);
+
+    CHECK(CLOSE(ah[1]) == 0);
+    CLOSE(ah[0]);
+  }
+
+  return 0;
+}
+
+static void WorkPath(char *pszDest, const char *pszName)
+{
+  snprintf(pszDest, MAX_PATH, "%s\\%s", szWork, pszName);
+}
+
+/**
+ * @brief Check that a file holds the pattern and nothing else
+ */
+static int CheckFile(const char *pszPath, unsigned long ulSize)
+{
+  unsigned char abBuf[FILE_CHUNK];
+  unsigned long ulOffset;
+  int fd, iRead, iOk;
+
+  fd = OPEN(pszPath, O_RDONLY | O_BINARY);
+  if (fd == -1)
+    return 0;
+
+  iOk = 1;
+  ulOffset = 0;
+  while (iOk && (iRead = READ(fd, abBuf, sizeof(abBuf))) > 0)
+  {
+    iOk = CheckPattern(abBuf, iRead, ulOffset);
+    ulOffset += iRead;
+  }
+  CLOSE(fd);
+
+  return iOk && ulOffset == ulSize;
+}
+
+/**
+ * @brief Read exactly ulLen bytes of the pattern
+ */
+static int ReadPattern(intptr_t fd, unsigned long ulLen,
+  unsigned long ulOffset)
+{
+  unsigned char abBuf[FILE_CHUNK];
+  int iRead;
+
+  while (ulLen)
+  {
+    iRead = READ(fd, abBuf, ulLen < sizeof(abBuf) ? ulLen : sizeof(abBuf));
+    if (iRead <= 0 || !CheckPattern(abBuf, iRead, ulOffset))
+      return 0;
+    ulLen -= iRead;
+    ulOffset += iRead;
+  }
+
+  return 1;
+}
+
+static volatile LONG lFreed;
+
+static void CountingFree(void *pMem)
+{
+  InterlockedIncrement(&lFreed);
+  free(pMem);
+}
+
+#define OWNED_SIZE (1024 * 1024)
+
+/**
+ * @brief Large writes with and without a copy, and short owned writes
+ */
+static int Owned(unsigned long ulIterations)
+{
+  unsigned char abBuf[16 * FILE_CHUNK], *pBuf;
+  struct iovec aiov[16];
+  struct pollfd pfd;
+  char szPath[MAX_PATH];
+  intptr_t ah[2];
+  unsigned long ul;
+  int fd, i, iRet;
+
+  /* A blocking write() no longer copies */
+  WorkPath(szPath, "owned");
+  pBuf = (unsigned char *) malloc(OWNED_SIZE);
+  CHECK(pBuf != NULL);
+  if (!pBuf)
+    return 0;
+  fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  CHECK(fd != -1);
+  if (fd == -1)
+    return 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    Pattern(pBuf, OWNED_SIZE, ul * OWNED_SIZE);
+    CHECK(WRITE(fd, pBuf, OWNED_SIZE) == OWNED_SIZE);
+  }
+  StopTimer("1 MB write(), blocking", ulIterations);
+  CHECK(CLOSE(fd) == 0);
+  CHECK(CheckFile(szPath, ulIterations * OWNED_SIZE));
+  free(pBuf);
+
+  /* Non-blocking, the buffers are queued as they are */
+  fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  CHECK(fd != -1);
+  if (fd == -1)
+    return 0;
+  __win_SetHandleBlockingMode(fd, FALSE);
+  lFreed = 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    pBuf = (unsigned char *) malloc(OWNED_SIZE);
+    CHECK(pBuf != NULL);
+    if (!pBuf)
+      break;
+    Pattern(pBuf, OWNED_SIZE, ul * OWNED_SIZE);
+    while ((iRet = plibc_write_owned(fd, pBuf, OWNED_SIZE, CountingFree)) ==
+      -1 && errno == EAGAIN)
+      Sleep(0);
+    CHECK(iRet == OWNED_SIZE);
+  }
+  CHECK(CLOSE(fd) == 0);
+  StopTimer("1 MB plibc_write_owned()", ulIterations);
+  CHECK(lFreed == (LONG) ulIterations);
+  CHECK(CheckFile(szPath, ulIterations * OWNED_SIZE));
+  UNLINK(szPath);
+
+  /* Only part of the data fits into the pipe: the buffer stays with the
+     caller, and writev() must not leak its gathered copy */
+  CHECK(plibc_pipe_ex(ah, 16384, 0) == 0);
+  if (iCaseFailed)
+    return 0;
+  __win_SetHandleBlockingMode(ah[1], FALSE);
+
+  Pattern(abBuf, sizeof(abBuf), 0);
+  lFreed = 0;
+  iRet = plibc_write_owned((int) ah[1], abBuf, sizeof(abBuf), CountingFree);
+  CHECK(iRet > 0 && iRet < (int) sizeof(abBuf));
+  CHECK(lFreed == 0);
+  if (iRet > 0)
+    CHECK(ReadPattern(ah[0], iRet, 0));
+
+  pfd.fd = ah[1];
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  CHECK(POLL(&pfd, 1, 5000) == 1 && (pfd.revents & POLLOUT));
+  Pattern(abBuf, sizeof(abBuf), 0);
+  for (i = 0; i < 16; i++)
+  {
+    aiov[i].iov_base = abBuf + i * FILE_CHUNK;
+    aiov[i].iov_len = FILE_CHUNK;
+  }
+  iRet = WRITEV(ah[1], aiov, 16);
+  CHECK(iRet > 0 && iRet < (int) sizeof(abBuf));
+  if (iRet > 0)
+    CHECK(ReadPattern(ah[0], iRet, 0));
+
+  CLOSE(ah[0]);
+  CLOSE(ah[1]);
+
+  return 0;
+}
+
+/**
+ * @brief Number of write operations the process issued so far
+ */
+static ULONGLONG WriteOps()
+{
+  IO_COUNTERS ioc;
+
+  if (!GetProcessIoCounters(GetCurrentProcess(), &ioc))
+    return 0;
+
+  return ioc.WriteOperationCount;
+}
+
+#define VEC_PARTS 16
+#define VEC_PART 64
+
+/**
+ * @brief 16 small parts written separately, copied into one buffer first,
+ *        and gathered by writev()
+ */
+static int Vecio(unsigned long ulIterations)
+{
+  static const char *apszHow[] = {"16 write() per message",
+    "memcpy() + write()", "writev()"};
+  unsigned char abMsg[VEC_PARTS * VEC_PART], abCopy[VEC_PARTS * VEC_PART];
+  struct iovec aiov[VEC_PARTS];
+  char szPath[MAX_PATH];
+  ULONGLONG ullOps;
+  unsigned long ul;
+  int fd, i, iHow;
+
+  WorkPath(szPath, "vecio");
+  Pattern(abMsg, sizeof(abMsg), 0);
+  for (i = 0; i < VEC_PARTS; i++)
+  {
+    aiov[i].iov_base = abMsg + i * VEC_PART;
+    aiov[i].iov_len = VEC_PART;
+  }
+
+  for (iHow = 0; iHow < 3; iHow++)
+  {
+    fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    CHECK(fd != -1);
+    if (fd == -1)
+      return 0;
+
+    ullOps = WriteOps();
+    StartTimer();
+    for (ul = 0; ul < ulIterations; ul++)
+    {
+      switch (iHow)
+      {
+        case 0:
+          for (i = 0; i < VEC_PARTS; i++)
+            CHECK(WRITE(fd, aiov[i].iov_base, VEC_PART) == VEC_PART);
+          break;
+        case 1:
+          for (i = 0; i < VEC_PARTS; i++)
+            memcpy(abCopy + i * VEC_PART, aiov[i].iov_base, VEC_PART);
+          CHECK(WRITE(fd, abCopy, sizeof(abCopy)) == sizeof(abCopy));
+          break;
+        default:
+          CHECK(WRITEV(fd, aiov, VEC_PARTS) == sizeof(abMsg));
+      }
+    }
+    StopTimer(apszHow[iHow], ulIterations);
+    ullOps = WriteOps() - ullOps;
+    printf("%-10s %.2f write operations per message\n", pszCase,
+      ulIterations ? (double) ullOps / ulIterations : 0.0);
+    CHECK(CLOSE(fd) == 0);
+  }
+
+  /* Scatter one message back from the middle of the file */
+  fd = OPEN(szPath, O_RDONLY | O_BINARY);
+  CHECK(fd != -1);
+  if (fd == -1)
+    return 0;
+  memset(abCopy, 0, sizeof(abCopy));
+  for (i = 0; i < VEC_PARTS; i++)
+  {
+    aiov[i].iov_base = abCopy + (VEC_PARTS - 1 - i) * VEC_PART;
+    aiov[i].iov_len = VEC_PART;
+  }
+  if (ulIterations > 1)
+  {
+    CHECK(PREADV(fd, aiov, VEC_PARTS, (off_t) sizeof(abMsg)) ==
+      sizeof(abMsg));
+    for (i = 0; i < VEC_PARTS; i++)
+      CHECK(memcmp(aiov[i].iov_base, abMsg + i * VEC_PART, VEC_PART) == 0);
+  }
+  CHECK(LSEEK(fd, 0, SEEK_CUR) == 0);
+  CLOSE(fd);
+  UNLINK(szPath);
+
+  return 0;
+}
+
+#define PREAD_BLOCKS 4096
+
+typedef struct
+{
+  int fd;
+  int iLocked;
+  unsigned long ulReads;
+  unsigned long ulSeed;
+  int iOk;
+} TReader;
+
+static CRITICAL_SECTION csSeek;
+
+/**
+ * @brief Read random blocks of the index file, either with pread() or with
+ *        lseek() and read() under a lock
+ */
+static DWORD WINAPI Reader(LPVOID lpParam)
+{
+  TReader *pReader = (TReader *) lpParam;
+  unsigned char abBuf[FILE_CHUNK];
+  unsigned long ul, ulSeed, ulOffset;
+  int iRead;
+
+  ulSeed = pReader->ulSeed;
+  for (ul = 0; ul < pReader->ulReads; ul++)
+  {
+    ulSeed = ulSeed * 1103515245 + 12345;
+    ulOffset = (ulSeed >> 8) % PREAD_BLOCKS * FILE_CHUNK;
+    if (pReader->iLocked)
+    {
+      EnterCriticalSection(&csSeek);
+      LSEEK(pReader->fd, ulOffset, SEEK_SET);
+      iRead = READ(pReader->fd, abBuf, sizeof(abBuf));
+      LeaveCriticalSection(&csSeek);
+    }
+    else
+      iRead = PREAD(pReader->fd, abBuf, sizeof(abBuf), ulOffset);
+
+    if (iRead != sizeof(abBuf) || !CheckPattern(abBuf, iRead, ulOffset))
+    {
+      pReader->iOk = 0;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Concurrent random reads from one descriptor
+ */
+static int Pread(unsigned long ulIterations)
+{
+  static const unsigned int auiThreads[] = {1, 2, 4, 8};
+  unsigned char abBuf[FILE_CHUNK];
+  char szPath[MAX_PATH], szWhat[64];
+  TReader aReaders[8];
+  HANDLE ahThreads[8];
+  unsigned int ui, uiThread;
+  int fd, iLocked;
+
+  WorkPath(szPath, "pread");
+  fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  CHECK(fd != -1);
+  if (fd == -1)
+    return 0;
+  for (ui = 0; ui < PREAD_BLOCKS; ui++)
+  {
+    Pattern(abBuf, sizeof(abBuf), ui * FILE_CHUNK);
+    CHECK(WRITE(fd, abBuf, sizeof(abBuf)) == sizeof(abBuf));
+  }
+  CHECK(CLOSE(fd) == 0);
+
+  fd = OPEN(szPath, O_RDONLY | O_BINARY);
+  CHECK(fd != -1);
+  if (fd == -1)
+    return 0;
+  InitializeCriticalSection(&csSeek);
+
+  for (iLocked = 1; iLocked >= 0; iLocked--)
+  {
+    for (ui = 0; ui < sizeof(auiThreads) / sizeof(auiThreads[0]); ui++)
+    {
+      StartTimer();
+      for (uiThread = 0; uiThread < auiThreads[ui]; uiThread++)
+      {
+        aReaders[uiThread].fd = fd;
+        aReaders[uiThread].iLocked = iLocked;
+        aReaders[uiThread].ulReads = ulIterations / auiThreads[ui];
+        aReaders[uiThread].ulSeed = uiThread + 1;
+        aReaders[uiThread].iOk = 1;
+        ahThreads[uiThread] = CreateThread(NULL, 0, Reader,
+          &aReaders[uiThread], 0, NULL);
+        CHECK(ahThreads[uiThread] != NULL);
+      }
+      WaitForMultipleObjects(auiThreads[ui], ahThreads, TRUE, INFINITE);
+      snprintf(szWhat, sizeof(szWhat), "%s, %u threads",
+        iLocked ? "lseek() + read()" : "pread()", auiThreads[ui]);
+      StopTimer(szWhat, ulIterations / auiThreads[ui] * auiThreads[ui]);
+
+      for (uiThread = 0; uiThread < auiThreads[ui]; uiThread++)
+      {
+        CHECK(aReaders[uiThread].iOk);
+        CloseHandle(ahThreads[uiThread]);
+      }
+    }
+  }
+
+  DeleteCriticalSection(&csSeek);
+  CLOSE(fd);
+  UNLINK(szPath);
+
+  return 0;
+}
+
+#define STDIO_SIZE (64 * 1024)
+
+/**
+ * @brief Bulk fread()/fwrite() with 1 byte and 64 KB items, against the
+ *        CRT, and the text mode translation
+ */
+static int Stdio(unsigned long ulIterations)
+{
+  static const size_t anItems[] = {1, STDIO_SIZE};
+  static unsigned char abBuf[STDIO_SIZE], abRead[STDIO_SIZE];
+  char szPath[MAX_PATH], szWhat[64], szText[8];
+  unsigned long ul;
+  size_t nSize, nCount, nDone;
+  unsigned int ui;
+  FILE *f;
+  int iCrt;
+
+  WorkPath(szPath, "stdio");
+  for (ui = 0; ui < sizeof(anItems) / sizeof(anItems[0]); ui++)
+  {
+    nSize = anItems[ui];
+    nCount = STDIO_SIZE / nSize;
+    for (iCrt = 0; iCrt < 2; iCrt++)
+    {
+      f = FOPEN(szPath, "wb");
+      CHECK(f != NULL);
+      if (!f)
+        return 0;
+      StartTimer();
+      for (ul = 0; ul < ulIterations; ul++)
+      {
+        Pattern(abBuf, STDIO_SIZE, ul * STDIO_SIZE);
+        if (iCrt)
+          nDone = fwrite(abBuf, nSize, nCount, f);
+        else
+          nDone = GN_FWRITE(abBuf, nSize, nCount, f);
+        CHECK(nDone == nCount);
+      }
+      fclose(f);
+      snprintf(szWhat, sizeof(szWhat), "%s, %lu byte items",
+        iCrt ? "CRT fwrite()" : "fwrite()", (unsigned long) nSize);
+      StopTimer(szWhat, ulIterations);
+
+      f = FOPEN(szPath, "rb");
+      CHECK(f != NULL);
+      if (!f)
+        return 0;
+      StartTimer();
+      for (ul = 0; ul < ulIterations; ul++)
+      {
+        if (iCrt)
+          nDone = fread(abRead, nSize, nCount, f);
+        else
+          nDone = GN_FREAD(abRead, nSize, nCount, f);
+        CHECK(nDone == nCount);
+        CHECK(CheckPattern(abRead, STDIO_SIZE, ul * STDIO_SIZE));
+      }
+      CHECK(GN_FREAD(abRead, 1, 1, f) == 0 && feof(f));
+      fclose(f);
+      snprintf(szWhat, sizeof(szWhat), "%s, %lu byte items",
+        iCrt ? "CRT fread()" : "fread()", (unsigned long) nSize);
+      StopTimer(szWhat, ulIterations);
+    }
+  }
+
+  /* Text streams still translate line ends */
+  f = FOPEN(szPath, "w");
+  CHECK(f != NULL);
+  if (!f)
+    return 0;
+  CHECK(GN_FWRITE("a\nb", 1, 3, f) == 3);
+  fclose(f);
+
+  f = FOPEN(szPath, "rb");
+  CHECK(f != NULL);
+  if (!f)
+    return 0;
+  memset(szText, 0, sizeof(szText));
+  CHECK(GN_FREAD(szText, 1, sizeof(szText) - 1, f) == 4);
+  CHECK(strcmp(szText, "a\r\nb") == 0);
+  fclose(f);
+
+  f = FOPEN(szPath, "r");
+  CHECK(f != NULL);
+  if (!f)
+    return 0;
+  memset(szText, 0, sizeof(szText));
+  CHECK(GN_FREAD(szText, 1, sizeof(szText) - 1, f) == 3);
+  CHECK(strcmp(szText, "a\nb") == 0);
+  fclose(f);
+  UNLINK(szPath);
+
+  return 0;
+}
+
+#define PATH_SET 1000
+
+/**
+ * @brief Translate the same set of paths over and over, with the cache
+ *        warm
+ */
+static int Path(unsigned long ulIterations)
+{
+  struct plibc_path_cache_stats before, after;
+  char szPath[MAX_PATH], szWin[MAX_PATH], szFirst[MAX_PATH];
+  unsigned long ul, ulAllocs;
+  int fd;
+
+  /* Entries expire after a while, which costs a miss and an allocation */
+  plibc_get_path_cache_stats(&before);
+  ulAllocs = plibc_get_alloc_count();
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    snprintf(szPath, sizeof(szPath), "/tmp/plibcbench/dir%lu/file.txt",
+      ul % PATH_SET);
+    CHECK(plibc_conv_to_win_path(szPath, szWin, MAX_PATH) == ERROR_SUCCESS);
+    if (iCaseFailed)
+      break;
+  }
+  StopTimer("plibc_conv_to_win_path", ulIterations);
+  plibc_get_path_cache_stats(&after);
+
+  CHECK(after.hits - before.hits + after.misses - before.misses ==
+    ulIterations);
+  CHECK(after.hits - before.hits + PATH_SET >= ulIterations / 100 * 99);
+  CHECK(plibc_get_alloc_count() - ulAllocs <= after.misses - before.misses);
+
+  /* PlibC's own changes to the file system invalidate the cache */
+  WorkPath(szPath, "path");
+  CHECK(plibc_conv_to_win_path(szPath, szFirst, MAX_PATH) == ERROR_SUCCESS);
+  fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK(fd != -1);
+  CLOSE(fd);
+  plibc_get_path_cache_stats(&before);
+  CHECK(UNLINK(szPath) == 0);
+  plibc_get_path_cache_stats(&after);
+  CHECK(after.generation != before.generation);
+  CHECK(plibc_conv_to_win_path(szPath, szWin, MAX_PATH) == ERROR_SUCCESS);
+  CHECK(strcmp(szWin, szFirst) == 0);
+
+  return 0;
+}
+
+/**
+ * @brief Translate paths through a mapping added by the application
+ */
+static int Mount(unsigned long ulIterations)
+{
+  char szWin[MAX_PATH], szExpected[MAX_PATH];
+  unsigned long ul;
+
+  CHECK(plibc_mount("/plibcbench/", szWork) == ERROR_SUCCESS);
+  if (iCaseFailed)
+    return 0;
+
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+    CHECK(plibc_conv_to_win_path("/plibcbench/x", szWin, MAX_PATH) ==
+      ERROR_SUCCESS);
+  StopTimer("mapped plibc_conv_to_win_path", ulIterations);
+
+  /* The trailing slash is ignored, but only whole components match */
+  WorkPath(szExpected, "x");
+  CHECK(stricmp(szWin, szExpected) == 0);
+  CHECK(plibc_conv_to_win_path("/plibcbench", szWin, MAX_PATH) ==
+    ERROR_SUCCESS);
+  CHECK(stricmp(szWin, szWork) == 0);
+  CHECK(plibc_conv_to_win_path("/plibcbenchx", szWin, MAX_PATH) ==
+    ERROR_SUCCESS);
+  CHECK(strnicmp(szWin, szWork, strlen(szWork)) != 0);
+
+  CHECK(plibc_mount("/plibcbench", NULL) == ERROR_SUCCESS);
+  CHECK(plibc_conv_to_win_path("/plibcbench/x", szWin, MAX_PATH) ==
+    ERROR_SUCCESS);
+  CHECK(stricmp(szWin, szExpected) != 0);
+
+  return 0;
+}
+
+#define STAT_DIRS 25
+#define STAT_FILES 2000
+
+/**
+ * @brief Create files named file0000... in a directory, file i holds
+ *        i % 100 bytes
+ */
+static void MakeFiles(const char *pszDir, int iFiles)
+{
+  char szPath[MAX_PATH];
+  int fd, i;
+
+  CreateDirectoryA(pszDir, NULL);
+  for (i = 0; i < iFiles; i++)
+  {
+    snprintf(szPath, sizeof(szPath), "%s\\file%04d", pszDir, i);
+    fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd != -1)
+    {
+      WRITE(fd, szPath, i % 100);
+      CLOSE(fd);
+    }
+  }
+}
+
+/**
+ * @brief Check whether a tree was completed by an earlier run, or mark it
+ *        as complete
+ */
+static int TreeDone(const char *pszDir, int iMark)
+{
+  char szPath[MAX_PATH];
+  int fd;
+
+  snprintf(szPath, sizeof(szPath), "%s\\complete", pszDir);
+  if (!iMark)
+    return GetFileAttributesA(szPath) != INVALID_FILE_ATTRIBUTES;
+
+  fd = OPEN(szPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd != -1)
+    CLOSE(fd);
+
+  return fd != -1;
+}
+
+/**
+ * @brief stat() every file of the 50k file tree once
+ */
+static int StatTree(const char *pszRoot)
+{
+  struct _stat st;
+  char szPath[MAX_PATH];
+  int iDir, iFile;
+
+  for (iDir = 0; iDir < STAT_DIRS; iDir++)
+  {
+    for (iFile = 0; iFile < STAT_FILES; iFile++)
+    {
+      snprintf(szPath, sizeof(szPath), "%s\\dir%02d\\file%04d", pszRoot, iDir,
+        iFile);
+      if (STAT(szPath, &st) != 0 || st.st_size != (off_t) (iFile % 100))
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Re-stat a 50k file tree with and without the stat cache
+ */
+static int StatCache(unsigned long ulIterations)
+{
+  struct plibc_stat_cache_stats before, after;
+  struct _stat st;
+  char szRoot[MAX_PATH], szPath[MAX_PATH];
+  unsigned long ul, ulAllocs;
+  int fd, i;
+
+  WorkPath(szRoot, "statcache");
+  if (!TreeDone(szRoot, 0))
+  {
+    printf("%-10s creating %d files\n", pszCase, STAT_DIRS * STAT_FILES);
+    CreateDirectoryA(szRoot, NULL);
+    for (i = 0; i < STAT_DIRS; i++)
+    {
+      snprintf(szPath, sizeof(szPath), "%s\\dir%02d", szRoot, i);
+      MakeFiles(szPath, STAT_FILES);
+    }
+    CHECK(TreeDone(szRoot, 1));
+  }
+
+  StartTimer();
+  for (ul = 0; ul < ulIterations && !iCaseFailed; ul++)
+    CHECK(StatTree(szRoot));
+  StopTimer("stat() of 50k files, no cache", ulIterations);
+
+  CHECK(plibc_stat_cache_enable(65536, 60000) == ERROR_SUCCESS);
+  StartTimer();
+  CHECK(StatTree(szRoot));
+  StopTimer("stat() of 50k files, cache cold", 1);
+
+  plibc_stat_cache_stats(&before);
+  ulAllocs = plibc_get_alloc_count();
+  StartTimer();
+  for (ul = 0; ul < ulIterations && !iCaseFailed; ul++)
+    CHECK(StatTree(szRoot));
+  StopTimer("stat() of 50k files, cache warm", ulIterations);
+  plibc_stat_cache_stats(&after);
+  printf("%-10s %lu entries, %lu watches\n", pszCase, after.entries,
+    after.watches);
+  CHECK(after.hits - before.hits ==
+    ulIterations * STAT_DIRS * STAT_FILES);
+  CHECK(plibc_get_alloc_count() == ulAllocs);
+
+  /* Changes must show up once the directory notification arrived */
+  snprintf(szPath, sizeof(szPath), "%s\\dir00\\file0001", szRoot);
+  fd = OPEN(szPath, O_WRONLY | O_APPEND | O_BINARY);
+  CHECK(fd != -1 && WRITE(fd, "x", 1) == 1);
+  if (fd != -1)
+    CLOSE(fd);
+  for (i = 0; i < 100; i++)
+  {
+    if (STAT(szPath, &st) == 0 && st.st_size == 2)
+      break;
+    Sleep(10);
+  }
+  CHECK(st.st_size == 2);
+
+  /* Restore the tree for the next run */
+  fd = OPEN(szPath, O_WRONLY | O_TRUNC | O_BINARY);
+  if (fd != -1)
+  {
+    WRITE(fd, szPath, 1);
+    CLOSE(fd);
+  }
+  plibc_stat_cache_disable();
+
+  return 0;
+}
+
+#define DIR_FILES 1000
+
+/**
+ * @brief readdir() and stat() per entry against plibc_readdir_bulk()
+ */
+static int ReadDir(unsigned long ulIterations)
+{
+  static struct plibc_dirent entries[64];
+  struct dirent *pEntry;
+  struct _stat st;
+  char szDir[MAX_PATH], szPath[MAX_PATH];
+  unsigned long ul, ulEntries, ulBulk;
+  int i, iGot;
+  DIR *pDir;
+
+  WorkPath(szDir, "readdir");
+  if (!TreeDone(szDir, 0))
+  {
+    MakeFiles(szDir, DIR_FILES);
+    CHECK(TreeDone(szDir, 1));
+  }
+
+  ulEntries = 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    pDir = OPENDIR(szDir);
+    CHECK(pDir != NULL);
+    if (!pDir)
+      return 0;
+    while ((pEntry = READDIR(pDir)) != NULL)
+    {
+      if (strncmp(pEntry->d_name, "file", 4) != 0)
+        continue;
+      snprintf(szPath, sizeof(szPath), "%s\\%s", szDir, pEntry->d_name);
+      CHECK(STAT(szPath, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size == atoi(pEntry->d_name + 4) % 100);
+      ulEntries++;
+    }
+    CLOSEDIR(pDir);
+  }
+  StopTimer("readdir() + stat()", ulEntries);
+  CHECK(ulEntries == ulIterations * DIR_FILES);
+
+  ulBulk = 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    pDir = OPENDIR(szDir);
+    CHECK(pDir != NULL);
+    if (!pDir)
+      return 0;
+    while ((iGot = plibc_readdir_bulk(pDir, entries, 64)) > 0)
+    {
+      for (i = 0; i < iGot; i++)
+      {
+        if (strncmp(entries[i].d_name, "file", 4) != 0)
+          continue;
+        CHECK(entries[i].d_type == DT_REG &&
+          entries[i].d_size == atoi(entries[i].d_name + 4) % 100);
+        ulBulk++;
+      }
+    }
+    CHECK(iGot == 0);
+    CLOSEDIR(pDir);
+  }
+  StopTimer("plibc_readdir_bulk()", ulBulk);
+  CHECK(ulBulk == ulEntries);
+
+  return 0;
+}
+
+#define BIG_FILES 100000
+
+/**
+ * @brief Name of entry i of the large directory, every 8th name has
+ *        non-ASCII characters
+ */
+static void BigName(wchar_t *pwszDest, size_t nLen, const char *pszDir,
+  int i)
+{
+  _snwprintf(pwszDest, nLen, L"%hs\\%ls%06d", pszDir,
+    (i % 8) ? L"entry" : L"\x00e9t\x00e9\x6587", i);
+}
+
+/**
+ * @brief Enumerate a directory with 100k entries
+ */
+static int BigDir(unsigned long ulIterations)
+{
+  struct dirent *pEntry;
+  wchar_t wszPath[MAX_PATH];
+  char szDir[MAX_PATH];
+  unsigned long ul, ulEntries, ulWide, ulAllocs;
+  HANDLE h;
+  DIR *pDir;
+  int i;
+
+  WorkPath(szDir, "bigdir");
+  if (!TreeDone(szDir, 0))
+  {
+    printf("%-10s creating %d files\n", pszCase, BIG_FILES);
+    CreateDirectoryA(szDir, NULL);
+    for (i = 0; i < BIG_FILES; i++)
+    {
+      BigName(wszPath, MAX_PATH, szDir, i);
+      h = CreateFileW(wszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+      if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    }
+    CHECK(TreeDone(szDir, 1));
+  }
+
+  /* The first pass fills the pool of directory streams */
+  ulAllocs = 0;
+  ulEntries = ulWide = 0;
+  for (ul = 0; ul <= ulIterations; ul++)
+  {
+    if (ul == 1)
+    {
+      StartTimer();
+      ulAllocs = plibc_get_alloc_count();
+      ulEntries = ulWide = 0;
+    }
+    pDir = OPENDIR(szDir);
+    CHECK(pDir != NULL);
+    if (!pDir)
+      return 0;
+    while ((pEntry = READDIR(pDir)) != NULL)
+    {
+      if (strncmp(pEntry->d_name, "entry", 5) == 0)
+        ulEntries++;
+      else if (strncmp(pEntry->d_name, "\xc3\xa9t\xc3\xa9\xe6\x96\x87", 8) ==
+        0)
+        ulWide++;
+    }
+    CLOSEDIR(pDir);
+  }
+  StopTimer(iUtf8 ? "readdir(), UTF-8" : "readdir(), ANSI",
+    ulIterations * BIG_FILES);
+  CHECK(plibc_get_alloc_count() == ulAllocs);
+  CHECK(ulEntries == ulIterations * (BIG_FILES - BIG_FILES / 8));
+  if (iUtf8)
+    CHECK(ulWide == ulIterations * (BIG_FILES / 8));
+
+  return 0;
+}
+
+#define TREE_FANOUT 10
+#define TREE_DEPTH 3
+#define TREE_FILES 900
+
+/**
+ * @brief Create a tree of empty files, TREE_FILES in every directory
+ */
+static void MakeTree(const char *pszDir, int iDepth)
+{
+  char szPath[MAX_PATH];
+  HANDLE h;
+  int i;
+
+  CreateDirectoryA(pszDir, NULL);
+  for (i = 0; i < TREE_FILES; i++)
+  {
+    snprintf(szPath, sizeof(szPath), "%s\\file%03d", pszDir, i);
+    h = CreateFileA(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h != INVALID_HANDLE_VALUE)
+      CloseHandle(h);
+  }
+  if (!iDepth)
+    return;
+  for (i = 0; i < TREE_FANOUT; i++)
+  {
+    snprintf(szPath, sizeof(szPath), "%s\\dir%d", pszDir, i);
+    MakeTree(szPath, iDepth - 1);
+  }
+}
+
+static volatile LONG lWalked;
+
+static int CountNftw(const char *path, const struct _stat *sb, int type,
+  struct FTW *ftwbuf)
+{
+  InterlockedIncrement(&lWalked);
+
+  return 0;
+}
+
+static int CountWalk(const char *path, const struct _stat *sb, int type,
+  struct FTW *ftwbuf, void *cls)
+{
+  InterlockedIncrement(&lWalked);
+
+  return 0;
+}
+
+/**
+ * @brief nftw() against plibc_walk() with 1 to 16 threads on a tree of
+ *        1M files
+ */
+static int Walk(unsigned long ulIterations)
+{
+  static const unsigned int auiThreads[] = {1, 2, 4, 8, 16};
+  struct plibc_walk_options options;
+  char szDir[MAX_PATH], szWhat[64];
+  unsigned long ul;
+  unsigned int ui;
+  LONG lExpected;
+
+  /* 1 + 10 + 100 + 1000 directories with 900 files each, and the marker */
+  WorkPath(szDir, "walk");
+  if (!TreeDone(szDir, 0))
+  {
+    printf("%-10s creating %d files\n", pszCase,
+      (1 + 10 + 100 + 1000) * TREE_FILES);
+    MakeTree(szDir, TREE_DEPTH);
+    CHECK(TreeDone(szDir, 1));
+  }
+  lExpected = (1 + 10 + 100 + 1000) * (TREE_FILES + 1) + 1;
+
+  lWalked = 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+    CHECK(NFTW(szDir, CountNftw, 16, FTW_PHYS) == 0);
+  StopTimer("nftw()", (unsigned long) lWalked);
+  CHECK(lWalked == lExpected * (LONG) ulIterations);
+
+  for (ui = 0; ui < sizeof(auiThreads) / sizeof(auiThreads[0]); ui++)
+  {
+    memset(&options, 0, sizeof(options));
+    options.flags = FTW_PHYS;
+    options.threads = auiThreads[ui];
+    lWalked = 0;
+    StartTimer();
+    for (ul = 0; ul < ulIterations; ul++)
+      CHECK(plibc_walk(szDir, &options, CountWalk, NULL) == 0);
+    snprintf(szWhat, sizeof(szWhat), "plibc_walk(), %u threads",
+      auiThreads[ui]);
+    StopTimer(szWhat, (unsigned long) lWalked);
+    CHECK(lWalked == lExpected * (LONG) ulIterations);
+  }
+
+  return 0;
+}
+
+#define WAKEUP_PAIRS 30
+
+/**
+ * @brief Connect two TCP sockets over the loopback interface
+ */
+static int SocketPair(intptr_t *ps)
+{
+  struct sockaddr_in addr;
+  intptr_t sListen;
+  int iLen;
+
+  sListen = SOCKET(AF_INET, SOCK_STREAM, 0);
+  if (sListen == -1)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  iLen = sizeof(addr);
+  if (BIND(sListen, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+    LISTEN(sListen, 1) == -1 ||
+    GETSOCKNAME(sListen, (struct sockaddr *) &addr, &iLen) == -1)
+  {
+    CLOSE(sListen);
+    return -1;
+  }
+
+  ps[0] = SOCKET(AF_INET, SOCK_STREAM, 0);
+  if (ps[0] == -1 ||
+    CONNECT(ps[0], (struct sockaddr *) &addr, sizeof(addr)) == -1)
+  {
+    CLOSE(sListen);
+    return -1;
+  }
+  ps[1] = ACCEPT(sListen, NULL, NULL);
+  CLOSE(sListen);
+  if (ps[1] == -1)
+  {
+    CLOSE(ps[0]);
+    return -1;
+  }
+
+  return 0;
+}
+
+typedef struct
+{
+  intptr_t fd;
+  unsigned long ulWrites;
+  HANDLE hReady;
+  volatile LONGLONG llStamp;
+} TWaker;
+
+/**
+ * @brief Write one byte to a pipe whenever the reader is ready, and
+ *        record when
+ */
+static DWORD WINAPI Waker(LPVOID lpParam)
+{
+  TWaker *pWaker = (TWaker *) lpParam;
+  LARGE_INTEGER liNow;
+  unsigned long ul;
+
+  for (ul = 0; ul < pWaker->ulWrites; ul++)
+  {
+    if (WaitForSingleObject(pWaker->hReady, 5000) != WAIT_OBJECT_0)
+      break;
+    /* Give the reader time to block in select() */
+    Sleep(1);
+    QueryPerformanceCounter(&liNow);
+    pWaker->llStamp = liNow.QuadPart;
+    if (WRITE(pWaker->fd, "x", 1) != 1)
+      break;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Ping-pong over a socket pair waiting with select(), and the
+ *        latency of a pipe write seen by a select() that also waits for
+ *        sockets
+ */
+static int Select(unsigned long ulIterations)
+{
+  struct timeval tv;
+  intptr_t as[2], aIdle[2 * WAKEUP_PAIRS], ah[2], fdMax;
+  LARGE_INTEGER liNow;
+  unsigned long ul, ulRounds;
+  double dUs, dSum, dMax;
+  TWaker waker;
+  HANDLE hThread;
+  fd_set rfds;
+  char c;
+  int i;
+
+  CHECK(SocketPair(as) == 0);
+  if (iCaseFailed)
+    return 0;
+  fdMax = as[0] > as[1] ? as[0] : as[1];
+
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      c = (char) (ul + i);
+      CHECK(SEND(as[i], &c, 1, 0) == 1);
+      FD_ZERO(&rfds);
+      FD_SET(as[!i], &rfds);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      CHECK(SELECT((int) fdMax + 1, &rfds, NULL, NULL, &tv) == 1 &&
+        FD_ISSET(as[!i], &rfds));
+      CHECK(RECV(as[!i], &c, 1, 0) == 1 && c == (char) (ul + i));
+    }
+    if (iCaseFailed)
+      break;
+  }
+  StopTimer("round trips", ulIterations);
+
+  /* Nothing left to read */
+  FD_ZERO(&rfds);
+  FD_SET(as[0], &rfds);
+  FD_SET(as[1], &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  CHECK(SELECT((int) fdMax + 1, &rfds, NULL, NULL, &tv) == 0);
+  CLOSE(as[0]);
+  CLOSE(as[1]);
+
+  /* Wakeups by a pipe among idle sockets */
+  CHECK(PIPE(ah) == 0);
+  if (iCaseFailed)
+    return 0;
+  fdMax = ah[0];
+  for (i = 0; i < WAKEUP_PAIRS; i++)
+  {
+    CHECK(SocketPair(aIdle + 2 * i) == 0);
+    if (iCaseFailed)
+      return 0;
+    if (aIdle[2 * i] > fdMax)
+      fdMax = aIdle[2 * i];
+    if (aIdle[2 * i + 1] > fdMax)
+      fdMax = aIdle[2 * i + 1];
+  }
+
+  ulRounds = ulIterations / 10;
+  waker.fd = ah[1];
+  waker.ulWrites = ulRounds;
+  waker.hReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+  hThread = CreateThread(NULL, 0, Waker, &waker, 0, NULL);
+  CHECK(waker.hReady != NULL && hThread != NULL);
+  if (iCaseFailed)
+    return 0;
+
+  dSum = dMax = 0;
+  for (ul = 0; ul < ulRounds; ul++)
+  {
+    FD_ZERO(&rfds);
+    FD_SET(ah[0], &rfds);
+    for (i = 0; i < 2 * WAKEUP_PAIRS; i++)
+      FD_SET(aIdle[i], &rfds);
+    SetEvent(waker.hReady);
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    CHECK(SELECT((int) fdMax + 1, &rfds, NULL, NULL, &tv) == 1 &&
+      FD_ISSET(ah[0], &rfds));
+    QueryPerformanceCounter(&liNow);
+    CHECK(READ(ah[0], &c, 1) == 1);
+    if (iCaseFailed)
+      break;
+
+    dUs = (liNow.QuadPart - waker.llStamp) * 1e6 / liFreq.QuadPart;
+    dSum += dUs;
+    if (dUs > dMax)
+      dMax = dUs;
+  }
+  printf("%-10s pipe wakeup among %d sockets: %.1f us average, %.1f us max\n",
+    pszCase, 2 * WAKEUP_PAIRS, ulRounds ? dSum / ulRounds : 0.0, dMax);
+
+  WaitForSingleObject(hThread, INFINITE);
+  CloseHandle(hThread);
+  CloseHandle(waker.hReady);
+  for (i = 0; i < 2 * WAKEUP_PAIRS; i++)
+    CLOSE(aIdle[i]);
+  CLOSE(ah[0]);
+  CLOSE(ah[1]);
+
+  return 0;
+}
+
+/**
+ * @brief Ping-pong over a socket pair waiting with poll(), and the corner
+ *        cases of the socket and mixed paths
+ */
+static int Poll(unsigned long ulIterations)
+{
+  struct pollfd pfd, apfd[3];
+  intptr_t as[2], ah[2];
+  unsigned long ul;
+  DWORD dwStart;
+  char c;
+  int i;
+
+  CHECK(SocketPair(as) == 0);
+  if (iCaseFailed)
+    return 0;
+
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      c = (char) (ul + i);
+      CHECK(SEND(as[i], &c, 1, 0) == 1);
+      pfd.fd = as[!i];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      CHECK(POLL(&pfd, 1, 5000) == 1 && (pfd.revents & POLLIN));
+      CHECK(RECV(as[!i], &c, 1, 0) == 1 && c == (char) (ul + i));
+    }
+    if (iCaseFailed)
+      break;
+  }
+  StopTimer("round trips", ulIterations);
+
+  /* Only ignored entries: poll() still waits for the timeout */
+  apfd[0].fd = -1;
+  apfd[0].events = POLLIN;
+  apfd[0].revents = POLLIN;
+  dwStart = GetTickCount();
+  CHECK(POLL(apfd, 1, 100) == 0 && apfd[0].revents == 0);
+  CHECK(GetTickCount() - dwStart >= 80);
+
+  /* Results of an earlier call don't survive, on either path */
+  CHECK(PIPE(ah) == 0);
+  if (iCaseFailed)
+    return 0;
+  for (i = 0; i < 2; i++)
+  {
+    apfd[0].fd = as[0];
+    apfd[1].fd = -1;
+    apfd[2].fd = i ? ah[0] : as[1];
+    apfd[0].events = apfd[1].events = apfd[2].events = POLLIN;
+    apfd[0].revents = apfd[1].revents = apfd[2].revents = POLLIN;
+    CHECK(POLL(apfd, 3, 0) == 0);
+    CHECK(!apfd[0].revents && !apfd[1].revents && !apfd[2].revents);
+  }
+  CLOSE(ah[0]);
+  CLOSE(ah[1]);
+
+  /* A closed peer is reported */
+  CLOSE(as[1]);
+  pfd.fd = as[0];
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  CHECK(POLL(&pfd, 1, 5000) == 1 && (pfd.revents & (POLLIN | POLLHUP)));
+  CLOSE(as[0]);
+
+  return 0;
+}
+
+#define ECHO_BURST 16
+
+static const char *apszWaits[] = {"plibc_epoll_wait()", "poll()",
+  "select()"};
+
+/**
+ * @brief Connect many loopback clients to one listener
+ * @return number of connections made
+ */
+static int Connections(intptr_t *psClients, intptr_t *psServers, int iCount)
+{
+  struct sockaddr_in addr;
+  intptr_t sListen;
+  int i, iLen;
+
+  sListen = SOCKET(AF_INET, SOCK_STREAM, 0);
+  if (sListen == -1)
+    return 0;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  iLen = sizeof(addr);
+  if (BIND(sListen, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+    LISTEN(sListen, SOMAXCONN) == -1 ||
+    GETSOCKNAME(sListen, (struct sockaddr *) &addr, &iLen) == -1)
+  {
+    CLOSE(sListen);
+    return 0;
+  }
+
+  for (i = 0; i < iCount; i++)
+  {
+    psClients[i] = SOCKET(AF_INET, SOCK_STREAM, 0);
+    if (psClients[i] == -1)
+      break;
+    if (CONNECT(psClients[i], (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      (psServers[i] = ACCEPT(sListen, NULL, NULL)) == -1)
+    {
+      CLOSE(psClients[i]);
+      break;
+    }
+  }
+  CLOSE(sListen);
+
+  return i;
+}
+
+/**
+ * @brief Echo what one connection of the server side received
+ * @return number of bytes echoed
+ */
+static int Echo(intptr_t s)
+{
+  char acBuf[ECHO_BURST];
+  int iRead;
+
+  iRead = RECV(s, acBuf, sizeof(acBuf), 0);
+  if (iRead <= 0 || SEND(s, acBuf, iRead, 0) != iRead)
+    return 0;
+
+  return iRead;
+}
+
+/**
+ * @brief Serve ECHO_BURST bytes, waiting with plibc_epoll_wait(), poll()
+ *        or select()
+ * @return FALSE if a wait failed or timed out
+ */
+static int Serve(int iWait, intptr_t epfd, struct pollfd *pfds,
+  intptr_t *psServers, int iCount, intptr_t fdMax)
+{
+  struct epoll_event events[64];
+  struct timeval tv;
+  fd_set rfds;
+  int i, iReady, iEchoed;
+
+  iEchoed = 0;
+  while (iEchoed < ECHO_BURST)
+  {
+    switch (iWait)
+    {
+      case 0:
+        iReady = plibc_epoll_wait(epfd, events, 64, 5000);
+        for (i = 0; i < iReady; i++)
+          iEchoed += Echo(psServers[events[i].data.u32]);
+        break;
+      case 1:
+        iReady = POLL(pfds, iCount, 5000);
+        for (i = 0; i < iCount && iReady > 0; i++)
+          if (pfds[i].revents & POLLIN)
+            iEchoed += Echo(pfds[i].fd);
+        break;
+      default:
+        FD_ZERO(&rfds);
+        for (i = 0; i < iCount; i++)
+          FD_SET(psServers[i], &rfds);
+        tv.tv_sec = 5;
+        tv.tv_usec = 0;
+        iReady = SELECT((int) fdMax + 1, &rfds, NULL, NULL, &tv);
+        for (i = 0; i < iCount && iReady > 0; i++)
+          if (FD_ISSET(psServers[i], &rfds))
+            iEchoed += Echo(psServers[i]);
+    }
+    if (iReady <= 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @brief Loopback echo server with 64, 1k and 10k connections; select()
+ *        only takes part with 64 because of FD_SETSIZE
+ */
+static int EchoServer(unsigned long ulIterations)
+{
+  static const int aiConns[] = {FD_SETSIZE, 1000, 10000};
+  struct epoll_event event;
+  struct pollfd *pfds;
+  intptr_t *psClients, *psServers, epfd, fdMax;
+  unsigned long ul, ulSeed;
+  unsigned int ui;
+  char szWhat[64], c;
+  int aiSent[ECHO_BURST], i, iCount, iWait, iOk;
+
+  psClients = (intptr_t *) malloc(10000 * sizeof(intptr_t));
+  psServers = (intptr_t *) malloc(10000 * sizeof(intptr_t));
+  pfds = (struct pollfd *) malloc(10000 * sizeof(struct pollfd));
+  CHECK(psClients && psServers && pfds);
+  if (iCaseFailed)
+    return 0;
+
+  for (ui = 0; ui < sizeof(aiConns) / sizeof(aiConns[0]); ui++)
+  {
+    iCount = Connections(psClients, psServers, aiConns[ui]);
+    CHECK(iCount == aiConns[ui]);
+    if (iCaseFailed)
+      break;
+
+    fdMax = 0;
+    epfd = plibc_epoll_create(iCount);
+    CHECK(epfd != -1);
+    for (i = 0; i < iCount; i++)
+    {
+      event.events = EPOLLIN;
+      event.data.u32 = i;
+      CHECK(plibc_epoll_ctl(epfd, EPOLL_CTL_ADD, psServers[i], &event) == 0);
+      pfds[i].fd = psServers[i];
+      pfds[i].events = POLLIN;
+      pfds[i].revents = 0;
+      if (psServers[i] > fdMax)
+        fdMax = psServers[i];
+    }
+
+    for (iWait = 0; iWait < 3 && !iCaseFailed; iWait++)
+    {
+      if (iWait == 2 && iCount > FD_SETSIZE)
+        break;
+
+      ulSeed = 1;
+      StartTimer();
+      for (ul = 0; ul < ulIterations; ul++)
+      {
+        /* The client sends on some connections, the server echoes */
+        for (i = 0; i < ECHO_BURST; i++)
+        {
+          ulSeed = ulSeed * 1103515245 + 12345;
+          aiSent[i] = (int) ((ulSeed >> 8) % iCount);
+          c = (char) i;
+          CHECK(SEND(psClients[aiSent[i]], &c, 1, 0) == 1);
+        }
+        CHECK(Serve(iWait, epfd, pfds, psServers, iCount, fdMax));
+        iOk = 1;
+        for (i = 0; i < ECHO_BURST && iOk; i++)
+          iOk = RECV(psClients[aiSent[i]], &c, 1, 0) == 1;
+        CHECK(iOk);
+        if (iCaseFailed)
+          break;
+      }
+      snprintf(szWhat, sizeof(szWhat), "%s, %d connections",
+        apszWaits[iWait], iCount);
+      StopTimer(szWhat, ulIterations);
+    }
+
+    CHECK(CLOSE(epfd) == 0);
+    for (i = 0; i < iCount; i++)
+    {
+      CLOSE(psClients[i]);
+      CLOSE(psServers[i]);
+    }
+  }
+
+  free(psClients);
+  free(psServers);
+  free(pfds);
+
+  return 0;
+}
+
+/**
+ * @brief Ping-pong over a socket pair, waiting with plibc_epoll_wait()
+ */
+static int Epoll(unsigned long ulIterations)
+{
+  struct epoll_event event, events[4];
+  intptr_t as[2], epfd;
+  unsigned long ul;
+  u_long ulMode;
+  char c;
+  int i;
+
+  CHECK(SocketPair(as) == 0);
+  if (iCaseFailed)
+    return 0;
+  epfd = plibc_epoll_create(1);
+  CHECK(epfd != -1);
+  if (epfd == -1)
+    return 0;
+
+  for (i = 0; i < 2; i++)
+  {
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    CHECK(plibc_epoll_ctl(epfd, EPOLL_CTL_ADD, as[i], &event) == 0);
+  }
+  CHECK(plibc_epoll_wait(epfd, events, 4, 0) == 0);
+
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      c = (char) (ul + i);
+      CHECK(SEND(as[i], &c, 1, 0) == 1);
+      CHECK(plibc_epoll_wait(epfd, events, 4, 5000) == 1 &&
+        events[0].data.u32 == (uint32_t) !i &&
+        (events[0].events & EPOLLIN));
+      CHECK(RECV(as[!i], &c, 1, 0) == 1 && c == (char) (ul + i));
+    }
+    if (iCaseFailed)
+      break;
+  }
+  StopTimer("round trips", ulIterations);
+
+  /* Edge-triggered: reported once until a read fails with EAGAIN */
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u32 = 1;
+  CHECK(plibc_epoll_ctl(epfd, EPOLL_CTL_MOD, as[1], &event) == 0);
+  CHECK(SEND(as[0], "ab", 2, 0) == 2);
+  CHECK(plibc_epoll_wait(epfd, events, 4, 5000) == 1);
+  CHECK(plibc_epoll_wait(epfd, events, 4, 100) == 0);
+  ulMode = 1;
+  ioctlsocket(as[1], FIONBIO, &ulMode);
+  __win_SetHandleBlockingMode(as[1], FALSE);
+  CHECK(RECV(as[1], &c, 1, 0) == 1 && RECV(as[1], &c, 1, 0) == 1);
+  CHECK(RECV(as[1], &c, 1, 0) == -1 && errno == EWOULDBLOCK);
+  CHECK(SEND(as[0], "c", 1, 0) == 1);
+  CHECK(plibc_epoll_wait(epfd, events, 4, 5000) == 1);
+
+  CHECK(CLOSE(epfd) == 0);
+  CLOSE(as[0]);
+  CLOSE(as[1]);
+
+  return 0;
+}
+
+/**
+ * @brief Writability of a pipe made by plibc_pipe_ex()
+ */
+static int Pipe(unsigned long ulIterations)
+{
+  unsigned char abBuf[FILE_CHUNK];
+  struct pollfd pfd;
+  intptr_t ah[2];
+  unsigned long ul, ulRead, ulWritten;
+  int iRet;
+
+  CHECK(plibc_pipe_ex(ah, 16384, 0) == 0);
+  if (iCaseFailed)
+    return 0;
+  __win_SetHandleBlockingMode(ah[1], FALSE);
+
+  ulRead = ulWritten = 0;
+  StartTimer();
+  for (ul = 0; ul < ulIterations; ul++)
+  {
+    /* Fill the pipe until it is full, then drain it */
+    while (1)
+    {
+      pfd.fd = ah[1];
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      if (POLL(&pfd, 1, 0) != 1)
+        break;
+      Pattern(abBuf, sizeof(abBuf), ulWritten);
+      iRet = WRITE(ah[1], abBuf, sizeof(abBuf));
+      if (iRet == -1 && errno == EAGAIN)
+        break;
+      CHECK(iRet > 0);
+      if (iRet <= 0)
+        break;
+      ulWritten += iRet;
+    }
+    CHECK(ulWritten > ulRead);
+
+    while (ulRead < ulWritten)
+    {
+      iRet = READ(ah[0], abBuf, sizeof(abBuf));
+      CHECK(iRet > 0 && CheckPattern(abBuf, iRet, ulRead));
+      if (iRet <= 0)
+        break;
+      ulRead += iRet;
+    }
+    if (iCaseFailed)
+      break;
+  }
+  StopTimer("fill and drain 16 KB", ulIterations);
+
+  /* Writing to a pipe without reader fails */
+  CLOSE(ah[0]);
+  pfd.fd = ah[1];
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  CHECK(POLL(&pfd, 1, 1000) == 1 && (pfd.revents & POLLERR));
+  CLOSE(ah[1]);
+
+  return 0;
+}
+
+static const TCase cases[] = {
+  {"handles", Handles, 1000000},
+  {"aio", Aio, 200000},
+  {"owned", Owned, 256},
+  {"vecio", Vecio, 100000},
+  {"pread", Pread, 200000},
+  {"stdio", Stdio, 2000},
+  {"path", Path, 1000000},
+  {"mount", Mount, 1000000},
+  {"statcache", StatCache, 5},
+  {"readdir", ReadDir, 100},
+  {"bigdir", BigDir, 10},
+  {"walk", Walk, 1},
+  {"select", Select, 10000},
+  {"poll", Poll, 10000},
+  {"epoll", Epoll, 10000},
+  {"echo", EchoServer, 2000},
+  {"pipe", Pipe, 1000}
+};
+
+int main(int argc, char *argv[])
+{
+  unsigned long ulScale;
+  unsigned int ui;
+  int i, iFailed, iRun, iNames;
+
+  ulScale = 1;
+  iUtf8 = 1;
+  iNames = 0;
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      ulScale = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-a") == 0)
+      iUtf8 = 0;
+    else
+      argv[++iNames] = argv[i];
+  }
+
+  plibc_init_utf8("PlibC", "plibcbench", iUtf8);
+  QueryPerformanceFrequency(&liFreq);
+
+  GetTempPathA(MAX_PATH, szWork);
+  strcat(szWork, "plibcbench");
+  CreateDirectoryA(szWork, NULL);
+
+  iFailed = iRun = 0;
+  for (ui = 0; ui < sizeof(cases) / sizeof(cases[0]); ui++)
+  {
+    for (i = 1; i <= iNames; i++)
+      if (strcmp(argv[i], cases[ui].pszName) == 0)
+        break;
+    if (iNames && i > iNames)
+      continue;
+
+    pszCase = cases[ui].pszName;
+    iCaseFailed = 0;
+    cases[ui].pProc(cases[ui].ulIterations * ulScale);
+    iFailed += iCaseFailed;
+    iRun++;
+  }
+
+  printf("%d cases, %d failed\n", iRun, iFailed);
+  plibc_shutdown();
+
+  return iFailed != 0 || !iRun;
+}
+
+/* end of plibcbench.c */
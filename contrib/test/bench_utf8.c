@@ -0,0 +1,254 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/test/bench_utf8.c
+ * @brief Throughput of the UTF-8 <-> UTF-16 converters
+ *
+ *   bench_utf8 [-m megabytes]
+ * Converts sets of path-like strings in both directions with the portable
+ * kernels, the ones __win_InitTranscoder() selects for this CPU and iconv,
+ * and prints MB/s of UTF-8. Build it optimized and without the sanitizers
+ * (see Makefile).
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "plibc_utf8.h"
+
+#define STRINGS 4096
+#define MAX_LEN 260
+
+typedef struct
+{
+  const char *pszName;
+  int iMinLen, iMaxLen;         /* characters per string */
+  int iNonAscii;                /* percentage of non-ASCII characters */
+  unsigned long ulFirst, ulCount;   /* range of the non-ASCII characters */
+} TCorpus;
+
+static const TCorpus corpora[] = {
+  {"short ASCII names", 4, 24, 0, 0, 0},
+  {"long ASCII paths", 60, 200, 0, 0, 0},
+  {"latin paths", 60, 200, 5, 0xC0, 0x40},
+  {"CJK names", 4, 24, 90, 0x4E00, 0x5000}
+};
+
+typedef struct
+{
+  char *pszUtf8;
+  size_t nUtf8Len;
+  unsigned short *pUtf16;
+  size_t nUtf16Len;
+} TString;
+
+static TString strings[STRINGS];
+static unsigned long ulState = 88172645UL;
+
+static unsigned long Random()
+{
+  /* xorshift */
+  ulState ^= ulState << 13;
+  ulState ^= ulState >> 17;
+  ulState ^= ulState << 5;
+
+  return ulState & 0xFFFFFFFFUL;
+}
+
+static double Now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t MakeCorpus(const TCorpus *pCorpus)
+{
+  static const char szAscii[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ._-\\";
+  unsigned long ulChar;
+  size_t nTotal;
+  int i, j, iLen;
+  char *p;
+
+  nTotal = 0;
+  for (i = 0; i < STRINGS; i++)
+  {
+    iLen = pCorpus->iMinLen + Random() % (pCorpus->iMaxLen -
+      pCorpus->iMinLen + 1);
+    p = strings[i].pszUtf8;
+    for (j = 0; j < iLen; j++)
+    {
+      if ((int) (Random() % 100) >= pCorpus->iNonAscii)
+      {
+        *p++ = szAscii[Random() % (sizeof(szAscii) - 1)];
+        continue;
+      }
+
+      ulChar = pCorpus->ulFirst + Random() % pCorpus->ulCount;
+      if (ulChar < 0x800)
+      {
+        *p++ = (char) (0xC0 | (ulChar >> 6));
+        *p++ = (char) (0x80 | (ulChar & 0x3F));
+      }
+      else
+      {
+        *p++ = (char) (0xE0 | (ulChar >> 12));
+        *p++ = (char) (0x80 | ((ulChar >> 6) & 0x3F));
+        *p++ = (char) (0x80 | (ulChar & 0x3F));
+      }
+    }
+    *p = 0;
+    strings[i].nUtf8Len = p - strings[i].pszUtf8;
+    strings[i].nUtf16Len = __win_Utf8ToUtf16N(strings[i].pszUtf8,
+      strings[i].nUtf8Len, strings[i].pUtf16, MAX_LEN * 3 + 1);
+    nTotal += strings[i].nUtf8Len;
+  }
+
+  return nTotal;
+}
+
+/**
+ * @brief Convert the corpus until at least ulBytes of UTF-8 were processed
+ * @param iWay 0 UTF-8 -> UTF-16, 1 UTF-16 -> UTF-8
+ * @param h iconv handle or (iconv_t) -1 for PlibC
+ * @return MB/s
+ */
+static double Measure(int iWay, iconv_t h, unsigned long ulBytes)
+{
+  static unsigned short aus16[MAX_LEN * 3 + 1];
+  static char sz8[MAX_LEN * 3 + 1];
+  unsigned long ulDone;
+  double dStart;
+  size_t nIn, nOut;
+  char *pIn, *pOut;
+  int i;
+
+  ulDone = 0;
+  dStart = Now();
+  while (ulDone < ulBytes)
+  {
+    for (i = 0; i < STRINGS; i++)
+    {
+      if (h != (iconv_t) -1)
+      {
+        iconv(h, NULL, NULL, NULL, NULL);
+        if (iWay == 0)
+        {
+          pIn = strings[i].pszUtf8;
+          nIn = strings[i].nUtf8Len;
+          pOut = (char *) aus16;
+          nOut = sizeof(aus16);
+        }
+        else
+        {
+          pIn = (char *) strings[i].pUtf16;
+          nIn = strings[i].nUtf16Len * 2;
+          pOut = sz8;
+          nOut = sizeof(sz8);
+        }
+        iconv(h, &pIn, &nIn, &pOut, &nOut);
+      }
+      else if (iWay == 0)
+        __win_Utf8ToUtf16N(strings[i].pszUtf8, strings[i].nUtf8Len, aus16,
+          MAX_LEN * 3 + 1);
+      else
+        __win_Utf16ToUtf8N(strings[i].pUtf16, strings[i].nUtf16Len, sz8,
+          sizeof(sz8));
+      ulDone += strings[i].nUtf8Len;
+    }
+  }
+
+  return ulDone / (Now() - dStart) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+  static double adResults[sizeof(corpora) / sizeof(corpora[0])][6];
+  unsigned long ulBytes;
+  iconv_t hToUtf16, hToUtf8;
+  unsigned int i;
+  int iKernel;
+
+  ulBytes = 200;
+  if (argc == 3 && strcmp(argv[1], "-m") == 0)
+    ulBytes = strtoul(argv[2], NULL, 0);
+  ulBytes *= 1000000UL;
+
+  hToUtf16 = iconv_open("UTF-16LE", "UTF-8");
+  hToUtf8 = iconv_open("UTF-8", "UTF-16LE");
+  if (hToUtf16 == (iconv_t) -1 || hToUtf8 == (iconv_t) -1)
+  {
+    perror("iconv_open");
+    return 2;
+  }
+
+  for (i = 0; i < STRINGS; i++)
+  {
+    strings[i].pszUtf8 = malloc(MAX_LEN * 3 + 1);
+    strings[i].pUtf16 = malloc((MAX_LEN * 3 + 1) * sizeof(unsigned short));
+  }
+
+  /* The kernels can't be switched back, so go through every corpus with
+     the portable ones first */
+  for (iKernel = 0; iKernel < 2; iKernel++)
+  {
+    if (iKernel)
+      __win_InitTranscoder();
+    for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++)
+    {
+      ulState = 88172645UL + i;
+      MakeCorpus(&corpora[i]);
+      adResults[i][iKernel * 2] = Measure(0, (iconv_t) -1, ulBytes);
+      adResults[i][iKernel * 2 + 1] = Measure(1, (iconv_t) -1, ulBytes);
+      if (iKernel)
+      {
+        adResults[i][4] = Measure(0, hToUtf16, ulBytes);
+        adResults[i][5] = Measure(1, hToUtf8, ulBytes);
+      }
+    }
+  }
+
+  printf("MB/s of UTF-8        portable 8->16/16->8   "
+    "selected 8->16/16->8   iconv 8->16/16->8\n");
+  for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++)
+    printf("%-20s %8.0f %8.0f        %8.0f %8.0f        %8.0f %8.0f\n",
+      corpora[i].pszName, adResults[i][0], adResults[i][1], adResults[i][2],
+      adResults[i][3], adResults[i][4], adResults[i][5]);
+
+  for (i = 0; i < STRINGS; i++)
+  {
+    free(strings[i].pszUtf8);
+    free(strings[i].pUtf16);
+  }
+  iconv_close(hToUtf16);
+  iconv_close(hToUtf8);
+
+  return 0;
+}
+
+/* end of bench_utf8.c */
@@ -0,0 +1,228 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/test/fuzz_lnkparse.c
+ * @brief Fuzz target for the shell link parser
+ *
+ * Built with -DPLIBC_LIBFUZZER, this is a libFuzzer target. Otherwise it
+ * has its own driver that mutates the given seed files:
+ *   fuzz_lnkparse [-n iterations] [-s seed] files...
+ * Out of bounds accesses are caught by the sanitizers, the target itself
+ * checks that results are terminated within the buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plibc_lnkparse.h"
+
+#define MAX_INPUT LNK_READ_SIZE
+
+static size_t AnyToWide(const char *pszAnsi, size_t nLen, wchar_t *pwszDest,
+  size_t nDestLen)
+{
+  size_t i;
+
+  /* Exercise both outcomes of the conversion */
+  if (nLen > nDestLen || (nLen && pszAnsi[0] == '!'))
+    return 0;
+  for (i = 0; i < nLen; i++)
+    pwszDest[i] = (unsigned char) pszAnsi[i];
+
+  return nLen;
+}
+
+static void Check(const unsigned char *pData, size_t nSize, size_t nTargetLen)
+{
+  wchar_t *pwszTarget;
+  size_t n;
+  int iKind;
+
+  pwszTarget = malloc(nTargetLen * sizeof(wchar_t));
+  if (!pwszTarget)
+    abort();
+
+  iKind = __win_ParseShortcut(pData, nSize, pwszTarget, nTargetLen,
+    AnyToWide);
+  if (iKind != LNK_NONE && iKind != LNK_TARGET && iKind != LNK_UNKNOWN)
+    abort();
+  if (iKind == LNK_TARGET)
+  {
+    for (n = 0; n < nTargetLen && pwszTarget[n]; n++)
+      ;
+    if (n == 0 || n == nTargetLen)
+      abort();
+  }
+
+  free(pwszTarget);
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *pData, size_t nSize)
+{
+  unsigned char *pCopy;
+
+  /* Copy, so that reads past the end are caught */
+  pCopy = malloc(nSize ? nSize : 1);
+  if (!pCopy)
+    abort();
+  memcpy(pCopy, pData, nSize);
+
+  Check(pCopy, nSize, 261);
+  Check(pCopy, nSize, 1 + (nSize ? pCopy[nSize - 1] % 32 : 0));
+
+  free(pCopy);
+
+  return 0;
+}
+
+#ifndef PLIBC_LIBFUZZER
+
+static unsigned long ulState;
+
+static unsigned long Random()
+{
+  /* xorshift */
+  ulState ^= ulState << 13;
+  ulState ^= ulState >> 17;
+  ulState ^= ulState << 5;
+
+  return ulState & 0xFFFFFFFFUL;
+}
+
+/**
+ * @brief Change a seed the way that breaks parsers: bit flips, offsets and
+ *        sizes replaced by boundary values, truncation and splicing
+ */
+static size_t Mutate(unsigned char *pBuf, size_t nLen,
+  const unsigned char *pOther, size_t nOtherLen)
+{
+  static const unsigned long aulValues[] = {0, 1, 0x14, 0x1C, 0x24, 0x4C,
+    0x7F, 0x80, 0xFF, 0xFFFF, 0x7FFFFFFFUL, 0x80000000UL, 0xFFFFFFFFUL};
+  unsigned long ulValue;
+  size_t nPos, nCount;
+  int i, iSteps;
+
+  iSteps = 1 + Random() % 4;
+  for (i = 0; i < iSteps && nLen; i++)
+  {
+    nPos = Random() % nLen;
+    switch (Random() % 6)
+    {
+      case 0:
+        pBuf[nPos] ^= 1 << (Random() % 8);
+        break;
+      case 1:
+        pBuf[nPos] = (unsigned char) Random();
+        break;
+      case 2:
+        if (nPos + 4 > nLen)
+          break;
+        ulValue = aulValues[Random() % (sizeof(aulValues) /
+          sizeof(aulValues[0]))];
+        if (Random() % 2)
+          ulValue = (ulValue + nLen - nPos + Random() % 8 - 4) & 0xFFFFFFFFUL;
+        pBuf[nPos] = (unsigned char) ulValue;
+        pBuf[nPos + 1] = (unsigned char) (ulValue >> 8);
+        pBuf[nPos + 2] = (unsigned char) (ulValue >> 16);
+        pBuf[nPos + 3] = (unsigned char) (ulValue >> 24);
+        break;
+      case 3:
+        nLen = nPos;
+        break;
+      case 4:
+        if (!nOtherLen)
+          break;
+        nCount = Random() % nOtherLen;
+        if (nPos + nCount > MAX_INPUT)
+          nCount = MAX_INPUT - nPos;
+        memcpy(pBuf + nPos, pOther + Random() % (nOtherLen - nCount + 1),
+          nCount);
+        if (nPos + nCount > nLen)
+          nLen = nPos + nCount;
+        break;
+      default:
+        /* Strings without terminators */
+        nCount = Random() % 16;
+        while (nCount-- && nPos < nLen)
+          if (!pBuf[nPos++])
+            pBuf[nPos - 1] = 'A';
+        break;
+    }
+  }
+
+  return nLen;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char *apSeeds[256], abBuf[MAX_INPUT];
+  size_t anSeedLen[256], nLen, nSeed;
+  unsigned long ulIter, ulIterations;
+  int i, iSeeds;
+  FILE *f;
+
+  ulIterations = 100000;
+  ulState = 2463534242UL;
+  iSeeds = 0;
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      ulIterations = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      ulState = strtoul(argv[++i], NULL, 0) | 1;
+    else if (iSeeds < 256)
+    {
+      f = fopen(argv[i], "rb");
+      if (!f)
+        continue;
+      apSeeds[iSeeds] = malloc(MAX_INPUT);
+      anSeedLen[iSeeds] = fread(apSeeds[iSeeds], 1, MAX_INPUT, f);
+      fclose(f);
+      LLVMFuzzerTestOneInput(apSeeds[iSeeds], anSeedLen[iSeeds]);
+      iSeeds++;
+    }
+  }
+  if (!iSeeds)
+  {
+    fprintf(stderr, "Usage: %s [-n iterations] [-s seed] files...\n",
+      argv[0]);
+    return 2;
+  }
+
+  for (ulIter = 0; ulIter < ulIterations; ulIter++)
+  {
+    nSeed = Random() % iSeeds;
+    memcpy(abBuf, apSeeds[nSeed], anSeedLen[nSeed]);
+    i = Random() % iSeeds;
+    nLen = Mutate(abBuf, anSeedLen[nSeed], apSeeds[i], anSeedLen[i]);
+    LLVMFuzzerTestOneInput(abBuf, nLen);
+  }
+
+  printf("%lu inputs from %d seeds\n", ulIterations, iSeeds);
+  for (i = 0; i < iSeeds; i++)
+    free(apSeeds[i]);
+
+  return 0;
+}
+
+#endif
+
+/* end of fuzz_lnkparse.c */
@@ -0,0 +1,147 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/test/mklnkcorpus.c
+ * @brief Add shortcuts made by the shell to the parser test corpus
+ *
+ * Runs on Windows and links against PlibC:
+ *   mklnkcorpus <corpus directory>
+ * Creates shortcuts with _plibc_CreateShortcutW(), copies them to the
+ * corpus as "shell-*.lnk" and appends their targets to EXPECTED. Links to
+ * existing files must be understood by the parser (TARGET), links to
+ * missing targets may be left to the shell (SHELL).
+ */
+
+#include <plibc.h>
+#include <stdio.h>
+
+typedef struct
+{
+  const wchar_t *pwszName;      /* name of the shortcut */
+  const wchar_t *pwszTarget;    /* relative to the work directory or absolute */
+  int iCreate;                  /* 0: leave missing, 1: file, 2: directory */
+} TCorpusLink;
+
+static const TCorpusLink links[] = {
+  {L"file", L"plain.txt", 1},
+  {L"unicode", L"D\x00f6nn\x00e9" L"es \x00fcn\x00ef \x4e2d.txt", 1},
+  {L"dir", L"subdir", 2},
+  {L"nested", L"subdir\\nested file.bin", 1},
+  {L"root", NULL, 0},                               /* drive of the work dir */
+  {L"missing", L"missing.txt", 0},
+  {L"unc-missing", L"\\\\localhost\\plibc-no-share\\file.txt", 0}
+};
+
+static void AppendExpected(FILE *f, const wchar_t *pwszFile, const char *pszKind,
+  const wchar_t *pwszTarget)
+{
+  char szFile[MAX_PATH * 3], szTarget[MAX_PATH * 3];
+
+  WideCharToMultiByte(CP_UTF8, 0, pwszFile, -1, szFile, sizeof(szFile), NULL,
+    NULL);
+  WideCharToMultiByte(CP_UTF8, 0, pwszTarget, -1, szTarget, sizeof(szTarget),
+    NULL, NULL);
+  fprintf(f, "%s\t%s\t%s\n", szFile, pszKind, szTarget);
+}
+
+int main(int argc, char *argv[])
+{
+  wchar_t szCorpus[MAX_PATH], szWork[MAX_PATH], szTarget[MAX_PATH],
+    szLink[MAX_PATH], szFile[MAX_PATH], szDest[MAX_PATH];
+  const TCorpusLink *pLink;
+  unsigned int i;
+  HANDLE h;
+  FILE *f;
+  int iRet;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: %s <corpus directory>\n", argv[0]);
+    return 2;
+  }
+
+  plibc_init("PlibC", "mklnkcorpus");
+
+  MultiByteToWideChar(CP_ACP, 0, argv[1], -1, szCorpus, MAX_PATH);
+  GetTempPathW(MAX_PATH, szWork);
+  wcscat(szWork, L"plibc-lnkcorpus");
+  CreateDirectoryW(szWork, NULL);
+  swprintf(szTarget, L"%s\\subdir", szWork);
+  CreateDirectoryW(szTarget, NULL);
+
+  swprintf(szFile, L"%s\\EXPECTED", szCorpus);
+  f = _wfopen(szFile, L"a");
+  if (!f)
+  {
+    fprintf(stderr, "Can't open EXPECTED\n");
+    return 2;
+  }
+
+  iRet = 0;
+  for (i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+  {
+    pLink = &links[i];
+
+    if (!pLink->pwszTarget)
+      swprintf(szTarget, L"%.3s", szWork);
+    else if (pLink->pwszTarget[0] == L'\\')
+      wcscpy(szTarget, pLink->pwszTarget);
+    else
+      swprintf(szTarget, L"%s\\%s", szWork, pLink->pwszTarget);
+
+    if (pLink->iCreate == 1)
+    {
+      h = CreateFileW(szTarget, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+      if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    }
+    else if (pLink->iCreate == 2)
+      CreateDirectoryW(szTarget, NULL);
+
+    /* _plibc_CreateShortcutW() appends ".lnk" */
+    swprintf(szLink, L"%s\\%s", szWork, pLink->pwszName);
+    if (!_plibc_CreateShortcutW(szTarget, szLink))
+    {
+      fwprintf(stderr, L"Can't create a shortcut to %s\n", szTarget);
+      iRet = 1;
+      continue;
+    }
+
+    wcscat(szLink, L".lnk");
+    swprintf(szFile, L"shell-%s.lnk", pLink->pwszName);
+    swprintf(szDest, L"%s\\%s", szCorpus, szFile);
+    if (!CopyFileW(szLink, szDest, FALSE))
+    {
+      fwprintf(stderr, L"Can't copy %s\n", szLink);
+      iRet = 1;
+      continue;
+    }
+
+    AppendExpected(f, szFile, pLink->iCreate || !pLink->pwszTarget ?
+      "TARGET" : "SHELL", szTarget);
+  }
+
+  fclose(f);
+  plibc_shutdown();
+
+  return iRet;
+}
+
+/* end of mklnkcorpus.c */
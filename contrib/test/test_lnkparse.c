@@ -0,0 +1,295 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/test/test_lnkparse.c
+ * @brief Unit test for the shell link parser
+ *
+ * Parses every file listed in <corpus>/EXPECTED and compares the result.
+ * SHELL means that the parser may either find the target or leave the link
+ * to the shell.
+ * Each file is also parsed when truncated to every length and with every
+ * target buffer size, which must never give a different target. Build it
+ * with the sanitizers (see Makefile) so that out of bounds accesses fail.
+ *
+ * ANSI strings are converted as ISO-8859-1 here, the corpus only uses
+ * ASCII in them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plibc_lnkparse.h"
+
+#define TARGET_LEN 261              /* _MAX_PATH + 1 */
+#define LNK_SHELL  -1               /* LNK_TARGET or LNK_UNKNOWN */
+
+static int iFailed = 0;
+
+static size_t LatinToWide(const char *pszAnsi, size_t nLen, wchar_t *pwszDest,
+  size_t nDestLen)
+{
+  size_t i;
+
+  if (nLen > nDestLen)
+    return 0;
+  for (i = 0; i < nLen; i++)
+    pwszDest[i] = (unsigned char) pszAnsi[i];
+
+  return nLen;
+}
+
+/**
+ * @brief Decode UTF-8 into UTF-16 code units
+ * @return number of code units or -1
+ */
+static int Utf8ToUnits(const char *pszUtf8, wchar_t *pwszDest, size_t nDestLen)
+{
+  const unsigned char *p = (const unsigned char *) pszUtf8;
+  unsigned long ulCp;
+  size_t n = 0;
+  int iMore;
+
+  while (*p)
+  {
+    if (*p < 0x80)
+    {
+      ulCp = *p++;
+      iMore = 0;
+    }
+    else if ((*p & 0xE0) == 0xC0)
+    {
+      ulCp = *p++ & 0x1F;
+      iMore = 1;
+    }
+    else if ((*p & 0xF0) == 0xE0)
+    {
+      ulCp = *p++ & 0x0F;
+      iMore = 2;
+    }
+    else
+      return -1;                    /* The corpus only uses the BMP */
+
+    while (iMore--)
+    {
+      if ((*p & 0xC0) != 0x80)
+        return -1;
+      ulCp = (ulCp << 6) | (*p++ & 0x3F);
+    }
+
+    if (n + 1 >= nDestLen)
+      return -1;
+    pwszDest[n++] = (wchar_t) ulCp;
+  }
+  pwszDest[n] = 0;
+
+  return (int) n;
+}
+
+static unsigned char *LoadFile(const char *pszPath, size_t *pnLen)
+{
+  unsigned char *pData;
+  FILE *f;
+  long lLen;
+
+  f = fopen(pszPath, "rb");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  lLen = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  /* malloc(0) may return NULL */
+  pData = malloc(lLen + 1);
+  if (pData && fread(pData, 1, lLen, f) != (size_t) lLen)
+  {
+    free(pData);
+    pData = NULL;
+  }
+  fclose(f);
+  *pnLen = (size_t) lLen;
+
+  return pData;
+}
+
+static void Fail(const char *pszFile, const char *pszWhat, size_t nArg)
+{
+  fprintf(stderr, "FAIL %s: %s (%lu)\n", pszFile, pszWhat,
+    (unsigned long) nArg);
+  iFailed++;
+}
+
+/**
+ * @brief Parse a copy of exactly nLen bytes into exactly nTargetLen
+ *        characters, so that the sanitizers catch any overrun
+ */
+static int Parse(const unsigned char *pData, size_t nLen, size_t nTargetLen,
+  TLnkAnsiProc pAnsiProc, wchar_t **ppwszTarget)
+{
+  unsigned char *pCopy;
+  int iKind;
+
+  pCopy = malloc(nLen ? nLen : 1);
+  *ppwszTarget = malloc(nTargetLen * sizeof(wchar_t));
+  if (!pCopy || !*ppwszTarget)
+  {
+    fprintf(stderr, "Out of memory\n");
+    exit(2);
+  }
+  memcpy(pCopy, pData, nLen);
+
+  iKind = __win_ParseShortcut(pCopy, nLen, *ppwszTarget, nTargetLen,
+    pAnsiProc);
+  free(pCopy);
+
+  return iKind;
+}
+
+static int SameTarget(const wchar_t *pwszA, const wchar_t *pwszB)
+{
+  while (*pwszA && *pwszA == *pwszB)
+  {
+    pwszA++;
+    pwszB++;
+  }
+
+  return *pwszA == *pwszB;
+}
+
+static void TestFile(const char *pszDir, const char *pszFile, int iExpected,
+  const char *pszTarget)
+{
+  wchar_t szExpected[TARGET_LEN], *pwszTarget;
+  unsigned char *pData;
+  char szPath[1024];
+  size_t nLen, n;
+  int iKind, iExpectedLen;
+
+  snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszFile);
+  pData = LoadFile(szPath, &nLen);
+  if (!pData)
+  {
+    Fail(pszFile, "can't read", 0);
+    return;
+  }
+
+  iExpectedLen = Utf8ToUnits(pszTarget, szExpected, TARGET_LEN);
+  if (iExpectedLen < 0)
+  {
+    Fail(pszFile, "bad expected target", 0);
+    free(pData);
+    return;
+  }
+
+  iKind = Parse(pData, nLen, TARGET_LEN, LatinToWide, &pwszTarget);
+  if (iExpected == LNK_SHELL && iKind != LNK_NONE)
+  {
+    if (iKind == LNK_TARGET && !SameTarget(pwszTarget, szExpected))
+      Fail(pszFile, "unexpected target", 0);
+  }
+  else if (iKind != iExpected)
+    Fail(pszFile, "unexpected result", iKind);
+  else if (iKind == LNK_TARGET && !SameTarget(pwszTarget, szExpected))
+    Fail(pszFile, "unexpected target", 0);
+  free(pwszTarget);
+
+  /* Truncated data never gives another target */
+  for (n = 0; n < nLen; n++)
+  {
+    iKind = Parse(pData, n, TARGET_LEN, LatinToWide, &pwszTarget);
+    if (iKind == LNK_TARGET && (iExpected == LNK_NONE ||
+      iExpected == LNK_UNKNOWN ||
+      !SameTarget(pwszTarget, szExpected)))
+      Fail(pszFile, "truncated data gave a target", n);
+    free(pwszTarget);
+  }
+
+  /* The target must fit, including the terminator */
+  for (n = 1; n <= (size_t) iExpectedLen + 1; n++)
+  {
+    iKind = Parse(pData, nLen, n, LatinToWide, &pwszTarget);
+    if (iKind == LNK_TARGET && (n <= (size_t) iExpectedLen ||
+      !SameTarget(pwszTarget, szExpected)))
+      Fail(pszFile, "target didn't fit", n);
+    free(pwszTarget);
+  }
+
+  /* Without a converter, ANSI links are left to the shell */
+  iKind = Parse(pData, nLen, TARGET_LEN, NULL, &pwszTarget);
+  if (iKind == LNK_TARGET && !SameTarget(pwszTarget, szExpected))
+    Fail(pszFile, "unexpected target without converter", 0);
+  free(pwszTarget);
+
+  free(pData);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *pszDir;
+  char szLine[1024], szPath[1024], *pszFile, *pszKind, *pszTarget, *p;
+  int iExpected, iFiles;
+  FILE *f;
+
+  pszDir = argc > 1 ? argv[1] : "lnkcorpus";
+  snprintf(szPath, sizeof(szPath), "%s/EXPECTED", pszDir);
+  f = fopen(szPath, "r");
+  if (!f)
+  {
+    perror(szPath);
+    return 2;
+  }
+
+  iFiles = 0;
+  while (fgets(szLine, sizeof(szLine), f))
+  {
+    p = szLine + strcspn(szLine, "\r\n");
+    *p = 0;
+    if (!szLine[0] || szLine[0] == '#')
+      continue;
+
+    pszFile = strtok(szLine, "\t");
+    pszKind = strtok(NULL, "\t");
+    pszTarget = strtok(NULL, "\t");
+    if (!pszKind)
+    {
+      Fail(szLine, "malformed line in EXPECTED", 0);
+      continue;
+    }
+
+    if (strcmp(pszKind, "TARGET") == 0)
+      iExpected = LNK_TARGET;
+    else if (strcmp(pszKind, "SHELL") == 0)
+      iExpected = LNK_SHELL;
+    else if (strcmp(pszKind, "NONE") == 0)
+      iExpected = LNK_NONE;
+    else
+      iExpected = LNK_UNKNOWN;
+
+    TestFile(pszDir, pszFile, iExpected, pszTarget ? pszTarget : "");
+    iFiles++;
+  }
+  fclose(f);
+
+  printf("%d files, %d failures\n", iFiles, iFailed);
+
+  return iFailed || !iFiles;
+}
+
+/* end of test_lnkparse.c */
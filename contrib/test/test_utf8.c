@@ -0,0 +1,469 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file contrib/test/test_utf8.c
+ * @brief Differential fuzz test for the UTF-8 <-> UTF-16 converters
+ *
+ *   test_utf8 [-n iterations] [-s seed]
+ * Random strings are converted by src/utf8.c and by iconv. iconv rejects
+ * ill-formed input, so that is compared with a reference decoder that
+ * replaces each maximal ill-formed subsequence with U+FFFD instead. The
+ * reference is checked against iconv on well-formed input. Every string is
+ * also converted into buffers that are one unit too small. Everything runs
+ * twice, with the portable kernels and with the ones
+ * __win_InitTranscoder() selects for this CPU.
+ */
+
+#include <errno.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plibc_utf8.h"
+
+#define MAX_CHARS 300
+
+static unsigned long ulState;
+static unsigned long ulFailed = 0;
+static iconv_t hToUtf16, hToUtf8;
+
+static unsigned long Random()
+{
+  /* xorshift */
+  ulState ^= ulState << 13;
+  ulState ^= ulState >> 17;
+  ulState ^= ulState << 5;
+
+  return ulState & 0xFFFFFFFFUL;
+}
+
+static void Fail(const char *pszWhat, unsigned long ulIter)
+{
+  if (ulFailed++ < 20)
+    fprintf(stderr, "FAIL: %s (iteration %lu)\n", pszWhat, ulIter);
+}
+
+static size_t PutUtf8(unsigned char *p, unsigned long ulChar)
+{
+  if (ulChar < 0x80)
+  {
+    p[0] = (unsigned char) ulChar;
+    return 1;
+  }
+  if (ulChar < 0x800)
+  {
+    p[0] = (unsigned char) (0xC0 | (ulChar >> 6));
+    p[1] = (unsigned char) (0x80 | (ulChar & 0x3F));
+    return 2;
+  }
+  if (ulChar < 0x10000)
+  {
+    p[0] = (unsigned char) (0xE0 | (ulChar >> 12));
+    p[1] = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+    p[2] = (unsigned char) (0x80 | (ulChar & 0x3F));
+    return 3;
+  }
+  p[0] = (unsigned char) (0xF0 | (ulChar >> 18));
+  p[1] = (unsigned char) (0x80 | ((ulChar >> 12) & 0x3F));
+  p[2] = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+  p[3] = (unsigned char) (0x80 | (ulChar & 0x3F));
+  return 4;
+}
+
+/**
+ * @brief Get a random scalar value, mostly ASCII in runs that cross the
+ *        16 and 32 byte blocks of the SIMD kernels
+ */
+static unsigned long RandomChar()
+{
+  unsigned long ulChar;
+
+  switch (Random() % 8)
+  {
+    case 0:
+      return 0x80 + Random() % 0x780;
+    case 1:
+      do
+        ulChar = 0x800 + Random() % 0xF800;
+      while (ulChar >= 0xD800 && ulChar <= 0xDFFF);
+      return ulChar;
+    case 2:
+      return 0x10000 + Random() % 0x100000;
+    default:
+      return 1 + Random() % 0x7F;
+  }
+}
+
+/**
+ * @brief Generate UTF-8, ill-formed if bInvalid
+ * @return length in bytes
+ */
+static size_t RandomUtf8(unsigned char *p, int bInvalid)
+{
+  static const char *apszBad[] = {"\x80", "\xBF", "\xC0\xAF", "\xC1\xBF",
+    "\xE0\x80\xAF", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xED\xBF\xBF",
+    "\xF0\x80\x80\xAF", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5",
+    "\xFE", "\xFF", "\xC2", "\xE1\x80", "\xF1\x80\x80", "\xE1", "\xF1"};
+  size_t nLen, nRun;
+  int i, iChars;
+
+  nLen = 0;
+  iChars = Random() % MAX_CHARS;
+  for (i = 0; i < iChars; i++)
+  {
+    if (Random() % 4 == 0)
+    {
+      /* ASCII run */
+      for (nRun = Random() % 70; nRun; nRun--)
+        p[nLen++] = (unsigned char) (0x20 + Random() % 0x5F);
+    }
+    else if (bInvalid && Random() % 6 == 0)
+    {
+      const char *pszBad = apszBad[Random() % (sizeof(apszBad) /
+        sizeof(apszBad[0]))];
+
+      memcpy(p + nLen, pszBad, strlen(pszBad));
+      nLen += strlen(pszBad);
+    }
+    else
+      nLen += PutUtf8(p + nLen, RandomChar());
+  }
+
+  return nLen;
+}
+
+/**
+ * @brief Generate UTF-16, with unpaired surrogates if bInvalid
+ * @return length in units
+ */
+static size_t RandomUtf16(unsigned short *p, int bInvalid)
+{
+  unsigned long ulChar;
+  size_t nLen;
+  int i, iChars;
+
+  nLen = 0;
+  iChars = Random() % MAX_CHARS;
+  for (i = 0; i < iChars; i++)
+  {
+    if (bInvalid && Random() % 8 == 0)
+    {
+      p[nLen++] = (unsigned short) (0xD800 + Random() % 0x800);
+      continue;
+    }
+
+    ulChar = RandomChar();
+    if (ulChar >= 0x10000)
+    {
+      ulChar -= 0x10000;
+      p[nLen++] = (unsigned short) (0xD800 | (ulChar >> 10));
+      p[nLen++] = (unsigned short) (0xDC00 | (ulChar & 0x3FF));
+    }
+    else
+      p[nLen++] = (unsigned short) ulChar;
+  }
+
+  return nLen;
+}
+
+/**
+ * @brief Reference UTF-8 decoder, written from table 3-7 of the Unicode
+ *        standard. Each maximal subpart of an ill-formed sequence becomes
+ *        one U+FFFD.
+ */
+static size_t RefUtf8ToUtf16(const unsigned char *p, size_t nLen,
+  unsigned short *pDest)
+{
+  unsigned long ulChar;
+  unsigned char ucLow, ucHigh;
+  size_t i, nOut;
+  int iNeed, iHave;
+
+  nOut = 0;
+  i = 0;
+  while (i < nLen)
+  {
+    ulChar = p[i++];
+    ucLow = 0x80;
+    ucHigh = 0xBF;
+    if (ulChar < 0x80)
+    {
+      pDest[nOut++] = (unsigned short) ulChar;
+      continue;
+    }
+    else if (ulChar >= 0xC2 && ulChar <= 0xDF)
+      iNeed = 1;
+    else if (ulChar == 0xE0)
+    {
+      iNeed = 2;
+      ucLow = 0xA0;
+    }
+    else if (ulChar == 0xED)
+    {
+      iNeed = 2;
+      ucHigh = 0x9F;
+    }
+    else if (ulChar >= 0xE1 && ulChar <= 0xEF)
+      iNeed = 2;
+    else if (ulChar == 0xF0)
+    {
+      iNeed = 3;
+      ucLow = 0x90;
+    }
+    else if (ulChar == 0xF4)
+    {
+      iNeed = 3;
+      ucHigh = 0x8F;
+    }
+    else if (ulChar >= 0xF1 && ulChar <= 0xF3)
+      iNeed = 3;
+    else
+    {
+      pDest[nOut++] = 0xFFFD;
+      continue;
+    }
+
+    ulChar &= 0x3F >> iNeed;
+    for (iHave = 0; iHave < iNeed; iHave++)
+    {
+      if (i == nLen || p[i] < ucLow || p[i] > ucHigh)
+        break;
+      ulChar = (ulChar << 6) | (p[i++] & 0x3F);
+      ucLow = 0x80;
+      ucHigh = 0xBF;
+    }
+
+    if (iHave < iNeed)
+      pDest[nOut++] = 0xFFFD;
+    else if (ulChar >= 0x10000)
+    {
+      ulChar -= 0x10000;
+      pDest[nOut++] = (unsigned short) (0xD800 | (ulChar >> 10));
+      pDest[nOut++] = (unsigned short) (0xDC00 | (ulChar & 0x3FF));
+    }
+    else
+      pDest[nOut++] = (unsigned short) ulChar;
+  }
+
+  return nOut;
+}
+
+/**
+ * @brief Reference UTF-16 decoder, unpaired surrogates become U+FFFD
+ */
+static size_t RefUtf16ToUtf8(const unsigned short *p, size_t nLen,
+  unsigned char *pDest)
+{
+  unsigned long ulChar;
+  size_t i, nOut;
+
+  nOut = 0;
+  for (i = 0; i < nLen; i++)
+  {
+    ulChar = p[i];
+    if (ulChar >= 0xD800 && ulChar <= 0xDBFF && i + 1 < nLen &&
+      p[i + 1] >= 0xDC00 && p[i + 1] <= 0xDFFF)
+    {
+      ulChar = 0x10000 + ((ulChar - 0xD800) << 10) + (p[i + 1] - 0xDC00);
+      i++;
+    }
+    else if (ulChar >= 0xD800 && ulChar <= 0xDFFF)
+      ulChar = 0xFFFD;
+    nOut += PutUtf8(pDest + nOut, ulChar);
+  }
+
+  return nOut;
+}
+
+/**
+ * @brief Convert with iconv
+ * @return length of the result in bytes or -1 on ill-formed input
+ */
+static long Iconv(iconv_t h, const void *pSrc, size_t nLen, void *pDest,
+  size_t nDestLen)
+{
+  char *pIn, *pOut;
+  size_t nIn, nOut;
+
+  iconv(h, NULL, NULL, NULL, NULL);
+  pIn = (char *) pSrc;
+  pOut = (char *) pDest;
+  nIn = nLen;
+  nOut = nDestLen;
+  if (iconv(h, &pIn, &nIn, &pOut, &nOut) == (size_t) -1)
+    return -1;
+
+  return (long) (nDestLen - nOut);
+}
+
+/**
+ * @brief Convert UTF-8 into a buffer of exactly nDestLen units and compare
+ */
+static void CheckUtf8(const unsigned char *pSrc, size_t nLen,
+  const unsigned short *pExpected, size_t nExpected, unsigned long ulIter)
+{
+  unsigned short *pDest;
+  char *pCopy;
+  size_t nDestLen;
+  int iRet;
+
+  /* Exact copies, so that the sanitizers see overruns */
+  pCopy = malloc(nLen + 1);
+  memcpy(pCopy, pSrc, nLen);
+
+  nDestLen = nExpected + 1;
+  pDest = malloc(nDestLen * sizeof(unsigned short));
+  iRet = __win_Utf8ToUtf16N(pCopy, nLen, pDest, nDestLen);
+  if (iRet != (int) nExpected ||
+    memcmp(pDest, pExpected, nExpected * sizeof(unsigned short)) != 0 ||
+    pDest[nExpected] != 0)
+    Fail("UTF-8 -> UTF-16 differs", ulIter);
+  free(pDest);
+
+  /* One unit too small, including the terminator */
+  nDestLen = nExpected;
+  pDest = malloc((nDestLen ? nDestLen : 1) * sizeof(unsigned short));
+  if (__win_Utf8ToUtf16N(pCopy, nLen, pDest, nDestLen) != -1)
+    Fail("UTF-8 -> UTF-16 overflow not detected", ulIter);
+  free(pDest);
+
+  /* The worst case the callers rely on */
+  nDestLen = nLen + 1;
+  pDest = malloc(nDestLen * sizeof(unsigned short));
+  if (__win_Utf8ToUtf16N(pCopy, nLen, pDest, nDestLen) != (int) nExpected)
+    Fail("UTF-8 -> UTF-16 needs more than one unit per byte", ulIter);
+  free(pDest);
+
+  free(pCopy);
+}
+
+/**
+ * @brief Convert UTF-16 into a buffer of exactly nDestLen bytes and compare
+ */
+static void CheckUtf16(const unsigned short *pSrc, size_t nLen,
+  const unsigned char *pExpected, size_t nExpected, unsigned long ulIter)
+{
+  unsigned short *pCopy;
+  char *pDest;
+  size_t nDestLen;
+  int iRet;
+
+  pCopy = malloc((nLen + 1) * sizeof(unsigned short));
+  memcpy(pCopy, pSrc, nLen * sizeof(unsigned short));
+
+  nDestLen = nExpected + 1;
+  pDest = malloc(nDestLen);
+  iRet = __win_Utf16ToUtf8N(pCopy, nLen, pDest, nDestLen);
+  if (iRet != (int) nExpected || memcmp(pDest, pExpected, nExpected) != 0 ||
+    pDest[nExpected] != 0)
+    Fail("UTF-16 -> UTF-8 differs", ulIter);
+  free(pDest);
+
+  nDestLen = nExpected;
+  pDest = malloc(nDestLen ? nDestLen : 1);
+  if (__win_Utf16ToUtf8N(pCopy, nLen, pDest, nDestLen) != -1)
+    Fail("UTF-16 -> UTF-8 overflow not detected", ulIter);
+  free(pDest);
+
+  nDestLen = nLen * 3 + 1;
+  pDest = malloc(nDestLen);
+  if (__win_Utf16ToUtf8N(pCopy, nLen, pDest, nDestLen) != (int) nExpected)
+    Fail("UTF-16 -> UTF-8 needs more than 3 bytes per unit", ulIter);
+  free(pDest);
+
+  free(pCopy);
+}
+
+static void Run(unsigned long ulIterations)
+{
+  static unsigned char abUtf8[MAX_CHARS * 70], abRef8[MAX_CHARS * 70 * 3];
+  static unsigned short ausUtf16[MAX_CHARS * 70 * 2],
+    ausRef16[MAX_CHARS * 70 * 2];
+  unsigned long ulIter;
+  size_t nLen, nRef;
+  long lIconv;
+
+  for (ulIter = 0; ulIter < ulIterations; ulIter++)
+  {
+    /* Well-formed UTF-8, iconv and the reference have to agree */
+    nLen = RandomUtf8(abUtf8, 0);
+    lIconv = Iconv(hToUtf16, abUtf8, nLen, ausRef16, sizeof(ausRef16));
+    nRef = RefUtf8ToUtf16(abUtf8, nLen, ausUtf16);
+    if (lIconv < 0 || (size_t) lIconv != nRef * 2 ||
+      memcmp(ausRef16, ausUtf16, lIconv) != 0)
+      Fail("reference UTF-8 decoder differs from iconv", ulIter);
+    CheckUtf8(abUtf8, nLen, ausRef16, nRef, ulIter);
+
+    /* And back */
+    lIconv = Iconv(hToUtf8, ausRef16, nRef * 2, abRef8, sizeof(abRef8));
+    if (lIconv < 0 || (size_t) lIconv != nLen ||
+      memcmp(abRef8, abUtf8, nLen) != 0)
+      Fail("iconv round trip", ulIter);
+    CheckUtf16(ausRef16, nRef, abUtf8, nLen, ulIter);
+
+    /* Ill-formed input */
+    nLen = RandomUtf8(abUtf8, 1);
+    nRef = RefUtf8ToUtf16(abUtf8, nLen, ausRef16);
+    CheckUtf8(abUtf8, nLen, ausRef16, nRef, ulIter);
+
+    nLen = RandomUtf16(ausUtf16, 1);
+    nRef = RefUtf16ToUtf8(ausUtf16, nLen, abRef8);
+    CheckUtf16(ausUtf16, nLen, abRef8, nRef, ulIter);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long ulIterations;
+  int i;
+
+  ulIterations = 20000;
+  ulState = 88172645UL;
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      ulIterations = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      ulState = strtoul(argv[++i], NULL, 0) | 1;
+  }
+
+  hToUtf16 = iconv_open("UTF-16LE", "UTF-8");
+  hToUtf8 = iconv_open("UTF-8", "UTF-16LE");
+  if (hToUtf16 == (iconv_t) -1 || hToUtf8 == (iconv_t) -1)
+  {
+    perror("iconv_open");
+    return 2;
+  }
+
+  /* Portable kernels, then the ones for this CPU */
+  Run(ulIterations);
+  __win_InitTranscoder();
+  Run(ulIterations);
+
+  iconv_close(hToUtf16);
+  iconv_close(hToUtf8);
+
+  printf("%lu strings, %lu failures\n", ulIterations * 4 * 2, ulFailed);
+
+  return ulFailed != 0;
+}
+
+/* end of test_utf8.c */
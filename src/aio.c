@@ -0,0 +1,443 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/aio.c
+ * @brief Asynchronous writes on non-blocking descriptors
+ *
+ * Windows has no non-blocking mode for files and anonymous pipes, so writes
+ * on descriptors marked as non-blocking are queued and carried out by a
+ * small pool of worker threads. Every descriptor has its own FIFO queue
+ * that is served by at most one worker at a time, which keeps the order of
+ * writes. The amount of queued data per descriptor is limited; once the
+ * limit is reached, write() fails with EAGAIN. Errors of queued writes are
+ * reported by the next write() on the descriptor.
+ *
+ * write() copies the data into the queue. plibc_write_owned() hands the
+ * buffer itself over instead; it is released through the caller's free
+ * function once it has been written.
+ */
+
+#include "plibc_private.h"
+
+#define AIO_MAX_THREADS 8
+#define AIO_QUEUE_QUOTA (1024 * 1024)
+#define AIO_BATCH 16
+#define AIO_IDLE_TIMEOUT 30000
+
+typedef struct _TAioRequest
+{
+  struct _TAioRequest *pNext;
+  TReadWriteInfo info;
+  TFreeProc pFree;
+} TAioRequest;
+
+struct _TAioQueue
+{
+  intptr_t fildes;
+  THandleType eType;
+  TAioRequest *pHead, *pTail;
+  size_t nPending;            /* bytes queued */
+  int iError;                 /* errno of a failed queued write */
+  BOOL bScheduled;            /* on the run list or being served */
+  HANDLE hIdle;               /* signalled while the queue is empty */
+  struct _TAioQueue *pNextRun;
+};
+
+static CRITICAL_SECTION csAio;
+static HANDLE hWork, hNoThreads;
+static TAioQueue *pRunHead = NULL, *pRunTail = NULL;
+static unsigned int uiThreads = 0, uiIdleThreads = 0, uiPeakThreads = 0;
+static BOOL bShutdown = FALSE;
+
+/**
+ * @brief Append a queue to the run list and wake a worker
+ * @internal
+ * @note Must be called with csAio held
+ */
+static void __win_AioSchedule(TAioQueue *pQueue)
+{
+  pQueue->pNextRun = NULL;
+  if (pRunTail)
+    pRunTail->pNextRun = pQueue;
+  else
+    pRunHead = pQueue;
+  pRunTail = pQueue;
+
+  ReleaseSemaphore(hWork, 1, NULL);
+}
+
+/**
+ * @brief Write the queued requests of a descriptor
+ * @internal
+ * @note At most AIO_BATCH requests are written per call so that a busy
+ *       descriptor doesn't starve the others
+ */
+static void __win_AioService(TAioQueue *pQueue)
+{
+  unsigned int uiCount;
+
+  for (uiCount = 0; uiCount < AIO_BATCH; uiCount++)
+  {
+    TAioRequest *pReq;
+    TReadWriteInfo info;
+    int iRet, iErr;
+
+    EnterCriticalSection(&csAio);
+    pReq = pQueue->pHead;
+    LeaveCriticalSection(&csAio);
+    if (!pReq)
+      break;
+
+    /* write() may be partial on pipes */
+    info = pReq->info;
+    iErr = 0;
+    while (info.nbyte)
+    {
+      iRet = __win_Write(&info);
+      if (iRet <= 0)
+      {
+        iErr = errno ? errno : EIO;
+        break;
+      }
+      info.buf = (char *) info.buf + iRet;
+      info.nbyte -= iRet;
+    }
+
+    EnterCriticalSection(&csAio);
+    pQueue->pHead = pReq->pNext;
+    if (!pQueue->pHead)
+      pQueue->pTail = NULL;
+    pQueue->nPending -= pReq->info.nbyte;
+    if (iErr)
+    {
+      TAioRequest *pDrop;
+
+      /* Later writes would fail as well */
+      if (!pQueue->iError)
+        pQueue->iError = iErr;
+      pDrop = pQueue->pHead;
+      pQueue->pHead = pQueue->pTail = NULL;
+      pQueue->nPending = 0;
+      while (pDrop)
+      {
+        TAioRequest *pNext = pDrop->pNext;
+
+        pDrop->pFree(pDrop->info.buf);
+        free(pDrop);
+        pDrop = pNext;
+      }
+    }
+    LeaveCriticalSection(&csAio);
+
+    pReq->pFree(pReq->info.buf);
+    free(pReq);
+  }
+
+  EnterCriticalSection(&csAio);
+  if (pQueue->pHead)
+    __win_AioSchedule(pQueue);
+  else
+  {
+    pQueue->bScheduled = FALSE;
+    SetEvent(pQueue->hIdle);
+  }
+  LeaveCriticalSection(&csAio);
+}
+
+/**
+ * @brief Worker thread
+ * @internal
+ * @note Workers exit after being idle for AIO_IDLE_TIMEOUT ms
+ */
+static DWORD WINAPI __win_AioWorker(LPVOID pUnused)
+{
+  EnterCriticalSection(&csAio);
+  while (TRUE)
+  {
+    TAioQueue *pQueue;
+
+    pQueue = pRunHead;
+    if (pQueue)
+    {
+      pRunHead = pQueue->pNextRun;
+      if (!pRunHead)
+        pRunTail = NULL;
+      LeaveCriticalSection(&csAio);
+
+      __win_AioService(pQueue);
+
+      EnterCriticalSection(&csAio);
+    }
+    else
+    {
+      DWORD dwWait;
+
+      if (bShutdown)
+        break;
+
+      uiIdleThreads++;
+      LeaveCriticalSection(&csAio);
+      dwWait = WaitForSingleObject(hWork, AIO_IDLE_TIMEOUT);
+      EnterCriticalSection(&csAio);
+      uiIdleThreads--;
+
+      if (dwWait == WAIT_TIMEOUT && !pRunHead)
+        break;
+    }
+  }
+
+  uiThreads--;
+  if (!uiThreads)
+    SetEvent(hNoThreads);
+  LeaveCriticalSection(&csAio);
+
+  return 0;
+}
+
+/**
+ * @brief Start another worker if all are busy
+ * @internal
+ * @return FALSE if there is no worker at all
+ * @note Must be called with csAio held
+ */
+static BOOL __win_AioSpawn()
+{
+  DWORD dwTID; /* Last ptr of CreateThread my not be NULL under Win9x */
+  HANDLE h;
+
+  if (uiIdleThreads || uiThreads >= AIO_MAX_THREADS)
+    return TRUE;
+
+  h = CreateThread(NULL, 0, __win_AioWorker, NULL, 0, &dwTID);
+  if (!h)
+    return uiThreads != 0;
+  CloseHandle(h);
+
+  if (!uiThreads)
+    ResetEvent(hNoThreads);
+  uiThreads++;
+  if (uiThreads > uiPeakThreads)
+    uiPeakThreads = uiThreads;
+
+  return TRUE;
+}
+
+/**
+ * @brief Set up the worker pool
+ * @internal
+ */
+void __win_InitAio()
+{
+  InitializeCriticalSection(&csAio);
+  hWork = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  hNoThreads = CreateEvent(NULL, TRUE, TRUE, NULL);
+  bShutdown = FALSE;
+}
+
+/**
+ * @brief Stop the worker pool after pending writes are done
+ * @internal
+ */
+void __win_FreeAio()
+{
+  EnterCriticalSection(&csAio);
+  bShutdown = TRUE;
+  ReleaseSemaphore(hWork, AIO_MAX_THREADS, NULL);
+  LeaveCriticalSection(&csAio);
+
+  WaitForSingleObject(hNoThreads, INFINITE);
+
+  CloseHandle(hWork);
+  CloseHandle(hNoThreads);
+  DeleteCriticalSection(&csAio);
+}
+
+/**
+ * @brief Queue a write on a non-blocking descriptor
+ * @internal
+ * @param pInfo registry entry of the descriptor
+ * @param pFree NULL to queue a copy of buf, otherwise the function that
+ *        releases buf. In the latter case, buf is queued as a whole and
+ *        belongs to the queue if the call succeeds.
+ * @return number of bytes accepted or -1 on error
+ */
+int __win_AioWrite(const THandleInfo *pInfo, const void *buf, size_t nbyte,
+  TFreeProc pFree)
+{
+  TAioQueue *pQueue;
+  TAioRequest *pReq;
+  THandleInfo info;
+
+  if (!nbyte)
+  {
+    /* Nothing to write, but buf was handed over */
+    if (pFree)
+      pFree((void *) buf);
+    return 0;
+  }
+
+  EnterCriticalSection(&csAio);
+
+  /* Look again, another thread may have created the queue */
+  pQueue = pInfo->pAio;
+  if (!pQueue && __win_GetHandleInfo(pInfo->dwHandle, &info))
+    pQueue = info.pAio;
+  if (!pQueue)
+  {
+    pQueue = (TAioQueue *) __win_Calloc(1, sizeof(TAioQueue));
+    if (!pQueue)
+    {
+      LeaveCriticalSection(&csAio);
+      errno = ENOMEM;
+      return -1;
+    }
+    pQueue->fildes = pInfo->dwHandle;
+    pQueue->eType = pInfo->eType;
+    pQueue->hIdle = CreateEvent(NULL, TRUE, TRUE, NULL);
+    __win_SetHandleAioQueue(pInfo->dwHandle, pQueue);
+  }
+
+  if (pQueue->iError)
+  {
+    errno = pQueue->iError;
+    pQueue->iError = 0;
+    LeaveCriticalSection(&csAio);
+    return -1;
+  }
+
+  if (pQueue->nPending >= AIO_QUEUE_QUOTA)
+  {
+    LeaveCriticalSection(&csAio);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  /* A scheduled queue keeps its worker, otherwise make sure there is one.
+     Without any, the request would never be written and close() would
+     wait for it forever. */
+  if (!pQueue->bScheduled && !__win_AioSpawn())
+  {
+    LeaveCriticalSection(&csAio);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  pReq = (TAioRequest *) __win_Malloc(sizeof(TAioRequest));
+  if (!pReq)
+  {
+    LeaveCriticalSection(&csAio);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (pFree)
+  {
+    pReq->info.buf = (void *) buf;
+    pReq->pFree = pFree;
+  }
+  else
+  {
+    if (nbyte > AIO_QUEUE_QUOTA - pQueue->nPending)
+      nbyte = AIO_QUEUE_QUOTA - pQueue->nPending;
+
+    pReq->info.buf = __win_Malloc(nbyte);
+    if (!pReq->info.buf)
+    {
+      free(pReq);
+      LeaveCriticalSection(&csAio);
+      errno = ENOMEM;
+      return -1;
+    }
+    memcpy(pReq->info.buf, buf, nbyte);
+    pReq->pFree = free;
+  }
+  pReq->info.fildes = pQueue->fildes;
+  pReq->info.eType = pQueue->eType;
+  pReq->info.nbyte = nbyte;
+  pReq->pNext = NULL;
+
+  if (pQueue->pTail)
+    pQueue->pTail->pNext = pReq;
+  else
+    pQueue->pHead = pReq;
+  pQueue->pTail = pReq;
+  pQueue->nPending += nbyte;
+
+  if (!pQueue->bScheduled)
+  {
+    pQueue->bScheduled = TRUE;
+    ResetEvent(pQueue->hIdle);
+    __win_AioSchedule(pQueue);
+  }
+
+  LeaveCriticalSection(&csAio);
+
+  return nbyte;
+}
+
+/**
+ * @brief Wait until the queued writes of a descriptor are done
+ * @internal
+ */
+void __win_AioFlush(const THandleInfo *pInfo)
+{
+  if (pInfo->pAio)
+    WaitForSingleObject(pInfo->pAio->hIdle, INFINITE);
+}
+
+/**
+ * @brief Finish the queued writes of a descriptor that is about to be closed
+ * @internal
+ */
+void __win_AioClose(intptr_t fildes)
+{
+  THandleInfo info;
+  TAioQueue *pQueue;
+
+  if (!__win_GetHandleInfo(fildes, &info) || !info.pAio)
+    return;
+
+  pQueue = info.pAio;
+  WaitForSingleObject(pQueue->hIdle, INFINITE);
+
+  EnterCriticalSection(&csAio);
+  __win_SetHandleAioQueue(fildes, NULL);
+  LeaveCriticalSection(&csAio);
+
+  CloseHandle(pQueue->hIdle);
+  free(pQueue);
+}
+
+/**
+ * @brief Get the number of asynchronous I/O threads
+ * @param puiThreads receives the number of running threads, may be NULL
+ * @param puiPeak receives the highest number of threads so far, may be NULL
+ */
+void plibc_get_aio_thread_count(unsigned *puiThreads, unsigned *puiPeak)
+{
+  EnterCriticalSection(&csAio);
+  if (puiThreads)
+    *puiThreads = uiThreads;
+  if (puiPeak)
+    *puiPeak = uiPeakThreads;
+  LeaveCriticalSection(&csAio);
+}
+
+/* end of aio.c */
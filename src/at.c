@@ -0,0 +1,800 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/at.c
+ * @brief openat(), fstatat(), unlinkat(), mkdirat(), fdopendir()
+ *
+ * open() with O_DIRECTORY returns a directory handle that is registered as
+ * DIR_HANDLE together with its absolute path. Relative names are opened
+ * with NtCreateFile() and the directory handle as RootDirectory, so the
+ * kernel only walks the components below the directory and PlibC doesn't
+ * translate the path at all. Names the NT layer handles differently from
+ * Win32 ("." and ".." components, trailing dots or spaces) are appended to
+ * the cached directory path and passed to the path based functions. So are
+ * names that aren't found while shortcuts emulate symbolic links, since
+ * they may only exist as a .lnk file.
+ */
+
+#include "plibc_private.h"
+#include <direct.h>
+
+/* Taken from the Wine project <http://www.winehq.org>
+    /wine/include/winternl.h */
+typedef struct
+{
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+} PLIBC_UNICODE_STRING;
+
+typedef struct
+{
+  ULONG Length;
+  HANDLE RootDirectory;
+  PLIBC_UNICODE_STRING *ObjectName;
+  ULONG Attributes;
+  PVOID SecurityDescriptor;
+  PVOID SecurityQualityOfService;
+} PLIBC_OBJECT_ATTRIBUTES;
+
+typedef struct
+{
+  union
+  {
+    LONG Status;
+    PVOID Pointer;
+  } u;
+  ULONG_PTR Information;
+} PLIBC_IO_STATUS_BLOCK;
+
+typedef struct
+{
+  BOOLEAN DeleteFile;
+} PLIBC_FILE_DISPOSITION_INFORMATION;
+
+typedef LONG (WINAPI *TNtCreateFile) (PHANDLE FileHandle,
+  ACCESS_MASK DesiredAccess, PLIBC_OBJECT_ATTRIBUTES *ObjectAttributes,
+  PLIBC_IO_STATUS_BLOCK *IoStatusBlock, PLARGE_INTEGER AllocationSize,
+  ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition,
+  ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength);
+typedef LONG (WINAPI *TNtSetInformationFile) (HANDLE FileHandle,
+  PLIBC_IO_STATUS_BLOCK *IoStatusBlock, PVOID FileInformation, ULONG Length,
+  int FileInformationClass);
+typedef ULONG (WINAPI *TRtlNtStatusToDosError) (LONG Status);
+
+#define FileDispositionInformation 13
+
+#define PLIBC_OBJ_INHERIT                   0x00000002
+#define PLIBC_OBJ_CASE_INSENSITIVE          0x00000040
+
+#define PLIBC_FILE_OPEN                     1
+#define PLIBC_FILE_CREATE                   2
+#define PLIBC_FILE_OPEN_IF                  3
+#define PLIBC_FILE_OVERWRITE                4
+#define PLIBC_FILE_OVERWRITE_IF             5
+
+#define PLIBC_FILE_DIRECTORY_FILE           0x00000001
+#define PLIBC_FILE_SYNCHRONOUS_IO_NONALERT  0x00000020
+#define PLIBC_FILE_NON_DIRECTORY_FILE       0x00000040
+#define PLIBC_FILE_OPEN_FOR_BACKUP_INTENT   0x00004000
+#define PLIBC_FILE_OPEN_REPARSE_POINT       0x00200000
+
+#define PLIBC_STATUS_OBJECT_NAME_NOT_FOUND  ((LONG) 0xC0000034)
+#define PLIBC_STATUS_OBJECT_PATH_NOT_FOUND  ((LONG) 0xC000003A)
+#define PLIBC_STATUS_FILE_IS_A_DIRECTORY    ((LONG) 0xC00000BA)
+#define PLIBC_STATUS_NOT_A_DIRECTORY        ((LONG) 0xC0000103)
+
+#define DIR_FD_ACCESS (FILE_LIST_DIRECTORY | FILE_TRAVERSE | \
+  FILE_READ_ATTRIBUTES | SYNCHRONIZE)
+#define DIR_FD_SHARE (FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE)
+
+/* How __win_ResolveAt() wants a name to be opened */
+#define AT_RESOLVE_PATH     0   /* path based function with pszPath */
+#define AT_RESOLVE_RELATIVE 1   /* NtCreateFile() relative to hDir */
+
+typedef struct
+{
+  HANDLE hDir;
+  const wchar_t *pwszDir;                 /* owned by the registry */
+  const char *pszPath;
+  wchar_t wszName[_MAX_PATH + 1];
+  char szJoined[_MAX_PATH * 3 + 1];
+} TAtPath;
+
+static TNtCreateFile pNtCreateFile = NULL;
+static TNtSetInformationFile pNtSetInformationFile = NULL;
+static TRtlNtStatusToDosError pRtlNtStatusToDosError = NULL;
+
+/**
+ * @brief Set up directory descriptors
+ * @internal
+ */
+void __win_InitDirFds()
+{
+  HMODULE hNtdll;
+
+  hNtdll = GetModuleHandle("ntdll.dll");
+  pNtCreateFile = (TNtCreateFile) GetProcAddress(hNtdll, "NtCreateFile");
+  pNtSetInformationFile = (TNtSetInformationFile) GetProcAddress(hNtdll,
+    "NtSetInformationFile");
+  pRtlNtStatusToDosError = (TRtlNtStatusToDosError) GetProcAddress(hNtdll,
+    "RtlNtStatusToDosError");
+  if (!pNtSetInformationFile || !pRtlNtStatusToDosError)
+    pNtCreateFile = NULL;
+}
+
+static void __win_SetErrnoFromNtStatus(LONG lStatus)
+{
+  if (lStatus == PLIBC_STATUS_FILE_IS_A_DIRECTORY)
+    errno = EISDIR;
+  else if (lStatus == PLIBC_STATUS_NOT_A_DIRECTORY)
+    errno = ENOTDIR;
+  else
+    SetErrnoFromWinError(pRtlNtStatusToDosError(lStatus));
+}
+
+/**
+ * @brief Append a name to a directory path
+ * @internal
+ * @return the new path, to be freed with free(), or NULL
+ */
+static wchar_t *__win_JoinDirW(const wchar_t *pwszDir, const wchar_t *pwszName)
+{
+  size_t nDir, nName;
+  wchar_t *pwszRet;
+
+  nDir = wcslen(pwszDir);
+  nName = wcslen(pwszName);
+  pwszRet = (wchar_t *) __win_Malloc((nDir + nName + 2) * sizeof(wchar_t));
+  if (!pwszRet)
+    return NULL;
+
+  memcpy(pwszRet, pwszDir, nDir * sizeof(wchar_t));
+  if (nDir && pwszDir[nDir - 1] != L'\\')
+    pwszRet[nDir++] = L'\\';
+  memcpy(pwszRet + nDir, pwszName, (nName + 1) * sizeof(wchar_t));
+
+  return pwszRet;
+}
+
+/**
+ * @brief Register a directory handle
+ * @internal
+ * @param pwszPath absolute path of the directory, allocated with malloc()
+ * @return the directory descriptor or -1
+ */
+static int __win_RegisterDirFd(HANDLE hDir, wchar_t *pwszPath)
+{
+  if (!pwszPath)
+  {
+    CloseHandle(hDir);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  __win_SetHandleType((intptr_t) hDir, DIR_HANDLE);
+  __win_SetHandleDirPath((intptr_t) hDir, pwszPath);
+
+  return (int) (intptr_t) hDir;
+}
+
+/**
+ * @brief Open a directory descriptor
+ * @internal
+ * @param pPath Windows path, wchar_t if bWide is TRUE, ANSI otherwise
+ * @param oflag flags passed to open()
+ * @return the directory descriptor or -1
+ */
+int __win_OpenDirFd(const void *pPath, BOOL bWide, int oflag)
+{
+  wchar_t szPath[_MAX_PATH + 1], *pwszPath, *pwszFull;
+  SECURITY_ATTRIBUTES sa;
+  BY_HANDLE_FILE_INFORMATION fileInfo;
+  HANDLE hDir;
+  DWORD dwLen;
+
+  if (bWide)
+    pwszPath = (wchar_t *) pPath;
+  else
+  {
+    if (strtowchar_buf((const char *) pPath, szPath, _MAX_PATH + 1, CP_ACP)
+      != 0)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    pwszPath = szPath;
+  }
+
+  if ((oflag & (O_WRONLY | O_RDWR)) || (oflag & O_CREAT))
+  {
+    errno = EISDIR;
+    return -1;
+  }
+
+  sa.nLength = sizeof(sa);
+  sa.lpSecurityDescriptor = NULL;
+  sa.bInheritHandle = !(oflag & O_NOINHERIT);
+
+  hDir = CreateFileW(pwszPath, DIR_FD_ACCESS, DIR_FD_SHARE, &sa,
+    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (hDir == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(GetLastError());
+    return -1;
+  }
+
+  if (!GetFileInformationByHandle(hDir, &fileInfo) ||
+    !(fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+  {
+    CloseHandle(hDir);
+    errno = ENOTDIR;
+    return -1;
+  }
+
+  /* Remember where the directory is, relative paths depend on the CWD */
+  pwszFull = NULL;
+  dwLen = GetFullPathNameW(pwszPath, 0, NULL, NULL);
+  if (dwLen)
+  {
+    pwszFull = (wchar_t *) __win_Malloc(dwLen * sizeof(wchar_t));
+    if (pwszFull && !GetFullPathNameW(pwszPath, dwLen, pwszFull, NULL))
+    {
+      free(pwszFull);
+      pwszFull = NULL;
+    }
+  }
+
+  return __win_RegisterDirFd(hDir, pwszFull);
+}
+
+/**
+ * @brief Append the name to the directory path for the path based functions
+ * @internal
+ * @return FALSE with errno set if the path doesn't fit
+ */
+static BOOL __win_JoinAt(TAtPath *pAt)
+{
+  wchar_t *pwszJoined;
+  int iRet;
+
+  pwszJoined = __win_JoinDirW(pAt->pwszDir, pAt->wszName);
+  if (!pwszJoined)
+  {
+    errno = ENOMEM;
+    return FALSE;
+  }
+
+  iRet = wchartostr_buf(pwszJoined, pAt->szJoined, sizeof(pAt->szJoined),
+    _plibc_utf8_mode == 1 ? CP_UTF8 : CP_ACP);
+  free(pwszJoined);
+  if (iRet != 0)
+  {
+    errno = iRet == 1 ? EILSEQ : ENAMETOOLONG;
+    return FALSE;
+  }
+  pAt->pszPath = pAt->szJoined;
+
+  return TRUE;
+}
+
+/**
+ * @brief Decide how to open a path given to one of the *at() functions
+ * @internal
+ * @param dirfd directory descriptor or AT_FDCWD
+ * @param path POSIX path in the encoding of the caller
+ * @param pAt receives the name relative to the directory or the path
+ * @return AT_RESOLVE_PATH, AT_RESOLVE_RELATIVE or -1 with errno set
+ */
+static int __win_ResolveAt(int dirfd, const char *path, TAtPath *pAt)
+{
+  THandleInfo info;
+  wchar_t *pwszName, *pwszPart, *pwszEnd;
+  size_t nLen;
+  BOOL bSimple;
+
+  pAt->pszPath = path;
+  pAt->hDir = NULL;
+  pAt->pwszDir = NULL;
+
+  if (!*path)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  if (dirfd == AT_FDCWD)
+    return AT_RESOLVE_PATH;
+
+  pwszName = pAt->wszName;
+  if (strtowchar_buf(path, pwszName, _MAX_PATH + 1,
+    _plibc_utf8_mode == 1 ? CP_UTF8 : CP_ACP) != 0)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  /* dirfd is ignored for absolute paths */
+  if (pwszName[0] == L'/' || pwszName[0] == L'\\' ||
+    (iswalpha(pwszName[0]) && pwszName[1] == L':') ||
+    __win_FindMount(pwszName, TRUE))
+    return AT_RESOLVE_PATH;
+
+  if (!__win_GetHandleInfo(dirfd, &info))
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (info.eType != DIR_HANDLE)
+  {
+    errno = ENOTDIR;
+    return -1;
+  }
+  if (!info.pwszDirPath)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  pAt->hDir = (HANDLE) (intptr_t) dirfd;
+  pAt->pwszDir = info.pwszDirPath;
+
+  for (pwszPart = pwszName; *pwszPart; pwszPart++)
+  {
+    if (*pwszPart == L'/')
+      *pwszPart = L'\\';
+  }
+  nLen = pwszPart - pwszName;
+  while (nLen > 1 && pwszName[nLen - 1] == L'\\')
+    pwszName[--nLen] = 0;
+
+  /* The NT layer takes each component literally */
+  bSimple = pNtCreateFile != NULL;
+  pwszPart = pwszName;
+  while (bSimple)
+  {
+    pwszEnd = wcschr(pwszPart, L'\\');
+    nLen = pwszEnd ? (size_t) (pwszEnd - pwszPart) : wcslen(pwszPart);
+    if (nLen == 0 || pwszPart[nLen - 1] == L'.' || pwszPart[nLen - 1] == L' ')
+      bSimple = FALSE;
+    if (!pwszEnd)
+      break;
+    pwszPart = pwszEnd + 1;
+  }
+
+  if (bSimple)
+    return AT_RESOLVE_RELATIVE;
+
+  return __win_JoinAt(pAt) ? AT_RESOLVE_PATH : -1;
+}
+
+/**
+ * @brief Open a name relative to the directory of pAt
+ * @internal
+ * @return NTSTATUS
+ */
+static LONG __win_NtOpenAt(const TAtPath *pAt, ACCESS_MASK amAccess,
+  ULONG ulAttributes, ULONG ulShare, ULONG ulDisposition, ULONG ulOptions,
+  BOOL bInherit, HANDLE *phFile)
+{
+  PLIBC_UNICODE_STRING usName;
+  PLIBC_OBJECT_ATTRIBUTES oa;
+  PLIBC_IO_STATUS_BLOCK iosb;
+
+  usName.Length = (USHORT) (wcslen(pAt->wszName) * sizeof(wchar_t));
+  usName.MaximumLength = usName.Length;
+  usName.Buffer = (PWSTR) pAt->wszName;
+
+  memset(&oa, 0, sizeof(oa));
+  oa.Length = sizeof(oa);
+  oa.RootDirectory = pAt->hDir;
+  oa.ObjectName = &usName;
+  oa.Attributes = PLIBC_OBJ_CASE_INSENSITIVE |
+    (bInherit ? PLIBC_OBJ_INHERIT : 0);
+
+  return pNtCreateFile(phFile, amAccess, &oa, &iosb, NULL, ulAttributes,
+    ulShare, ulDisposition, ulOptions, NULL, 0);
+}
+
+/**
+ * @brief Check whether a failed relative open should be repeated by path
+ * @internal
+ * @note Names that aren't found may still exist as a shortcut
+ */
+static BOOL __win_RetryAtByPath(LONG lStatus, TAtPath *pAt)
+{
+  if (_plibc_native_symlinks ||
+    (lStatus != PLIBC_STATUS_OBJECT_NAME_NOT_FOUND &&
+    lStatus != PLIBC_STATUS_OBJECT_PATH_NOT_FOUND))
+    return FALSE;
+
+  return __win_JoinAt(pAt);
+}
+
+/**
+ * @brief Open a file relative to a directory descriptor
+ */
+int _win_openat(int dirfd, const char *path, int oflag, ...)
+{
+  TAtPath at;
+  HANDLE hFile;
+  ACCESS_MASK amAccess;
+  ULONG ulDisposition, ulOptions, ulAttributes;
+  LONG lStatus;
+  int mode, iFD;
+
+  if (oflag & O_CREAT)
+  {
+    va_list arg;
+    va_start(arg, oflag);
+    mode = va_arg(arg, int);
+    va_end(arg);
+  }
+  else
+  {
+    mode = 0;
+  }
+
+  switch (__win_ResolveAt(dirfd, path, &at))
+  {
+    case AT_RESOLVE_PATH:
+      return _win_open(at.pszPath, oflag, mode);
+    case AT_RESOLVE_RELATIVE:
+      break;
+    default:
+      return -1;
+  }
+
+  if (oflag & O_DIRECTORY)
+  {
+    if ((oflag & (O_WRONLY | O_RDWR)) || (oflag & O_CREAT))
+    {
+      errno = EISDIR;
+      return -1;
+    }
+
+    lStatus = __win_NtOpenAt(&at, DIR_FD_ACCESS, 0, DIR_FD_SHARE,
+      PLIBC_FILE_OPEN, PLIBC_FILE_DIRECTORY_FILE |
+      PLIBC_FILE_SYNCHRONOUS_IO_NONALERT | PLIBC_FILE_OPEN_FOR_BACKUP_INTENT,
+      !(oflag & O_NOINHERIT), &hFile);
+    if (lStatus >= 0)
+      return __win_RegisterDirFd(hFile, __win_JoinDirW(at.pwszDir,
+        at.wszName));
+  }
+  else
+  {
+    if (oflag & O_RDWR)
+      amAccess = FILE_GENERIC_READ | FILE_GENERIC_WRITE;
+    else if (oflag & O_WRONLY)
+      amAccess = FILE_GENERIC_WRITE;
+    else
+      amAccess = FILE_GENERIC_READ;
+
+    if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+      ulDisposition = PLIBC_FILE_CREATE;
+    else if ((oflag & (O_CREAT | O_TRUNC)) == (O_CREAT | O_TRUNC))
+      ulDisposition = PLIBC_FILE_OVERWRITE_IF;
+    else if (oflag & O_CREAT)
+      ulDisposition = PLIBC_FILE_OPEN_IF;
+    else if (oflag & O_TRUNC)
+      ulDisposition = PLIBC_FILE_OVERWRITE;
+    else
+      ulDisposition = PLIBC_FILE_OPEN;
+
+    /* Like _open(), create read-only files if the mode says so */
+    ulAttributes = ((oflag & O_CREAT) && !(mode & S_IWRITE)) ?
+      FILE_ATTRIBUTE_READONLY : FILE_ATTRIBUTE_NORMAL;
+
+    ulOptions = PLIBC_FILE_SYNCHRONOUS_IO_NONALERT;
+    if (oflag & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC))
+      ulOptions |= PLIBC_FILE_NON_DIRECTORY_FILE;
+
+    lStatus = __win_NtOpenAt(&at, amAccess, ulAttributes,
+      FILE_SHARE_READ | FILE_SHARE_WRITE, ulDisposition, ulOptions,
+      !(oflag & O_NOINHERIT), &hFile);
+    if (lStatus >= 0)
+    {
+      iFD = _open_osfhandle((intptr_t) hFile,
+        oflag & (O_APPEND | O_RDONLY | O_WRONLY | O_RDWR));
+      if (iFD == -1)
+      {
+        CloseHandle(hFile);
+        errno = EMFILE;
+        return -1;
+      }
+
+      if (oflag & O_CREAT)
+        __win_InvalidatePathCache();
+
+      __win_SetHandleType(iFD, FD_HANDLE);
+
+      return iFD;
+    }
+  }
+
+  if (__win_RetryAtByPath(lStatus, &at))
+    return _win_open(at.pszPath, oflag, mode);
+
+  __win_SetErrnoFromNtStatus(lStatus);
+  return -1;
+}
+
+/**
+ * @brief Fill a stat structure the way _stat() does
+ * @internal
+ * @return 0 or -1 with errno set
+ */
+static int __win_FillStat(const BY_HANDLE_FILE_INFORMATION *pInfo,
+  const TAtPath *pAt, struct _stat *buffer)
+{
+  if (pInfo->nFileSizeHigh || pInfo->nFileSizeLow > LONG_MAX)
+  {
+    errno = EOVERFLOW;
+    return -1;
+  }
+
+  memset(buffer, 0, sizeof(*buffer));
+
+  buffer->st_mode = __win_AttributesToMode(pInfo->dwFileAttributes,
+    pAt->wszName);
+
+  buffer->st_nlink = (short) pInfo->nNumberOfLinks;
+  buffer->st_size = pInfo->nFileSizeLow;
+  buffer->st_atime = __win_FileTimeToUnix(&pInfo->ftLastAccessTime);
+  buffer->st_mtime = __win_FileTimeToUnix(&pInfo->ftLastWriteTime);
+  buffer->st_ctime = __win_FileTimeToUnix(&pInfo->ftCreationTime);
+
+  /* Drive number, 0 = A: */
+  if (iswalpha(pAt->pwszDir[0]) && pAt->pwszDir[1] == L':')
+    buffer->st_dev = buffer->st_rdev = towupper(pAt->pwszDir[0]) - L'A';
+
+  return 0;
+}
+
+/**
+ * @brief Get status information on a file relative to a directory
+ *        descriptor
+ * @param flag 0 or AT_SYMLINK_NOFOLLOW
+ */
+int _win_fstatat(int dirfd, const char *path, struct _stat *buf, int flag)
+{
+  TAtPath at;
+  BY_HANDLE_FILE_INFORMATION fileInfo;
+  HANDLE hFile;
+  LONG lStatus;
+  BOOL bNoFollow;
+
+  bNoFollow = (flag & AT_SYMLINK_NOFOLLOW) != 0;
+
+  switch (__win_ResolveAt(dirfd, path, &at))
+  {
+    case AT_RESOLVE_PATH:
+      return bNoFollow ? _win_lstat(at.pszPath, buf) :
+        _win_stat(at.pszPath, buf);
+    case AT_RESOLVE_RELATIVE:
+      break;
+    default:
+      return -1;
+  }
+
+  lStatus = __win_NtOpenAt(&at, FILE_READ_ATTRIBUTES | SYNCHRONIZE, 0,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, PLIBC_FILE_OPEN,
+    PLIBC_FILE_SYNCHRONOUS_IO_NONALERT | PLIBC_FILE_OPEN_FOR_BACKUP_INTENT |
+    (bNoFollow ? PLIBC_FILE_OPEN_REPARSE_POINT : 0), FALSE, &hFile);
+  if (lStatus < 0)
+  {
+    if (__win_RetryAtByPath(lStatus, &at))
+      return bNoFollow ? _win_lstat(at.pszPath, buf) :
+        _win_stat(at.pszPath, buf);
+
+    __win_SetErrnoFromNtStatus(lStatus);
+    return -1;
+  }
+
+  if (!GetFileInformationByHandle(hFile, &fileInfo))
+  {
+    SetErrnoFromWinError(GetLastError());
+    CloseHandle(hFile);
+    return -1;
+  }
+  CloseHandle(hFile);
+
+  /* lstat() knows how to describe the link itself */
+  if (bNoFollow && _plibc_native_symlinks &&
+    (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+    if (!__win_JoinAt(&at))
+      return -1;
+    return _win_lstat(at.pszPath, buf);
+  }
+
+  return __win_FillStat(&fileInfo, &at, buf);
+}
+
+/**
+ * @brief Create a directory relative to a directory descriptor
+ * @note mode is ignored like on all Windows file systems
+ */
+int _win_mkdirat(int dirfd, const char *path, mode_t mode)
+{
+  TAtPath at;
+  wchar_t szDir[_MAX_PATH + 1];
+  HANDLE hDir;
+  LONG lStatus;
+  long lRet;
+
+  switch (__win_ResolveAt(dirfd, path, &at))
+  {
+    case AT_RESOLVE_PATH:
+      break;
+    case AT_RESOLVE_RELATIVE:
+      lStatus = __win_NtOpenAt(&at, FILE_LIST_DIRECTORY | SYNCHRONIZE,
+        FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        PLIBC_FILE_CREATE, PLIBC_FILE_DIRECTORY_FILE |
+        PLIBC_FILE_SYNCHRONOUS_IO_NONALERT | PLIBC_FILE_OPEN_FOR_BACKUP_INTENT,
+        FALSE, &hDir);
+      if (lStatus >= 0)
+      {
+        CloseHandle(hDir);
+        __win_InvalidatePathCache();
+        return 0;
+      }
+      if (!__win_RetryAtByPath(lStatus, &at))
+      {
+        __win_SetErrnoFromNtStatus(lStatus);
+        return -1;
+      }
+      break;
+    default:
+      return -1;
+  }
+
+  if (_plibc_utf8_mode == 1)
+    lRet = plibc_conv_to_win_pathwconv(at.pszPath, szDir, _MAX_PATH);
+  else
+    lRet = plibc_conv_to_win_path(at.pszPath, (char *) szDir, _MAX_PATH);
+  if (lRet != ERROR_SUCCESS)
+  {
+    SetErrnoFromWinError(lRet);
+    return -1;
+  }
+
+  /* mkdir sets errno */
+  if (_plibc_utf8_mode == 1)
+    lRet = _wmkdir(szDir);
+  else
+    lRet = mkdir((char *) szDir);
+
+  /* Translations may refer to the old file system state */
+  if (lRet == 0)
+    __win_InvalidatePathCache();
+
+  return lRet;
+}
+
+/**
+ * @brief Remove a directory entry relative to a directory descriptor
+ * @param flag 0 or AT_REMOVEDIR
+ */
+int _win_unlinkat(int dirfd, const char *path, int flag)
+{
+  TAtPath at;
+  PLIBC_FILE_DISPOSITION_INFORMATION dispInfo;
+  PLIBC_IO_STATUS_BLOCK iosb;
+  HANDLE hFile;
+  LONG lStatus;
+  BOOL bDir;
+
+  bDir = (flag & AT_REMOVEDIR) != 0;
+
+  switch (__win_ResolveAt(dirfd, path, &at))
+  {
+    case AT_RESOLVE_PATH:
+      return bDir ? _win_rmdir(at.pszPath) : _win_unlink(at.pszPath);
+    case AT_RESOLVE_RELATIVE:
+      break;
+    default:
+      return -1;
+  }
+
+  /* Watched directories can't be removed for good */
+  if (bDir)
+  {
+    __win_CloseShortcutWatches();
+    __win_CloseStatCacheWatches();
+  }
+
+  /* Links are removed, not their targets */
+  lStatus = __win_NtOpenAt(&at, DELETE | SYNCHRONIZE, 0,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, PLIBC_FILE_OPEN,
+    PLIBC_FILE_SYNCHRONOUS_IO_NONALERT | PLIBC_FILE_OPEN_FOR_BACKUP_INTENT |
+    PLIBC_FILE_OPEN_REPARSE_POINT | (bDir ? PLIBC_FILE_DIRECTORY_FILE :
+    PLIBC_FILE_NON_DIRECTORY_FILE), FALSE, &hFile);
+  if (lStatus < 0)
+  {
+    if (__win_RetryAtByPath(lStatus, &at))
+      return bDir ? _win_rmdir(at.pszPath) : _win_unlink(at.pszPath);
+
+    __win_SetErrnoFromNtStatus(lStatus);
+    return -1;
+  }
+
+  /* Unlike FILE_DELETE_ON_CLOSE, this reports non-empty directories and
+     read-only files */
+  dispInfo.DeleteFile = TRUE;
+  lStatus = pNtSetInformationFile(hFile, &iosb, &dispInfo, sizeof(dispInfo),
+    FileDispositionInformation);
+  CloseHandle(hFile);
+  if (lStatus < 0)
+  {
+    __win_SetErrnoFromNtStatus(lStatus);
+    return -1;
+  }
+
+  /* Translations may refer to the old file system state */
+  __win_InvalidatePathCache();
+
+  return 0;
+}
+
+/**
+ * @brief Open a directory stream for a directory descriptor
+ * @note On success, the descriptor belongs to the stream and is closed by
+ *       closedir()
+ */
+DIR *_win_fdopendir(int fd)
+{
+  THandleInfo info;
+  struct plibc_WDIR *pwd;
+  char szDir[_MAX_PATH * 3 + 1];
+
+  if (!__win_GetHandleInfo(fd, &info))
+  {
+    errno = EBADF;
+    return NULL;
+  }
+  if (info.eType != DIR_HANDLE)
+  {
+    errno = ENOTDIR;
+    return NULL;
+  }
+  if (!info.pwszDirPath)
+  {
+    errno = EBADF;
+    return NULL;
+  }
+
+  if (_plibc_utf8_mode == 1)
+    pwd = __win_OpenDirStream(info.pwszDirPath);
+  else
+  {
+    if (wchartostr_buf(info.pwszDirPath, szDir, sizeof(szDir), CP_ACP) != 0)
+    {
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    pwd = __win_OpenDirStream(szDir);
+  }
+
+  if (pwd)
+    pwd->dirfd = fd;
+
+  return (DIR *) pwd;
+}
+
+/* end of at.c */
@@ -40,7 +40,7 @@ plibc_ChooseDirW(wchar_t *pszTitle, unsigned long ulFlags)
 
   if (0 != (pidl = SHBrowseForFolderW (&info)))
   {
-    fn = malloc((_MAX_PATH + 1) * sizeof (wchar_t));
+    fn = __win_Malloc((_MAX_PATH + 1) * sizeof (wchar_t));
     if (!SHGetPathFromIDListW (pidl, fn))
     {
       free (fn);
@@ -47,7 +47,7 @@ plibc_ChooseFileW(wchar_t *pszTitle, unsigned long ulFlags)
   theDlg.Flags = ulFlags;
   
   if (GetOpenFileNameW(&theDlg))
-    return wcsdup (theDlg.lpstrFile);
+    return __win_WcsDup(theDlg.lpstrFile);
   return NULL;
 }
 
@@ -26,10 +26,33 @@
 
 int _win_close(intptr_t fd)
 {
+  THandleInfo info;
   THandleType theType;
   int ret;
 
-  theType = __win_GetHandleType(fd);
+  if (!__win_GetHandleInfo(fd, &info))
+  {
+    info.eType = UNKNOWN_HANDLE;
+    info.hPositional = NULL;
+  }
+  theType = info.eType;
+
+  /* Finish writes queued by non-blocking write() */
+  if (theType != UNKNOWN_HANDLE && theType != SOCKET_HANDLE)
+    __win_AioClose(fd);
+
+  /* Stop watching it */
+  if (theType == SOCKET_HANDLE || theType == PIPE_HANDLE)
+    __win_EpollForget(fd);
+
+  /* Pipe made by plibc_pipe_ex() */
+  if (theType == PIPE_HANDLE && info.pPipe)
+    __win_PipeClose(&info);
+
+  /* Handle opened by pread()/pwrite() */
+  if (info.hPositional && info.hPositional != INVALID_HANDLE_VALUE)
+    CloseHandle(info.hPositional);
+
   switch(theType)
   {
     case SOCKET_HANDLE:
@@ -38,6 +61,7 @@ int _win_close(intptr_t fd)
         SetErrnoFromWinsockError(WSAGetLastError());
       break;
     case PIPE_HANDLE:
+    case DIR_HANDLE:
       if (!CloseHandle((HANDLE) fd))
       {
         SetErrnoFromWinError(GetLastError());
@@ -49,6 +73,9 @@ int _win_close(intptr_t fd)
     case FD_HANDLE:
       ret = close(fd);
       break;
+    case EPOLL_HANDLE:
+      ret = __win_EpollClose(fd);
+      break;
     default:
       theType = UNKNOWN_HANDLE;
     case UNKNOWN_HANDLE:
@@ -60,10 +87,7 @@ int _win_close(intptr_t fd)
   }
 
   if (theType != UNKNOWN_HANDLE)
-  {
-    __win_DiscardHandleBlockingMode(fd);
     __win_DiscardHandleType(fd);
-  }
 
   return ret;
 }
@@ -29,24 +29,28 @@
  */
 int _win_closedir(DIR *dirp)
 {
-  /* closedir sets errno */
-  if (_plibc_utf8_mode == 1)
+  struct plibc_WDIR *pwd;
+  int result;
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd)
   {
-    struct plibc_WDIR *pwd;
-    int result;
-    pwd = (struct plibc_WDIR *) dirp;
-    if (pwd->self != pwd)
-    {
-      errno = EINVAL;
-      return -1;
-    }
-    result = _wclosedir(pwd->mingw_wdir);
-    free (pwd);
-    return result;
+    errno = EINVAL;
+    return -1;
   }
-  else
-    return closedir(dirp);
-}
 
+  result = 0;
+  if (pwd->hFind != INVALID_HANDLE_VALUE && !FindClose(pwd->hFind))
+  {
+    SetErrnoFromWinError(GetLastError());
+    result = -1;
+  }
+
+  /* The stream was opened by fdopendir() */
+  if (pwd->dirfd != -1 && _win_close(pwd->dirfd) != 0)
+    result = -1;
+
+  __win_ReleaseDirStream(pwd);
+  return result;
+}
 
 /* end of closedir.c */
@@ -0,0 +1,1135 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/epoll.c
+ * @brief epoll-style readiness notification
+ *
+ * An epoll instance is an I/O completion port. Its interest set is kept
+ * between calls, so plibc_epoll_wait() only touches descriptors that
+ * became ready. Sockets are watched with IOCTL_AFD_POLL requests, the
+ * request ws2_32 uses for select(), issued on a private handle to the AFD
+ * driver. The request completes on the port as soon as one of the events
+ * holds. Sockets themselves are never associated with the port, so the
+ * application remains free to use them with overlapped I/O.
+ * Pipes are watched by a thread that waits for data, like select() does,
+ * and posts to the port.
+ *
+ * Descriptors that were reported are watched again when the next
+ * plibc_epoll_wait() starts, after the application had a chance to read or
+ * write; AFD would otherwise complete at once for data that is consumed
+ * by then. Edge-triggered ones (EPOLLET) stop being watched for the events
+ * that were reported until a PlibC read, write, accept or connect on them
+ * fails with EAGAIN, so descriptors must be drained before waiting again, as
+ * epoll(7) prescribes. Reads and writes that bypass PlibC, e.g. recv() on
+ * the ws2_32 socket or ReadFile(), don't count. EPOLLONESHOT descriptors are
+ * watched again by EPOLL_CTL_MOD.
+ *
+ * Every call keeps the instance alive, so closing the epoll descriptor
+ * while other threads wait on it wakes them up (errno = EBADF) and the
+ * instance is freed by the last one to leave.
+ *
+ * This needs Windows Vista or later (errno = ENOSYS).
+ */
+
+#include "plibc_private.h"
+
+#define EPOLL_MIN_BUCKETS 64            /* power of 2 */
+#define EPOLL_MAX_BATCH   1024          /* completions dequeued at once */
+
+#define IOCTL_AFD_POLL 0x00012024
+
+#define AFD_POLL_RECEIVE           0x0001
+#define AFD_POLL_RECEIVE_EXPEDITED 0x0002
+#define AFD_POLL_SEND              0x0004
+#define AFD_POLL_DISCONNECT        0x0008
+#define AFD_POLL_ABORT             0x0010
+#define AFD_POLL_LOCAL_CLOSE       0x0020
+#define AFD_POLL_ACCEPT            0x0080
+#define AFD_POLL_CONNECT_FAIL      0x0100
+
+#ifndef SIO_BASE_HANDLE
+  #define SIO_BASE_HANDLE 0x48000022
+#endif
+
+#define PLIBC_STATUS_CANCELLED     ((LONG) 0xC0000120)
+#define PLIBC_FILE_OPEN            1
+#define PLIBC_OBJ_CASE_INSENSITIVE 0x40
+
+#define EPOLL_READ  (EPOLLIN | EPOLLRDNORM)
+#define EPOLL_WRITE (EPOLLOUT | EPOLLWRNORM | EPOLLWRBAND)
+
+/* Taken from the Wine project <http://www.winehq.org>
+    /wine/include/winternl.h */
+typedef struct
+{
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+} PLIBC_UNICODE_STRING;
+
+typedef struct
+{
+  ULONG Length;
+  HANDLE RootDirectory;
+  PLIBC_UNICODE_STRING *ObjectName;
+  ULONG Attributes;
+  PVOID SecurityDescriptor;
+  PVOID SecurityQualityOfService;
+} PLIBC_OBJECT_ATTRIBUTES;
+
+typedef struct
+{
+  union
+  {
+    LONG Status;
+    PVOID Pointer;
+  } u;
+  ULONG_PTR Information;
+} PLIBC_IO_STATUS_BLOCK;
+
+typedef struct
+{
+  HANDLE Handle;
+  ULONG Events;
+  LONG Status;
+} PLIBC_AFD_POLL_HANDLE_INFO;
+
+typedef struct
+{
+  LARGE_INTEGER Timeout;
+  ULONG NumberOfHandles;
+  ULONG Exclusive;
+  PLIBC_AFD_POLL_HANDLE_INFO Handles[1];
+} PLIBC_AFD_POLL_INFO;
+
+typedef struct
+{
+  ULONG_PTR lpCompletionKey;
+  LPOVERLAPPED lpOverlapped;
+  ULONG_PTR Internal;
+  DWORD dwNumberOfBytesTransferred;
+} PLIBC_OVERLAPPED_ENTRY;
+
+typedef LONG (WINAPI *TNtCreateFile) (PHANDLE FileHandle,
+  ACCESS_MASK DesiredAccess, PLIBC_OBJECT_ATTRIBUTES *ObjectAttributes,
+  PLIBC_IO_STATUS_BLOCK *IoStatusBlock, PLARGE_INTEGER AllocationSize,
+  ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition,
+  ULONG CreateOptions, PVOID EaBuffer, ULONG EaLength);
+typedef ULONG (WINAPI *TRtlNtStatusToDosError) (LONG Status);
+typedef BOOL (WINAPI *TGetQueuedCompletionStatusEx) (HANDLE CompletionPort,
+  PLIBC_OVERLAPPED_ENTRY *lpCompletionPortEntries, ULONG ulCount,
+  PULONG ulNumEntriesRemoved, DWORD dwMilliseconds, BOOL fAlertable);
+typedef BOOL (WINAPI *TCancelIoEx) (HANDLE hFile, LPOVERLAPPED lpOverlapped);
+
+typedef struct _TEpollItem
+{
+  struct _TEpollItem *pNextHash;
+  intptr_t iFD;
+  THandleType eType;
+  HANDLE hBase;             /* base provider socket */
+  uint32_t uiEvents;        /* what the application asked for */
+  epoll_data_t data;
+  uint32_t uiMuted;         /* EPOLLET: reported, not watched until EAGAIN */
+  BOOL bArmed;              /* FALSE after EPOLLONESHOT fired */
+  BOOL bRearm;              /* EAGAIN while a request was outstanding */
+  BOOL bPending;            /* request outstanding */
+  BOOL bDeleted;            /* free when the request completes */
+  BOOL bQueued;             /* on the update list */
+  struct _TEpollItem *pNextUpdate;
+  ULONG ulPendingMask;      /* AFD_POLL_* of the outstanding request */
+  OVERLAPPED ov;
+  PLIBC_AFD_POLL_INFO pollInfo;
+  TPipeWaiter waiter;
+} TEpollItem;
+
+struct _TEpoll
+{
+  struct _TEpoll *pNext;
+  HANDLE hPort;
+  HANDLE hAfd;
+  CRITICAL_SECTION cs;
+  TEpollItem **ppBuckets;
+  unsigned int uiBuckets;
+  unsigned int uiItems;
+  unsigned int uiPending;   /* outstanding requests, including deleted items */
+  TEpollItem *pUpdates;     /* reported, to be watched again */
+  volatile LONG lRefs;      /* the descriptor and every call in progress */
+  BOOL bClosed;
+};
+
+static TNtCreateFile pNtCreateFile;
+static TRtlNtStatusToDosError pRtlNtStatusToDosError;
+static TGetQueuedCompletionStatusEx pGetQueuedCompletionStatusEx;
+static TCancelIoEx pCancelIoEx;
+
+/* All instances, for close() and EAGAIN */
+static CRITICAL_SECTION csEpolls;
+static TEpoll *pEpolls = NULL;
+static volatile LONG lEpolls = 0;
+
+/**
+ * @brief Set up epoll
+ * @internal
+ */
+void __win_InitEpoll()
+{
+  HMODULE hNtdll, hKernel;
+
+  InitializeCriticalSection(&csEpolls);
+
+  hNtdll = GetModuleHandle("ntdll.dll");
+  hKernel = GetModuleHandle("kernel32.dll");
+  pNtCreateFile = (TNtCreateFile) GetProcAddress(hNtdll, "NtCreateFile");
+  pRtlNtStatusToDosError = (TRtlNtStatusToDosError) GetProcAddress(hNtdll,
+    "RtlNtStatusToDosError");
+  pGetQueuedCompletionStatusEx = (TGetQueuedCompletionStatusEx)
+    GetProcAddress(hKernel, "GetQueuedCompletionStatusEx");
+  pCancelIoEx = (TCancelIoEx) GetProcAddress(hKernel, "CancelIoEx");
+}
+
+static unsigned int __win_EpollHash(intptr_t fd)
+{
+  return (unsigned int) (((unsigned long long) fd *
+    0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static TEpollItem *__win_EpollFind(TEpoll *pEp, intptr_t fd)
+{
+  TEpollItem *pItem;
+
+  pItem = pEp->ppBuckets[__win_EpollHash(fd) & (pEp->uiBuckets - 1)];
+  while (pItem && pItem->iFD != fd)
+    pItem = pItem->pNextHash;
+
+  return pItem;
+}
+
+static void __win_EpollLink(TEpoll *pEp, TEpollItem *pItem)
+{
+  TEpollItem **ppBucket;
+
+  /* Grow, the old table stays if there is no memory */
+  if (pEp->uiItems >= pEp->uiBuckets)
+  {
+    TEpollItem **ppNew, *pOld;
+    unsigned int uiBuckets, ui;
+
+    uiBuckets = pEp->uiBuckets * 2;
+    ppNew = (TEpollItem **) __win_Calloc(uiBuckets, sizeof(TEpollItem *));
+    if (ppNew)
+    {
+      for (ui = 0; ui < pEp->uiBuckets; ui++)
+      {
+        while ((pOld = pEp->ppBuckets[ui]) != NULL)
+        {
+          pEp->ppBuckets[ui] = pOld->pNextHash;
+          ppBucket = &ppNew[__win_EpollHash(pOld->iFD) & (uiBuckets - 1)];
+          pOld->pNextHash = *ppBucket;
+          *ppBucket = pOld;
+        }
+      }
+      free(pEp->ppBuckets);
+      pEp->ppBuckets = ppNew;
+      pEp->uiBuckets = uiBuckets;
+    }
+  }
+
+  ppBucket = &pEp->ppBuckets[__win_EpollHash(pItem->iFD) &
+    (pEp->uiBuckets - 1)];
+  pItem->pNextHash = *ppBucket;
+  *ppBucket = pItem;
+  pEp->uiItems++;
+}
+
+static void __win_EpollUnlink(TEpoll *pEp, TEpollItem *pItem)
+{
+  TEpollItem **ppLink;
+
+  ppLink = &pEp->ppBuckets[__win_EpollHash(pItem->iFD) &
+    (pEp->uiBuckets - 1)];
+  while (*ppLink != pItem)
+    ppLink = &(*ppLink)->pNextHash;
+  *ppLink = pItem->pNextHash;
+  pEp->uiItems--;
+}
+
+/**
+ * @brief Translate EPOLL* to AFD_POLL_*
+ * @internal
+ */
+static ULONG __win_EpollToAfd(uint32_t uiEvents)
+{
+  ULONG ulMask = AFD_POLL_LOCAL_CLOSE;
+
+  if (uiEvents & EPOLL_READ)
+    ulMask |= AFD_POLL_RECEIVE | AFD_POLL_ACCEPT;
+  if (uiEvents & (EPOLLPRI | EPOLLRDBAND))
+    ulMask |= AFD_POLL_RECEIVE_EXPEDITED;
+  if (uiEvents & EPOLL_WRITE)
+    ulMask |= AFD_POLL_SEND;
+  if (uiEvents & (EPOLL_READ | EPOLLRDHUP))
+    ulMask |= AFD_POLL_DISCONNECT;
+  if (uiEvents & EPOLLHUP)
+    ulMask |= AFD_POLL_ABORT;
+  if (uiEvents & EPOLLERR)
+    ulMask |= AFD_POLL_CONNECT_FAIL;
+
+  return ulMask;
+}
+
+/**
+ * @brief Translate AFD_POLL_* to EPOLL*
+ * @internal
+ */
+static uint32_t __win_AfdToEpoll(ULONG ulMask)
+{
+  uint32_t uiEvents = 0;
+
+  if (ulMask & (AFD_POLL_RECEIVE | AFD_POLL_ACCEPT))
+    uiEvents |= EPOLL_READ;
+  if (ulMask & AFD_POLL_RECEIVE_EXPEDITED)
+    uiEvents |= EPOLLPRI | EPOLLRDBAND;
+  if (ulMask & AFD_POLL_SEND)
+    uiEvents |= EPOLL_WRITE;
+  if (ulMask & AFD_POLL_DISCONNECT)
+    uiEvents |= EPOLL_READ | EPOLLRDHUP;
+  if (ulMask & AFD_POLL_ABORT)
+    uiEvents |= EPOLLHUP;
+  if (ulMask & AFD_POLL_CONNECT_FAIL)
+    uiEvents |= EPOLL_READ | EPOLL_WRITE | EPOLLERR | EPOLLRDHUP;
+
+  return uiEvents;
+}
+
+/**
+ * @brief Get the socket AFD knows, layered service providers may wrap it
+ * @internal
+ */
+static HANDLE __win_EpollBaseSocket(intptr_t s)
+{
+  SOCKET sBase;
+  DWORD dwBytes;
+
+  if (WSAIoctl(s, SIO_BASE_HANDLE, NULL, 0, &sBase, sizeof(sBase), &dwBytes,
+    NULL, NULL) == SOCKET_ERROR)
+    return (HANDLE) s;
+
+  return (HANDLE) sBase;
+}
+
+/**
+ * @brief Get the events a descriptor is watched for
+ * @internal
+ */
+static uint32_t __win_EpollWatched(TEpollItem *pItem)
+{
+  return pItem->uiEvents & ~pItem->uiMuted & ~(EPOLLET | EPOLLONESHOT);
+}
+
+/**
+ * @brief Start watching a descriptor, unless it is watched already
+ * @internal
+ * @return 0 on success, -1 on error
+ * @note Must be called with pEp->cs held
+ */
+static int __win_EpollSubmit(TEpoll *pEp, TEpollItem *pItem)
+{
+  uint32_t uiWatch;
+
+  uiWatch = __win_EpollWatched(pItem);
+  if (pItem->bDeleted || !pItem->bArmed || pItem->bPending || !uiWatch)
+    return 0;
+
+  if (pItem->eType == PIPE_HANDLE)
+  {
+    /* The waiter returns as long as there is data */
+    if (!(uiWatch & EPOLL_READ))
+      return 0;
+
+    __win_StartPipeWaiter(&pItem->waiter);
+  }
+  else
+  {
+    pItem->ulPendingMask = __win_EpollToAfd(uiWatch);
+    pItem->pollInfo.Timeout.QuadPart = 0x7FFFFFFFFFFFFFFFLL;
+    pItem->pollInfo.NumberOfHandles = 1;
+    pItem->pollInfo.Exclusive = FALSE;
+    pItem->pollInfo.Handles[0].Handle = pItem->hBase;
+    pItem->pollInfo.Handles[0].Events = pItem->ulPendingMask;
+    pItem->pollInfo.Handles[0].Status = 0;
+    memset(&pItem->ov, 0, sizeof(OVERLAPPED));
+
+    /* Completes on the port even if it succeeds right away */
+    if (!DeviceIoControl(pEp->hAfd, IOCTL_AFD_POLL, &pItem->pollInfo,
+      sizeof(PLIBC_AFD_POLL_INFO), &pItem->pollInfo,
+      sizeof(PLIBC_AFD_POLL_INFO), NULL, &pItem->ov) &&
+      GetLastError() != ERROR_IO_PENDING)
+    {
+      SetErrnoFromWinError(GetLastError());
+      return -1;
+    }
+  }
+
+  pItem->bPending = TRUE;
+  pEp->uiPending++;
+
+  return 0;
+}
+
+/**
+ * @brief Stop watching a descriptor and forget it
+ * @internal
+ * @note Must be called with pEp->cs held. The item is freed once its
+ *       outstanding request, if any, has completed and it has left the
+ *       update list.
+ */
+static void __win_EpollRemove(TEpoll *pEp, TEpollItem *pItem)
+{
+  __win_EpollUnlink(pEp, pItem);
+  pItem->bDeleted = TRUE;
+
+  if (pItem->bPending)
+  {
+    if (pItem->eType == PIPE_HANDLE)
+    {
+      if (!__win_StopPipeWaiter(&pItem->waiter))
+      {
+        pItem->bPending = FALSE;
+        pEp->uiPending--;
+      }
+    }
+    else
+      /* Completes with STATUS_CANCELLED, or has completed already */
+      pCancelIoEx(pEp->hAfd, &pItem->ov);
+  }
+
+  if (!pItem->bPending && !pItem->bQueued)
+    free(pItem);
+}
+
+/**
+ * @brief Watch the descriptors on the update list again
+ * @internal
+ * @param pEvents receives EPOLLERR events for descriptors that can't be
+ *        watched anymore, NULL to drop them
+ * @param iMax size of pEvents
+ * @return number of events in pEvents
+ * @note Must be called with pEp->cs held
+ */
+static int __win_EpollUpdate(TEpoll *pEp, struct epoll_event *pEvents,
+  int iMax)
+{
+  TEpollItem *pItem;
+  int iRet;
+
+  iRet = 0;
+  while ((pItem = pEp->pUpdates) != NULL && (!pEvents || iRet < iMax))
+  {
+    pEp->pUpdates = pItem->pNextUpdate;
+    pItem->bQueued = FALSE;
+
+    if (pItem->bDeleted)
+    {
+      if (!pItem->bPending)
+        free(pItem);
+    }
+    else if (__win_EpollSubmit(pEp, pItem) == -1)
+    {
+      /* Don't try again and again */
+      pItem->bArmed = FALSE;
+      if (pEvents)
+      {
+        pEvents[iRet].events = EPOLLERR;
+        pEvents[iRet].data = pItem->data;
+        iRet++;
+      }
+    }
+  }
+
+  return iRet;
+}
+
+/**
+ * @brief Check a pipe
+ * @internal
+ */
+static uint32_t __win_EpollPipeEvents(intptr_t fd)
+{
+  DWORD dwBytes;
+
+  if (!PeekNamedPipe((HANDLE) fd, NULL, 0, NULL, &dwBytes, NULL))
+    return GetLastError() == ERROR_BROKEN_PIPE ? EPOLLHUP : EPOLLERR;
+
+  return dwBytes ? EPOLL_READ : 0;
+}
+
+/**
+ * @brief Process a completed request
+ * @internal
+ * @param pEvent receives the event to report
+ * @return 1 if pEvent was filled in, 0 otherwise
+ * @note Must be called with pEp->cs held
+ */
+static int __win_EpollComplete(TEpoll *pEp, TEpollItem *pItem,
+  struct epoll_event *pEvent)
+{
+  uint32_t uiReady;
+
+  pItem->bPending = FALSE;
+  pEp->uiPending--;
+
+  if (pItem->eType == PIPE_HANDLE)
+    __win_StopPipeWaiter(&pItem->waiter);
+
+  if (pItem->bDeleted)
+  {
+    if (!pItem->bQueued)
+      free(pItem);
+    return 0;
+  }
+
+  uiReady = 0;
+  if (pItem->eType == PIPE_HANDLE)
+    uiReady = __win_EpollPipeEvents(pItem->iFD);
+  else if ((LONG) pItem->ov.Internal == PLIBC_STATUS_CANCELLED)
+    uiReady = 0;
+  else if ((LONG) pItem->ov.Internal < 0)
+    uiReady = EPOLLERR;
+  else if (pItem->pollInfo.NumberOfHandles)
+  {
+    /* Closed without close() */
+    if (pItem->pollInfo.Handles[0].Events & AFD_POLL_LOCAL_CLOSE)
+    {
+      __win_EpollRemove(pEp, pItem);
+      return 0;
+    }
+
+    uiReady = __win_AfdToEpoll(pItem->pollInfo.Handles[0].Events);
+  }
+
+  uiReady &= __win_EpollWatched(pItem);
+  if (uiReady)
+  {
+    if (pItem->uiEvents & EPOLLONESHOT)
+      pItem->bArmed = FALSE;
+    else if ((pItem->uiEvents & EPOLLET) && !pItem->bRearm)
+      pItem->uiMuted |= uiReady;
+  }
+  pItem->bRearm = FALSE;
+
+  if (!uiReady)
+  {
+    /* Cancelled or nothing the application is interested in anymore */
+    if (__win_EpollSubmit(pEp, pItem) == -1)
+    {
+      pItem->bArmed = FALSE;
+      uiReady = EPOLLERR;
+    }
+  }
+  else if (!pItem->bQueued)
+  {
+    /* Until the application has seen the event, a new request would
+       complete right away for the same data */
+    pItem->bQueued = TRUE;
+    pItem->pNextUpdate = pEp->pUpdates;
+    pEp->pUpdates = pItem;
+  }
+
+  if (!uiReady)
+    return 0;
+
+  pEvent->events = uiReady;
+  pEvent->data = pItem->data;
+
+  return 1;
+}
+
+/**
+ * @brief Open a handle to the AFD driver
+ * @internal
+ * @return NULL on error
+ */
+static HANDLE __win_OpenAfd()
+{
+  static wchar_t wszAfd[] = L"\\Device\\Afd\\PlibC";
+  PLIBC_UNICODE_STRING name;
+  PLIBC_OBJECT_ATTRIBUTES attr;
+  PLIBC_IO_STATUS_BLOCK iosb;
+  HANDLE hAfd;
+  LONG lStatus;
+
+  name.Length = sizeof(wszAfd) - sizeof(wchar_t);
+  name.MaximumLength = sizeof(wszAfd);
+  name.Buffer = wszAfd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.Length = sizeof(attr);
+  attr.ObjectName = &name;
+  attr.Attributes = PLIBC_OBJ_CASE_INSENSITIVE;
+
+  lStatus = pNtCreateFile(&hAfd, SYNCHRONIZE, &attr, &iosb, NULL, 0,
+    FILE_SHARE_READ | FILE_SHARE_WRITE, PLIBC_FILE_OPEN, 0, NULL, 0);
+  if (lStatus < 0)
+  {
+    SetErrnoFromWinError(pRtlNtStatusToDosError(lStatus));
+    return NULL;
+  }
+
+  return hAfd;
+}
+
+/**
+ * @brief Stop watching all descriptors
+ * @internal
+ * @note Must be called with pEp->cs held
+ */
+static void __win_EpollRemoveAll(TEpoll *pEp)
+{
+  unsigned int ui;
+
+  for (ui = 0; ui < pEp->uiBuckets; ui++)
+  {
+    while (pEp->ppBuckets[ui])
+      __win_EpollRemove(pEp, pEp->ppBuckets[ui]);
+  }
+}
+
+/**
+ * @brief Free an epoll instance
+ * @internal
+ * @note The instance must not be in the list of instances anymore and no
+ *       other thread may use it
+ */
+static void __win_EpollDestroy(TEpoll *pEp)
+{
+  PLIBC_OVERLAPPED_ENTRY entry;
+  struct epoll_event event;
+  ULONG ulGot;
+
+  EnterCriticalSection(&pEp->cs);
+
+  __win_EpollRemoveAll(pEp);
+  __win_EpollUpdate(pEp, NULL, 0);
+
+  /* The kernel may still write to items with outstanding requests */
+  while (pEp->uiPending)
+  {
+    if (!pGetQueuedCompletionStatusEx(pEp->hPort, &entry, 1, &ulGot,
+      INFINITE, FALSE))
+      break;
+    if (entry.lpOverlapped)
+      __win_EpollComplete(pEp, CONTAINING_RECORD(entry.lpOverlapped,
+        TEpollItem, ov), &event);
+  }
+
+  LeaveCriticalSection(&pEp->cs);
+
+  CloseHandle(pEp->hAfd);
+  CloseHandle(pEp->hPort);
+  DeleteCriticalSection(&pEp->cs);
+  free(pEp->ppBuckets);
+  free(pEp);
+}
+
+/**
+ * @brief Get the instance behind an epoll descriptor and keep it alive
+ * @internal
+ * @note Release with __win_ReleaseEpoll()
+ */
+static TEpoll *__win_AcquireEpoll(intptr_t epfd)
+{
+  THandleInfo info;
+  TEpoll *pEp;
+
+  pEp = NULL;
+
+  /* __win_EpollClose() detaches the instance under the same lock */
+  EnterCriticalSection(&csEpolls);
+  if (__win_GetHandleInfo(epfd, &info) && info.eType == EPOLL_HANDLE)
+    pEp = info.pEpoll;
+  if (pEp)
+    InterlockedIncrement(&pEp->lRefs);
+  LeaveCriticalSection(&csEpolls);
+
+  if (!pEp)
+    errno = EBADF;
+
+  return pEp;
+}
+
+/**
+ * @brief Drop a reference to an instance, free it with the last one
+ * @internal
+ */
+static void __win_ReleaseEpoll(TEpoll *pEp)
+{
+  if (!InterlockedDecrement(&pEp->lRefs))
+    __win_EpollDestroy(pEp);
+}
+
+/**
+ * @brief Close an epoll descriptor
+ * @internal
+ * @note plibc_epoll_wait() in other threads returns -1 (errno = EBADF)
+ */
+int __win_EpollClose(intptr_t epfd)
+{
+  THandleInfo info;
+  TEpoll **ppLink, *pEp;
+
+  EnterCriticalSection(&csEpolls);
+  if (!__win_GetHandleInfo(epfd, &info) || !info.pEpoll)
+  {
+    LeaveCriticalSection(&csEpolls);
+    errno = EBADF;
+    return -1;
+  }
+
+  pEp = info.pEpoll;
+  ppLink = &pEpolls;
+  while (*ppLink != pEp)
+    ppLink = &(*ppLink)->pNext;
+  *ppLink = pEp->pNext;
+  InterlockedDecrement(&lEpolls);
+  __win_SetHandleEpoll(epfd, NULL);
+  LeaveCriticalSection(&csEpolls);
+
+  EnterCriticalSection(&pEp->cs);
+  pEp->bClosed = TRUE;
+  __win_EpollRemoveAll(pEp);
+  LeaveCriticalSection(&pEp->cs);
+
+  /* Wake up a waiting thread, which passes it on */
+  PostQueuedCompletionStatus(pEp->hPort, 0, 0, NULL);
+
+  __win_ReleaseEpoll(pEp);
+
+  return 0;
+}
+
+/**
+ * @brief Free all epoll instances
+ * @internal
+ */
+void __win_FreeEpoll()
+{
+  TEpoll *pEp;
+
+  while ((pEp = pEpolls) != NULL)
+  {
+    pEpolls = pEp->pNext;
+    __win_EpollDestroy(pEp);
+  }
+  lEpolls = 0;
+
+  DeleteCriticalSection(&csEpolls);
+}
+
+/**
+ * @brief Remove a descriptor that is about to be closed from all instances
+ * @internal
+ */
+void __win_EpollForget(intptr_t fd)
+{
+  TEpoll *pEp;
+  TEpollItem *pItem;
+
+  if (!lEpolls)
+    return;
+
+  EnterCriticalSection(&csEpolls);
+  for (pEp = pEpolls; pEp; pEp = pEp->pNext)
+  {
+    EnterCriticalSection(&pEp->cs);
+    pItem = __win_EpollFind(pEp, fd);
+    if (pItem)
+      __win_EpollRemove(pEp, pItem);
+    LeaveCriticalSection(&pEp->cs);
+  }
+  LeaveCriticalSection(&csEpolls);
+}
+
+/**
+ * @brief Watch an edge-triggered descriptor for all its events again
+ * @internal
+ * @note Called when an operation on fd failed with EAGAIN
+ */
+void __win_EpollRearm(intptr_t fd)
+{
+  TEpoll *pEp;
+  TEpollItem *pItem;
+
+  if (!lEpolls)
+    return;
+
+  EnterCriticalSection(&csEpolls);
+  for (pEp = pEpolls; pEp; pEp = pEp->pNext)
+  {
+    EnterCriticalSection(&pEp->cs);
+    pItem = __win_EpollFind(pEp, fd);
+    if (pItem && (pItem->uiEvents & (EPOLLET | EPOLLONESHOT)) == EPOLLET)
+    {
+      /* An event of the outstanding request may predate the EAGAIN */
+      if (pItem->bPending)
+        pItem->bRearm = TRUE;
+
+      if (pItem->uiMuted)
+      {
+        pItem->uiMuted = 0;
+        if (!pItem->bPending)
+          __win_EpollSubmit(pEp, pItem);
+        else if (pItem->eType == SOCKET_HANDLE)
+          /* Resubmitted with all events when it completes */
+          pCancelIoEx(pEp->hAfd, &pItem->ov);
+      }
+    }
+    LeaveCriticalSection(&pEp->cs);
+  }
+  LeaveCriticalSection(&csEpolls);
+}
+
+/**
+ * @brief Open an epoll descriptor
+ * @param size ignored, but must be greater than zero
+ * @return the descriptor, -1 on error. Close it with close().
+ */
+intptr_t plibc_epoll_create(int size)
+{
+  TEpoll *pEp;
+  int iErr;
+
+  if (size <= 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!pNtCreateFile || !pRtlNtStatusToDosError ||
+    !pGetQueuedCompletionStatusEx || !pCancelIoEx)
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  pEp = (TEpoll *) __win_Calloc(1, sizeof(TEpoll));
+  if (!pEp)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  pEp->uiBuckets = EPOLL_MIN_BUCKETS;
+  pEp->ppBuckets = (TEpollItem **) __win_Calloc(pEp->uiBuckets,
+    sizeof(TEpollItem *));
+  if (!pEp->ppBuckets)
+  {
+    free(pEp);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  pEp->hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+  if (!pEp->hPort)
+  {
+    SetErrnoFromWinError(GetLastError());
+    free(pEp->ppBuckets);
+    free(pEp);
+    return -1;
+  }
+
+  pEp->hAfd = __win_OpenAfd();
+  if (!pEp->hAfd || !CreateIoCompletionPort(pEp->hAfd, pEp->hPort, 0, 0))
+  {
+    if (pEp->hAfd)
+      SetErrnoFromWinError(GetLastError());
+    iErr = errno;
+    if (pEp->hAfd)
+      CloseHandle(pEp->hAfd);
+    CloseHandle(pEp->hPort);
+    free(pEp->ppBuckets);
+    free(pEp);
+    errno = iErr;
+    return -1;
+  }
+
+  InitializeCriticalSection(&pEp->cs);
+  pEp->lRefs = 1;
+
+  __win_SetHandleType((intptr_t) pEp->hPort, EPOLL_HANDLE);
+  __win_SetHandleEpoll((intptr_t) pEp->hPort, pEp);
+
+  EnterCriticalSection(&csEpolls);
+  pEp->pNext = pEpolls;
+  pEpolls = pEp;
+  InterlockedIncrement(&lEpolls);
+  LeaveCriticalSection(&csEpolls);
+
+  errno = 0;
+
+  return (intptr_t) pEp->hPort;
+}
+
+/**
+ * @brief Add, modify or remove a descriptor of an epoll instance
+ * @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param event events to watch for and data to report, ignored by
+ *        EPOLL_CTL_DEL
+ * @return 0 on success, -1 on error
+ * @note Only sockets and pipes can be watched (errno = EPERM). Pipes are
+ *       only watched if EPOLLIN is requested and not for writability
+ *       (errno = ENOSYS). EPOLLERR and EPOLLHUP are always reported.
+ * @note Once an EPOLLET descriptor was reported, its events are only
+ *       reported again after a PlibC read, write, accept or connect on it
+ *       failed with EAGAIN. I/O that bypasses PlibC doesn't rearm it.
+ */
+int plibc_epoll_ctl(intptr_t epfd, int op, intptr_t fd,
+  struct epoll_event *event)
+{
+  TEpoll *pEp;
+  TEpollItem *pItem;
+  THandleInfo info;
+  THandleType eType;
+  int iRet;
+
+  if (fd == epfd)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (op != EPOLL_CTL_DEL && !event)
+  {
+    errno = EFAULT;
+    return -1;
+  }
+
+  if (!__win_GetHandleInfo(fd, &info))
+  {
+    info.eType = UNKNOWN_HANDLE;
+    info.pPipe = NULL;
+  }
+  eType = info.eType;
+  if (eType == UNKNOWN_HANDLE)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (eType != SOCKET_HANDLE && eType != PIPE_HANDLE)
+  {
+    errno = EPERM;
+    return -1;
+  }
+  if (op != EPOLL_CTL_DEL && eType == PIPE_HANDLE &&
+    (!__win_CanWaitForPipes() || (event->events & EPOLL_WRITE)))
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  pEp = __win_AcquireEpoll(epfd);
+  if (!pEp)
+    return -1;
+
+  errno = 0;
+  iRet = 0;
+
+  EnterCriticalSection(&pEp->cs);
+
+  pItem = __win_EpollFind(pEp, fd);
+  switch (pEp->bClosed ? 0 : op)
+  {
+    case EPOLL_CTL_ADD:
+      if (pItem)
+      {
+        errno = EEXIST;
+        iRet = -1;
+        break;
+      }
+
+      pItem = (TEpollItem *) __win_Calloc(1, sizeof(TEpollItem));
+      if (!pItem)
+      {
+        errno = ENOMEM;
+        iRet = -1;
+        break;
+      }
+
+      pItem->iFD = fd;
+      pItem->eType = eType;
+      if (eType == SOCKET_HANDLE)
+        pItem->hBase = __win_EpollBaseSocket(fd);
+      pItem->uiEvents = event->events | EPOLLERR | EPOLLHUP;
+      pItem->data = event->data;
+      pItem->bArmed = TRUE;
+      pItem->waiter.iFD = fd;
+      pItem->waiter.bOverlapped = info.pPipe != NULL;
+      pItem->waiter.hPort = pEp->hPort;
+      pItem->waiter.pOverlapped = &pItem->ov;
+      __win_EpollLink(pEp, pItem);
+
+      iRet = __win_EpollSubmit(pEp, pItem);
+      if (iRet == -1)
+      {
+        __win_EpollUnlink(pEp, pItem);
+        free(pItem);
+      }
+      break;
+    case EPOLL_CTL_MOD:
+      if (!pItem)
+      {
+        errno = ENOENT;
+        iRet = -1;
+        break;
+      }
+
+      pItem->uiEvents = event->events | EPOLLERR | EPOLLHUP;
+      pItem->data = event->data;
+      pItem->uiMuted = 0;
+      pItem->bArmed = TRUE;
+      pItem->bRearm = FALSE;
+
+      /* The outstanding request is resubmitted when it completes */
+      if (pItem->bPending && eType == SOCKET_HANDLE &&
+        pItem->ulPendingMask != __win_EpollToAfd(__win_EpollWatched(pItem)))
+        pCancelIoEx(pEp->hAfd, &pItem->ov);
+      else
+        iRet = __win_EpollSubmit(pEp, pItem);
+      break;
+    case EPOLL_CTL_DEL:
+      if (!pItem)
+      {
+        errno = ENOENT;
+        iRet = -1;
+        break;
+      }
+
+      __win_EpollRemove(pEp, pItem);
+      break;
+    case 0:
+      /* Closed by another thread */
+      errno = EBADF;
+      iRet = -1;
+      break;
+    default:
+      errno = EINVAL;
+      iRet = -1;
+      break;
+  }
+
+  LeaveCriticalSection(&pEp->cs);
+  __win_ReleaseEpoll(pEp);
+
+  return iRet;
+}
+
+/**
+ * @brief Wait for events of an epoll instance
+ * @param events receives up to maxevents events
+ * @param timeout in milliseconds, -1 to wait forever
+ * @return number of events, 0 on timeout, -1 on error. errno is EBADF if
+ *         another thread closed epfd meanwhile.
+ */
+int plibc_epoll_wait(intptr_t epfd, struct epoll_event *events,
+  int maxevents, int timeout)
+{
+  TEpoll *pEp;
+  PLIBC_OVERLAPPED_ENTRY *pEntries;
+  ULONG ul, ulMax, ulGot;
+  DWORD dwStart, dwElapsed, dwWait, dwErr;
+  int iRet;
+
+  if (maxevents <= 0 || !events)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pEp = __win_AcquireEpoll(epfd);
+  if (!pEp)
+    return -1;
+
+  ulMax = maxevents < EPOLL_MAX_BATCH ? maxevents : EPOLL_MAX_BATCH;
+  pEntries = (PLIBC_OVERLAPPED_ENTRY *) __win_ScratchAlloc(ulMax *
+    sizeof(PLIBC_OVERLAPPED_ENTRY));
+  if (!pEntries)
+  {
+    __win_ReleaseEpoll(pEp);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  errno = 0;
+  dwStart = GetTickCount();
+
+  /* Descriptors reported by the last call */
+  EnterCriticalSection(&pEp->cs);
+  iRet = pEp->bClosed ? 0 : __win_EpollUpdate(pEp, events, maxevents);
+  LeaveCriticalSection(&pEp->cs);
+
+  while (!iRet)
+  {
+    if (timeout < 0)
+      dwWait = INFINITE;
+    else
+    {
+      dwElapsed = GetTickCount() - dwStart;
+      dwWait = dwElapsed >= (DWORD) timeout ? 0 : timeout - dwElapsed;
+    }
+
+    if (!pGetQueuedCompletionStatusEx(pEp->hPort, pEntries, ulMax, &ulGot,
+      dwWait, FALSE))
+    {
+      dwErr = GetLastError();
+      if (dwErr != WAIT_TIMEOUT)
+      {
+        SetErrnoFromWinError(dwErr);
+        iRet = -1;
+      }
+      break;
+    }
+
+    /* Every completion yields at most one event */
+    EnterCriticalSection(&pEp->cs);
+    for (ul = 0; ul < ulGot; ul++)
+    {
+      if (pEntries[ul].lpOverlapped)
+        iRet += __win_EpollComplete(pEp, CONTAINING_RECORD(
+          pEntries[ul].lpOverlapped, TEpollItem, ov), &events[iRet]);
+    }
+
+    /* Closed items don't yield events, so this is all or nothing */
+    if (pEp->bClosed)
+    {
+      errno = EBADF;
+      iRet = -1;
+    }
+    LeaveCriticalSection(&pEp->cs);
+
+    if (iRet == -1)
+      PostQueuedCompletionStatus(pEp->hPort, 0, 0, NULL);
+  }
+
+  __win_ScratchFree(pEntries);
+  __win_ReleaseEpoll(pEp);
+
+  return iRet;
+}
+
+/* end of epoll.c */
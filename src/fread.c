@@ -24,26 +24,108 @@
 
 #include "plibc_private.h"
 
+/* Largest ReadFile() request */
+#define FREAD_CHUNK (1024 * 1024 * 1024)
+
+#ifndef _UCRT
+/**
+ * @brief Check whether a stream is read and written without translation
+ * @internal
+ * @note The MSVCRT keeps the text mode flag with the descriptor, the
+ *       FILE doesn't know about it
+ */
+BOOL __win_IsBinaryStream(FILE *stream)
+{
+  int fd, iMode;
+
+  fd = fileno(stream);
+  iMode = _setmode(fd, _O_BINARY);
+  if (iMode == -1)
+    return FALSE;
+  if (iMode != _O_BINARY)
+    _setmode(fd, iMode);
+
+  return iMode == _O_BINARY;
+}
+#endif
+
 /**
  * @brief Reads data from a stream
+ * @note Requests of at least the size of the stream's buffer on binary
+ *       streams bypass the buffer: data already buffered in the stream is
+ *       consumed first, the rest is read directly into the caller's buffer,
+ *       in chunks of up to 1 GiB. Only whole items are counted.
+ *       Smaller requests and text mode streams, which need CR-LF and ^Z
+ *       translation, go through the CRT's fread().
+ *       The buffer of the stream is accessed through the fields of the
+ *       MSVCRT's FILE. The UCRT's FILE is opaque, so UCRT builds call the
+ *       CRT's fread(), which reads large requests directly as well.
  */
 size_t _win_fread( void *buffer, size_t size, size_t count, FILE *stream )
 {
-  DWORD dwRead;
-  int iItemsRead;
-  void *pDest = buffer;
+#ifdef _UCRT
+  return fread(buffer, size, count, stream);
+#else
+  size_t nTotal, nDone, nBuf;
+  char *pDest = (char *) buffer;
+  HANDLE hFile;
 
-  for(iItemsRead = 0; iItemsRead < count; iItemsRead++)
+  if (!size || !count)
+    return 0;
+  if (count > (size_t) -1 / size)
   {
-    if (!ReadFile((HANDLE) _get_osfhandle(fileno(stream)), pDest, size,
-                  &dwRead, NULL))
-      break;
-    pDest += size;
+    errno = EINVAL;
+    return 0;
+  }
+  nTotal = size * count;
+
+  nBuf = stream->_bufsiz > 0 ? (size_t) stream->_bufsiz : BUFSIZ;
+  if (nTotal < nBuf || !__win_IsBinaryStream(stream))
+    return fread(buffer, size, count, stream);
+
+  nDone = 0;
+
+  /* Data the CRT has already read ahead */
+  if (stream->_cnt > 0)
+  {
+    nDone = (size_t) stream->_cnt;
+    if (nDone > nTotal)
+      nDone = nTotal;
+    memcpy(pDest, stream->_ptr, nDone);
+    stream->_ptr += nDone;
+    stream->_cnt -= (int) nDone;
   }
 
-  SetErrnoFromWinError(GetLastError());
+  hFile = (HANDLE) _get_osfhandle(fileno(stream));
+  while (nDone < nTotal)
+  {
+    DWORD dwChunk, dwRead;
+
+    dwChunk = (nTotal - nDone > FREAD_CHUNK) ? FREAD_CHUNK : nTotal - nDone;
+    if (!ReadFile(hFile, pDest + nDone, dwChunk, &dwRead, NULL))
+    {
+      DWORD dwErr = GetLastError();
+
+      /* Writer closed the pipe */
+      if (dwErr == ERROR_BROKEN_PIPE || dwErr == ERROR_HANDLE_EOF)
+        stream->_flag |= _IOEOF;
+      else
+      {
+        stream->_flag |= _IOERR;
+        SetErrnoFromWinError(dwErr);
+      }
+      break;
+    }
+    if (!dwRead)
+    {
+      stream->_flag |= _IOEOF;
+      break;
+    }
+    nDone += dwRead;
+  }
 
-  return iItemsRead;
+  return nDone / size;
+#endif
 }
 
 /* end of fread.c */
@@ -24,18 +24,71 @@
 
 #include "plibc_private.h"
 
+/* Largest WriteFile() request */
+#define FWRITE_CHUNK (1024 * 1024 * 1024)
+
 /**
  * @brief Writes data to a stream
+ * @note Requests of at least the size of the stream's buffer on binary
+ *       streams bypass the buffer: data buffered in the stream is flushed
+ *       first so that the order is kept, the caller's buffer is then written
+ *       directly, in chunks of up to 1 GiB. Only whole items are counted.
+ *       Smaller requests and text mode streams go through the CRT's
+ *       fwrite().
+ *       Errors are flagged in the MSVCRT's FILE. The UCRT's FILE is opaque,
+ *       so UCRT builds call the CRT's fwrite(), which writes large requests
+ *       directly as well.
  */
 size_t _win_fwrite(const void *buffer, size_t size, size_t count, FILE *stream)
 {
-  DWORD dwWritten;
+#ifdef _UCRT
+  return fwrite(buffer, size, count, stream);
+#else
+  size_t nTotal, nDone, nBuf;
+  const char *pSrc = (const char *) buffer;
+  HANDLE hFile;
+
+  if (!size || !count)
+    return 0;
+  if (count > (size_t) -1 / size)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  nTotal = size * count;
+
+  nBuf = stream->_bufsiz > 0 ? (size_t) stream->_bufsiz : BUFSIZ;
+  if (nTotal < nBuf || !__win_IsBinaryStream(stream))
+    return fwrite(buffer, size, count, stream);
+
+  if (fflush(stream) == EOF)
+    return 0;
+
+  hFile = (HANDLE) _get_osfhandle(fileno(stream));
+  nDone = 0;
+  while (nDone < nTotal)
+  {
+    DWORD dwChunk, dwWritten;
 
-  WriteFile((HANDLE) _get_osfhandle(fileno(stream)), buffer, size, &dwWritten,
-            NULL);
-  SetErrnoFromWinError(GetLastError());
+    dwChunk = (nTotal - nDone > FWRITE_CHUNK) ? FWRITE_CHUNK : nTotal - nDone;
+    if (!WriteFile(hFile, pSrc + nDone, dwChunk, &dwWritten, NULL))
+    {
+      stream->_flag |= _IOERR;
+      SetErrnoFromWinError(GetLastError());
+      break;
+    }
+    if (!dwWritten)
+    {
+      /* Nothing would ever be written */
+      stream->_flag |= _IOERR;
+      errno = EIO;
+      break;
+    }
+    nDone += dwWritten;
+  }
 
-  return dwWritten;
+  return nDone / size;
+#endif
 }
 
 /* end of fwrite.c */
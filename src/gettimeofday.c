@@ -42,4 +42,19 @@ void _win_gettimeofday(struct timeval *tp, void *tzp)
 #endif
 }
 
+/**
+ * @brief Convert a FILETIME to seconds since the Unix epoch
+ * @internal
+ */
+time_t __win_FileTimeToUnix(const FILETIME *pft)
+{
+  ULARGE_INTEGER uli;
+
+  uli.LowPart = pft->dwLowDateTime;
+  uli.HighPart = pft->dwHighDateTime;
+
+  /* 100ns intervals since 1601-01-01 */
+  return (time_t) ((uli.QuadPart - 116444736000000000ULL) / 10000000ULL);
+}
+
 /* end of gettimeofday.c */
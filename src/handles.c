@@ -0,0 +1,547 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/handles.c
+ * @brief Descriptor registry
+ *
+ * Maps CRT descriptors, sockets, pipe and directory handles to their type,
+ * blocking mode, asynchronous write queue, positional I/O handle and, for
+ * directories, epoll descriptors and pipes made by plibc_pipe_ex(), their
+ * path, instance or pipe state. One lookup returns the whole record.
+ * The registry is an open addressing hash table. Writers are serialized by a
+ * critical section and bump a sequence counter around every modification;
+ * readers never lock, they retry if the counter changed while they probed.
+ * Deleted slots are purged in place. Tables replaced by growing are kept
+ * until plibc_shutdown() so that a reader that is still probing an old table
+ * never touches freed memory; as the size doubles every time, they take less
+ * memory than the current table.
+ */
+
+#include "plibc_private.h"
+
+#define HANDLE_TABLE_MIN_SIZE 64
+
+#define HANDLE_SLOT_EMPTY   0
+#define HANDLE_SLOT_USED    1
+#define HANDLE_SLOT_DELETED 2
+
+typedef struct
+{
+  volatile LONG lState;
+  THandleInfo info;
+} THandleSlot;
+
+typedef struct _THandleTable
+{
+  unsigned int uiSize;    /* number of slots, power of 2 */
+  unsigned int uiUsed;    /* live entries */
+  unsigned int uiFilled;  /* live + deleted entries */
+  struct _THandleTable *pRetired;
+  THandleSlot pSlots[1];
+} THandleTable;
+
+static THandleTable * volatile pHandleTable = NULL;
+static volatile LONG lHandleSeq = 0;
+static CRITICAL_SECTION csHandles;
+
+/**
+ * @brief Hash a handle value
+ * @internal
+ * @note Socket and pipe handles are multiples of 4, so the low bits
+ *       carry no information. Fibonacci hashing spreads them anyway.
+ */
+static unsigned int __win_HashHandle(intptr_t dwHandle)
+{
+  return (unsigned int) (((unsigned long long) dwHandle *
+    0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static THandleTable *__win_AllocHandleTable(unsigned int uiSize)
+{
+  THandleTable *pTable;
+
+  pTable = (THandleTable *) __win_Calloc(1, sizeof(THandleTable) +
+    (uiSize - 1) * sizeof(THandleSlot));
+  if (pTable)
+    pTable->uiSize = uiSize;
+
+  return pTable;
+}
+
+/**
+ * @brief Find the slot of a handle
+ * @internal
+ * @return slot index or -1 if the handle isn't registered
+ * @note The probe count is bounded, so this terminates even if the table is
+ *       modified concurrently. The caller has to validate the result.
+ */
+static long __win_FindHandleSlot(THandleTable *pTable, intptr_t dwHandle)
+{
+  unsigned int uiMask, uiIndex, uiProbe;
+
+  uiMask = pTable->uiSize - 1;
+  uiIndex = __win_HashHandle(dwHandle) & uiMask;
+  for (uiProbe = 0; uiProbe < pTable->uiSize; uiProbe++)
+  {
+    THandleSlot *pSlot = &pTable->pSlots[uiIndex];
+
+    if (pSlot->lState == HANDLE_SLOT_EMPTY)
+      break;
+    if (pSlot->lState == HANDLE_SLOT_USED && pSlot->info.dwHandle == dwHandle)
+      return uiIndex;
+    uiIndex = (uiIndex + 1) & uiMask;
+  }
+
+  return -1;
+}
+
+/**
+ * @brief Insert a handle that is known not to be in the table
+ * @internal
+ */
+static THandleInfo *__win_InsertHandleSlot(THandleTable *pTable,
+  intptr_t dwHandle)
+{
+  unsigned int uiMask, uiIndex;
+  THandleSlot *pSlot;
+
+  uiMask = pTable->uiSize - 1;
+  uiIndex = __win_HashHandle(dwHandle) & uiMask;
+  while (pTable->pSlots[uiIndex].lState == HANDLE_SLOT_USED)
+    uiIndex = (uiIndex + 1) & uiMask;
+
+  pSlot = &pTable->pSlots[uiIndex];
+  if (pSlot->lState == HANDLE_SLOT_EMPTY)
+    pTable->uiFilled++;
+  pTable->uiUsed++;
+
+  memset(&pSlot->info, 0, sizeof(THandleInfo));
+  pSlot->info.dwHandle = dwHandle;
+  pSlot->lState = HANDLE_SLOT_USED;
+
+  return &pSlot->info;
+}
+
+/**
+ * @brief Make room for one more entry, growing or purging deleted slots
+ * @internal
+ * @note Must be called with csHandles held, but outside of a sequence
+ *       write section. A grown table is published atomically, a purged one
+ *       is rewritten in place inside a write section.
+ */
+static BOOL __win_ReserveHandleSlot()
+{
+  THandleTable *pOld, *pNew;
+  unsigned int uiSize, uiIndex;
+
+  pOld = pHandleTable;
+  if ((pOld->uiFilled + 1) * 4 <= pOld->uiSize * 3)
+    return TRUE;
+
+  uiSize = pOld->uiSize;
+  if ((pOld->uiUsed + 1) * 2 > uiSize)
+    uiSize *= 2;
+
+  pNew = __win_AllocHandleTable(uiSize);
+  if (!pNew)
+    return FALSE;
+
+  for (uiIndex = 0; uiIndex < pOld->uiSize; uiIndex++)
+  {
+    if (pOld->pSlots[uiIndex].lState == HANDLE_SLOT_USED)
+      *__win_InsertHandleSlot(pNew, pOld->pSlots[uiIndex].info.dwHandle) =
+        pOld->pSlots[uiIndex].info;
+  }
+
+  if (uiSize == pOld->uiSize)
+  {
+    /* Same size, only deleted slots to drop. Readers retry while the slots
+       are copied back and the memory stays valid for them. */
+    InterlockedIncrement(&lHandleSeq);
+    memcpy(pOld->pSlots, pNew->pSlots, uiSize * sizeof(THandleSlot));
+    pOld->uiUsed = pNew->uiUsed;
+    pOld->uiFilled = pNew->uiFilled;
+    InterlockedIncrement(&lHandleSeq);
+
+    free(pNew);
+    return TRUE;
+  }
+  pNew->pRetired = pOld;
+
+  InterlockedIncrement(&lHandleSeq);
+  pHandleTable = pNew;
+  InterlockedIncrement(&lHandleSeq);
+
+  return TRUE;
+}
+
+/**
+ * @brief Set up the descriptor registry
+ * @internal
+ */
+void __win_InitHandleTable()
+{
+  InitializeCriticalSection(&csHandles);
+  pHandleTable = __win_AllocHandleTable(HANDLE_TABLE_MIN_SIZE);
+}
+
+/**
+ * @brief Free the descriptor registry, including retired tables
+ * @internal
+ */
+void __win_FreeHandleTable()
+{
+  THandleTable *pTable;
+  unsigned int uiIndex;
+
+  pTable = pHandleTable;
+  pHandleTable = NULL;
+
+  /* Directories that were never closed */
+  for (uiIndex = 0; pTable && uiIndex < pTable->uiSize; uiIndex++)
+  {
+    if (pTable->pSlots[uiIndex].lState == HANDLE_SLOT_USED)
+      free(pTable->pSlots[uiIndex].info.pwszDirPath);
+  }
+
+  while (pTable)
+  {
+    THandleTable *pRetired = pTable->pRetired;
+
+    free(pTable);
+    pTable = pRetired;
+  }
+  DeleteCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Get the registry entry of a handle without locking
+ * @internal
+ * @param dwHandle handle to look up
+ * @param pInfo receives a consistent copy of the entry
+ * @return TRUE if the handle is registered
+ */
+BOOL __win_GetHandleInfo(intptr_t dwHandle, THandleInfo *pInfo)
+{
+  THandleTable *pTable;
+  LONG lSeq;
+  long lSlot;
+
+  while (TRUE)
+  {
+    lSeq = lHandleSeq;
+    if (lSeq & 1)
+    {
+      /* Writer active */
+      Sleep(0);
+      continue;
+    }
+    MemoryBarrier();
+
+    pTable = pHandleTable;
+    if (!pTable)
+      return FALSE;
+    lSlot = __win_FindHandleSlot(pTable, dwHandle);
+    if (lSlot != -1)
+      *pInfo = pTable->pSlots[lSlot].info;
+
+    MemoryBarrier();
+    if (lHandleSeq == lSeq)
+      return lSlot != -1;
+  }
+}
+
+/**
+ * @brief Get the registry entry of a handle for modification
+ * @internal
+ * @param bCreate add an entry if the handle isn't registered yet
+ * @return the entry or NULL
+ * @note Must be called with csHandles held. The caller modifies the entry
+ *       inside a sequence write section.
+ */
+static THandleInfo *__win_LockedHandleInfo(intptr_t dwHandle, BOOL bCreate)
+{
+  THandleInfo *pInfo;
+  long lSlot;
+
+  lSlot = __win_FindHandleSlot(pHandleTable, dwHandle);
+  if (lSlot != -1)
+    return &pHandleTable->pSlots[lSlot].info;
+
+  if (!bCreate)
+    return NULL;
+
+  if (!__win_ReserveHandleSlot())
+    __plibc_panic(6, "Cannot grow handle table\n");
+
+  InterlockedIncrement(&lHandleSeq);
+  pInfo = __win_InsertHandleSlot(pHandleTable, dwHandle);
+  pInfo->eType = UNKNOWN_HANDLE;
+  pInfo->bBlocking = TRUE;
+  InterlockedIncrement(&lHandleSeq);
+
+  return pInfo;
+}
+
+THandleType __win_GetHandleType(intptr_t dwHandle)
+{
+  THandleInfo info;
+
+  if (!__win_GetHandleInfo(dwHandle, &info))
+    return UNKNOWN_HANDLE;
+
+  return info.eType;
+}
+
+void __win_SetHandleType(intptr_t dwHandle, THandleType eType)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, TRUE);
+  if (pInfo)
+  {
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->eType = eType;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+void __win_DiscardHandleType(intptr_t dwHandle)
+{
+  wchar_t *pwszDirPath = NULL;
+  long lSlot;
+
+  EnterCriticalSection(&csHandles);
+
+  lSlot = __win_FindHandleSlot(pHandleTable, dwHandle);
+  if (lSlot != -1)
+  {
+    pwszDirPath = pHandleTable->pSlots[lSlot].info.pwszDirPath;
+
+    InterlockedIncrement(&lHandleSeq);
+    pHandleTable->pSlots[lSlot].lState = HANDLE_SLOT_DELETED;
+    pHandleTable->uiUsed--;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+
+  free(pwszDirPath);
+}
+
+/**
+ * @brief Check whether a handle is in blocking mode
+ * @note Unregistered handles are blocking
+ */
+BOOL __win_IsHandleMarkedAsBlocking(intptr_t hHandle)
+{
+  THandleInfo info;
+
+  if (!__win_GetHandleInfo(hHandle, &info))
+    return TRUE;
+
+  return info.bBlocking;
+}
+
+/**
+ * @brief Record the blocking mode of a handle
+ */
+void __win_SetHandleBlockingMode(intptr_t s, BOOL bBlocking)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(s, TRUE);
+  if (pInfo)
+  {
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->bBlocking = bBlocking;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Forget the blocking mode of a handle
+ * @note Entries that were only created to hold the blocking mode are removed
+ */
+void __win_DiscardHandleBlockingMode(intptr_t s)
+{
+  long lSlot;
+
+  EnterCriticalSection(&csHandles);
+
+  lSlot = __win_FindHandleSlot(pHandleTable, s);
+  if (lSlot != -1)
+  {
+    THandleSlot *pSlot = &pHandleTable->pSlots[lSlot];
+
+    InterlockedIncrement(&lHandleSeq);
+    if (pSlot->info.eType == UNKNOWN_HANDLE)
+    {
+      pSlot->lState = HANDLE_SLOT_DELETED;
+      pHandleTable->uiUsed--;
+    }
+    else
+      pSlot->info.bBlocking = TRUE;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Attach the asynchronous write queue of a handle
+ * @internal
+ */
+void __win_SetHandleAioQueue(intptr_t dwHandle, TAioQueue *pAio)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, pAio != NULL);
+  if (pInfo)
+  {
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->pAio = pAio;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Attach the positional I/O handle of a descriptor
+ * @internal
+ * @return the handle attached to the descriptor. This is hPositional unless
+ *         another handle was attached before.
+ */
+HANDLE __win_SetHandlePositional(intptr_t dwHandle, HANDLE hPositional)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, FALSE);
+  if (pInfo)
+  {
+    if (!pInfo->hPositional)
+    {
+      InterlockedIncrement(&lHandleSeq);
+      pInfo->hPositional = hPositional;
+      InterlockedIncrement(&lHandleSeq);
+    }
+    hPositional = pInfo->hPositional;
+  }
+
+  LeaveCriticalSection(&csHandles);
+
+  return hPositional;
+}
+
+/**
+ * @brief Attach the path of a directory descriptor
+ * @internal
+ * @param pwszPath absolute Windows path allocated with malloc(), owned by
+ *        the registry from now on
+ */
+void __win_SetHandleDirPath(intptr_t dwHandle, wchar_t *pwszPath)
+{
+  THandleInfo *pInfo;
+  wchar_t *pwszOld = NULL;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, TRUE);
+  if (pInfo)
+  {
+    pwszOld = pInfo->pwszDirPath;
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->pwszDirPath = pwszPath;
+    InterlockedIncrement(&lHandleSeq);
+  }
+  else
+    pwszOld = pwszPath;
+
+  LeaveCriticalSection(&csHandles);
+
+  free(pwszOld);
+}
+
+/**
+ * @brief Attach the epoll instance behind an EPOLL_HANDLE
+ * @internal
+ */
+void __win_SetHandleEpoll(intptr_t dwHandle, TEpoll *pEpoll)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, pEpoll != NULL);
+  if (pInfo)
+  {
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->pEpoll = pEpoll;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Attach the state of a pipe end created by plibc_pipe_ex()
+ * @internal
+ */
+void __win_SetHandlePipe(intptr_t dwHandle, TPipe *pPipe)
+{
+  THandleInfo *pInfo;
+
+  EnterCriticalSection(&csHandles);
+
+  pInfo = __win_LockedHandleInfo(dwHandle, pPipe != NULL);
+  if (pInfo)
+  {
+    InterlockedIncrement(&lHandleSeq);
+    pInfo->pPipe = pPipe;
+    InterlockedIncrement(&lHandleSeq);
+  }
+
+  LeaveCriticalSection(&csHandles);
+}
+
+/**
+ * @brief Get the number of registered descriptors
+ */
+unsigned plibc_get_handle_count()
+{
+  THandleTable *pTable = pHandleTable;
+
+  return pTable ? pTable->uiUsed : 0;
+}
+
+/* end of handles.c */
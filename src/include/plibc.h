@@ -386,6 +386,17 @@ enum
 #define MS_INVALIDATE   2       /* invalidate the caches */
 #define MS_SYNC         4       /* synchronous memory sync */
 
+/* Scatter/gather I/O */
+#ifndef IOV_MAX
+  #define IOV_MAX 1024
+#endif
+
+struct iovec
+{
+  void *iov_base;   /* start of the buffer */
+  size_t iov_len;   /* size of the buffer */
+};
+
 struct statfs
 {
   long f_type;                  /* type of filesystem (see below) */
@@ -476,6 +487,118 @@ typedef struct
 #define S_IRWXG 0
 #define S_IRWXO 0
 
+/* Reported by lstat() for native symbolic links */
+#ifndef S_IFLNK
+  #define S_IFLNK 0xA000
+#endif
+#ifndef S_ISLNK
+  #define S_ISLNK(m) (((m) & S_IFMT) == S_IFLNK)
+#endif
+
+/* Flags for plibc_init_ex() */
+#define PLIBC_NATIVE_SYMLINKS 1   /* NTFS symbolic links instead of shortcuts */
+
+/* Flags for plibc_pipe_ex() */
+#define PLIBC_PIPE_SYNC_READ 1    /* synchronous read end */
+#define PLIBC_PIPE_SYNC_WRITE 2   /* synchronous write end */
+
+/* Entry types for plibc_readdir_bulk() */
+#ifndef DT_UNKNOWN
+  #define DT_UNKNOWN 0
+  #define DT_FIFO 1
+  #define DT_CHR 2
+  #define DT_DIR 4
+  #define DT_BLK 6
+  #define DT_REG 8
+  #define DT_LNK 10
+  #define DT_SOCK 12
+#endif
+
+/* Directory descriptors for openat() and friends */
+#ifndef O_DIRECTORY
+  #define O_DIRECTORY 0x200000
+#endif
+#define AT_FDCWD -100
+#define AT_SYMLINK_NOFOLLOW 0x100
+#define AT_REMOVEDIR 0x200
+
+/* File tree walks */
+#ifndef FTW_F
+  #define FTW_F 0       /* file */
+  #define FTW_D 1       /* directory, before its entries */
+  #define FTW_DNR 2     /* directory that can't be read */
+  #define FTW_NS 3      /* stat() failed */
+  #define FTW_SL 4      /* symbolic link (FTW_PHYS) */
+  #define FTW_DP 5      /* directory, after its entries (FTW_DEPTH) */
+  #define FTW_SLN 6     /* dangling symbolic link */
+
+  #define FTW_PHYS 1
+  #define FTW_MOUNT 2
+  #define FTW_CHDIR 4
+  #define FTW_DEPTH 8
+
+  struct FTW
+  {
+    int base;
+    int level;
+  };
+#endif
+
+/* poll(), same layout and values as WSAPoll() uses */
+#ifndef POLLIN
+  #define POLLERR 0x0001
+  #define POLLHUP 0x0002
+  #define POLLNVAL 0x0004
+  #define POLLWRNORM 0x0010
+  #define POLLWRBAND 0x0020
+  #define POLLRDNORM 0x0100
+  #define POLLRDBAND 0x0200
+  #define POLLPRI 0x0400
+  #define POLLIN (POLLRDNORM | POLLRDBAND)
+  #define POLLOUT POLLWRNORM
+
+  struct pollfd
+  {
+    SOCKET fd;
+    short events;
+    short revents;
+  };
+#endif
+
+/* plibc_epoll_*() */
+#ifndef EPOLLIN
+  #define EPOLLIN 0x001
+  #define EPOLLPRI 0x002
+  #define EPOLLOUT 0x004
+  #define EPOLLERR 0x008
+  #define EPOLLHUP 0x010
+  #define EPOLLRDNORM 0x040
+  #define EPOLLRDBAND 0x080
+  #define EPOLLWRNORM 0x100
+  #define EPOLLWRBAND 0x200
+  #define EPOLLRDHUP 0x2000
+  #define EPOLLONESHOT (1U << 30)
+  #define EPOLLET (1U << 31)
+
+  #define EPOLL_CTL_ADD 1
+  #define EPOLL_CTL_DEL 2
+  #define EPOLL_CTL_MOD 3
+
+  typedef union epoll_data
+  {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+  } epoll_data_t;
+
+  struct epoll_event
+  {
+    uint32_t events;
+    epoll_data_t data;
+  };
+#endif
+
 #define SHUT_WR SD_SEND
 #define SHUT_RD SD_RECEIVE
 #define SHUT_RDWR SD_BOTH
@@ -508,9 +631,41 @@ int plibc_conv_to_win_pathw(const wchar_t *pszUnix, wchar_t *pwszWindows, size_t
 
 int plibc_conv_to_win_pathwconv(const char *pszUnix, wchar_t *pwszWindows, size_t pszWindows_buff_length);
 int plibc_conv_to_win_pathwconv_ex(const char *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks);
+int plibc_conv_to_win_path_long(const char *pszUnix, wchar_t **ppwszWindows, int derefLinks);
 
 unsigned plibc_get_handle_count();
 
+struct plibc_path_cache_stats
+{
+  unsigned long hits;           /* translations served from the cache */
+  unsigned long misses;         /* translations computed */
+  unsigned long entries;        /* cached translations */
+  unsigned long generation;     /* bumped on every invalidation */
+};
+void plibc_get_path_cache_stats(struct plibc_path_cache_stats *pStats);
+void plibc_invalidate_path_cache();
+/* Heap allocations made by PlibC itself, not by the CRT or Windows */
+unsigned long plibc_get_alloc_count();
+int plibc_mount(const char *pszPosix, const char *pszWindows);
+
+struct plibc_stat_cache_stats
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long invalidations;  /* directory changes and flushes */
+  unsigned long entries;
+  unsigned long watches;        /* watched directories */
+};
+
+int plibc_stat_cache_enable(unsigned int uiEntries, unsigned int uiTTL);
+void plibc_stat_cache_disable();
+void plibc_stat_cache_flush();
+void plibc_stat_cache_stats(struct plibc_stat_cache_stats *pStats);
+void plibc_get_aio_thread_count(unsigned *puiThreads, unsigned *puiPeak);
+
+typedef void (*TFreeProc) (void *);
+int plibc_write_owned(int fildes, void *buf, size_t nbyte, TFreeProc free_fn);
+
 typedef void (*TPanicProc) (int, char *);
 void plibc_set_panic_proc(TPanicProc proc);
 
@@ -535,6 +690,7 @@ struct tm *gmtime_r(const time_t *clock, struct tm *result);
 
 int plibc_init(char *pszOrg, char *pszApp);
 int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode);
+int plibc_init_ex(char *pszOrg, char *pszApp, int utf8_mode, int flags);
 void plibc_shutdown();
 int plibc_initialized();
 
@@ -548,6 +704,44 @@ int _win_fclose(FILE *);
 DIR *_win_opendir(const char *dirname);
 struct dirent *_win_readdir(DIR *dirp);
 int _win_closedir(DIR *dirp);
+void _win_rewinddir(DIR *dirp);
+long _win_telldir(DIR *dirp);
+void _win_seekdir(DIR *dirp, long loc);
+
+struct plibc_dirent
+{
+  unsigned char d_type;         /* DT_* */
+  unsigned long d_attributes;   /* FILE_ATTRIBUTE_* */
+  int64_t d_size;
+  time_t d_mtime;
+  unsigned short d_namlen;
+  char d_name[FILENAME_MAX * 3];  /* UTF-8 in UTF-8 mode */
+};
+int plibc_readdir_bulk(DIR *dirp, struct plibc_dirent *entries, int count);
+
+struct plibc_walk_options
+{
+  int flags;                    /* FTW_* */
+  unsigned int threads;         /* 0 or 1 for a serial walk */
+  unsigned int queue_limit;     /* directories queued per thread, 0: default */
+  int sorted;                   /* deliver entries ordered by name */
+};
+typedef int (*TWalkProc) (const char *path, const struct _stat *sb, int type,
+  struct FTW *ftwbuf, void *cls);
+typedef int (*TNftwProc) (const char *path, const struct _stat *sb, int type,
+  struct FTW *ftwbuf);
+int plibc_walk(const char *path, const struct plibc_walk_options *options,
+  TWalkProc fn, void *cls);
+int _win_nftw(const char *path, TNftwProc fn, int fd_limit, int flags);
+/* EPOLLET descriptors are only reported again after a PlibC read, write,
+   accept or connect failed with EAGAIN, not after I/O that bypasses PlibC.
+   Closing the epoll descriptor makes plibc_epoll_wait() in other threads
+   fail with EBADF. */
+intptr_t plibc_epoll_create(int size);
+int plibc_epoll_ctl(intptr_t epfd, int op, intptr_t fd,
+  struct epoll_event *event);
+int plibc_epoll_wait(intptr_t epfd, struct epoll_event *events,
+  int maxevents, int timeout);
 int _win_open(const char *filename, int oflag, ...);
 #ifdef ENABLE_NLS
 char *_win_bindtextdomain(const char *domainname, const char *dirname);
@@ -563,6 +757,7 @@ int _win_ftruncate(int fildes, off_t length);
 void _win_gettimeofday(struct timeval *tp, void *tzp);
 int _win_kill(pid_t pid, int sig);
 int _win_pipe(intptr_t *phandles);
+int plibc_pipe_ex(intptr_t *phandles, unsigned long size, int flags);
 intptr_t _win_mkfifo(const char *path, mode_t mode);
 int _win_rmdir(const char *path);
 int _win_access( const char *path, int mode );
@@ -578,6 +773,14 @@ long _win_sysconf(int name);
 int _win_unlink(const char *filename);
 int _win_write(int fildes, const void *buf, size_t nbyte);
 int _win_read(int fildes, void *buf, size_t nbyte);
+int _win_pread(int fildes, void *buf, size_t nbyte, off_t offset);
+int _win_pwrite(int fildes, const void *buf, size_t nbyte, off_t offset);
+int _win_pread64(int fildes, void *buf, size_t nbyte, int64_t offset);
+int _win_pwrite64(int fildes, const void *buf, size_t nbyte, int64_t offset);
+int _win_readv(int fildes, const struct iovec *iov, int iovcnt);
+int _win_writev(int fildes, const struct iovec *iov, int iovcnt);
+int _win_preadv(int fildes, const struct iovec *iov, int iovcnt, off_t offset);
+int _win_pwritev(int fildes, const struct iovec *iov, int iovcnt, off_t offset);
 size_t _win_fwrite(const void *buffer, size_t size, size_t count, FILE *stream);
 size_t _win_fread( void *buffer, size_t size, size_t count, FILE *stream );
 int _win_symlink(const char *path1, const char *path2);
@@ -588,6 +791,11 @@ int _win_munmap(void *start, size_t length);
 int _win_lstat(const char *path, struct _stat *buf);
 int _win_lstat64(const char *path, struct stat64 *buf);
 int _win_readlink(const char *path, char *buf, size_t bufsize);
+int _win_openat(int dirfd, const char *path, int oflag, ...);
+int _win_fstatat(int dirfd, const char *path, struct _stat *buf, int flag);
+int _win_mkdirat(int dirfd, const char *path, mode_t mode);
+int _win_unlinkat(int dirfd, const char *path, int flag);
+DIR *_win_fdopendir(int fd);
 
 int _win_printf(const char *format,...);
 int _win_wprintf(const wchar_t *format, ...);
@@ -645,6 +853,7 @@ int _win_listen(intptr_t s, int backlog);
 int _win_recv(intptr_t s, char *buf, int len, int flags);
 int _win_recvfrom(intptr_t s, void *buf, int len, int flags,
              struct sockaddr *from, int *fromlen);
+int _win_poll(struct pollfd *fds, unsigned long nfds, int timeout);
 int _win_select(int max_fd, fd_set * rfds, fd_set * wfds, fd_set * efds,
                 const struct timeval *tv);
 int _win_send(intptr_t s, const char *buf, int len, int flags);
@@ -699,6 +908,9 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define OPENDIR(d) opendir(d)
  #define CLOSEDIR(d) closedir(d)
  #define READDIR(d) readdir(d)
+ #define REWINDDIR(d) rewinddir(d)
+ #define TELLDIR(d) telldir(d)
+ #define SEEKDIR(d, l) seekdir(d, l)
  #define OPEN open
  #define CHDIR(d) chdir(d)
  #define CLOSE(f) close(f)
@@ -717,6 +929,14 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define UNLINK(f) unlink(f)
  #define WRITE(f, b, n) write(f, b, n)
  #define READ(f, b, n) read(f, b, n)
+ #define PREAD(f, b, n, o) pread(f, b, n, o)
+ #define PWRITE(f, b, n, o) pwrite(f, b, n, o)
+ #define PREAD64(f, b, n, o) pread64(f, b, n, o)
+ #define PWRITE64(f, b, n, o) pwrite64(f, b, n, o)
+ #define READV(f, v, c) readv(f, v, c)
+ #define WRITEV(f, v, c) writev(f, v, c)
+ #define PREADV(f, v, c, o) preadv(f, v, c, o)
+ #define PWRITEV(f, v, c, o) pwritev(f, v, c, o)
  #define GN_FREAD(b, s, c, f) fread(b, s, c, f)
  #define GN_FWRITE(b, s, c, f) fwrite(b, s, c, f)
  #define SYMLINK(a, b) symlink(a, b)
@@ -730,6 +950,12 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define READLINK(p, b, s) readlink(p, b, s)
  #define LSTAT(p, b) lstat(p, b)
  #define LSTAT64(p, b) lstat64(p, b)
+ #define OPENAT openat
+ #define FSTATAT(d, p, b, f) fstatat(d, p, b, f)
+ #define MKDIRAT(d, p, m) mkdirat(d, p, m)
+ #define UNLINKAT(d, p, f) unlinkat(d, p, f)
+ #define FDOPENDIR(f) fdopendir(f)
+ #define NFTW(p, f, d, fl) nftw(p, f, d, fl)
  #define PRINTF printf
  #define FPRINTF fprintf
  #define VPRINTF(f, a) vprintf(f, a)
@@ -754,6 +980,7 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define LISTEN(s, b) listen(s, b)
  #define RECV(s, b, l, f) recv(s, b, l, f)
  #define RECVFROM(s, b, l, f, r, o) recvfrom(s, b, l, f, r, o)
+ #define POLL(f, n, t) poll(f, n, t)
  #define SELECT(n, r, w, e, t) select(n, r, w, e, t)
  #define SEND(s, b, l, f) send(s, b, l, f)
  #define SENDTO(s, b, l, f, o, n) sendto(s, b, l, f, o, n)
@@ -797,6 +1024,9 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define OPENDIR(d) _win_opendir(d)
  #define CLOSEDIR(d) _win_closedir(d)
  #define READDIR(d) _win_readdir(d)
+ #define REWINDDIR(d) _win_rewinddir(d)
+ #define TELLDIR(d) _win_telldir(d)
+ #define SEEKDIR(d, l) _win_seekdir(d, l)
  #define OPEN _win_open
  #define CHDIR(d) _win_chdir(d)
  #define CLOSE(f) _win_close(f)
@@ -817,6 +1047,14 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define UNLINK(f) _win_unlink(f)
  #define WRITE(f, b, n) _win_write(f, b, n)
  #define READ(f, b, n) _win_read(f, b, n)
+ #define PREAD(f, b, n, o) _win_pread(f, b, n, o)
+ #define PWRITE(f, b, n, o) _win_pwrite(f, b, n, o)
+ #define PREAD64(f, b, n, o) _win_pread64(f, b, n, o)
+ #define PWRITE64(f, b, n, o) _win_pwrite64(f, b, n, o)
+ #define READV(f, v, c) _win_readv(f, v, c)
+ #define WRITEV(f, v, c) _win_writev(f, v, c)
+ #define PREADV(f, v, c, o) _win_preadv(f, v, c, o)
+ #define PWRITEV(f, v, c, o) _win_pwritev(f, v, c, o)
  #define GN_FREAD(b, s, c, f) _win_fread(b, s, c, f)
  #define GN_FWRITE(b, s, c, f) _win_fwrite(b, s, c, f)
  #define SYMLINK(a, b) _win_symlink(a, b)
@@ -828,6 +1066,12 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define READLINK(p, b, s) _win_readlink(p, b, s)
  #define LSTAT(p, b) _win_lstat(p, b)
  #define LSTAT64(p, b) _win_lstat64(p, b)
+ #define OPENAT _win_openat
+ #define FSTATAT(d, p, b, f) _win_fstatat(d, p, b, f)
+ #define MKDIRAT(d, p, m) _win_mkdirat(d, p, m)
+ #define UNLINKAT(d, p, f) _win_unlinkat(d, p, f)
+ #define FDOPENDIR(f) _win_fdopendir(f)
+ #define NFTW(p, f, d, fl) _win_nftw(p, f, d, fl)
  #define PRINTF(f, ...) _win_printf(f , __VA_ARGS__)
  #define FPRINTF(fil, fmt, ...) _win_fprintf(fil, fmt, __VA_ARGS__)
  #define VPRINTF(f, a) _win_vprintf(f, a)
@@ -852,6 +1096,7 @@ char *strcasestr(const char *haystack_start, const char *needle_start);
  #define LISTEN(s, b) _win_listen(s, b)
  #define RECV(s, b, l, f) _win_recv(s, b, l, f)
  #define RECVFROM(s, b, l, f, r, o) _win_recvfrom(s, b, l, f, r, o)
+ #define POLL(f, n, t) _win_poll(f, n, t)
  #define SELECT(n, r, w, e, t) _win_select(n, r, w, e, t)
  #define SEND(s, b, l, f) _win_send(s, b, l, f)
  #define SENDTO(s, b, l, f, o, n) _win_sendto(s, b, l, f, o, n)
@@ -0,0 +1,56 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file include/plibc_lnkparse.h
+ * @brief Parser for shell link (.lnk) files
+ * @internal
+ *
+ * The parser only works on bytes and doesn't depend on Windows, so that it
+ * can be tested and fuzzed on any platform (see contrib/test).
+ */
+
+#ifndef _PLIBC_LNKPARSE_H_
+#define _PLIBC_LNKPARSE_H_
+
+#include <stddef.h>
+#include <wchar.h>
+
+#define LNK_READ_SIZE 4096
+#define LNK_NONE      0
+#define LNK_TARGET    1
+#define LNK_UNKNOWN   2
+
+/**
+ * @brief Convert an ANSI string from a shell link
+ * @param pszAnsi string, not NUL terminated
+ * @param nLen number of bytes in pszAnsi
+ * @param pwszDest receives the characters, not NUL terminated
+ * @param nDestLen size of pwszDest in characters
+ * @return number of characters stored, 0 on error
+ */
+typedef size_t (*TLnkAnsiProc)(const char *pszAnsi, size_t nLen,
+  wchar_t *pwszDest, size_t nDestLen);
+
+int __win_ParseShortcut(const unsigned char *pData, size_t nLen,
+  wchar_t *pwszTarget, size_t nTargetLen, TLnkAnsiProc pAnsiProc);
+
+#endif //_PLIBC_LNKPARSE_H_
+
+/* end of plibc_lnkparse.h */
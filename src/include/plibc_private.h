@@ -54,31 +54,35 @@ typedef struct {
   HANDLE hFile;
 } TMapping;
 
-typedef struct
-{
-  SOCKET s;
-  BOOL bBlocking;
-} Winsock;
-extern Winsock *pSocks;
-extern unsigned int uiSockCount;
-extern HANDLE hSocksLock;
 extern TPanicProc __plibc_panic;
 
+typedef int (*TStat64) (const char *path, struct stat64 *buffer);
+typedef int (*TWStat64) (const wchar_t *path, struct stat64 *buffer);
+
+typedef enum {UNKNOWN_HANDLE, SOCKET_HANDLE, PIPE_HANDLE, FD_HANDLE,
+  DIR_HANDLE, EPOLL_HANDLE} THandleType;
+
+typedef struct _TAioQueue TAioQueue;
+typedef struct _TEpoll TEpoll;
+typedef struct _TPipe TPipe;
+
 typedef struct
 {
   intptr_t fildes;
+  THandleType eType;
   void *buf;
   size_t nbyte;
 } TReadWriteInfo;
-
-typedef int (*TStat64) (const char *path, struct stat64 *buffer);
-typedef int (*TWStat64) (const wchar_t *path, struct stat64 *buffer);
-
-typedef enum {UNKNOWN_HANDLE, SOCKET_HANDLE, PIPE_HANDLE, FD_HANDLE} THandleType;
 typedef struct
 {
   intptr_t dwHandle;
   THandleType eType;
+  BOOL bBlocking;
+  TAioQueue *pAio;
+  HANDLE hPositional;
+  wchar_t *pwszDirPath;   /* absolute path of a DIR_HANDLE */
+  TEpoll *pEpoll;         /* instance behind an EPOLL_HANDLE */
+  TPipe *pPipe;           /* overlapped end made by plibc_pipe_ex() */
 } THandleInfo;
 
 extern TStat64 _plibc_stat64;
@@ -87,23 +91,186 @@ extern TWStat64 _plibc_wstat64;
 struct plibc_WDIR
 {
   struct plibc_WDIR *self;
-  _WDIR *mingw_wdir;
+  HANDLE hFind;           /* INVALID_HANDLE_VALUE if the directory is empty */
+  WIN32_FIND_DATAW findData;
+  BOOL bHaveEntry;        /* findData holds an entry not returned yet */
+  int iError;             /* errno to report by the next read */
   struct dirent udirent;
+  intptr_t dirfd;         /* closed by closedir(), -1 if none */
+  long lPos;              /* entries returned, see telldir() */
+  wchar_t *pwszPattern;   /* dir\*, szPattern or allocated */
+  wchar_t szPattern[_MAX_PATH + 3];
 };
 
 extern int _plibc_utf8_mode;
+extern int _plibc_native_symlinks;
 
+void __win_InitHandleTable();
+void __win_FreeHandleTable();
+BOOL __win_GetHandleInfo(intptr_t dwHandle, THandleInfo *pInfo);
 THandleType __win_GetHandleType(intptr_t dwHandle);
 void __win_SetHandleType(intptr_t dwHandle, THandleType eType);
 void __win_DiscardHandleType(intptr_t dwHandle);
+void __win_SetHandleAioQueue(intptr_t dwHandle, TAioQueue *pAio);
+HANDLE __win_SetHandlePositional(intptr_t dwHandle, HANDLE hPositional);
+void __win_SetHandleDirPath(intptr_t dwHandle, wchar_t *pwszPath);
+void __win_SetHandleEpoll(intptr_t dwHandle, TEpoll *pEpoll);
+void __win_SetHandlePipe(intptr_t dwHandle, TPipe *pPipe);
+
+int __win_Read(TReadWriteInfo *pInfo);
+int __win_Write(TReadWriteInfo *pInfo);
+
+#ifndef _UCRT
+BOOL __win_IsBinaryStream(FILE *stream);
+#endif
+
+#define IOV_STACK_BUFS 16
+
+int __win_GetIovLength(const struct iovec *iov, int iovcnt, size_t *pnTotal);
+LPWSABUF __win_IovToWSABuf(const struct iovec *iov, int iovcnt,
+  LPWSABUF pStack);
+
+void __win_InitPositionalIO();
+void __win_FreePositionalIO();
+int __win_PositionalIO(int fildes, void *buf, size_t nbyte, int64_t offset,
+  BOOL bWrite);
+
+void __win_InitAio();
+void __win_FreeAio();
+int __win_AioWrite(const THandleInfo *pInfo, const void *buf, size_t nbyte,
+  TFreeProc pFree);
+void __win_AioFlush(const THandleInfo *pInfo);
+void __win_AioClose(intptr_t fildes);
 
 int __win_deref(char *path);
 int __win_derefw(wchar_t *path);
+void __win_InitShortcutCache();
+void __win_FreeShortcutCache();
+void __win_CloseShortcutWatches();
+
+#include "plibc_lnkparse.h"
+
+void __win_InitSymlinks(BOOL bEnable);
+int __win_CreateSymlinkW(const wchar_t *pwszTarget, const wchar_t *pwszLink);
+int __win_ReadSymlinkW(const wchar_t *pwszLink, wchar_t *pwszTarget,
+  size_t nTargetLen);
+int __win_ReadSymlink(const char *pszLink, char *pszTarget, size_t nTargetLen);
+int __win_ResolveSymlinkW(wchar_t *pwszPath, size_t nLen);
+int __win_ResolveSymlink(char *pszPath, size_t nLen);
+
+void __win_InitPipes();
+int __win_PipeRead(const THandleInfo *pInfo, void *buf, size_t nbyte);
+int __win_PipeWrite(const THandleInfo *pInfo, const void *buf, size_t nbyte);
+HANDLE __win_GetPipeWriteEvent(const THandleInfo *pInfo);
+short __win_PipeWritable(const THandleInfo *pInfo);
+void __win_PipeClose(const THandleInfo *pInfo);
+
+/* Thread that waits for data in a pipe */
+typedef struct
+{
+  intptr_t iFD;
+  BOOL bOverlapped;           /* made by plibc_pipe_ex() */
+  OVERLAPPED ovRead;
+  HANDLE hThread;
+  HANDLE hReady;
+  HANDLE hPort;               /* completion port to notify, or NULL */
+  LPOVERLAPPED pOverlapped;
+  volatile LONG lStop;
+} TPipeWaiter;
+
+void __win_InitSelect();
+BOOL __win_CanWaitForPipes();
+void __win_StartPipeWaiter(TPipeWaiter *pWaiter);
+BOOL __win_StopPipeWaiter(TPipeWaiter *pWaiter);
+void __win_UnbindSocketEvent(intptr_t s);
+void __win_InitPoll();
+
+void __win_InitEpoll();
+void __win_FreeEpoll();
+int __win_EpollClose(intptr_t epfd);
+void __win_EpollForget(intptr_t fd);
+void __win_EpollRearm(intptr_t fd);
+
+void __win_InitDirFds();
+int __win_OpenDirFd(const void *pPath, BOOL bWide, int oflag);
+void __win_InitDirStreams();
+void __win_FreeDirStreams();
+struct plibc_WDIR *__win_OpenDirStreamW(const wchar_t *pwszDir);
+struct plibc_WDIR *__win_OpenDirStream(const void *pDir);
+void __win_ReleaseDirStream(struct plibc_WDIR *pwd);
+DWORD __win_RestartDirStream(struct plibc_WDIR *pwd);
+BOOL __win_NextDirEntry(struct plibc_WDIR *pwd);
+
+void __win_InitScratch();
+void __win_FreeScratch();
+void *__win_ScratchAlloc(size_t nSize);
+void __win_ScratchFree(void *pMem);
+void *__win_Malloc(size_t nSize);
+void *__win_Calloc(size_t nCount, size_t nSize);
+void *__win_Realloc(void *pMem, size_t nSize);
+char *__win_StrDup(const char *pszSrc);
+wchar_t *__win_WcsDup(const wchar_t *pwszSrc);
+
+#include "plibc_utf8.h"
+int __win_Utf16ToUtf8(const wchar_t *pwszSrc, char *pszDest, size_t nDestLen);
+int __win_Utf8ToUtf16(const char *pszSrc, wchar_t *pwszDest, size_t nDestLen);
+int __win_Utf16ToLocal(const wchar_t *pwszSrc, char *pszDest,
+  size_t nDestLen);
+
+time_t __win_FileTimeToUnix(const FILETIME *pft);
+unsigned short __win_AttributesToMode(DWORD dwAttributes,
+  const wchar_t *pwszName);
 
 long _plibc_DetermineRootDir(void);
 long _plibc_DetermineProgramDataDir(void);
 long _plibc_DetermineHomeDir(void);
 
+typedef struct
+{
+  wchar_t *pwszPosix, *pwszWindows;
+  char *pszPosix, *pszWindows;
+  long lPosixLenW, lWindowsLenW;
+  long lPosixLen, lWindowsLen;
+  BOOL bBoundary;
+} TMount;
+
+void __win_InitMounts();
+void __win_FreeMounts();
+const TMount *__win_FindMount(const void *pPath, BOOL bWide);
+
+#define PATH_CACHE_DEREF 1
+#define PATH_CACHE_WIDE  2
+
+void __win_InitPathCache();
+void __win_FreePathCache();
+void __win_InvalidatePathCache();
+LONG __win_GetPathCacheGeneration();
+BOOL __win_PathCacheLookup(int iKind, const void *pKey, size_t nKeyLen,
+  void *pDest, size_t nDestLen, LONG *plGeneration);
+void __win_PathCacheInsert(int iKind, const void *pKey, size_t nKeyLen,
+  const void *pValue, size_t nValueLen, LONG lGeneration);
+
+#define STAT_CACHE_WIDE  1
+#define STAT_CACHE_64    2
+#define STAT_CACHE_LSTAT 4
+
+typedef struct
+{
+  BOOL bCache;
+  LONG lGeneration;
+  int iWatch;
+  LONG lEpoch;
+} TStatCacheTicket;
+
+void __win_InitStatCache();
+void __win_FreeStatCache();
+void __win_CloseStatCacheWatches();
+BOOL __win_StatCacheLookup(int iKind, const void *pKey, size_t nKeyLen,
+  void *pStat, size_t nStatLen, int *piRet, TStatCacheTicket *pTicket);
+void __win_StatCacheInsert(const TStatCacheTicket *pTicket, int iKind,
+  const void *pKey, size_t nKeyLen, const void *pStat, size_t nStatLen,
+  int iRet);
+
 int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszWindows_buff_length, int derefLinks);
 int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks);
 
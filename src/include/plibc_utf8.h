@@ -0,0 +1,42 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file include/plibc_utf8.h
+ * @brief UTF-8 <-> UTF-16 conversion
+ * @internal
+ *
+ * The converters work on UTF-16 code units rather than wchar_t, so that
+ * they can be tested and benchmarked on any platform (see contrib/test).
+ */
+
+#ifndef _PLIBC_UTF8_H_
+#define _PLIBC_UTF8_H_
+
+#include <stddef.h>
+
+void __win_InitTranscoder();
+int __win_Utf16ToUtf8N(const unsigned short *pSrc, size_t nSrcLen,
+  char *pszDest, size_t nDestLen);
+int __win_Utf8ToUtf16N(const char *pszSrc, size_t nSrcLen,
+  unsigned short *pDest, size_t nDestLen);
+
+#endif //_PLIBC_UTF8_H_
+
+/* end of plibc_utf8.h */
@@ -0,0 +1,244 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/lnkparse.c
+ * @brief Parser for shell link (.lnk) files
+ *
+ * Reads the target of a shortcut from the ShellLinkHeader and the LinkInfo
+ * structure as described in [MS-SHLLINK]. This is what
+ * IShellLinkW::GetPath() returns for links to files, but it doesn't need
+ * COM. The parser only looks at the bytes it is given, links it can't
+ * handle (targets given by an item ID list or environment variables only)
+ * are left to the shell.
+ * This file must not depend on Windows, contrib/test builds it on other
+ * platforms for unit tests and fuzzing.
+ */
+
+#include <string.h>
+
+#include "plibc_lnkparse.h"
+
+#define LNK_HEADER_SIZE               0x4C
+
+/* LinkFlags */
+#define LNK_HAS_TARGET_ID_LIST        0x00000001
+#define LNK_HAS_LINK_INFO             0x00000002
+#define LNK_FORCE_NO_LINK_INFO        0x00000100
+#define LNK_HAS_EXP_STRING            0x00000200
+
+/* LinkInfoFlags */
+#define LNK_VOLUME_ID_AND_LOCAL_BASE  0x00000001
+#define LNK_COMMON_NETWORK_RELATIVE   0x00000002
+
+/* {00021401-0000-0000-C000-000000000046} */
+static const unsigned char abLinkCLSID[16] = {
+  0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+};
+
+static unsigned int __win_LnkWord(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long __win_LnkDword(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+/**
+ * @brief Append a string from the LinkInfo structure to the target
+ * @internal
+ * @param pInfo LinkInfo structure
+ * @param ulInfoLen size of the LinkInfo structure
+ * @param ulOffset offset of the NUL terminated string within pInfo
+ * @param bUnicode 1 if the string consists of UTF-16LE characters
+ * @param pnTarget number of characters in pwszTarget, updated
+ * @param pAnsiProc converts ANSI strings or NULL
+ * @return 0 if the string is malformed or doesn't fit
+ */
+static int __win_LnkAppend(const unsigned char *pInfo, unsigned long ulInfoLen,
+  unsigned long ulOffset, int bUnicode, wchar_t *pwszTarget, size_t *pnTarget,
+  size_t nTargetLen, TLnkAnsiProc pAnsiProc)
+{
+  const unsigned char *p, *pEnd;
+  size_t nLen;
+
+  if (ulOffset >= ulInfoLen)
+    return 0;
+
+  p = pInfo + ulOffset;
+  pEnd = pInfo + ulInfoLen;
+
+  if (bUnicode)
+  {
+    for (nLen = 0; p + 2 * nLen + 1 < pEnd && __win_LnkWord(p + 2 * nLen);
+      nLen++)
+      ;
+    if (p + 2 * nLen + 1 >= pEnd || *pnTarget + nLen >= nTargetLen)
+      return 0;
+
+    while (nLen--)
+    {
+      pwszTarget[(*pnTarget)++] = (wchar_t) __win_LnkWord(p);
+      p += 2;
+    }
+  }
+  else
+  {
+    size_t nConv;
+
+    nLen = 0;
+    while (p + nLen < pEnd && p[nLen])
+      nLen++;
+    if (p + nLen >= pEnd)
+      return 0;
+
+    if (nLen)
+    {
+      /* A destination size of 0 would only query the length */
+      if (!pAnsiProc || *pnTarget + 1 >= nTargetLen)
+        return 0;
+
+      /* The shell writes these in the ANSI code page */
+      nConv = pAnsiProc((const char *) p, nLen, pwszTarget + *pnTarget,
+        nTargetLen - *pnTarget - 1);
+      if (!nConv || nConv > nTargetLen - *pnTarget - 1)
+        return 0;
+      *pnTarget += nConv;
+    }
+  }
+
+  pwszTarget[*pnTarget] = 0;
+
+  return 1;
+}
+
+/**
+ * @brief Get the target of a shortcut from its contents
+ * @internal
+ * @param pData start of the .lnk file
+ * @param nLen number of bytes in pData, may be less than the file size
+ * @param pwszTarget receives the target
+ * @param nTargetLen size of pwszTarget in characters
+ * @param pAnsiProc converts ANSI strings, links that need it are
+ *        LNK_UNKNOWN if NULL
+ * @return LNK_TARGET if pwszTarget holds the target, LNK_NONE if the data
+ *         isn't a shell link, LNK_UNKNOWN if only the shell can tell
+ */
+int __win_ParseShortcut(const unsigned char *pData, size_t nLen,
+  wchar_t *pwszTarget, size_t nTargetLen, TLnkAnsiProc pAnsiProc)
+{
+  const unsigned char *pInfo;
+  unsigned long ulFlags, ulInfoLen, ulInfoHeaderLen, ulInfoFlags, ulOffset,
+    ulSuffix;
+  size_t nPos, nTarget;
+  int bUnicode;
+
+  if (nLen < LNK_HEADER_SIZE || __win_LnkDword(pData) != LNK_HEADER_SIZE ||
+    memcmp(pData + 4, abLinkCLSID, sizeof(abLinkCLSID)) != 0)
+    return LNK_NONE;
+
+  ulFlags = __win_LnkDword(pData + 0x14);
+  if (!(ulFlags & LNK_HAS_LINK_INFO) || (ulFlags & LNK_FORCE_NO_LINK_INFO) ||
+    (ulFlags & LNK_HAS_EXP_STRING))
+    return LNK_UNKNOWN;
+
+  /* Skip the LinkTargetIDList */
+  nPos = LNK_HEADER_SIZE;
+  if (ulFlags & LNK_HAS_TARGET_ID_LIST)
+  {
+    if (nPos + 2 > nLen)
+      return LNK_UNKNOWN;
+    nPos += 2 + __win_LnkWord(pData + nPos);
+  }
+
+  /* LinkInfo */
+  if (nPos + 0x1C > nLen)
+    return LNK_UNKNOWN;
+  pInfo = pData + nPos;
+  ulInfoLen = __win_LnkDword(pInfo);
+  ulInfoHeaderLen = __win_LnkDword(pInfo + 4);
+  ulInfoFlags = __win_LnkDword(pInfo + 8);
+  if (ulInfoLen < 0x1C || ulInfoLen > nLen - nPos || ulInfoHeaderLen < 0x1C ||
+    ulInfoHeaderLen > ulInfoLen)
+    return LNK_UNKNOWN;
+
+  /* Prefer the Unicode strings, if present */
+  bUnicode = ulInfoHeaderLen >= 0x24;
+  nTarget = 0;
+  pwszTarget[0] = 0;
+
+  if (ulInfoFlags & LNK_VOLUME_ID_AND_LOCAL_BASE)
+  {
+    /* LocalBasePath + CommonPathSuffix */
+    ulOffset = __win_LnkDword(pInfo + (bUnicode ? 0x1C : 0x10));
+    ulSuffix = __win_LnkDword(pInfo + (bUnicode ? 0x20 : 0x18));
+    if (!__win_LnkAppend(pInfo, ulInfoLen, ulOffset, bUnicode, pwszTarget,
+        &nTarget, nTargetLen, pAnsiProc) ||
+      !__win_LnkAppend(pInfo, ulInfoLen, ulSuffix, bUnicode, pwszTarget,
+        &nTarget, nTargetLen, pAnsiProc))
+      return LNK_UNKNOWN;
+  }
+  else if (ulInfoFlags & LNK_COMMON_NETWORK_RELATIVE)
+  {
+    const unsigned char *pNet;
+    unsigned long ulNetLen, ulNetName;
+    int bNetUnicode;
+
+    /* NetName + "\" + CommonPathSuffix */
+    ulOffset = __win_LnkDword(pInfo + 0x14);
+    if (ulOffset > ulInfoLen || ulInfoLen - ulOffset < 0x14)
+      return LNK_UNKNOWN;
+    pNet = pInfo + ulOffset;
+    ulNetLen = __win_LnkDword(pNet);
+    if (ulNetLen < 0x14 || ulNetLen > ulInfoLen - ulOffset)
+      return LNK_UNKNOWN;
+
+    ulNetName = __win_LnkDword(pNet + 8);
+    bNetUnicode = ulNetName > 0x14 && ulNetLen >= 0x1C;
+    if (bNetUnicode)
+      ulNetName = __win_LnkDword(pNet + 0x14);
+    if (!__win_LnkAppend(pNet, ulNetLen, ulNetName, bNetUnicode, pwszTarget,
+        &nTarget, nTargetLen, pAnsiProc))
+      return LNK_UNKNOWN;
+
+    ulSuffix = __win_LnkDword(pInfo + (bUnicode ? 0x20 : 0x18));
+    if (ulSuffix >= ulInfoLen)
+      return LNK_UNKNOWN;
+    if ((bUnicode ? ulSuffix + 1 < ulInfoLen && __win_LnkWord(pInfo + ulSuffix) :
+      pInfo[ulSuffix]) && nTarget && pwszTarget[nTarget - 1] != L'\\')
+    {
+      if (nTarget + 1 >= nTargetLen)
+        return LNK_UNKNOWN;
+      pwszTarget[nTarget++] = L'\\';
+      pwszTarget[nTarget] = 0;
+    }
+    if (!__win_LnkAppend(pInfo, ulInfoLen, ulSuffix, bUnicode, pwszTarget,
+        &nTarget, nTargetLen, pAnsiProc))
+      return LNK_UNKNOWN;
+  }
+  else
+    return LNK_UNKNOWN;
+
+  return nTarget ? LNK_TARGET : LNK_UNKNOWN;
+}
+
+/* end of lnkparse.c */
@@ -136,7 +136,7 @@ void *_win_mmap(void *start, size_t len, int access, int flags, int fd,
       if (uiIndex == uiMappingsCount)
       {
         uiMappingsCount++;
-        pMappings = (TMapping *) realloc(pMappings, (uiMappingsCount + 1) * sizeof(TMapping));
+        pMappings = (TMapping *) __win_Realloc(pMappings, (uiMappingsCount + 1) * sizeof(TMapping));
         pMappings[uiMappingsCount].pStart = NULL;
       }
       uiIndex++;
@@ -0,0 +1,474 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/mount.c
+ * @brief Mount table for the path translation
+ *
+ * Maps POSIX path prefixes to Windows directories. The table is compiled
+ * into two prefix tries, one for wide and one for narrow paths, so that
+ * finding the longest matching prefix takes a single walk over the path.
+ * A table is never modified once it has been published. plibc_mount()
+ * builds a new one and swaps the pointer; replaced tables are kept until
+ * plibc_shutdown() because readers don't lock.
+ */
+
+#include "plibc_private.h"
+
+extern wchar_t szRootDir[_MAX_PATH + 1];
+extern wchar_t szHomeDir[_MAX_PATH + 2];
+extern wchar_t szDataDir[_MAX_PATH + 1];
+
+typedef struct
+{
+  unsigned int c;         /* code unit leading to this node */
+  int iFirstChild;
+  int iNextSibling;
+  int iMount;             /* mount ending here or -1 */
+} TMountNode;
+
+typedef struct
+{
+  TMountNode *pNodes;
+  unsigned int uiNodes, uiSize;
+} TMountTrie;
+
+typedef struct _TMountTable
+{
+  TMount *pMounts;
+  unsigned int uiMounts;
+  TMountTrie trieW, trie;
+  struct _TMountTable *pRetired;
+} TMountTable;
+
+typedef struct
+{
+  wchar_t *pwszPosix;
+  wchar_t *pwszWindows;
+} TUserMount;
+
+static TMountTable * volatile pMountTable = NULL;
+static CRITICAL_SECTION csMounts;
+static TUserMount *pUserMounts = NULL;
+static unsigned int uiUserMounts = 0;
+static BOOL bMountsInit = FALSE;
+
+/**
+ * @brief Add a key to a trie
+ * @internal
+ * @return FALSE if out of memory
+ */
+static BOOL __win_TrieInsert(TMountTrie *pTrie, const void *pKey, BOOL bWide,
+  int iMount)
+{
+  int iNode;
+  size_t i;
+
+  if (!pTrie->uiNodes)
+  {
+    pTrie->uiSize = 32;
+    pTrie->pNodes = (TMountNode *) __win_Malloc(pTrie->uiSize * sizeof(TMountNode));
+    if (!pTrie->pNodes)
+      return FALSE;
+    pTrie->pNodes[0].c = 0;
+    pTrie->pNodes[0].iFirstChild = pTrie->pNodes[0].iNextSibling = -1;
+    pTrie->pNodes[0].iMount = -1;
+    pTrie->uiNodes = 1;
+  }
+
+  iNode = 0;
+  for (i = 0; ; i++)
+  {
+    unsigned int c;
+    int iChild;
+
+    c = bWide ? ((const wchar_t *) pKey)[i] :
+      ((const unsigned char *) pKey)[i];
+    if (!c)
+      break;
+
+    for (iChild = pTrie->pNodes[iNode].iFirstChild; iChild != -1;
+      iChild = pTrie->pNodes[iChild].iNextSibling)
+    {
+      if (pTrie->pNodes[iChild].c == c)
+        break;
+    }
+
+    if (iChild == -1)
+    {
+      if (pTrie->uiNodes == pTrie->uiSize)
+      {
+        TMountNode *pNew;
+
+        pNew = (TMountNode *) __win_Realloc(pTrie->pNodes,
+          pTrie->uiSize * 2 * sizeof(TMountNode));
+        if (!pNew)
+          return FALSE;
+        pTrie->pNodes = pNew;
+        pTrie->uiSize *= 2;
+      }
+
+      iChild = pTrie->uiNodes++;
+      pTrie->pNodes[iChild].c = c;
+      pTrie->pNodes[iChild].iFirstChild = -1;
+      pTrie->pNodes[iChild].iMount = -1;
+      pTrie->pNodes[iChild].iNextSibling = pTrie->pNodes[iNode].iFirstChild;
+      pTrie->pNodes[iNode].iFirstChild = iChild;
+    }
+
+    iNode = iChild;
+  }
+
+  pTrie->pNodes[iNode].iMount = iMount;
+
+  return TRUE;
+}
+
+static void __win_FreeMountTable(TMountTable *pTable)
+{
+  unsigned int uiIndex;
+
+  for (uiIndex = 0; uiIndex < pTable->uiMounts; uiIndex++)
+  {
+    free(pTable->pMounts[uiIndex].pwszPosix);
+    free(pTable->pMounts[uiIndex].pwszWindows);
+    free(pTable->pMounts[uiIndex].pszPosix);
+    free(pTable->pMounts[uiIndex].pszWindows);
+  }
+  free(pTable->pMounts);
+  free(pTable->trieW.pNodes);
+  free(pTable->trie.pNodes);
+  free(pTable);
+}
+
+/**
+ * @brief Append a mapping to a table that is being built
+ * @internal
+ * @param bBoundary the prefix only matches whole path components
+ */
+static BOOL __win_AddMount(TMountTable *pTable, const wchar_t *pwszPosix,
+  const wchar_t *pwszWindows, BOOL bBoundary)
+{
+  TMount *pMount;
+  UINT uiCP;
+
+  uiCP = (_plibc_utf8_mode == 1) ? CP_UTF8 : CP_ACP;
+  pMount = &pTable->pMounts[pTable->uiMounts];
+  memset(pMount, 0, sizeof(TMount));
+
+  pMount->pwszPosix = __win_WcsDup(pwszPosix);
+  pMount->pwszWindows = __win_WcsDup(pwszWindows);
+  if (!pMount->pwszPosix || !pMount->pwszWindows ||
+    wchartostr(pwszPosix, &pMount->pszPosix, uiCP) < 0 ||
+    wchartostr(pwszWindows, &pMount->pszWindows, uiCP) < 0)
+  {
+    free(pMount->pwszPosix);
+    free(pMount->pwszWindows);
+    free(pMount->pszPosix);
+    return FALSE;
+  }
+
+  pMount->lPosixLenW = wcslen(pMount->pwszPosix);
+  pMount->lWindowsLenW = wcslen(pMount->pwszWindows);
+  pMount->lPosixLen = strlen(pMount->pszPosix);
+  pMount->lWindowsLen = strlen(pMount->pszWindows);
+  pMount->bBoundary = bBoundary;
+  pTable->uiMounts++;
+
+  /* Later mappings of the same prefix replace earlier ones */
+  return __win_TrieInsert(&pTable->trieW, pMount->pwszPosix, TRUE,
+      pTable->uiMounts - 1) &&
+    __win_TrieInsert(&pTable->trie, pMount->pszPosix, FALSE,
+      pTable->uiMounts - 1);
+}
+
+/**
+ * @brief Build and publish a new mount table
+ * @internal
+ * @note Must be called with csMounts held
+ */
+static BOOL __win_RebuildMounts()
+{
+  TMountTable *pTable;
+  wchar_t wszTemp[_MAX_PATH + 1], wszData[_MAX_PATH + 5];
+  unsigned int uiIndex;
+  BOOL bOk;
+
+  pTable = (TMountTable *) __win_Calloc(1, sizeof(TMountTable));
+  if (!pTable)
+    return FALSE;
+  pTable->pMounts = (TMount *) __win_Malloc((8 + uiUserMounts) * sizeof(TMount));
+  if (!pTable->pMounts)
+  {
+    free(pTable);
+    return FALSE;
+  }
+
+  if (!GetTempPathW(_MAX_PATH + 1, wszTemp))
+    wszTemp[0] = 0;
+
+  /* Built-in mappings. All but the root only match whole components, so
+     "/tmpfile" stays below the root instead of becoming "%TEMP%\file". */
+  bOk = __win_AddMount(pTable, L"/", szRootDir, FALSE) &&
+    __win_AddMount(pTable, L"/tmp", wszTemp, TRUE) &&
+    __win_AddMount(pTable, L"/dev/null", L"nul", TRUE) &&
+    __win_AddMount(pTable, L"~", szHomeDir, TRUE) &&
+    __win_AddMount(pTable, L"$HOME", szHomeDir, TRUE);
+  if (bOk)
+  {
+    const wchar_t *pwszDataDirs[] = {L"etc", L"com", L"var"};
+
+    for (uiIndex = 0; bOk && uiIndex < 3; uiIndex++)
+    {
+      wchar_t wszPosix[5];
+
+      wszPosix[0] = L'/';
+      wcscpy(wszPosix + 1, pwszDataDirs[uiIndex]);
+      _win_snwprintf(wszData, _MAX_PATH + 4, L"%s%s", szDataDir,
+        pwszDataDirs[uiIndex]);
+      wszData[_MAX_PATH + 4] = 0;
+      bOk = __win_AddMount(pTable, wszPosix, wszData, TRUE);
+    }
+  }
+
+  /* Mappings added by the application */
+  for (uiIndex = 0; bOk && uiIndex < uiUserMounts; uiIndex++)
+    bOk = __win_AddMount(pTable, pUserMounts[uiIndex].pwszPosix,
+      pUserMounts[uiIndex].pwszWindows, TRUE);
+
+  if (!bOk)
+  {
+    __win_FreeMountTable(pTable);
+    return FALSE;
+  }
+
+  pTable->pRetired = pMountTable;
+  InterlockedExchangePointer((void * volatile *) &pMountTable, pTable);
+
+  /* Cached translations used the old table */
+  __win_InvalidatePathCache();
+
+  return TRUE;
+}
+
+/**
+ * @brief Build the mount table from the base directories
+ * @internal
+ */
+void __win_InitMounts()
+{
+  if (!bMountsInit)
+  {
+    InitializeCriticalSection(&csMounts);
+    bMountsInit = TRUE;
+  }
+
+  EnterCriticalSection(&csMounts);
+  __win_RebuildMounts();
+  LeaveCriticalSection(&csMounts);
+}
+
+/**
+ * @brief Free the mount tables and the mappings added by the application
+ * @internal
+ */
+void __win_FreeMounts()
+{
+  TMountTable *pTable;
+  unsigned int uiIndex;
+
+  if (!bMountsInit)
+    return;
+
+  pTable = pMountTable;
+  pMountTable = NULL;
+  while (pTable)
+  {
+    TMountTable *pRetired = pTable->pRetired;
+
+    __win_FreeMountTable(pTable);
+    pTable = pRetired;
+  }
+
+  for (uiIndex = 0; uiIndex < uiUserMounts; uiIndex++)
+  {
+    free(pUserMounts[uiIndex].pwszPosix);
+    free(pUserMounts[uiIndex].pwszWindows);
+  }
+  free(pUserMounts);
+  pUserMounts = NULL;
+  uiUserMounts = 0;
+
+  DeleteCriticalSection(&csMounts);
+  bMountsInit = FALSE;
+}
+
+/**
+ * @brief Find the longest mount prefix of a path
+ * @internal
+ * @param pPath wide or narrow POSIX path
+ * @param bWide TRUE if pPath is a wide string
+ * @return the mapping or NULL
+ */
+const TMount *__win_FindMount(const void *pPath, BOOL bWide)
+{
+  TMountTable *pTable;
+  const TMountTrie *pTrie;
+  const TMountNode *pNodes;
+  int iNode, iMatch;
+  size_t i;
+
+  pTable = pMountTable;
+  if (!pTable)
+    return NULL;
+  pTrie = bWide ? &pTable->trieW : &pTable->trie;
+  pNodes = pTrie->pNodes;
+  if (!pNodes)
+    return NULL;
+
+  iNode = 0;
+  iMatch = -1;
+  for (i = 0; ; i++)
+  {
+    unsigned int c;
+    int iChild;
+
+    c = bWide ? ((const wchar_t *) pPath)[i] :
+      ((const unsigned char *) pPath)[i];
+
+    if (pNodes[iNode].iMount != -1 &&
+      (!pTable->pMounts[pNodes[iNode].iMount].bBoundary || !c || c == '/' ||
+      c == '\\'))
+      iMatch = pNodes[iNode].iMount;
+
+    if (!c)
+      break;
+
+    for (iChild = pNodes[iNode].iFirstChild; iChild != -1;
+      iChild = pNodes[iChild].iNextSibling)
+    {
+      if (pNodes[iChild].c == c)
+        break;
+    }
+    if (iChild == -1)
+      break;
+
+    iNode = iChild;
+  }
+
+  return iMatch == -1 ? NULL : &pTable->pMounts[iMatch];
+}
+
+/**
+ * @brief Map a POSIX directory to a Windows directory
+ * @param pszPosix POSIX path prefix, e.g. "/srv"
+ * @param pszWindows Windows directory, e.g. "D:\\data". NULL removes a
+ *        mapping added before.
+ * @return Error code from winerror.h, ERROR_SUCCESS on success
+ * @note Mappings added by the application take precedence over the built-in
+ *       ones. Like all mappings except the root, they only match whole path
+ *       components, trailing slashes of pszPosix are ignored. Strings are
+ *       UTF-8 if PlibC was initialized in UTF-8 mode, ANSI otherwise.
+ */
+int plibc_mount(const char *pszPosix, const char *pszWindows)
+{
+  wchar_t *pwszPosix, *pwszWindows;
+  unsigned int uiIndex;
+  UINT uiCP;
+  size_t nLen;
+  int iRet;
+
+  if (!pszPosix || !pszPosix[0])
+    return ERROR_INVALID_PARAMETER;
+  if (!bMountsInit)
+    return ERROR_NOT_READY;
+
+  uiCP = (_plibc_utf8_mode == 1) ? CP_UTF8 : CP_ACP;
+  if (strtowchar(pszPosix, &pwszPosix, uiCP) < 0)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  /* "/data/" is the same as "/data" */
+  nLen = wcslen(pwszPosix);
+  while (nLen > 1 && (pwszPosix[nLen - 1] == L'/' ||
+    pwszPosix[nLen - 1] == L'\\'))
+    pwszPosix[--nLen] = 0;
+
+  pwszWindows = NULL;
+  if (pszWindows && strtowchar(pszWindows, &pwszWindows, uiCP) < 0)
+  {
+    free(pwszPosix);
+    return ERROR_NOT_ENOUGH_MEMORY;
+  }
+
+  EnterCriticalSection(&csMounts);
+
+  for (uiIndex = 0; uiIndex < uiUserMounts; uiIndex++)
+    if (wcscmp(pUserMounts[uiIndex].pwszPosix, pwszPosix) == 0)
+      break;
+
+  iRet = ERROR_SUCCESS;
+  if (uiIndex < uiUserMounts)
+  {
+    free(pUserMounts[uiIndex].pwszPosix);
+    free(pUserMounts[uiIndex].pwszWindows);
+    if (pwszWindows)
+    {
+      pUserMounts[uiIndex].pwszPosix = pwszPosix;
+      pUserMounts[uiIndex].pwszWindows = pwszWindows;
+    }
+    else
+    {
+      pUserMounts[uiIndex] = pUserMounts[--uiUserMounts];
+      free(pwszPosix);
+    }
+  }
+  else if (pwszWindows)
+  {
+    TUserMount *pNew;
+
+    pNew = (TUserMount *) __win_Realloc(pUserMounts,
+      (uiUserMounts + 1) * sizeof(TUserMount));
+    if (pNew)
+    {
+      pUserMounts = pNew;
+      pUserMounts[uiUserMounts].pwszPosix = pwszPosix;
+      pUserMounts[uiUserMounts].pwszWindows = pwszWindows;
+      uiUserMounts++;
+    }
+    else
+    {
+      free(pwszPosix);
+      free(pwszWindows);
+      iRet = ERROR_NOT_ENOUGH_MEMORY;
+    }
+  }
+  else
+  {
+    free(pwszPosix);
+    iRet = ERROR_FILE_NOT_FOUND;
+  }
+
+  if (iRet == ERROR_SUCCESS && !__win_RebuildMounts())
+    iRet = ERROR_NOT_ENOUGH_MEMORY;
+
+  LeaveCriticalSection(&csMounts);
+
+  return iRet;
+}
+
+/* end of mount.c */
@@ -30,10 +30,16 @@
 int _win_open(const char *filename, int oflag, ...)
 {
   int mode, iFD;
-  wchar_t szFile[_MAX_PATH + 1];
+  wchar_t szFile[_MAX_PATH + 1], *pwszLong;
   long lRet;
+
+  pwszLong = NULL;
   if (_plibc_utf8_mode == 1)
+  {
     lRet = plibc_conv_to_win_pathwconv(filename, szFile, _MAX_PATH);
+    if (lRet == ERROR_BUFFER_OVERFLOW)
+      lRet = plibc_conv_to_win_path_long(filename, &pwszLong, 1);
+  }
   else
     lRet = plibc_conv_to_win_path(filename, (char *) szFile, _MAX_PATH);
   if (lRet != ERROR_SUCCESS)
@@ -56,13 +62,23 @@ int _win_open(const char *filename, int oflag, ...)
     mode = 0;
   }
 
+  /* Directories get a handle of their own for openat() and friends */
+  if (oflag & O_DIRECTORY)
+  {
+    iFD = __win_OpenDirFd(pwszLong ? pwszLong : szFile,
+      _plibc_utf8_mode == 1, oflag);
+    free(pwszLong);
+    return iFD;
+  }
+
   /* Set binary mode */
   oflag |= O_BINARY;
 
   if (_plibc_utf8_mode == 1)
-    iFD = _wopen(szFile, oflag, mode);
+    iFD = _wopen(pwszLong ? pwszLong : szFile, oflag, mode);
   else
     iFD = open((char *) szFile, oflag, mode);
+  free(pwszLong);
   if (iFD != -1)
     __win_SetHandleType(iFD, FD_HANDLE);
 
@@ -24,42 +24,232 @@
 
 #include "plibc_private.h"
 
+/* Windows 7 and later, missing from older headers */
+#define PLIBC_FIND_EX_INFO_BASIC ((FINDEX_INFO_LEVELS) 1)
+#ifndef FIND_FIRST_EX_LARGE_FETCH
+  #define FIND_FIRST_EX_LARGE_FETCH 2
+#endif
+
+#define DIR_STREAM_POOL 16
+
+/* Streams released by closedir() */
+static CRITICAL_SECTION csDirStreams;
+static struct plibc_WDIR *pDirPool[DIR_STREAM_POOL];
+static unsigned int uiDirPool = 0;
+
+/**
+ * @brief Set up the pool of directory streams
+ * @internal
+ */
+void __win_InitDirStreams()
+{
+  InitializeCriticalSection(&csDirStreams);
+}
+
+/**
+ * @brief Free the pool of directory streams
+ * @internal
+ */
+void __win_FreeDirStreams()
+{
+  while (uiDirPool)
+    free(pDirPool[--uiDirPool]);
+
+  DeleteCriticalSection(&csDirStreams);
+}
+
+/**
+ * @brief Return a directory stream to the pool
+ * @internal
+ */
+void __win_ReleaseDirStream(struct plibc_WDIR *pwd)
+{
+  pwd->self = NULL;
+  if (pwd->pwszPattern != pwd->szPattern)
+  {
+    free(pwd->pwszPattern);
+    pwd->pwszPattern = pwd->szPattern;
+  }
+
+  EnterCriticalSection(&csDirStreams);
+  if (uiDirPool < DIR_STREAM_POOL)
+  {
+    pDirPool[uiDirPool++] = pwd;
+    pwd = NULL;
+  }
+  LeaveCriticalSection(&csDirStreams);
+
+  free(pwd);
+}
+
+/**
+ * @brief Start enumerating a directory stream from its first entry
+ * @internal
+ * @return ERROR_SUCCESS, ERROR_DIRECTORY if the path isn't a directory,
+ *         another error code from winerror.h otherwise
+ * @note The stream enumerates with FindFirstFileExW(). Skipping the short
+ *       names and fetching large batches saves a lot of kernel transitions
+ *       in big directories, readdir() and plibc_readdir_bulk() then work
+ *       on the same buffer.
+ */
+DWORD __win_RestartDirStream(struct plibc_WDIR *pwd)
+{
+  size_t nLen;
+  DWORD dwErr, dwAttr;
+
+  pwd->bHaveEntry = FALSE;
+  pwd->iError = 0;
+  pwd->lPos = 0;
+
+  pwd->hFind = FindFirstFileExW(pwd->pwszPattern, PLIBC_FIND_EX_INFO_BASIC,
+    &pwd->findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+  if (pwd->hFind == INVALID_HANDLE_VALUE &&
+    GetLastError() == ERROR_INVALID_PARAMETER)
+  {
+    /* Windows Vista and earlier */
+    pwd->hFind = FindFirstFileExW(pwd->pwszPattern, FindExInfoStandard,
+      &pwd->findData, FindExSearchNameMatch, NULL, 0);
+  }
+  dwErr = GetLastError();
+
+  if (pwd->hFind != INVALID_HANDLE_VALUE)
+  {
+    pwd->bHaveEntry = TRUE;
+    return ERROR_SUCCESS;
+  }
+
+  /* Tell missing directories, files and empty directories apart */
+  nLen = wcslen(pwd->pwszPattern);
+  pwd->pwszPattern[nLen - 1] = 0;
+  dwAttr = GetFileAttributesW(pwd->pwszPattern);
+  if (dwAttr == INVALID_FILE_ATTRIBUTES)
+    dwErr = GetLastError();
+  else if (!(dwAttr & FILE_ATTRIBUTE_DIRECTORY))
+    dwErr = ERROR_DIRECTORY;
+  else if (dwErr == ERROR_FILE_NOT_FOUND)
+    dwErr = ERROR_SUCCESS;
+  pwd->pwszPattern[nLen - 1] = L'*';
+
+  return dwErr;
+}
+
+/**
+ * @brief Open a directory stream
+ * @internal
+ * @param pwszDir Windows path
+ */
+struct plibc_WDIR *__win_OpenDirStreamW(const wchar_t *pwszDir)
+{
+  struct plibc_WDIR *pwd;
+  wchar_t *pwszPattern;
+  size_t nLen;
+  DWORD dwErr;
+
+  pwd = NULL;
+  EnterCriticalSection(&csDirStreams);
+  if (uiDirPool)
+    pwd = pDirPool[--uiDirPool];
+  LeaveCriticalSection(&csDirStreams);
+  if (pwd == NULL)
+    pwd = __win_Malloc (sizeof (struct plibc_WDIR));
+  if (pwd == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  /* The pattern is kept for rewinddir() */
+  pwd->pwszPattern = pwd->szPattern;
+  nLen = wcslen(pwszDir);
+  if (nLen + 3 > sizeof(pwd->szPattern) / sizeof(wchar_t))
+  {
+    pwszPattern = __win_Malloc((nLen + 3) * sizeof(wchar_t));
+    if (pwszPattern == NULL)
+    {
+      __win_ReleaseDirStream(pwd);
+      errno = ENOMEM;
+      return NULL;
+    }
+    pwd->pwszPattern = pwszPattern;
+  }
+  pwszPattern = pwd->pwszPattern;
+  memcpy(pwszPattern, pwszDir, nLen * sizeof(wchar_t));
+
+  /* dir\* */
+  if (nLen && pwszPattern[nLen - 1] != L'\\' &&
+    pwszPattern[nLen - 1] != L'/' && pwszPattern[nLen - 1] != L':')
+    pwszPattern[nLen++] = L'\\';
+  pwszPattern[nLen++] = L'*';
+  pwszPattern[nLen] = 0;
+
+  dwErr = __win_RestartDirStream(pwd);
+  if (dwErr != ERROR_SUCCESS)
+  {
+    __win_ReleaseDirStream(pwd);
+    if (dwErr == ERROR_DIRECTORY)
+      errno = ENOTDIR;
+    else
+      SetErrnoFromWinError(dwErr);
+    return NULL;
+  }
+
+  /* Store some extra info, so return a wrapped pointer of our own */
+  pwd->self = pwd;
+  pwd->dirfd = -1;
+  return pwd;
+}
+
+/**
+ * @brief Open a directory stream
+ * @internal
+ * @param pDir Windows path, wchar_t in UTF-8 mode, ANSI otherwise
+ */
+struct plibc_WDIR *__win_OpenDirStream(const void *pDir)
+{
+  wchar_t szDir[_MAX_PATH + 1];
+
+  if (_plibc_utf8_mode == 1)
+    return __win_OpenDirStreamW((const wchar_t *) pDir);
+
+  /* Names are always enumerated in UTF-16 */
+  if (strtowchar_buf((const char *) pDir, szDir, _MAX_PATH + 1, CP_ACP) != 0)
+  {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  return __win_OpenDirStreamW(szDir);
+}
+
 /**
  * @brief Open a directory
  */
 DIR *_win_opendir(const char *dirname)
 {
-  _WDIR *mingw_wdir = NULL;
+  wchar_t szDir[_MAX_PATH + 1], *pwszLong;
   struct plibc_WDIR *pwd;
-  wchar_t szDir[_MAX_PATH + 1];
   long lRet;
   if (_plibc_utf8_mode == 1)
     lRet = plibc_conv_to_win_pathwconv(dirname, szDir, _MAX_PATH);
   else
     lRet = plibc_conv_to_win_path(dirname, (char *) szDir, _MAX_PATH);
+  if (lRet == ERROR_BUFFER_OVERFLOW && _plibc_utf8_mode == 1)
+  {
+    lRet = plibc_conv_to_win_path_long(dirname, &pwszLong, 1);
+    if (lRet == ERROR_SUCCESS)
+    {
+      pwd = __win_OpenDirStreamW(pwszLong);
+      free(pwszLong);
+      return (DIR *) pwd;
+    }
+  }
   if (lRet != ERROR_SUCCESS)
   {
     SetErrnoFromWinError(lRet);
     return NULL;
   }
 
-  /* opendir sets errno */
-  if (_plibc_utf8_mode == 1)
-  {
-    mingw_wdir = _wopendir(szDir);
-    if (mingw_wdir == NULL)
-      return NULL;
-    /* Now, we need to store some extra info, so return
-     * a wrapped pointer of our own.
-     */
-    pwd = malloc (sizeof (struct plibc_WDIR));
-    pwd->mingw_wdir = mingw_wdir;
-    pwd->self = pwd;
-    memset (&pwd->udirent, 0, sizeof (struct dirent));
-    return (DIR *) pwd;
-  }
-  else
-    return opendir((char *) szDir);
+  return (DIR *) __win_OpenDirStream(szDir);
 }
 
 
@@ -233,36 +233,167 @@ int plibc_conv_to_win_pathw(const wchar_t *pszUnix, wchar_t *pszWindows, size_t
 int plibc_conv_to_win_pathwconv(const char *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length)
 {
   wchar_t *pwszUnix;
+  size_t nLen;
   int r;
-  r = strtowchar (pszUnix, &pwszUnix, CP_UTF8);
-  if (r < 0)
-    return r;
+
+  if (!pszUnix)
+    return ERROR_INVALID_PARAMETER;
+
+  /* UTF-8 never needs more UTF-16 units than bytes */
+  nLen = strlen (pszUnix) + 1;
+  pwszUnix = (wchar_t *) __win_ScratchAlloc (nLen * sizeof (wchar_t));
+  if (!pwszUnix)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  __win_Utf8ToUtf16 (pszUnix, pwszUnix, nLen);
   r = plibc_conv_to_win_pathw_ex(pwszUnix, pszWindows, pszWindows_buff_length, 1);
-  free (pwszUnix);
+  __win_ScratchFree (pwszUnix);
   return r;
 }
 
 int plibc_conv_to_win_pathwconv_ex(const char *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks)
 {
   wchar_t *pwszUnix;
+  size_t nLen;
   int r;
-  r = strtowchar (pszUnix, &pwszUnix, CP_UTF8);
-  if (r < 0)
-    return r;
+
+  if (!pszUnix)
+    return ERROR_INVALID_PARAMETER;
+
+  /* UTF-8 never needs more UTF-16 units than bytes */
+  nLen = strlen (pszUnix) + 1;
+  pwszUnix = (wchar_t *) __win_ScratchAlloc (nLen * sizeof (wchar_t));
+  if (!pwszUnix)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  __win_Utf8ToUtf16 (pszUnix, pwszUnix, nLen);
   r = plibc_conv_to_win_pathw_ex(pwszUnix, pszWindows, pszWindows_buff_length, derefLinks);
-  free (pwszUnix);
+  __win_ScratchFree (pwszUnix);
   return r;
 }
 
+#define LONG_PATH_MAX 32767
+
 /**
- * @brief Convert a POSIX-sytle path to a Windows-style path
- * @param pszUnix POSIX path
- * @param pszWindows Windows path
+ * @brief Turn a Windows path into an absolute \\?\ path
+ * @internal
+ * @param ppwszLong receives the path, free with free()
+ * @return Error code from winerror.h, ERROR_SUCCESS on success
+ */
+static int __win_MakeLongPathW(const wchar_t *pwszPath, wchar_t **ppwszLong)
+{
+  wchar_t *pwszLong;
+  DWORD dwLen, dwRet;
+
+  /* Already in the device namespace */
+  if (wcsncmp(pwszPath, L"\\\\?\\", 4) == 0 ||
+    wcsncmp(pwszPath, L"\\\\.\\", 4) == 0)
+  {
+    pwszLong = __win_WcsDup(pwszPath);
+    if (!pwszLong)
+      return ERROR_NOT_ENOUGH_MEMORY;
+    *ppwszLong = pwszLong;
+    return ERROR_SUCCESS;
+  }
+
+  /* Windows doesn't normalize \\?\ paths, do it once now */
+  dwLen = GetFullPathNameW(pwszPath, 0, NULL, NULL);
+  if (!dwLen)
+    return GetLastError();
+
+  /* The full path goes behind the prefix, \\?\UNC\ replaces the \\ of
+     network paths */
+  pwszLong = (wchar_t *) __win_Malloc((dwLen + 8) * sizeof(wchar_t));
+  if (!pwszLong)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  dwRet = GetFullPathNameW(pwszPath, dwLen, pwszLong + 6, NULL);
+  if (!dwRet || dwRet >= dwLen)
+  {
+    /* The working directory changed in between */
+    free(pwszLong);
+    return dwRet ? ERROR_BUFFER_OVERFLOW : GetLastError();
+  }
+
+  if (pwszLong[6] == L'\\' && pwszLong[7] == L'\\')
+    memcpy(pwszLong, L"\\\\?\\UNC", 7 * sizeof(wchar_t));
+  else
+  {
+    memmove(pwszLong + 4, pwszLong + 6, (dwRet + 1) * sizeof(wchar_t));
+    memcpy(pwszLong, L"\\\\?\\", 4 * sizeof(wchar_t));
+  }
+
+  *ppwszLong = pwszLong;
+
+  return ERROR_SUCCESS;
+}
+
+/**
+ * @brief Convert a POSIX-sytle path to a Windows-style path of any length
+ * @param pszUnix POSIX path, UTF-8 in UTF-8 mode, ANSI otherwise
+ * @param ppwszWindows receives the absolute Windows path, free with free()
  * @param derefLinks 1 to dereference links
  * @return Error code from winerror.h, ERROR_SUCCESS on success
-*/
-int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks)
+ * @note The path is prefixed with \\?\ (\\?\UNC\ for network paths), which
+ *       lifts the MAX_PATH limit of the wide Windows API and makes Windows
+ *       pass the path to the file system as it is. It has to be used with
+ *       the wide API; the CRT rejects the "?" of the prefix.
+ */
+int plibc_conv_to_win_path_long(const char *pszUnix, wchar_t **ppwszWindows, int derefLinks)
 {
+  wchar_t *pwszUnix, *pwszPath, *pwszNew;
+  size_t nLen;
+  int iRet;
+
+  if (!pszUnix || !ppwszWindows)
+    return ERROR_INVALID_PARAMETER;
+
+  nLen = strlen(pszUnix) + 1;
+  pwszUnix = (wchar_t *) __win_ScratchAlloc(nLen * sizeof(wchar_t));
+  if (!pwszUnix)
+    return ERROR_NOT_ENOUGH_MEMORY;
+  if (_plibc_utf8_mode == 1)
+    __win_Utf8ToUtf16(pszUnix, pwszUnix, nLen);
+  else if (MultiByteToWideChar(CP_ACP, 0, pszUnix, -1, pwszUnix, nLen) <= 0)
+  {
+    iRet = GetLastError();
+    __win_ScratchFree(pwszUnix);
+    return iRet;
+  }
+
+  /* Translate, grow the buffer until it fits */
+  pwszPath = NULL;
+  nLen = _MAX_PATH + 1;
+  while (TRUE)
+  {
+    pwszNew = (wchar_t *) __win_Realloc(pwszPath, nLen * sizeof(wchar_t));
+    if (!pwszNew)
+    {
+      iRet = ERROR_NOT_ENOUGH_MEMORY;
+      break;
+    }
+    pwszPath = pwszNew;
+
+    iRet = plibc_conv_to_win_pathw_ex(pwszUnix, pwszPath, nLen - 1,
+      derefLinks);
+    if (iRet != ERROR_BUFFER_OVERFLOW || nLen > LONG_PATH_MAX)
+      break;
+    nLen = nLen * 2 > LONG_PATH_MAX + 1 ? LONG_PATH_MAX + 1 : nLen * 2;
+  }
+  __win_ScratchFree(pwszUnix);
+
+  if (iRet == ERROR_SUCCESS)
+    iRet = __win_MakeLongPathW(pwszPath, ppwszWindows);
+  free(pwszPath);
+
+  return iRet;
+}
+
+/**
+ * @brief Convert a POSIX-sytle path to a Windows-style path, bypassing the
+ *        cache
+ * @internal
+ */
+static int __win_ConvToWinPathW(const wchar_t *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks)
+{
+  const TMount *pMount;
   wchar_t *pSrc, *pDest;
   long iSpaceUsed;
   int iUnixLen;
@@ -282,68 +413,16 @@ int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size
     wcsncpy(pszWindows, pszUnix, pszWindows_buff_length);
   }
 
-  /* Temp. dir? */
-  if(wcsncmp(pszUnix, L"/tmp", 4) == 0)
+  /* Mapped directory? */
+  pMount = __win_FindMount(pszUnix, TRUE);
+  if (pMount)
   {
-    iSpaceUsed = GetTempPathW(pszWindows_buff_length, pszWindows);
-	if (iSpaceUsed == 0 )
-      return ERROR_INVALID_PARAMETER;
+    iSpaceUsed = pMount->lWindowsLenW;
     if (iSpaceUsed > pszWindows_buff_length)
       return ERROR_BUFFER_OVERFLOW;
+    memcpy(pszWindows, pMount->pwszWindows, iSpaceUsed * sizeof(wchar_t));
     pDest = pszWindows + iSpaceUsed;
-    pSrc = (wchar_t *) pszUnix + 4;
-  }
-  /* Bit bucket? */
-  else if (wcsncmp(pszUnix, L"/dev/null", 9) == 0)
-  {
-    wcsncpy(pszWindows, L"nul", pszWindows_buff_length);
-    iSpaceUsed = 3;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + lHomeDirLen;
-    pSrc = (wchar_t *) pszUnix + 9;
-  }
-  /* Data directories */
-  else if (wcsncmp(pszUnix, L"/etc", 4) == 0 ||
-    wcsncmp(pszUnix, L"/com", 4) == 0 ||
-    wcsncmp(pszUnix, L"/var", 4) == 0)
-  {
-    wcsncpy(pszWindows, szDataDir, pszWindows_buff_length);
-    iSpaceUsed = lDataDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + lDataDirLen;
-    pSrc = (wchar_t *) pszUnix + 1;
-  }
-  /* Is the unix path a full path? */
-  else if(pszUnix[0] == L'/')
-  {
-    wcsncpy(pszWindows, szRootDir, pszWindows_buff_length);
-    iSpaceUsed = lRootDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + lRootDirLen;
-    pSrc = (wchar_t *) pszUnix + 1;
-  }
-  /* Home dir? */
-  else if (pszUnix[0] == L'~')
-  {
-    wcsncpy(pszWindows, szHomeDir, pszWindows_buff_length);
-    iSpaceUsed = lHomeDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + lHomeDirLen;
-    pSrc = (wchar_t *) pszUnix + 1;
-  }
-  /* Home dir (env var)? */
-  else if (wcsncmp(pszUnix, L"$HOME", 5) == 0)
-  {
-    wcsncpy(pszWindows, szHomeDir, pszWindows_buff_length);
-    iSpaceUsed = lHomeDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + lHomeDirLen;
-    pSrc = (wchar_t *) pszUnix + 5;  	
+    pSrc = (wchar_t *) pszUnix + pMount->lPosixLenW;
   }
   else
   {
@@ -369,7 +448,12 @@ int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size
   }
   *pDest = 0;
 
-  if (derefLinks)
+  if (_plibc_native_symlinks)
+  {
+    /* The kernel follows symbolic links, there are no shortcuts to look
+       for */
+  }
+  else if (derefLinks)
     __win_derefw(pszWindows);
   else
   {
@@ -392,7 +476,7 @@ int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size
         
         if (iSpaceUsed + 5 > pszWindows_buff_length)
         {
-          pLnk = malloc((iSpaceUsed + 5) * sizeof (wchar_t));
+          pLnk = __win_Malloc((iSpaceUsed + 5) * sizeof (wchar_t));
           wcscpy(pLnk, pszWindows);
           mal = 1;
         }
@@ -447,8 +531,14 @@ int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size
   return ERROR_SUCCESS;
 }
 
-int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszWindows_buff_length, int derefLinks)
+/**
+ * @brief Convert a POSIX-sytle path to a Windows-style path, bypassing the
+ *        cache
+ * @internal
+ */
+static int __win_ConvToWinPath(const char *pszUnix, char *pszWindows, size_t pszWindows_buff_length, int derefLinks)
 {
+  const TMount *pMount;
   char *pSrc, *pDest;
   long iSpaceUsed;
   int iUnixLen;
@@ -468,68 +558,16 @@ int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszW
     strncpy(pszWindows, pszUnix, pszWindows_buff_length);
   }
 
-  /* Temp. dir? */
-  if(strncmp(pszUnix, "/tmp", 4) == 0)
+  /* Mapped directory? */
+  pMount = __win_FindMount(pszUnix, FALSE);
+  if (pMount)
   {
-    iSpaceUsed = GetTempPath(pszWindows_buff_length, pszWindows);
-	if (iSpaceUsed == 0)
-      return ERROR_INVALID_PARAMETER;
+    iSpaceUsed = pMount->lWindowsLen;
     if (iSpaceUsed > pszWindows_buff_length)
       return ERROR_BUFFER_OVERFLOW;
+    memcpy(pszWindows, pMount->pszWindows, iSpaceUsed);
     pDest = pszWindows + iSpaceUsed;
-    pSrc = (char *) pszUnix + 4;
-  }
-  /* Bit bucket? */
-  else if (strncmp(pszUnix, "/dev/null", 9) == 0)
-  {
-    strncpy(pszWindows, "nul", pszWindows_buff_length);
-    iSpaceUsed = 3;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + luHomeDirLen;
-    pSrc = (char *) pszUnix + 9;
-  }
-  /* Data directories */
-  else if (strncmp(pszUnix, "/etc", 4) == 0 ||
-    strncmp(pszUnix, "/com", 4) == 0 ||
-    strncmp(pszUnix, "/var", 4) == 0)
-  {
-    strncpy(pszWindows, szuDataDir, pszWindows_buff_length);
-    iSpaceUsed = luDataDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + luDataDirLen;
-    pSrc = (char *) pszUnix + 1;
-  }
-  /* Is the unix path a full path? */
-  else if(pszUnix[0] == '/')
-  {
-    strncpy(pszWindows, szuRootDir, pszWindows_buff_length);
-    iSpaceUsed = luRootDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + luRootDirLen;
-    pSrc = (char *) pszUnix + 1;
-  }
-  /* Home dir? */
-  else if (pszUnix[0] == '~')
-  {
-    strncpy(pszWindows, szuHomeDir, pszWindows_buff_length);
-    iSpaceUsed = luHomeDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + luHomeDirLen;
-    pSrc = (char *) pszUnix + 1;
-  }
-  /* Home dir (env var)? */
-  else if (strncmp(pszUnix, "$HOME", 5) == 0)
-  {
-    strncpy(pszWindows, szuHomeDir, pszWindows_buff_length);
-    iSpaceUsed = luHomeDirLen;
-    if (iSpaceUsed > pszWindows_buff_length)
-      return ERROR_BUFFER_OVERFLOW;
-    pDest = pszWindows + luHomeDirLen;
-    pSrc = (char *) pszUnix + 5;  	
+    pSrc = (char *) pszUnix + pMount->lPosixLen;
   }
   else
   {
@@ -555,7 +593,12 @@ int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszW
   }
   *pDest = 0;
 
-  if (derefLinks)
+  if (_plibc_native_symlinks)
+  {
+    /* The kernel follows symbolic links, there are no shortcuts to look
+       for */
+  }
+  else if (derefLinks)
     __win_deref(pszWindows);
   else
   {
@@ -578,7 +621,7 @@ int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszW
         
         if (iSpaceUsed + 5 > pszWindows_buff_length)
         {
-          pLnk = malloc(iSpaceUsed + 5);
+          pLnk = __win_Malloc(iSpaceUsed + 5);
           strcpy(pLnk, pszWindows);
           mal = 1;
         }
@@ -633,4 +676,69 @@ int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszW
   return ERROR_SUCCESS;
 }
 
+/* Relative paths depend on the working directory and are not cached */
+#define PATH_IS_ABSOLUTE(p) ((p)[0] == '/' || (p)[0] == '\\' || \
+  ((p)[0] && (p)[1] == ':' && ((p)[2] == '/' || (p)[2] == '\\')))
+
+/**
+ * @brief Convert a POSIX-sytle path to a Windows-style path
+ * @param pszUnix POSIX path
+ * @param pszWindows Windows path
+ * @param derefLinks 1 to dereference links
+ * @return Error code from winerror.h, ERROR_SUCCESS on success
+*/
+int plibc_conv_to_win_pathw_ex(const wchar_t *pszUnix, wchar_t *pszWindows, size_t pszWindows_buff_length, int derefLinks)
+{
+  size_t nKeyLen;
+  LONG lGeneration;
+  int iKind, iRet;
+
+  if (!pszUnix || !pszWindows)
+    return ERROR_INVALID_PARAMETER;
+
+  iKind = PATH_CACHE_WIDE | (derefLinks ? PATH_CACHE_DEREF : 0);
+  nKeyLen = wcslen(pszUnix) * sizeof(wchar_t);
+  if (!PATH_IS_ABSOLUTE(pszUnix))
+    return __win_ConvToWinPathW(pszUnix, pszWindows, pszWindows_buff_length,
+      derefLinks);
+  if (__win_PathCacheLookup(iKind, pszUnix, nKeyLen, pszWindows,
+    pszWindows_buff_length * sizeof(wchar_t), &lGeneration))
+    return ERROR_SUCCESS;
+
+  iRet = __win_ConvToWinPathW(pszUnix, pszWindows, pszWindows_buff_length,
+    derefLinks);
+  if (iRet == ERROR_SUCCESS)
+    __win_PathCacheInsert(iKind, pszUnix, nKeyLen, pszWindows,
+      (wcslen(pszWindows) + 1) * sizeof(wchar_t), lGeneration);
+
+  return iRet;
+}
+
+int plibc_conv_to_win_path_ex(const char *pszUnix, char *pszWindows, size_t pszWindows_buff_length, int derefLinks)
+{
+  size_t nKeyLen;
+  LONG lGeneration;
+  int iKind, iRet;
+
+  if (!pszUnix || !pszWindows)
+    return ERROR_INVALID_PARAMETER;
+
+  iKind = derefLinks ? PATH_CACHE_DEREF : 0;
+  nKeyLen = strlen(pszUnix);
+  if (!PATH_IS_ABSOLUTE(pszUnix))
+    return __win_ConvToWinPath(pszUnix, pszWindows, pszWindows_buff_length,
+      derefLinks);
+  if (__win_PathCacheLookup(iKind, pszUnix, nKeyLen, pszWindows,
+    pszWindows_buff_length, &lGeneration))
+    return ERROR_SUCCESS;
+
+  iRet = __win_ConvToWinPath(pszUnix, pszWindows, pszWindows_buff_length,
+    derefLinks);
+  if (iRet == ERROR_SUCCESS)
+    __win_PathCacheInsert(iKind, pszUnix, nKeyLen, pszWindows,
+      strlen(pszWindows) + 1, lGeneration);
+
+  return iRet;
+}
+
 /* end of path.c */
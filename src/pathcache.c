@@ -0,0 +1,325 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/pathcache.c
+ * @brief Cache for POSIX -> Windows path translations
+ *
+ * Translating a path may look for shortcuts on disk, so the results are
+ * kept in a bounded LRU cache. Every entry carries the generation it was
+ * computed in. PlibC bumps the generation whenever it changes the file
+ * system in a way that could change a translation (rename, unlink, symlink,
+ * ...) or when the base directories change, which invalidates all entries
+ * at once. Changes made by other processes are noticed once an entry is
+ * older than PATH_CACHE_TTL; applications that need them to show up at
+ * once can call plibc_invalidate_path_cache().
+ * Only absolute paths are cached, relative ones depend on the working
+ * directory.
+ */
+
+#include "plibc_private.h"
+
+#define PATH_CACHE_ENTRIES 1024
+#define PATH_CACHE_BUCKETS 2048     /* power of 2 */
+#define PATH_CACHE_MAX_KEY 1024     /* bytes, longer paths aren't cached */
+#define PATH_CACHE_TTL 2000         /* ms */
+
+typedef struct _TPathCacheEntry
+{
+  struct _TPathCacheEntry *pNextHash;
+  struct _TPathCacheEntry *pPrev, *pNext;   /* LRU list, most recent first */
+  unsigned int uiHash;
+  int iKind;
+  LONG lGeneration;
+  DWORD dwTick;                              /* GetTickCount() when added */
+  size_t nKeyLen;
+  size_t nValueLen;
+  char data[1];                              /* key, then value */
+} TPathCacheEntry;
+
+static CRITICAL_SECTION csPathCache;
+static TPathCacheEntry *pBuckets[PATH_CACHE_BUCKETS];
+static TPathCacheEntry *pLRUHead = NULL, *pLRUTail = NULL;
+static unsigned int uiEntries = 0;
+static volatile LONG lPathGeneration = 0;
+static unsigned long ulHits = 0, ulMisses = 0;
+static BOOL bPathCacheInit = FALSE;
+
+static unsigned int __win_HashPath(int iKind, const void *pKey, size_t nLen)
+{
+  const unsigned char *p = (const unsigned char *) pKey;
+  unsigned int uiHash = 2166136261U ^ iKind;
+
+  while (nLen--)
+  {
+    uiHash ^= *p++;
+    uiHash *= 16777619U;
+  }
+
+  return uiHash;
+}
+
+static void __win_UnlinkPathEntry(TPathCacheEntry *pEntry)
+{
+  TPathCacheEntry **ppLink;
+
+  ppLink = &pBuckets[pEntry->uiHash & (PATH_CACHE_BUCKETS - 1)];
+  while (*ppLink != pEntry)
+    ppLink = &(*ppLink)->pNextHash;
+  *ppLink = pEntry->pNextHash;
+
+  if (pEntry->pPrev)
+    pEntry->pPrev->pNext = pEntry->pNext;
+  else
+    pLRUHead = pEntry->pNext;
+  if (pEntry->pNext)
+    pEntry->pNext->pPrev = pEntry->pPrev;
+  else
+    pLRUTail = pEntry->pPrev;
+
+  uiEntries--;
+  free(pEntry);
+}
+
+static void __win_PushPathEntry(TPathCacheEntry *pEntry)
+{
+  pEntry->pPrev = NULL;
+  pEntry->pNext = pLRUHead;
+  if (pLRUHead)
+    pLRUHead->pPrev = pEntry;
+  else
+    pLRUTail = pEntry;
+  pLRUHead = pEntry;
+}
+
+/**
+ * @brief Set up the path cache
+ * @internal
+ */
+void __win_InitPathCache()
+{
+  if (!bPathCacheInit)
+  {
+    InitializeCriticalSection(&csPathCache);
+    bPathCacheInit = TRUE;
+  }
+
+  /* The base directories may have changed */
+  __win_InvalidatePathCache();
+}
+
+/**
+ * @brief Free the path cache
+ * @internal
+ */
+void __win_FreePathCache()
+{
+  if (!bPathCacheInit)
+    return;
+
+  EnterCriticalSection(&csPathCache);
+  while (pLRUHead)
+    __win_UnlinkPathEntry(pLRUHead);
+  LeaveCriticalSection(&csPathCache);
+
+  DeleteCriticalSection(&csPathCache);
+  bPathCacheInit = FALSE;
+}
+
+/**
+ * @brief Invalidate all cached translations
+ * @internal
+ */
+void __win_InvalidatePathCache()
+{
+  InterlockedIncrement(&lPathGeneration);
+}
+
+/**
+ * @brief Get the current generation of cached translations
+ * @internal
+ * @note Other caches of file system state use this to notice changes
+ */
+LONG __win_GetPathCacheGeneration()
+{
+  return lPathGeneration;
+}
+
+/**
+ * @brief Look up a translation
+ * @internal
+ * @param iKind distinguishes narrow/wide and deref/no-deref translations
+ * @param pKey POSIX path
+ * @param nKeyLen length of pKey in bytes
+ * @param pDest receives the Windows path, including the terminator
+ * @param nDestLen size of pDest in bytes
+ * @param plGeneration receives the current generation; pass it to
+ *        __win_PathCacheInsert()
+ * @return TRUE on a hit
+ */
+BOOL __win_PathCacheLookup(int iKind, const void *pKey, size_t nKeyLen,
+  void *pDest, size_t nDestLen, LONG *plGeneration)
+{
+  TPathCacheEntry *pEntry;
+  unsigned int uiHash;
+  BOOL bHit;
+
+  *plGeneration = lPathGeneration;
+  if (!bPathCacheInit || nKeyLen > PATH_CACHE_MAX_KEY)
+    return FALSE;
+
+  uiHash = __win_HashPath(iKind, pKey, nKeyLen);
+  bHit = FALSE;
+
+  EnterCriticalSection(&csPathCache);
+
+  pEntry = pBuckets[uiHash & (PATH_CACHE_BUCKETS - 1)];
+  while (pEntry)
+  {
+    if (pEntry->uiHash == uiHash && pEntry->iKind == iKind &&
+      pEntry->nKeyLen == nKeyLen && memcmp(pEntry->data, pKey, nKeyLen) == 0)
+      break;
+    pEntry = pEntry->pNextHash;
+  }
+
+  if (pEntry && (pEntry->lGeneration != *plGeneration ||
+    GetTickCount() - pEntry->dwTick > PATH_CACHE_TTL))
+  {
+    /* Stale */
+    __win_UnlinkPathEntry(pEntry);
+    pEntry = NULL;
+  }
+
+  if (pEntry && pEntry->nValueLen <= nDestLen)
+  {
+    memcpy(pDest, pEntry->data + nKeyLen, pEntry->nValueLen);
+
+    /* Move to front */
+    if (pEntry != pLRUHead)
+    {
+      pEntry->pPrev->pNext = pEntry->pNext;
+      if (pEntry->pNext)
+        pEntry->pNext->pPrev = pEntry->pPrev;
+      else
+        pLRUTail = pEntry->pPrev;
+      __win_PushPathEntry(pEntry);
+    }
+
+    ulHits++;
+    bHit = TRUE;
+  }
+  else
+    ulMisses++;
+
+  LeaveCriticalSection(&csPathCache);
+
+  return bHit;
+}
+
+/**
+ * @brief Remember a translation
+ * @internal
+ * @param lGeneration generation returned by __win_PathCacheLookup() before
+ *        the translation was computed
+ */
+void __win_PathCacheInsert(int iKind, const void *pKey, size_t nKeyLen,
+  const void *pValue, size_t nValueLen, LONG lGeneration)
+{
+  TPathCacheEntry *pEntry, *pOld;
+  unsigned int uiHash, uiBucket;
+
+  if (!bPathCacheInit || nKeyLen > PATH_CACHE_MAX_KEY)
+    return;
+
+  pEntry = (TPathCacheEntry *) __win_Malloc(sizeof(TPathCacheEntry) + nKeyLen +
+    nValueLen);
+  if (!pEntry)
+    return;
+
+  uiHash = __win_HashPath(iKind, pKey, nKeyLen);
+  uiBucket = uiHash & (PATH_CACHE_BUCKETS - 1);
+  pEntry->uiHash = uiHash;
+  pEntry->iKind = iKind;
+  pEntry->lGeneration = lGeneration;
+  pEntry->dwTick = GetTickCount();
+  pEntry->nKeyLen = nKeyLen;
+  pEntry->nValueLen = nValueLen;
+  memcpy(pEntry->data, pKey, nKeyLen);
+  memcpy(pEntry->data + nKeyLen, pValue, nValueLen);
+
+  EnterCriticalSection(&csPathCache);
+
+  /* The file system changed while the translation was computed */
+  if (lGeneration != lPathGeneration)
+  {
+    LeaveCriticalSection(&csPathCache);
+    free(pEntry);
+    return;
+  }
+
+  /* Another thread may have been faster */
+  pOld = pBuckets[uiBucket];
+  while (pOld)
+  {
+    if (pOld->uiHash == uiHash && pOld->iKind == iKind &&
+      pOld->nKeyLen == nKeyLen && memcmp(pOld->data, pKey, nKeyLen) == 0)
+    {
+      __win_UnlinkPathEntry(pOld);
+      break;
+    }
+    pOld = pOld->pNextHash;
+  }
+
+  if (uiEntries >= PATH_CACHE_ENTRIES)
+    __win_UnlinkPathEntry(pLRUTail);
+
+  pEntry->pNextHash = pBuckets[uiBucket];
+  pBuckets[uiBucket] = pEntry;
+  __win_PushPathEntry(pEntry);
+  uiEntries++;
+
+  LeaveCriticalSection(&csPathCache);
+}
+
+/**
+ * @brief Invalidate all cached path translations
+ * @note Call this after other processes changed shortcuts PlibC may have
+ *       resolved. Otherwise, their changes are noticed after 2 seconds.
+ */
+void plibc_invalidate_path_cache()
+{
+  __win_InvalidatePathCache();
+}
+
+/**
+ * @brief Get statistics of the path translation cache
+ */
+void plibc_get_path_cache_stats(struct plibc_path_cache_stats *pStats)
+{
+  if (bPathCacheInit)
+    EnterCriticalSection(&csPathCache);
+  pStats->hits = ulHits;
+  pStats->misses = ulMisses;
+  pStats->entries = uiEntries;
+  pStats->generation = (unsigned long) lPathGeneration;
+  if (bPathCacheInit)
+    LeaveCriticalSection(&csPathCache);
+}
+
+/* end of pathcache.c */
@@ -20,10 +20,422 @@
 /**
  * @file src/pipe.c
  * @brief pipe()
+ *
+ * pipe() returns anonymous pipes, which only support synchronous I/O.
+ * plibc_pipe_ex() creates a named pipe with overlapped ends instead, which
+ * rejects clients on other machines. Its write end keeps at most one
+ * non-blocking write outstanding, so select() and poll() can wait for that
+ * write to finish and query the free space of the pipe instead of
+ * guessing.
  */
 
 #include "plibc_private.h"
 
+/* Taken from the Wine project <http://www.winehq.org>
+    /wine/include/winternl.h */
+typedef struct
+{
+  union
+  {
+    LONG Status;
+    PVOID Pointer;
+  } u;
+  ULONG_PTR Information;
+} PLIBC_IO_STATUS_BLOCK;
+
+typedef struct
+{
+  ULONG NamedPipeType;
+  ULONG NamedPipeConfiguration;
+  ULONG MaximumInstances;
+  ULONG CurrentInstances;
+  ULONG InboundQuota;
+  ULONG ReadDataAvailable;
+  ULONG OutboundQuota;
+  ULONG WriteQuotaAvailable;
+  ULONG NamedPipeState;
+  ULONG NamedPipeEnd;
+} PLIBC_FILE_PIPE_LOCAL_INFORMATION;
+
+typedef LONG (WINAPI *TNtQueryInformationFile) (HANDLE FileHandle,
+  PLIBC_IO_STATUS_BLOCK *IoStatusBlock, PVOID FileInformation, ULONG Length,
+  int FileInformationClass);
+typedef BOOL (WINAPI *TCancelIoEx) (HANDLE hFile, LPOVERLAPPED lpOverlapped);
+
+#define FilePipeLocalInformation 24
+
+#define PLIBC_FILE_PIPE_DISCONNECTED_STATE  1
+#define PLIBC_FILE_PIPE_CLOSING_STATE       4
+
+#ifndef PIPE_REJECT_REMOTE_CLIENTS
+  #define PIPE_REJECT_REMOTE_CLIENTS 0x00000008
+#endif
+
+#define PIPE_DEFAULT_SIZE   65536
+#define PIPE_CREATE_TRIES   8       /* names taken by other processes */
+#define PIPE_CLOSE_WAIT     1000    /* ms close() waits for the reader */
+
+/* State of an end created by plibc_pipe_ex() */
+struct _TPipe
+{
+  BOOL bWriteEnd;
+  DWORD dwSize;               /* buffer size of the pipe */
+  CRITICAL_SECTION cs;        /* serializes transfers */
+  OVERLAPPED ov;              /* hEvent is set while nothing is outstanding */
+  BOOL bPending;              /* ov still has to be reaped */
+  DWORD dwError;              /* of the last non-blocking write */
+  char *pBuf;                 /* data of the non-blocking write */
+};
+
+static TNtQueryInformationFile pNtQueryInformationFile = NULL;
+static TCancelIoEx pCancelIoEx = NULL;
+static volatile LONG lPipeSerial = 0;
+static DWORD dwRejectRemote = PIPE_REJECT_REMOTE_CLIENTS;
+
+/**
+ * @brief Set up plibc_pipe_ex()
+ * @internal
+ */
+void __win_InitPipes()
+{
+  pNtQueryInformationFile = (TNtQueryInformationFile)
+    GetProcAddress(GetModuleHandle("ntdll.dll"), "NtQueryInformationFile");
+  pCancelIoEx = (TCancelIoEx) GetProcAddress(GetModuleHandle("kernel32.dll"),
+    "CancelIoEx");
+}
+
+static TPipe *__win_AllocPipe(BOOL bWriteEnd, DWORD dwSize)
+{
+  TPipe *pPipe;
+
+  pPipe = (TPipe *) __win_Calloc(1, sizeof(TPipe));
+  if (!pPipe)
+    return NULL;
+
+  if (bWriteEnd)
+  {
+    pPipe->pBuf = (char *) __win_Malloc(dwSize);
+    if (!pPipe->pBuf)
+    {
+      free(pPipe);
+      return NULL;
+    }
+  }
+
+  /* Nothing is outstanding yet */
+  pPipe->ov.hEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+  if (!pPipe->ov.hEvent)
+  {
+    free(pPipe->pBuf);
+    free(pPipe);
+    return NULL;
+  }
+
+  pPipe->bWriteEnd = bWriteEnd;
+  pPipe->dwSize = dwSize;
+  InitializeCriticalSection(&pPipe->cs);
+
+  return pPipe;
+}
+
+static void __win_FreePipe(TPipe *pPipe)
+{
+  if (!pPipe)
+    return;
+
+  DeleteCriticalSection(&pPipe->cs);
+  CloseHandle(pPipe->ov.hEvent);
+  free(pPipe->pBuf);
+  free(pPipe);
+}
+
+/**
+ * @brief Start a transfer on pPipe->ov
+ * @internal
+ * @param bWait wait for the transfer to finish
+ * @return number of bytes transferred, -1 on error (see GetLastError()),
+ *         -2 if the transfer is still going on
+ * @note Call with pPipe->cs held
+ */
+static long __win_PipeIO(HANDLE h, TPipe *pPipe, void *pBuf, DWORD dwLen,
+  BOOL bWait)
+{
+  HANDLE hEvent = pPipe->ov.hEvent;
+  DWORD dwDone;
+  BOOL bOk;
+
+  ZeroMemory(&pPipe->ov, sizeof(OVERLAPPED));
+  pPipe->ov.hEvent = hEvent;
+
+  if (pPipe->bWriteEnd)
+    bOk = WriteFile(h, pBuf, dwLen, NULL, &pPipe->ov);
+  else
+    bOk = ReadFile(h, pBuf, dwLen, NULL, &pPipe->ov);
+  if (!bOk && GetLastError() != ERROR_IO_PENDING)
+  {
+    DWORD dwErr = GetLastError();
+
+    SetEvent(hEvent);
+    SetLastError(dwErr);
+    return -1;
+  }
+
+  if (!bWait && !HasOverlappedIoCompleted(&pPipe->ov))
+  {
+    pPipe->bPending = TRUE;
+    return -2;
+  }
+
+  if (!GetOverlappedResult(h, &pPipe->ov, &dwDone, TRUE))
+    return -1;
+
+  return dwDone;
+}
+
+/**
+ * @brief Reap the non-blocking write that is still outstanding
+ * @internal
+ * @param bWait wait for it to finish
+ * @return FALSE if it is still going on
+ * @note Its error is kept in pPipe->dwError for the next write. Call with
+ *       pPipe->cs held.
+ */
+static BOOL __win_PipeFinish(HANDLE h, TPipe *pPipe, BOOL bWait)
+{
+  DWORD dwDone;
+
+  if (!pPipe->bPending)
+    return TRUE;
+
+  if (!GetOverlappedResult(h, &pPipe->ov, &dwDone, bWait))
+  {
+    DWORD dwErr = GetLastError();
+
+    if (dwErr == ERROR_IO_INCOMPLETE)
+      return FALSE;
+    pPipe->dwError = dwErr;
+  }
+  pPipe->bPending = FALSE;
+
+  return TRUE;
+}
+
+/**
+ * @brief Get the free space in the buffer of a pipe
+ * @internal
+ * @param pdwQuota receives the free space, 0 if it is unknown
+ * @return FALSE if the other end was closed
+ */
+static BOOL __win_PipeQuery(HANDLE h, DWORD *pdwQuota)
+{
+  PLIBC_FILE_PIPE_LOCAL_INFORMATION info;
+  PLIBC_IO_STATUS_BLOCK iosb;
+
+  *pdwQuota = 0;
+  if (!pNtQueryInformationFile || pNtQueryInformationFile(h, &iosb, &info,
+    sizeof(info), FilePipeLocalInformation) < 0)
+    return TRUE;
+
+  if (info.NamedPipeState == PLIBC_FILE_PIPE_DISCONNECTED_STATE ||
+    info.NamedPipeState == PLIBC_FILE_PIPE_CLOSING_STATE)
+    return FALSE;
+
+  *pdwQuota = info.WriteQuotaAvailable;
+
+  return TRUE;
+}
+
+/**
+ * @brief Read from a pipe created by plibc_pipe_ex()
+ * @internal
+ * @note Non-blocking reads only take the data that is already there
+ */
+int __win_PipeRead(const THandleInfo *pInfo, void *buf, size_t nbyte)
+{
+  TPipe *pPipe = pInfo->pPipe;
+  HANDLE h = (HANDLE) pInfo->dwHandle;
+  DWORD dwLen, dwErr;
+  long lRet;
+
+  errno = 0;
+
+  /* A read of 0 bytes would wait for data */
+  if (!nbyte)
+    return 0;
+  dwLen = nbyte > INT_MAX ? INT_MAX : (DWORD) nbyte;
+
+  if (!pInfo->bBlocking)
+  {
+    DWORD dwAvail;
+
+    if (!PeekNamedPipe(h, NULL, 0, NULL, &dwAvail, NULL))
+    {
+      dwErr = GetLastError();
+
+      /* Writer closed its end */
+      if (dwErr == ERROR_BROKEN_PIPE)
+        return 0;
+
+      SetErrnoFromWinError(dwErr);
+      return -1;
+    }
+
+    if (!dwAvail)
+    {
+      __win_EpollRearm(pInfo->dwHandle);
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (dwLen > dwAvail)
+      dwLen = dwAvail;
+  }
+
+  EnterCriticalSection(&pPipe->cs);
+  lRet = __win_PipeIO(h, pPipe, buf, dwLen, TRUE);
+  dwErr = GetLastError();
+  LeaveCriticalSection(&pPipe->cs);
+
+  if (lRet == -1)
+  {
+    if (dwErr == ERROR_BROKEN_PIPE)
+      return 0;
+
+    SetErrnoFromWinError(dwErr);
+  }
+
+  return lRet;
+}
+
+/**
+ * @brief Write to a pipe created by plibc_pipe_ex()
+ * @internal
+ * @note A non-blocking write copies as much data as fits into the pipe and
+ *       returns before it was written. Only one such write is outstanding,
+ *       further writes fail with EAGAIN until it finished. Its error is
+ *       reported by the next write.
+ */
+int __win_PipeWrite(const THandleInfo *pInfo, const void *buf, size_t nbyte)
+{
+  TPipe *pPipe = pInfo->pPipe;
+  HANDLE h = (HANDLE) pInfo->dwHandle;
+  DWORD dwLen, dwQuota;
+  long lRet;
+
+  dwLen = nbyte > INT_MAX ? INT_MAX : (DWORD) nbyte;
+  lRet = -1;
+
+  EnterCriticalSection(&pPipe->cs);
+
+  errno = 0;
+  if (!__win_PipeFinish(h, pPipe, pInfo->bBlocking))
+    errno = EAGAIN;
+  else if (pPipe->dwError)
+  {
+    SetErrnoFromWinError(pPipe->dwError);
+    pPipe->dwError = 0;
+  }
+  else if (!dwLen)
+    lRet = 0;
+  else if (pInfo->bBlocking)
+  {
+    lRet = __win_PipeIO(h, pPipe, (void *) buf, dwLen, TRUE);
+    if (lRet == -1)
+      SetErrnoFromWinError(GetLastError());
+  }
+  else if (!__win_PipeQuery(h, &dwQuota))
+    errno = EPIPE;
+  else
+  {
+    /* What fits into the pipe, but at least something */
+    if (dwQuota && dwLen > dwQuota)
+      dwLen = dwQuota;
+    if (dwLen > pPipe->dwSize)
+      dwLen = pPipe->dwSize;
+
+    memcpy(pPipe->pBuf, buf, dwLen);
+    lRet = __win_PipeIO(h, pPipe, pPipe->pBuf, dwLen, FALSE);
+    if (lRet == -2)
+      lRet = dwLen;
+    else if (lRet == -1)
+      SetErrnoFromWinError(GetLastError());
+  }
+
+  LeaveCriticalSection(&pPipe->cs);
+
+  return lRet;
+}
+
+/**
+ * @brief Get the event that is set while no write to a pipe is outstanding
+ * @internal
+ * @return NULL if the descriptor isn't the write end of a pipe created by
+ *         plibc_pipe_ex()
+ */
+HANDLE __win_GetPipeWriteEvent(const THandleInfo *pInfo)
+{
+  if (pInfo->eType != PIPE_HANDLE || !pInfo->pPipe ||
+    !pInfo->pPipe->bWriteEnd)
+    return NULL;
+
+  return pInfo->pPipe->ov.hEvent;
+}
+
+/**
+ * @brief Check whether a pipe can be written to
+ * @internal
+ * @param pInfo write end of a pipe created by plibc_pipe_ex()
+ * @return POLLOUT, POLLERR if the reader closed its end, 0 while a write is
+ *         outstanding
+ */
+short __win_PipeWritable(const THandleInfo *pInfo)
+{
+  DWORD dwQuota;
+
+  if (!__win_PipeQuery((HANDLE) pInfo->dwHandle, &dwQuota))
+    return POLLERR;
+
+  if (WaitForSingleObject(pInfo->pPipe->ov.hEvent, 0) != WAIT_OBJECT_0)
+    return 0;
+
+  return POLLOUT;
+}
+
+/**
+ * @brief Release the state of a pipe created by plibc_pipe_ex()
+ * @internal
+ * @note Gives the reader PIPE_CLOSE_WAIT ms to take the outstanding write,
+ *       then cancels it. Without CancelIoEx() (before Windows Vista), the
+ *       state is left to the kernel, which still owns the buffer.
+ */
+void __win_PipeClose(const THandleInfo *pInfo)
+{
+  TPipe *pPipe = pInfo->pPipe;
+  HANDLE h = (HANDLE) pInfo->dwHandle;
+  BOOL bDone;
+
+  bDone = TRUE;
+  if (pPipe->bWriteEnd)
+  {
+    EnterCriticalSection(&pPipe->cs);
+    if (pPipe->bPending &&
+      WaitForSingleObject(pPipe->ov.hEvent, PIPE_CLOSE_WAIT) == WAIT_TIMEOUT)
+    {
+      if (pCancelIoEx)
+        pCancelIoEx(h, &pPipe->ov);
+      else
+        bDone = FALSE;
+    }
+    if (bDone)
+      __win_PipeFinish(h, pPipe, TRUE);
+    LeaveCriticalSection(&pPipe->cs);
+  }
+
+  __win_SetHandlePipe(pInfo->dwHandle, NULL);
+  if (bDone)
+    __win_FreePipe(pPipe);
+}
+
 /**
  * Create a pipe for reading and writing
  */
@@ -47,6 +459,95 @@ int _win_pipe(intptr_t *phandles)
   }
 }
 
+/**
+ * @brief Create a pipe that can be waited for
+ * @param phandles receives the read and the write end
+ * @param size buffer size of the pipe, 0 for 64 KB
+ * @param flags PLIBC_PIPE_SYNC_READ and PLIBC_PIPE_SYNC_WRITE leave the
+ *        respective end synchronous, e.g. to hand it to a child process
+ * @return 0 on success, -1 on error
+ * @note Unlike the write end of pipe(), the overlapped write end can be
+ *       checked for writability and a closed reader by select() and poll().
+ *       Needs Windows NT.
+ */
+int plibc_pipe_ex(intptr_t *phandles, unsigned long size, int flags)
+{
+  wchar_t wszName[64];
+  HANDLE hRead, hWrite;
+  TPipe *pRead, *pWrite;
+  DWORD dwErr;
+  int i;
+
+  if (!size)
+    size = PIPE_DEFAULT_SIZE;
+
+  /* Other processes may have taken a name */
+  hRead = INVALID_HANDLE_VALUE;
+  dwErr = ERROR_PIPE_BUSY;
+  for (i = 0; i < PIPE_CREATE_TRIES && hRead == INVALID_HANDLE_VALUE; i++)
+  {
+    _win_snwprintf(wszName, 64, L"\\\\.\\pipe\\plibc-%lu-%ld",
+      GetCurrentProcessId(), InterlockedIncrement(&lPipeSerial));
+    hRead = CreateNamedPipeW(wszName, PIPE_ACCESS_INBOUND |
+      FILE_FLAG_FIRST_PIPE_INSTANCE |
+      ((flags & PLIBC_PIPE_SYNC_READ) ? 0 : FILE_FLAG_OVERLAPPED),
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | dwRejectRemote, 1,
+      size, size, 0, NULL);
+    if (hRead == INVALID_HANDLE_VALUE)
+    {
+      dwErr = GetLastError();
+
+      /* Windows XP doesn't know PIPE_REJECT_REMOTE_CLIENTS */
+      if (dwErr == ERROR_INVALID_PARAMETER && dwRejectRemote)
+      {
+        dwRejectRemote = 0;
+        continue;
+      }
+      if (dwErr != ERROR_ACCESS_DENIED && dwErr != ERROR_PIPE_BUSY)
+        break;
+    }
+  }
+  if (hRead == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(dwErr);
+    return -1;
+  }
+
+  /* FILE_READ_ATTRIBUTES lets us query the free space */
+  hWrite = CreateFileW(wszName, GENERIC_WRITE | FILE_READ_ATTRIBUTES, 0, NULL,
+    OPEN_EXISTING, (flags & PLIBC_PIPE_SYNC_WRITE) ? 0 : FILE_FLAG_OVERLAPPED,
+    NULL);
+  if (hWrite == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(GetLastError());
+    CloseHandle(hRead);
+    return -1;
+  }
+
+  pRead = (flags & PLIBC_PIPE_SYNC_READ) ? NULL : __win_AllocPipe(FALSE, size);
+  pWrite = (flags & PLIBC_PIPE_SYNC_WRITE) ? NULL : __win_AllocPipe(TRUE, size);
+  if ((!pRead && !(flags & PLIBC_PIPE_SYNC_READ)) ||
+    (!pWrite && !(flags & PLIBC_PIPE_SYNC_WRITE)))
+  {
+    __win_FreePipe(pRead);
+    __win_FreePipe(pWrite);
+    CloseHandle(hRead);
+    CloseHandle(hWrite);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  errno = 0;
+  phandles[0] = (intptr_t) hRead;
+  phandles[1] = (intptr_t) hWrite;
+  __win_SetHandleType(phandles[0], PIPE_HANDLE);
+  __win_SetHandleType(phandles[1], PIPE_HANDLE);
+  __win_SetHandlePipe(phandles[0], pRead);
+  __win_SetHandlePipe(phandles[1], pWrite);
+
+  return 0;
+}
+
 /**
  * Make a FIFO special file
  * @todo use mode
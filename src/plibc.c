@@ -44,13 +44,8 @@ char szuUser[261] = "";
 wchar_t *_pwszOrg = NULL, *_pwszApp = NULL;
 char *_pszuOrg = NULL, *_pszuApp = NULL;
 OSVERSIONINFO theWinVersion;
-unsigned int uiSockCount = 0;
-Winsock *pSocks = NULL;
-HANDLE hSocksLock, hHandlesLock;
 unsigned int uiMappingsCount = 0;
-unsigned int uiHandlesCount = 0;
 TMapping *pMappings = NULL;
-THandleInfo *pHandles = NULL;
 HANDLE hMappingsLock;
 TPanicProc __plibc_panic = NULL;
 int iInit = 0;
@@ -60,173 +55,7 @@ TWStat64 _plibc_wstat64 = NULL;
 int _plibc_utf8_mode = 0;
 
 static HINSTANCE hIphlpapi, hAdvapi;
-
-unsigned plibc_get_handle_count()
-{
-  return uiHandlesCount;
-}
-
-BOOL __win_IsHandleMarkedAsBlocking(intptr_t hHandle)
-{
-  BOOL bBlocking;
-  unsigned int uiIndex;
-
-  bBlocking = TRUE;
-  WaitForSingleObject(hSocksLock, INFINITE);
-  for(uiIndex = 0; uiIndex <= uiSockCount; uiIndex++)
-  {
-    if (pSocks[uiIndex].s == hHandle)
-    {
-      bBlocking = pSocks[uiIndex].bBlocking;
-      break;
-    }
-  }
-  ReleaseMutex(hSocksLock);
-
-  return bBlocking;
-}
-
-void __win_SetHandleBlockingMode(intptr_t s, BOOL bBlocking)
-{
-  unsigned int uiIndex = 0;
-  int bFound = 0;
-
-  WaitForSingleObject(hSocksLock, INFINITE);
-
-  for(uiIndex = 0; uiIndex <= uiSockCount; uiIndex++)
-  {
-    if (pSocks[uiIndex].s == s)
-    {
-      bFound = 1;
-      break;
-    }
-  }
-
-  if (bFound)
-    pSocks[uiIndex].bBlocking = bBlocking;
-  else
-  {
-    uiIndex = 0;
-
-    while(TRUE)
-    {
-      int iSet = 0;
-
-      if (pSocks[uiIndex].s == -1)
-      {
-        pSocks[uiIndex].s = s;
-        pSocks[uiIndex].bBlocking = bBlocking;
-        iSet = 1;
-      }
-      if (uiIndex == uiSockCount)
-      {
-        uiSockCount++;
-        pSocks = (Winsock *) realloc(pSocks, (uiSockCount + 1) * sizeof(Winsock));
-        pSocks[uiSockCount].s = -1;
-
-        break;
-      }
-
-      if (iSet)
-        break;
-
-      uiIndex++;
-    }
-  }
-  ReleaseMutex(hSocksLock);
-}
-
-void __win_DiscardHandleBlockingMode(intptr_t s)
-{
-  unsigned int uiIndex;
-
-  WaitForSingleObject(hSocksLock, INFINITE);
-  for(uiIndex = 0; uiIndex <= uiSockCount; uiIndex++)
-    if (pSocks[uiIndex].s == s)
-      pSocks[uiIndex].s = -1;
-  ReleaseMutex(hSocksLock);
-}
-
-THandleType __win_GetHandleType(intptr_t dwHandle)
-{
-  THandleType eType;
-  unsigned int uiIndex;
-
-  eType = UNKNOWN_HANDLE;
-  WaitForSingleObject(hHandlesLock, INFINITE);
-  for(uiIndex = 0; uiIndex <= uiHandlesCount; uiIndex++)
-  {
-    if (pHandles[uiIndex].dwHandle == dwHandle)
-    {
-      eType = pHandles[uiIndex].eType;
-      break;
-    }
-  }
-  ReleaseMutex(hHandlesLock);
-
-  return eType;
-}
-
-void __win_SetHandleType(intptr_t dwHandle, THandleType eType)
-{
-  unsigned int uiIndex = 0;
-  int bFound = 0;
-
-  WaitForSingleObject(hHandlesLock, INFINITE);
-
-  for(uiIndex = 0; uiIndex <= uiHandlesCount; uiIndex++)
-  {
-    if (pHandles[uiIndex].dwHandle == dwHandle)
-    {
-      bFound = 1;
-      break;
-    }
-  }
-
-  if (bFound)
-    pHandles[uiIndex].eType = eType;
-  else
-  {
-    uiIndex = 0;
-
-    while(TRUE)
-    {
-      int iSet = 0;
-
-      if (pHandles[uiIndex].dwHandle == 0)
-      {
-        pHandles[uiIndex].dwHandle = dwHandle;
-        pHandles[uiIndex].eType = eType;
-        iSet = 1;
-      }
-      if (uiIndex == uiHandlesCount)
-      {
-        uiHandlesCount++;
-        pHandles = (THandleInfo *) realloc(pHandles, (uiHandlesCount + 1) * sizeof(THandleInfo));
-        pHandles[uiHandlesCount].dwHandle = 0;
-
-        break;
-      }
-
-      if (iSet)
-        break;
-
-      uiIndex++;
-    }
-  }
-  ReleaseMutex(hHandlesLock);
-}
-
-void __win_DiscardHandleType(intptr_t dwHandle)
-{
-  unsigned int uiIndex;
-
-  WaitForSingleObject(hHandlesLock, INFINITE);
-  for(uiIndex = 0; uiIndex <= uiHandlesCount; uiIndex++)
-    if (pHandles[uiIndex].dwHandle == dwHandle)
-      pHandles[uiIndex].dwHandle = 0;
-  ReleaseMutex(hHandlesLock);
-}
+static int iInitFlags = 0;
 
 /**
  * Check if socket is valid
@@ -282,6 +111,22 @@ int plibc_init(char *pszOrg, char *pszApp)
  * @note Example: plibc_init("My Company", "My Application", 1);
 */
 int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
+{
+  return plibc_init_ex (pszOrg, pszApp, utf8_mode, 0);
+}
+
+/**
+ * @brief Initialize POSIX emulation and set up Windows environment
+ * @param pszOrg Organisation ("GNU" for GNU projects)
+ * @param pszApp Application title
+ * @param utf8_mode 1 to enable automatic UTF-8 conversion, 0 to use system CP
+ * @param flags PLIBC_NATIVE_SYMLINKS to use NTFS symbolic links instead of
+ *        shortcuts (ignored before Windows Vista)
+ * @return Error code from winerror.h, ERROR_SUCCESS on success
+ * @note Example: plibc_init_ex("My Company", "My Application", 1,
+ *       PLIBC_NATIVE_SYMLINKS);
+*/
+int plibc_init_ex(char *pszOrg, char *pszApp, int utf8_mode, int flags)
 {
   long lRet;
   WSADATA wsaData;
@@ -295,7 +140,7 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
 
   if (iInit > 0)
   {
-    if (_plibc_utf8_mode != utf8_mode)
+    if (_plibc_utf8_mode != utf8_mode || iInitFlags != flags)
 	  return ERROR_INVALID_PARAMETER;
 	  
     iInit++;
@@ -303,12 +148,17 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
     return ERROR_SUCCESS;
   }
   _plibc_utf8_mode = utf8_mode;
+  iInitFlags = flags;
 
   __plibc_panic = __plibc_panic_default;
 
+  /* UTF-8 conversion kernels for this CPU */
+  __win_InitTranscoder();
+  __win_InitScratch();
+
   /* Since different modules may initialize to *their* org/app, we need a mechanism to force this
    * information to a global "product name" */
-  binpath = malloc (4200);
+  binpath = __win_Malloc (4200);
   GetModuleFileNameW (NULL, binpath, 4096);
   binpath_idx = binpath + wcslen (binpath);
   while ((binpath_idx > binpath) && (*binpath_idx != L'\\') && (*binpath_idx != L'/'))
@@ -346,9 +196,9 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
   if (ini)
   {
     GetPrivateProfileStringW(L"init", L"organisation", NULL, szUser, sizeof(szUser), binpath);
-    _pwszOrg = wcsdup(szUser);
+    _pwszOrg = __win_WcsDup(szUser);
     GetPrivateProfileStringW(L"init", L"application", NULL, szUser, sizeof(szUser), binpath);
-    _pwszApp = wcsdup(szUser);
+    _pwszApp = __win_WcsDup(szUser);
 
     if (_plibc_utf8_mode == 1)
     {
@@ -369,8 +219,8 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
   {
     strtowchar (pszOrg, &_pwszOrg, CP_UTF8);
     strtowchar (pszApp, &_pwszApp, CP_UTF8);
-    _pszuOrg = strdup(pszOrg);
-    _pszuApp = strdup(pszApp);
+    _pszuOrg = __win_StrDup(pszOrg);
+    _pszuApp = __win_StrDup(pszApp);
   }
 
   /* Init path translation */
@@ -416,7 +266,7 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
                     FORMAT_MESSAGE_IGNORE_INSERTS, NULL, lRet, 0,
                     (LPTSTR) & pszMsg, 0, NULL);
 
-    pszMsg2 = (char *) malloc(lMem + 1);
+    pszMsg2 = (char *) __win_Malloc(lMem + 1);
     strcpy(pszMsg2, pszMsg);
     if(pszMsg2[lMem - 2] == '\r')
       pszMsg2[lMem - 2] = 0;
@@ -441,20 +291,44 @@ int plibc_init_utf8(char *pszOrg, char *pszApp, int utf8_mode)
     return GetLastError();
   }
 
-  /* To keep track of blocking/non-blocking sockets */
-  pSocks = (Winsock *) malloc(sizeof(Winsock) + (uiSockCount + 1));
-  pSocks[0].s = -1;
-  hSocksLock = CreateMutex(NULL, FALSE, NULL);
-
   /* To keep track of mapped files */
-  pMappings = (TMapping *) malloc(sizeof(TMapping));
+  pMappings = (TMapping *) __win_Malloc(sizeof(TMapping));
   pMappings[0].pStart = NULL;
   hMappingsLock = CreateMutex(NULL, FALSE, NULL);
 
-  /* To keep track of handle types */
-  pHandles = (THandleInfo *) malloc(sizeof(THandleInfo));
-  pHandles[0].dwHandle = 0;
-  hHandlesLock = CreateMutex(NULL, FALSE, NULL);
+  /* To keep track of handle types and blocking modes */
+  __win_InitHandleTable();
+
+  /* select() */
+  __win_InitSelect();
+
+  /* poll() */
+  __win_InitPoll();
+
+  /* plibc_epoll_*() */
+  __win_InitEpoll();
+
+  /* plibc_pipe_ex() */
+  __win_InitPipes();
+
+  /* Worker threads for non-blocking writes */
+  __win_InitAio();
+
+  /* pread() and pwrite() */
+  __win_InitPositionalIO();
+
+  /* openat() and friends */
+  __win_InitDirFds();
+  __win_InitDirStreams();
+
+  /* symlink() and friends */
+  __win_InitSymlinks(flags & PLIBC_NATIVE_SYMLINKS);
+
+  /* Cache of path translations, the base directories are known now */
+  __win_InitPathCache();
+  __win_InitMounts();
+  __win_InitShortcutCache();
+  __win_InitStatCache();
 
   /* Open files in binary mode */
   _fmode = _O_BINARY;
@@ -505,14 +379,20 @@ void plibc_shutdown()
   }
 
   WSACleanup();
-  free(pSocks);
-  CloseHandle(hSocksLock);
 
   free(pMappings);
   CloseHandle(hMappingsLock);
 
-  free(pHandles);
-  CloseHandle(hHandlesLock);
+  __win_FreeEpoll();
+  __win_FreeAio();
+  __win_FreePositionalIO();
+  __win_FreeDirStreams();
+  __win_FreeStatCache();
+  __win_FreeShortcutCache();
+  __win_FreeMounts();
+  __win_FreePathCache();
+  __win_FreeHandleTable();
+  __win_FreeScratch();
 
   FreeLibrary(hIphlpapi);
   FreeLibrary(hAdvapi);
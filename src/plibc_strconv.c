@@ -22,6 +22,8 @@
 #include <mbstring.h>
 #include <wchar.h>
 
+#include "plibc_private.h"
+
 /**
  * strtowchar:
  * @str: a string (UTF-8-encoded) to convert
@@ -47,13 +49,29 @@ strtowchar (const char *str, wchar_t **wretstr, UINT cp)
 {
   wchar_t *wstr;
   int len, lenc;
+
+  /* One pass into a buffer sized for the worst case */
+  if (cp == CP_UTF8)
+  {
+    size_t size = strlen (str) + 1;
+
+    wstr = __win_Malloc (sizeof (wchar_t) * size);
+    if (wstr == NULL)
+    {
+      return -2;
+    }
+    __win_Utf8ToUtf16 (str, wstr, size);
+    *wretstr = wstr;
+    return 0;
+  }
+
   len = MultiByteToWideChar (cp, 0, str, -1, NULL, 0);
   if (len <= 0)
   {
     return -1;
   }
   
-  wstr = malloc (sizeof (wchar_t) * len);
+  wstr = __win_Malloc (sizeof (wchar_t) * len);
   if (wstr == NULL)
   {
     return -2;
@@ -73,6 +91,16 @@ int
 strtowchar_buf (const char *str, wchar_t *wstr, long wstr_size, UINT cp)
 {
   int len, lenc;
+
+  if (cp == CP_UTF8)
+  {
+    if (wstr_size <= 0 || __win_Utf8ToUtf16 (str, wstr, wstr_size) < 0)
+    {
+      return -2;
+    }
+    return 0;
+  }
+
   len = MultiByteToWideChar (cp, 0, str, -1, NULL, 0);
   if (len <= 0)
   {
@@ -119,14 +147,30 @@ wchartostr (const wchar_t *wstr, char **retstr, UINT cp)
   char *str;
   int len, lenc;
   BOOL lossy = FALSE;
+
+  /* One pass into a buffer sized for the worst case */
+  if (cp == CP_UTF8)
+  {
+    size_t size = wcslen (wstr) * 3 + 1;
+
+    str = __win_Malloc (size);
+    if (str == NULL)
+    {
+      return -2;
+    }
+    __win_Utf16ToUtf8 (wstr, str, size);
+    *retstr = str;
+    return 0;
+  }
+
   len = WideCharToMultiByte (cp, 0, wstr, -1, NULL, 0, NULL, cp == CP_UTF8 ? NULL : &lossy);
   if (len <= 0)
   {
     return -1;
   }
   
-  str = malloc (sizeof (char) * len);
-  if (wstr == NULL)
+  str = __win_Malloc (sizeof (char) * len);
+  if (str == NULL)
   {
     return -2;
   }
@@ -148,6 +192,16 @@ wchartostr_buf (const wchar_t *wstr, char *str, long str_len, UINT cp)
 {
   int len, lenc;
   BOOL lossy = FALSE;
+
+  if (cp == CP_UTF8)
+  {
+    if (str_len <= 0 || __win_Utf16ToUtf8 (wstr, str, str_len) < 0)
+    {
+      return -2;
+    }
+    return 0;
+  }
+
   len = WideCharToMultiByte (cp, 0, wstr, -1, NULL, 0, NULL, cp == CP_UTF8 ? NULL : &lossy);
   if (len <= 0)
   {
@@ -0,0 +1,473 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/poll.c
+ * @brief poll()
+ *
+ * If all descriptors are sockets, poll() is WSAPoll() (Windows Vista and
+ * later). Otherwise, the sockets are checked with WSAPoll() and bound to an
+ * event with WSAEventSelect(), which is waited for together with the other
+ * handles, like select() does. The work depends on the number of
+ * descriptors passed, not on their values.
+ */
+
+#include "plibc_private.h"
+
+typedef int (WSAAPI *TWSAPoll) (struct pollfd *fdArray, ULONG fds,
+  int timeout);
+
+static TWSAPoll pWSAPoll;
+
+#define POLL_PIPE_POLL_MAX 16           /* ms between pipe checks */
+
+/* What WSAPoll() accepts */
+#define POLL_SOCKET_EVENTS (POLLRDNORM | POLLRDBAND | POLLWRNORM)
+
+/**
+ * @brief Set up poll()
+ * @internal
+ */
+void __win_InitPoll()
+{
+  pWSAPoll = (TWSAPoll) GetProcAddress(GetModuleHandle("ws2_32.dll"),
+    "WSAPoll");
+}
+
+/**
+ * @brief Poll sockets
+ * @internal
+ * @param pSrc descriptors passed to poll()
+ * @param pSockets scratch array, receives the sockets of pSrc
+ * @param plIndex scratch array, receives the indices into pSrc
+ * @return number of ready sockets, -1 on error
+ */
+static int __win_PollSockets(struct pollfd *pSrc, struct pollfd *pSockets,
+  unsigned long *plIndex, unsigned long ulSockets, int timeout)
+{
+  unsigned long ul;
+  int iRet;
+
+  for (ul = 0; ul < ulSockets; ul++)
+  {
+    pSockets[ul].fd = pSrc[plIndex[ul]].fd;
+    pSockets[ul].events = pSrc[plIndex[ul]].events & POLL_SOCKET_EVENTS;
+    pSockets[ul].revents = 0;
+  }
+
+  iRet = pWSAPoll(pSockets, ulSockets, timeout);
+  if (iRet == SOCKET_ERROR)
+  {
+    SetErrnoFromWinsockError(WSAGetLastError());
+    if (errno == ENOTSOCK)
+      errno = EBADF;
+
+    return -1;
+  }
+
+  for (ul = 0; ul < ulSockets; ul++)
+    pSrc[plIndex[ul]].revents = pSockets[ul].revents;
+
+  return iRet;
+}
+
+/**
+ * @brief Check a pipe
+ * @internal
+ */
+static short __win_PollPipe(struct pollfd *pfd)
+{
+  DWORD dwBytes;
+
+  if (!PeekNamedPipe((HANDLE) pfd->fd, NULL, 0, NULL, &dwBytes, NULL))
+    return GetLastError() == ERROR_BROKEN_PIPE ? POLLHUP : POLLERR;
+
+  return dwBytes ? pfd->events & POLLIN : 0;
+}
+
+/**
+ * @brief poll() without WSAPoll()
+ * @internal
+ */
+static int __win_PollBySelect(struct pollfd *fds, unsigned long nfds,
+  int timeout)
+{
+  fd_set rfds, wfds, efds;
+  struct timeval tv;
+  unsigned long ul;
+  int iMax, iRet;
+
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  FD_ZERO(&efds);
+  iMax = -1;
+  for (ul = 0; ul < nfds; ul++)
+  {
+    fds[ul].revents = 0;
+    if ((intptr_t) fds[ul].fd < 0)
+      continue;
+
+    if (rfds.fd_count >= FD_SETSIZE || wfds.fd_count >= FD_SETSIZE ||
+      efds.fd_count >= FD_SETSIZE)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    if (fds[ul].events & POLLIN)
+      FD_SET(fds[ul].fd, &rfds);
+    if (fds[ul].events & POLLOUT)
+      FD_SET(fds[ul].fd, &wfds);
+    if (fds[ul].events & POLLPRI)
+      FD_SET(fds[ul].fd, &efds);
+    if ((int) fds[ul].fd > iMax)
+      iMax = (int) fds[ul].fd;
+  }
+
+  /* Only negative descriptors, select() would fail */
+  if (iMax == -1)
+  {
+    Sleep(timeout < 0 ? INFINITE : (DWORD) timeout);
+    return 0;
+  }
+
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  iRet = _win_select(iMax + 1, &rfds, &wfds, &efds, timeout < 0 ? NULL : &tv);
+  if (iRet <= 0)
+    return iRet;
+
+  iRet = 0;
+  for (ul = 0; ul < nfds; ul++)
+  {
+    if ((intptr_t) fds[ul].fd < 0)
+      continue;
+
+    if (FD_ISSET(fds[ul].fd, &rfds))
+      fds[ul].revents |= fds[ul].events & POLLIN;
+    if (FD_ISSET(fds[ul].fd, &wfds))
+      fds[ul].revents |= fds[ul].events & POLLOUT;
+    if (FD_ISSET(fds[ul].fd, &efds))
+      fds[ul].revents |= POLLPRI;
+    if (fds[ul].revents)
+      iRet++;
+  }
+
+  return iRet;
+}
+
+/**
+ * @brief Wait for some event on a set of file descriptors
+ * @param timeout in milliseconds, -1 to wait forever
+ * @return number of descriptors with events, 0 on timeout, -1 on error
+ * @note Files and other waitable handles are ready for everything as soon
+ *       as they are signaled. Pipes are waited for like select() does. Only
+ *       write ends created by plibc_pipe_ex() are checked for POLLOUT and
+ *       report POLLERR once the reader is gone, other pipes are only checked
+ *       for readability (errno = ENOSYS for POLLOUT).
+ *       At most MAXIMUM_WAIT_OBJECTS - 1 descriptors may be other than
+ *       sockets (errno = EINVAL).
+ */
+int _win_poll(struct pollfd *fds, unsigned long nfds, int timeout)
+{
+  struct pollfd *pSockets;
+  unsigned long *plIndex, ul, ulSockets, ulHandles, ulPipes, ulWriters;
+  unsigned long aulHandles[MAXIMUM_WAIT_OBJECTS], aulPipes[MAXIMUM_WAIT_OBJECTS];
+  unsigned long aulWriters[MAXIMUM_WAIT_OBJECTS];
+  HANDLE ahWait[MAXIMUM_WAIT_OBJECTS];
+  TPipeWaiter pipes[MAXIMUM_WAIT_OBJECTS];
+  THandleInfo writers[MAXIMUM_WAIT_OBJECTS];  /* made by plibc_pipe_ex() */
+  THandleInfo info;
+  WSAEVENT hSockEvent;
+  DWORD dwStart, dwElapsed, dwWait, dwPoll, wret, nWait;
+  BOOL bPipeThreads;
+  long lEvents;
+  int iRet, iReady;
+
+  if (nfds && !fds)
+  {
+    errno = EFAULT;
+    return -1;
+  }
+
+  /* Sleep */
+  if (!nfds)
+  {
+    Sleep(timeout < 0 ? INFINITE : (DWORD) timeout);
+    return 0;
+  }
+
+  if (!pWSAPoll)
+    return __win_PollBySelect(fds, nfds, timeout);
+
+  pSockets = (struct pollfd *) __win_ScratchAlloc(nfds *
+    (sizeof(struct pollfd) + sizeof(unsigned long)));
+  if (!pSockets)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  plIndex = (unsigned long *) (pSockets + nfds);
+
+  /* Sort the descriptors by type */
+  ulSockets = ulHandles = ulPipes = ulWriters = 0;
+  iRet = 0;
+  for (ul = 0; ul < nfds && iRet == 0; ul++)
+  {
+    fds[ul].revents = 0;
+    if ((intptr_t) fds[ul].fd < 0)
+      continue;
+
+    if (!__win_GetHandleInfo(fds[ul].fd, &info))
+    {
+      info.eType = UNKNOWN_HANDLE;
+      info.pPipe = NULL;
+    }
+    if (info.eType == SOCKET_HANDLE)
+      plIndex[ulSockets++] = ul;
+    else if (ulHandles + ulPipes + ulWriters >= MAXIMUM_WAIT_OBJECTS - 1)
+    {
+      /* One slot is left for the sockets */
+      errno = EINVAL;
+      iRet = -1;
+    }
+    else if (info.eType == PIPE_HANDLE && __win_GetPipeWriteEvent(&info))
+    {
+      writers[ulWriters] = info;
+      aulWriters[ulWriters++] = ul;
+    }
+    else if (info.eType == PIPE_HANDLE)
+    {
+      if (fds[ul].events & POLLOUT)
+      {
+        errno = ENOSYS;
+        iRet = -1;  /* Not implemented */
+      }
+      else
+      {
+        pipes[ulPipes].iFD = fds[ul].fd;
+        pipes[ulPipes].bOverlapped = info.pPipe != NULL;
+        pipes[ulPipes].hThread = NULL;
+        pipes[ulPipes].hReady = NULL;
+        pipes[ulPipes].hPort = NULL;
+        aulPipes[ulPipes++] = ul;
+      }
+    }
+    else
+    {
+      ahWait[ulHandles] = (HANDLE) _get_osfhandle(fds[ul].fd);
+      if (ahWait[ulHandles] == (HANDLE)(intptr_t) -1)
+        ahWait[ulHandles] = (HANDLE) fds[ul].fd;
+      aulHandles[ulHandles++] = ul;
+    }
+  }
+  if (iRet == -1)
+  {
+    __win_ScratchFree(pSockets);
+    return -1;
+  }
+
+  /* Fast path */
+  if (!ulHandles && !ulPipes && !ulWriters)
+  {
+    /* Only negative descriptors, WSAPoll() would fail */
+    if (!ulSockets)
+    {
+      __win_ScratchFree(pSockets);
+      Sleep(timeout < 0 ? INFINITE : (DWORD) timeout);
+      return 0;
+    }
+
+    iRet = __win_PollSockets(fds, pSockets, plIndex, ulSockets, timeout);
+    __win_ScratchFree(pSockets);
+    return iRet;
+  }
+
+  /* Bind the sockets to an event */
+  hSockEvent = WSA_INVALID_EVENT;
+  if (ulSockets)
+  {
+    hSockEvent = WSACreateEvent();
+    if (hSockEvent == WSA_INVALID_EVENT)
+    {
+      SetErrnoFromWinsockError(WSAGetLastError());
+      __win_ScratchFree(pSockets);
+      return -1;
+    }
+
+    for (ul = 0; ul < ulSockets; ul++)
+    {
+      struct pollfd *pfd = &fds[plIndex[ul]];
+
+      lEvents = FD_CLOSE;
+      if (pfd->events & POLLIN)
+        lEvents |= FD_READ | FD_ACCEPT;
+      if (pfd->events & POLLOUT)
+        lEvents |= FD_WRITE | FD_CONNECT;
+      if (pfd->events & POLLPRI)
+        lEvents |= FD_OOB;
+
+      if (WSAEventSelect(pfd->fd, hSockEvent, lEvents) == SOCKET_ERROR)
+      {
+        SetErrnoFromWinsockError(WSAGetLastError());
+        if (errno == ENOTSOCK)
+          errno = EBADF;
+        ulSockets = ul;
+        iRet = -1;
+        break;
+      }
+    }
+    ahWait[ulHandles] = hSockEvent;
+  }
+  nWait = ulHandles + (ulSockets ? 1 : 0);
+
+  /* Write ends that aren't asked for POLLOUT would always wake us up */
+  for (ul = 0; ul < ulWriters; ul++)
+  {
+    if (fds[aulWriters[ul]].events & POLLOUT)
+      ahWait[nWait++] = __win_GetPipeWriteEvent(&writers[ul]);
+  }
+
+  bPipeThreads = __win_CanWaitForPipes();
+  for (ul = 0; bPipeThreads && ul < ulPipes; ul++)
+  {
+    pipes[ul].hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!pipes[ul].hReady)
+      bPipeThreads = FALSE;
+  }
+  if (bPipeThreads)
+  {
+    for (ul = 0; ul < ulPipes; ul++)
+      ahWait[nWait++] = pipes[ul].hReady;
+  }
+
+  dwStart = GetTickCount();
+  dwPoll = 1;
+  while (iRet == 0)
+  {
+    /* Reset before checking, so that nothing gets lost */
+    if (hSockEvent != WSA_INVALID_EVENT)
+      WSAResetEvent(hSockEvent);
+
+    iReady = 0;
+    if (ulSockets)
+    {
+      iReady = __win_PollSockets(fds, pSockets, plIndex, ulSockets, 0);
+      if (iReady == -1)
+      {
+        iRet = -1;
+        break;
+      }
+    }
+    for (ul = 0; ul < ulHandles; ul++)
+    {
+      if (WaitForSingleObject(ahWait[ul], 0) == WAIT_OBJECT_0)
+      {
+        fds[aulHandles[ul]].revents = fds[aulHandles[ul]].events &
+          (POLLIN | POLLOUT);
+        if (fds[aulHandles[ul]].revents)
+          iReady++;
+      }
+    }
+    for (ul = 0; ul < ulPipes; ul++)
+    {
+      fds[aulPipes[ul]].revents = __win_PollPipe(&fds[aulPipes[ul]]);
+      if (fds[aulPipes[ul]].revents)
+        iReady++;
+    }
+    for (ul = 0; ul < ulWriters; ul++)
+    {
+      struct pollfd *pfd = &fds[aulWriters[ul]];
+      short sState = __win_PipeWritable(&writers[ul]);
+
+      pfd->revents = sState == POLLERR ? POLLERR : sState & pfd->events;
+      if (pfd->revents)
+        iReady++;
+    }
+    if (iReady)
+    {
+      iRet = iReady;
+      break;
+    }
+
+    if (timeout < 0)
+      dwWait = INFINITE;
+    else
+    {
+      dwElapsed = GetTickCount() - dwStart;
+      if (dwElapsed >= (DWORD) timeout)
+        break;
+      dwWait = timeout - dwElapsed;
+    }
+
+    if (ulPipes)
+    {
+      if (bPipeThreads)
+      {
+        for (ul = 0; ul < ulPipes; ul++)
+          __win_StartPipeWaiter(&pipes[ul]);
+      }
+      else
+      {
+        if (dwWait > dwPoll)
+          dwWait = dwPoll;
+        if (dwPoll < POLL_PIPE_POLL_MAX)
+          dwPoll *= 2;
+      }
+    }
+
+    if (nWait)
+      wret = WaitForMultipleObjects(nWait, ahWait, FALSE, dwWait);
+    else
+    {
+      /* Only polled pipes */
+      Sleep(dwWait);
+      wret = WAIT_TIMEOUT;
+    }
+    if (wret == WAIT_FAILED)
+    {
+      SetErrnoFromWinError(GetLastError());
+      iRet = -1;
+      break;
+    }
+
+    /* Waiters that returned are restarted if the pipe isn't ready */
+    for (ul = 0; bPipeThreads && ul < ulPipes; ul++)
+    {
+      if (WaitForSingleObject(pipes[ul].hReady, 0) == WAIT_OBJECT_0)
+        __win_StopPipeWaiter(&pipes[ul]);
+    }
+  }
+
+  /* Clean up */
+  for (ul = 0; ul < ulPipes; ul++)
+  {
+    __win_StopPipeWaiter(&pipes[ul]);
+    if (pipes[ul].hReady)
+      CloseHandle(pipes[ul].hReady);
+  }
+  for (ul = 0; ul < ulSockets; ul++)
+    __win_UnbindSocketEvent(fds[plIndex[ul]].fd);
+  if (hSockEvent != WSA_INVALID_EVENT)
+    WSACloseEvent(hSockEvent);
+  __win_ScratchFree(pSockets);
+
+  return iRet;
+}
+
+/* end of poll.c */
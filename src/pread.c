@@ -0,0 +1,280 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/pread.c
+ * @brief pread()
+ *
+ * A ReadFile() with an offset in its OVERLAPPED structure still moves the
+ * file pointer of a synchronous handle. Positional I/O therefore goes
+ * through a second handle to the same file, opened for overlapped I/O with
+ * ReOpenFile() and kept in the descriptor registry until close(). Overlapped
+ * handles have no file pointer, so concurrent readers don't interfere.
+ * If ReOpenFile() isn't available (Windows XP and earlier), the CRT handle
+ * is used and the file pointer moves.
+ */
+
+#include "plibc_private.h"
+
+typedef HANDLE (WINAPI *TReOpenFile) (HANDLE hOriginalFile,
+  DWORD dwDesiredAccess, DWORD dwShareMode, DWORD dwFlags);
+
+/* Taken from the Wine project <http://www.winehq.org>
+    /wine/include/winternl.h */
+typedef struct
+{
+  ULONG Attributes;
+  ACCESS_MASK GrantedAccess;
+  ULONG HandleCount;
+  ULONG PointerCount;
+  ULONG Reserved[10];
+} PLIBC_OBJECT_BASIC_INFORMATION;
+
+typedef LONG (WINAPI *TNtQueryObject) (HANDLE Handle, int ObjectInformationClass,
+  PVOID ObjectInformation, ULONG ObjectInformationLength, PULONG ReturnLength);
+
+#define ObjectBasicInformation 0
+
+static TReOpenFile pReOpenFile = NULL;
+static TNtQueryObject pNtQueryObject = NULL;
+
+/* Unused events for overlapped I/O */
+static CRITICAL_SECTION csEvents;
+static HANDLE *phEvents = NULL;
+static unsigned int uiEvents = 0, uiEventsSize = 0;
+
+/**
+ * @brief Set up positional I/O
+ * @internal
+ */
+void __win_InitPositionalIO()
+{
+  InitializeCriticalSection(&csEvents);
+
+  pReOpenFile = (TReOpenFile) GetProcAddress(GetModuleHandle("kernel32.dll"),
+    "ReOpenFile");
+  pNtQueryObject = (TNtQueryObject)
+    GetProcAddress(GetModuleHandle("ntdll.dll"), "NtQueryObject");
+}
+
+/**
+ * @brief Free the event cache
+ * @internal
+ */
+void __win_FreePositionalIO()
+{
+  while (uiEvents)
+    CloseHandle(phEvents[--uiEvents]);
+  free(phEvents);
+  phEvents = NULL;
+  uiEventsSize = 0;
+
+  DeleteCriticalSection(&csEvents);
+}
+
+static HANDLE __win_AcquireEvent()
+{
+  HANDLE hEvent;
+
+  EnterCriticalSection(&csEvents);
+  hEvent = uiEvents ? phEvents[--uiEvents] : NULL;
+  LeaveCriticalSection(&csEvents);
+
+  if (!hEvent)
+    hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+  return hEvent;
+}
+
+static void __win_ReleaseEvent(HANDLE hEvent)
+{
+  EnterCriticalSection(&csEvents);
+  if (uiEvents == uiEventsSize)
+  {
+    HANDLE *phNew;
+
+    phNew = (HANDLE *) __win_Realloc(phEvents,
+      (uiEventsSize + 16) * sizeof(HANDLE));
+    if (phNew)
+    {
+      phEvents = phNew;
+      uiEventsSize += 16;
+    }
+  }
+  if (uiEvents < uiEventsSize)
+  {
+    phEvents[uiEvents++] = hEvent;
+    hEvent = NULL;
+  }
+  LeaveCriticalSection(&csEvents);
+
+  if (hEvent)
+    CloseHandle(hEvent);
+}
+
+/**
+ * @brief Get the overlapped handle of a descriptor
+ * @internal
+ * @return the handle or NULL if the CRT handle has to be used
+ * @note The new handle gets the same access rights as the original one, so
+ *       that pwrite() on a read-only descriptor still fails.
+ */
+static HANDLE __win_GetPositionalHandle(const THandleInfo *pInfo,
+  HANDLE hFile)
+{
+  PLIBC_OBJECT_BASIC_INFORMATION basicInfo;
+  HANDLE h;
+
+  if (pInfo->hPositional)
+    return pInfo->hPositional == INVALID_HANDLE_VALUE ? NULL :
+      pInfo->hPositional;
+
+  h = INVALID_HANDLE_VALUE;
+  if (pReOpenFile && pNtQueryObject && GetFileType(hFile) == FILE_TYPE_DISK &&
+    pNtQueryObject(hFile, ObjectBasicInformation, &basicInfo,
+      sizeof(basicInfo), NULL) >= 0)
+  {
+    h = pReOpenFile(hFile, basicInfo.GrantedAccess &
+      (FILE_GENERIC_READ | FILE_GENERIC_WRITE),
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      FILE_FLAG_OVERLAPPED);
+  }
+
+  /* Don't try again if this failed. Another thread may have been faster. */
+  hFile = __win_SetHandlePositional(pInfo->dwHandle, h);
+  if (hFile != h && h != INVALID_HANDLE_VALUE)
+    CloseHandle(h);
+
+  return hFile == INVALID_HANDLE_VALUE ? NULL : hFile;
+}
+
+/**
+ * @brief Read or write at an offset
+ * @internal
+ * @return number of bytes transferred or -1 (errno is set)
+ */
+int __win_PositionalIO(int fildes, void *buf, size_t nbyte, int64_t offset,
+  BOOL bWrite)
+{
+  THandleInfo info;
+  OVERLAPPED ov;
+  HANDLE hFile, h;
+  DWORD dwDone, dwErr;
+  BOOL bOk;
+
+  if (!__win_GetHandleInfo(fildes, &info))
+  {
+    info.dwHandle = fildes;
+    info.eType = UNKNOWN_HANDLE;
+    info.hPositional = INVALID_HANDLE_VALUE;
+  }
+
+  if (info.eType == SOCKET_HANDLE || info.eType == PIPE_HANDLE)
+  {
+    errno = ESPIPE;
+    return -1;
+  }
+  if (info.eType == DIR_HANDLE)
+  {
+    errno = EISDIR;
+    return -1;
+  }
+  if (offset < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nbyte > INT_MAX)
+    nbyte = INT_MAX;
+
+  if (info.eType == FD_HANDLE)
+    hFile = (HANDLE) _get_osfhandle(fildes);
+  else
+    hFile = (HANDLE) (intptr_t) fildes;
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  /* CRT descriptors of pipes and devices have no offset. A positional
+     handle exists only for disk files, so it saves the check. */
+  if ((!info.hPositional || info.hPositional == INVALID_HANDLE_VALUE) &&
+    GetFileType(hFile) != FILE_TYPE_DISK)
+  {
+    errno = ESPIPE;
+    return -1;
+  }
+
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = (DWORD) offset;
+  ov.OffsetHigh = (DWORD) (offset >> 32);
+
+  h = __win_GetPositionalHandle(&info, hFile);
+  if (h)
+  {
+    ov.hEvent = __win_AcquireEvent();
+    if (!ov.hEvent)
+      h = NULL;
+  }
+  if (!h)
+    h = hFile;
+
+  if (bWrite)
+    bOk = WriteFile(h, buf, nbyte, &dwDone, &ov);
+  else
+    bOk = ReadFile(h, buf, nbyte, &dwDone, &ov);
+  if (!bOk && GetLastError() == ERROR_IO_PENDING)
+    bOk = GetOverlappedResult(h, &ov, &dwDone, TRUE);
+  dwErr = bOk ? ERROR_SUCCESS : GetLastError();
+
+  if (ov.hEvent)
+    __win_ReleaseEvent(ov.hEvent);
+
+  if (!bOk)
+  {
+    if (!bWrite && dwErr == ERROR_HANDLE_EOF)
+      return 0;
+
+    SetErrnoFromWinError(dwErr);
+    return -1;
+  }
+
+  return dwDone;
+}
+
+/**
+ * @brief Read from a file at the given offset without moving the file
+ *        pointer
+ */
+int _win_pread(int fildes, void *buf, size_t nbyte, off_t offset)
+{
+  return __win_PositionalIO(fildes, buf, nbyte, offset, FALSE);
+}
+
+/**
+ * @brief Read from a file at the given 64 bit offset without moving the file
+ *        pointer
+ */
+int _win_pread64(int fildes, void *buf, size_t nbyte, int64_t offset)
+{
+  return __win_PositionalIO(fildes, buf, nbyte, offset, FALSE);
+}
+
+/* end of pread.c */
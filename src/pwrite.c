@@ -0,0 +1,45 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/pwrite.c
+ * @brief pwrite()
+ */
+
+#include "plibc_private.h"
+
+/**
+ * @brief Write to a file at the given offset without moving the file
+ *        pointer
+ */
+int _win_pwrite(int fildes, const void *buf, size_t nbyte, off_t offset)
+{
+  return __win_PositionalIO(fildes, (void *) buf, nbyte, offset, TRUE);
+}
+
+/**
+ * @brief Write to a file at the given 64 bit offset without moving the file
+ *        pointer
+ */
+int _win_pwrite64(int fildes, const void *buf, size_t nbyte, int64_t offset)
+{
+  return __win_PositionalIO(fildes, (void *) buf, nbyte, offset, TRUE);
+}
+
+/* end of pwrite.c */
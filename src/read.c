@@ -24,18 +24,17 @@
 
 #include "plibc_private.h"
 
-DWORD WINAPI __win_Read(TReadWriteInfo *pInfo)
+/**
+ * @brief Carry out a read
+ * @internal
+ */
+int __win_Read(TReadWriteInfo *pInfo)
 {
-  int iRet;
-  
-  if (__win_GetHandleType(pInfo->fildes) == FD_HANDLE)
+  if (pInfo->eType == FD_HANDLE)
   {
     _setmode(pInfo->fildes, _O_BINARY);
     errno = 0;
-    iRet = _read(pInfo->fildes, pInfo->buf, pInfo->nbyte);
-    free(pInfo);
-    
-    return iRet;
+    return _read(pInfo->fildes, pInfo->buf, pInfo->nbyte);
   }
   else
   {
@@ -45,47 +44,142 @@ DWORD WINAPI __win_Read(TReadWriteInfo *pInfo)
     if (!ReadFile((HANDLE) pInfo->fildes, pInfo->buf, pInfo->nbyte, &dwRead,
       NULL))
     {
-      free(pInfo);
       SetErrnoFromWinError(GetLastError());
       return -1;
     }
     else
-    {
-      free(pInfo);
       return dwRead;
+  }
+}
+
+/**
+ * @brief Check whether a read from console input would return at once
+ * @internal
+ * @note In line input mode, ReadFile() waits for the Enter key
+ */
+static BOOL __win_ConsoleReadable(HANDLE h, DWORD dwMode)
+{
+  INPUT_RECORD records[64];
+  DWORD dwCount, dwIndex;
+
+  if (WaitForSingleObject(h, 0) != WAIT_OBJECT_0)
+    return FALSE;
+
+  if (!PeekConsoleInputW(h, records, sizeof(records) / sizeof(records[0]),
+    &dwCount))
+    return TRUE;
+
+  for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
+  {
+    KEY_EVENT_RECORD *pKey = &records[dwIndex].Event.KeyEvent;
+
+    if (records[dwIndex].EventType != KEY_EVENT || !pKey->bKeyDown ||
+      !pKey->uChar.UnicodeChar)
+      continue;
+    if (!(dwMode & ENABLE_LINE_INPUT) || pKey->uChar.UnicodeChar == L'\r')
+      return TRUE;
+  }
+
+  /* More input than we looked at, let ReadFile() decide */
+  return dwCount == sizeof(records) / sizeof(records[0]);
+}
+
+/**
+ * @brief Read from a non-blocking descriptor
+ * @internal
+ * @note Pipes are peeked and console input is checked for pending keys
+ *       first so that ReadFile() never waits. Disk files cannot block for
+ *       long and are read directly. Other character devices, e.g. serial
+ *       ports, are read in blocking mode as far as their driver allows;
+ *       set their timeouts with SetCommTimeouts() to avoid waiting.
+ */
+static int __win_ReadNonBlocking(TReadWriteInfo *pInfo)
+{
+  HANDLE h;
+
+  if (pInfo->eType == FD_HANDLE)
+    h = (HANDLE) _get_osfhandle(pInfo->fildes);
+  else
+    h = (HANDLE) pInfo->fildes;
+
+  if (GetFileType(h) == FILE_TYPE_PIPE)
+  {
+    DWORD dwAvail;
+
+    if (!PeekNamedPipe(h, NULL, 0, NULL, &dwAvail, NULL))
+    {
+      DWORD dwErr = GetLastError();
+
+      /* Writer closed its end */
+      if (dwErr == ERROR_BROKEN_PIPE)
+        return 0;
+
+      SetErrnoFromWinError(dwErr);
+      return -1;
+    }
+
+    if (!dwAvail)
+    {
+      __win_EpollRearm(pInfo->fildes);
+      errno = EAGAIN;
+      return -1;
     }
+
+    if (pInfo->nbyte > dwAvail)
+      pInfo->nbyte = dwAvail;
   }
+  else
+  {
+    DWORD dwMode;
+
+    if (GetConsoleMode(h, &dwMode) && !__win_ConsoleReadable(h, dwMode))
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+
+  return __win_Read(pInfo);
 }
 
 /**
  * @brief Reads data from a file.
- *        If the handle is in non-blocking mode, this function
- *        always returns 1 for non-sockets.
+ *        If the handle is in non-blocking mode and no data is available,
+ *        this function fails with EAGAIN.
  */
 int _win_read(int fildes, void *buf, size_t nbyte)
 {
-  if (__win_GetHandleType(fildes) == SOCKET_HANDLE)
+  THandleInfo info;
+
+  if (!__win_GetHandleInfo(fildes, &info))
+  {
+    info.eType = UNKNOWN_HANDLE;
+    info.bBlocking = TRUE;
+    info.pPipe = NULL;
+  }
+
+  if (info.eType == SOCKET_HANDLE)
     return _win_recv(fildes, (char *) buf, nbyte, 0);
+  else if (info.eType == DIR_HANDLE)
+  {
+    errno = EISDIR;
+    return -1;
+  }
+  else if (info.pPipe)
+    return __win_PipeRead(&info, buf, nbyte);
   else
   {
-    TReadWriteInfo *pInfo;
-    
-    pInfo = malloc(sizeof(TReadWriteInfo));
-    pInfo->fildes = fildes;
-    pInfo->buf = buf;
-    pInfo->nbyte = nbyte;
+    TReadWriteInfo rwInfo;
 
-    if (__win_IsHandleMarkedAsBlocking(fildes))
-      return __win_Read(pInfo);
+    rwInfo.fildes = fildes;
+    rwInfo.eType = info.eType;
+    rwInfo.buf = buf;
+    rwInfo.nbyte = nbyte;
+
+    if (info.bBlocking)
+      return __win_Read(&rwInfo);
     else
-    {
-      DWORD dwTID; /* Last ptr of CreateThread my not be NULL under Win9x */
-      HANDLE h;
-      
-      h = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) __win_Read, pInfo, 0, &dwTID);
-      CloseHandle(h);
-      return 1;
-    }
+      return __win_ReadNonBlocking(&rwInfo);
   }
 }
 
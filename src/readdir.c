@@ -19,47 +19,167 @@
 
 /**
  * @file src/readdir.c
- * @brief readdir()
+ * @brief readdir(), plibc_readdir_bulk()
  */
 
 #include "plibc_private.h"
 
+/**
+ * @brief Advance to the next entry
+ * @internal
+ * @return FALSE at the end of the directory or on error (errno set)
+ */
+BOOL __win_NextDirEntry(struct plibc_WDIR *pwd)
+{
+  DWORD dwErr;
+
+  if (pwd->iError)
+  {
+    errno = pwd->iError;
+    pwd->iError = 0;
+    return FALSE;
+  }
+  if (pwd->bHaveEntry)
+  {
+    pwd->bHaveEntry = FALSE;
+    pwd->lPos++;
+    return TRUE;
+  }
+  if (pwd->hFind == INVALID_HANDLE_VALUE)
+    return FALSE;
+
+  if (FindNextFileW(pwd->hFind, &pwd->findData))
+  {
+    pwd->lPos++;
+    return TRUE;
+  }
+
+  dwErr = GetLastError();
+  if (dwErr != ERROR_NO_MORE_FILES)
+    SetErrnoFromWinError(dwErr);
+
+  return FALSE;
+}
+
+/**
+ * @brief Get the d_type of the current entry
+ * @internal
+ */
+static unsigned char __win_DirEntryType(struct plibc_WDIR *pwd)
+{
+  DWORD dwAttr = pwd->findData.dwFileAttributes;
+
+  /* dwReserved0 holds the reparse tag */
+  if ((dwAttr & FILE_ATTRIBUTE_REPARSE_POINT) && _plibc_native_symlinks &&
+    (pwd->findData.dwReserved0 == IO_REPARSE_TAG_SYMLINK ||
+    pwd->findData.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT))
+    return DT_LNK;
+  if (dwAttr & FILE_ATTRIBUTE_DIRECTORY)
+    return DT_DIR;
+  if (dwAttr & FILE_ATTRIBUTE_DEVICE)
+    return DT_CHR;
+
+  return DT_REG;
+}
+
 /**
  * @brief Read a directory
  */
 struct dirent *_win_readdir(DIR *dirp)
 {
-  /* readdir sets errno */
-  if (_plibc_utf8_mode == 1)
+  struct plibc_WDIR *pwd;
+  int iLen;
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd)
   {
-    struct _wdirent *w;
-    struct plibc_WDIR *pwd;
-    errno = 0;
-    pwd = (struct plibc_WDIR *) dirp;
-    if (pwd->self != pwd)
-    {
-      errno = EINVAL;
-      return NULL;
-    }
+    errno = EINVAL;
+    return NULL;
+  }
 
-    w = _wreaddir(pwd->mingw_wdir);
-    if (w == NULL)
-      return NULL;
+  errno = 0;
+  if (!__win_NextDirEntry(pwd))
+    return NULL;
 
-    pwd->udirent.d_ino = w->d_ino;
-    pwd->udirent.d_reclen = w->d_reclen;
-    pwd->udirent.d_namlen = w->d_namlen;
+  iLen = __win_Utf16ToLocal(pwd->findData.cFileName,
+    pwd->udirent.d_name, FILENAME_MAX);
+  if (iLen < 0)
+  {
+    errno = EOVERFLOW;
+    return NULL;
+  }
+  pwd->udirent.d_ino = 0;
+  pwd->udirent.d_reclen = 0;
+  pwd->udirent.d_namlen = iLen;
+  return &pwd->udirent;
+}
+
+/**
+ * @brief Read several directory entries at once, including the metadata
+ *        that would otherwise take a stat() per entry
+ * @param dirp directory stream
+ * @param entries receives the entries
+ * @param count number of elements in entries
+ * @return number of entries read, 0 at the end of the directory, -1 on
+ *         error
+ * @note Entries are served from the buffer FindNextFileW() fills, so this
+ *       costs one system call per batch of entries rather than per entry.
+ *       d_size and d_mtime describe a link itself, not its target.
+ */
+int plibc_readdir_bulk(DIR *dirp, struct plibc_dirent *entries, int count)
+{
+  struct plibc_WDIR *pwd;
+  struct plibc_dirent *pEntry;
+  int iRet, iLen;
 
-    if (wchartostr_buf (w->d_name, pwd->udirent.d_name, FILENAME_MAX, CP_UTF8) < 0)
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd || count < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  errno = 0;
+  for (iRet = 0; iRet < count; iRet++)
+  {
+    if (!__win_NextDirEntry(pwd))
+    {
+      if (errno && iRet == 0)
+        return -1;
+
+      /* Report the error with the next call */
+      if (errno)
+      {
+        pwd->iError = errno;
+        errno = 0;
+      }
+      break;
+    }
+
+    pEntry = &entries[iRet];
+    iLen = __win_Utf16ToLocal(pwd->findData.cFileName, pEntry->d_name,
+      sizeof(pEntry->d_name));
+    if (iLen < 0)
     {
-      errno = EOVERFLOW;
-      return NULL;
+      if (iRet == 0)
+      {
+        errno = EOVERFLOW;
+        return -1;
+      }
+
+      /* Keep the entry for the next call */
+      pwd->bHaveEntry = TRUE;
+      pwd->lPos--;
+      break;
     }
-    pwd->udirent.d_namlen = strlen (pwd->udirent.d_name);
-    return &pwd->udirent;
+    pEntry->d_namlen = iLen;
+    pEntry->d_type = __win_DirEntryType(pwd);
+    pEntry->d_attributes = pwd->findData.dwFileAttributes;
+    pEntry->d_size = ((int64_t) pwd->findData.nFileSizeHigh << 32) |
+      pwd->findData.nFileSizeLow;
+    pEntry->d_mtime = __win_FileTimeToUnix(&pwd->findData.ftLastWriteTime);
   }
-  else
-    return readdir(dirp);
+
+  return iRet;
 }
 
 /* end of readdir.c */
@@ -38,10 +38,48 @@ int _win_readlink(const char *path, char *buf, size_t bufsize)
     return -1;
   }
 
-  strcpy(szDeref, path);
+  /* Native symbolic links first, shortcuts may still exist */
+  if (_plibc_native_symlinks)
+  {
+    wchar_t szLink[_MAX_PATH + 1], szTarget[_MAX_PATH + 1];
+    long lRet;
 
-  if (__win_deref(szDeref) == -1)
-    return -1;
+    if (_plibc_utf8_mode == 1)
+      lRet = plibc_conv_to_win_pathwconv_ex(path, szLink, _MAX_PATH, 0);
+    else
+      lRet = plibc_conv_to_win_path_ex(path, (char *) szLink, _MAX_PATH, 0);
+    if (lRet != ERROR_SUCCESS)
+    {
+      SetErrnoFromWinError(lRet);
+      return -1;
+    }
+
+    if (_plibc_utf8_mode == 1)
+    {
+      iLen = __win_ReadSymlinkW(szLink, szTarget, _MAX_PATH + 1);
+      if (iLen != -1 &&
+        wchartostr_buf(szTarget, szDeref, sizeof(szDeref), CP_UTF8) < 0)
+      {
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+    }
+    else
+      iLen = __win_ReadSymlink((char *) szLink, szDeref, sizeof(szDeref));
+
+    if (iLen == -1 && errno != EINVAL)
+      return -1;
+  }
+  else
+    iLen = -1;
+
+  if (iLen == -1)
+  {
+    strcpy(szDeref, path);
+
+    if (__win_deref(szDeref) == -1)
+      return -1;
+  }
 
   if ((iLen = strlen(szDeref)) > bufsize)
   {
@@ -0,0 +1,207 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/readv.c
+ * @brief readv() and preadv()
+ */
+
+#include "plibc_private.h"
+
+/**
+ * @brief Validate an I/O vector and sum up its length
+ * @internal
+ * @return 0 on success, -1 otherwise (errno is set)
+ */
+int __win_GetIovLength(const struct iovec *iov, int iovcnt, size_t *pnTotal)
+{
+  size_t nTotal;
+  int i;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  nTotal = 0;
+  for (i = 0; i < iovcnt; i++)
+  {
+    /* The result has to fit into the return value */
+    if (iov[i].iov_len > (size_t) INT_MAX - nTotal)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    nTotal += iov[i].iov_len;
+  }
+  *pnTotal = nTotal;
+
+  return 0;
+}
+
+/**
+ * @brief Convert an I/O vector to a Winsock buffer array
+ * @internal
+ * @param pStack array of IOV_STACK_BUFS elements used for short vectors
+ * @return pStack, a malloc()ed array or NULL on error (errno is set)
+ */
+LPWSABUF __win_IovToWSABuf(const struct iovec *iov, int iovcnt,
+  LPWSABUF pStack)
+{
+  LPWSABUF pBufs;
+  int i;
+
+  if (iovcnt <= IOV_STACK_BUFS)
+    pBufs = pStack;
+  else
+  {
+    pBufs = (LPWSABUF) __win_Malloc(iovcnt * sizeof(WSABUF));
+    if (!pBufs)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  for (i = 0; i < iovcnt; i++)
+  {
+    pBufs[i].buf = (char *) iov[i].iov_base;
+    pBufs[i].len = (ULONG) iov[i].iov_len;
+  }
+
+  return pBufs;
+}
+
+/**
+ * @brief Distribute a buffer over an I/O vector
+ * @internal
+ */
+static void __win_ScatterIov(const struct iovec *iov, int iovcnt,
+  const char *pSrc, size_t nbyte)
+{
+  int i;
+
+  for (i = 0; i < iovcnt && nbyte; i++)
+  {
+    size_t nLen = iov[i].iov_len;
+
+    if (nLen > nbyte)
+      nLen = nbyte;
+    memcpy(iov[i].iov_base, pSrc, nLen);
+    pSrc += nLen;
+    nbyte -= nLen;
+  }
+}
+
+/**
+ * @brief Read data into multiple buffers
+ * @note Sockets use a single WSARecv(). Other descriptors are read with a
+ *       single read() into a temporary buffer.
+ */
+int _win_readv(int fildes, const struct iovec *iov, int iovcnt)
+{
+  size_t nTotal;
+  char *pBuf;
+  int iRet;
+
+  if (__win_GetIovLength(iov, iovcnt, &nTotal) == -1)
+    return -1;
+
+  if (__win_GetHandleType(fildes) == SOCKET_HANDLE)
+  {
+    WSABUF stackBufs[IOV_STACK_BUFS];
+    LPWSABUF pBufs;
+    DWORD dwRead, dwFlags;
+
+    pBufs = __win_IovToWSABuf(iov, iovcnt, stackBufs);
+    if (!pBufs)
+      return -1;
+
+    dwFlags = 0;
+    if (WSARecv(fildes, pBufs, iovcnt, &dwRead, &dwFlags, NULL, NULL) ==
+      SOCKET_ERROR)
+    {
+      SetErrnoFromWinsockError(WSAGetLastError());
+      if (errno == EWOULDBLOCK)
+        __win_EpollRearm(fildes);
+      iRet = -1;
+    }
+    else
+      iRet = dwRead;
+
+    if (pBufs != stackBufs)
+      free(pBufs);
+
+    return iRet;
+  }
+
+  if (!nTotal)
+    return 0;
+  if (iovcnt == 1)
+    return _win_read(fildes, iov[0].iov_base, iov[0].iov_len);
+
+  pBuf = (char *) __win_Malloc(nTotal);
+  if (!pBuf)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  iRet = _win_read(fildes, pBuf, nTotal);
+  if (iRet > 0)
+    __win_ScatterIov(iov, iovcnt, pBuf, iRet);
+  free(pBuf);
+
+  return iRet;
+}
+
+/**
+ * @brief Read data into multiple buffers, starting at the given offset
+ * @note Like pread(), this doesn't move the file pointer
+ */
+int _win_preadv(int fildes, const struct iovec *iov, int iovcnt, off_t offset)
+{
+  size_t nTotal;
+  char *pBuf;
+  int iRet;
+
+  if (__win_GetIovLength(iov, iovcnt, &nTotal) == -1)
+    return -1;
+
+  if (iovcnt == 1 || !nTotal)
+    return _win_pread(fildes, iovcnt ? iov[0].iov_base : NULL, nTotal,
+      offset);
+
+  pBuf = (char *) __win_Malloc(nTotal);
+  if (!pBuf)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  iRet = _win_pread(fildes, pBuf, nTotal, offset);
+  if (iRet > 0)
+    __win_ScatterIov(iov, iovcnt, pBuf, iRet);
+  free(pBuf);
+
+  return iRet;
+}
+
+/* end of readv.c */
@@ -29,12 +29,29 @@ char *realpath(const char *file_name, char *resolved_name, size_t resolv_buffer_
   long lRet;
   wchar_t szFile[_MAX_PATH + 1];
   wchar_t szRet[_MAX_PATH + 1];
-  wchar_t *wresult;
+  wchar_t *wresult, *pwszLong;
   char *result = NULL;
 
   if (_plibc_utf8_mode == 1)
   {
     lRet = plibc_conv_to_win_pathwconv(file_name, szFile, _MAX_PATH );
+    if (lRet == ERROR_BUFFER_OVERFLOW)
+    {
+      /* The long path is absolute already, drop the \\?\ prefix */
+      lRet = plibc_conv_to_win_path_long(file_name, &pwszLong, 1);
+      if (lRet == ERROR_SUCCESS)
+      {
+        if (wcsncmp(pwszLong, L"\\\\?\\UNC\\", 8) == 0)
+        {
+          pwszLong[6] = L'\\';
+          wchartostr (pwszLong + 6, &result, CP_UTF8);
+        }
+        else
+          wchartostr (pwszLong + 4, &result, CP_UTF8);
+        free (pwszLong);
+        return result;
+      }
+    }
     if (lRet != ERROR_SUCCESS)
     {
       SetErrnoFromWinError(lRet);
@@ -45,9 +45,15 @@ int _win_remove(const char *path)
 
   /* remove sets errno */
   if (_plibc_utf8_mode == 1)
-    return _wremove(szFile);
+    lRet = _wremove(szFile);
   else
-    return remove((char *) szFile);
+    lRet = remove((char *) szFile);
+
+  /* Translations may refer to the old file system state */
+  if (lRet == 0)
+    __win_InvalidatePathCache();
+
+  return lRet;
 }
 
 /* end of remove.c */
@@ -54,11 +54,21 @@ int _win_rename(const char *oldname, const char *newname)
     return -1;
   }
 
+  /* Watched directories can't be renamed */
+  __win_CloseShortcutWatches();
+  __win_CloseStatCacheWatches();
+
   /* rename sets errno */
   if (_plibc_utf8_mode == 1)
-    return _wrename(szOldName, szNewName);
+    lRet = _wrename(szOldName, szNewName);
   else
-    return rename((char *) szOldName, (char *) szNewName);
+    lRet = rename((char *) szOldName, (char *) szNewName);
+
+  /* Translations may refer to the old file system state */
+  if (lRet == 0)
+    __win_InvalidatePathCache();
+
+  return lRet;
 }
 
 /* end of rename.c */
@@ -0,0 +1,410 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/reparse.c
+ * @brief Native symbolic links
+ *
+ * If PlibC is initialized with PLIBC_NATIVE_SYMLINKS, symlink() creates NTFS
+ * symbolic links instead of shortcuts. The kernel follows them when a file
+ * is opened, so path translations don't look for shortcuts anymore. Only
+ * stat(), lstat() and readlink() need to look at the reparse point itself.
+ * Windows XP and earlier have no symbolic links, PlibC keeps using
+ * shortcuts there.
+ */
+
+#include "plibc_private.h"
+
+typedef BOOLEAN (WINAPI *TCreateSymbolicLinkW) (LPCWSTR lpSymlinkFileName,
+  LPCWSTR lpTargetFileName, DWORD dwFlags);
+typedef DWORD (WINAPI *TGetFinalPathNameByHandleW) (HANDLE hFile,
+  LPWSTR lpszFilePath, DWORD cchFilePath, DWORD dwFlags);
+
+/* Taken from the Wine project <http://www.winehq.org>
+    /wine/include/ntifs.h */
+typedef struct
+{
+  ULONG ReparseTag;
+  USHORT ReparseDataLength;
+  USHORT Reserved;
+  union
+  {
+    struct
+    {
+      USHORT SubstituteNameOffset;
+      USHORT SubstituteNameLength;
+      USHORT PrintNameOffset;
+      USHORT PrintNameLength;
+      ULONG Flags;
+      WCHAR PathBuffer[1];
+    } SymbolicLinkReparseBuffer;
+    struct
+    {
+      USHORT SubstituteNameOffset;
+      USHORT SubstituteNameLength;
+      USHORT PrintNameOffset;
+      USHORT PrintNameLength;
+      WCHAR PathBuffer[1];
+    } MountPointReparseBuffer;
+  } u;
+} PLIBC_REPARSE_DATA_BUFFER;
+
+#ifndef SYMBOLIC_LINK_FLAG_DIRECTORY
+  #define SYMBOLIC_LINK_FLAG_DIRECTORY 0x1
+#endif
+#ifndef SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE
+  #define SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE 0x2
+#endif
+#ifndef FILE_NAME_NORMALIZED
+  #define FILE_NAME_NORMALIZED 0x0
+#endif
+#ifndef VOLUME_NAME_DOS
+  #define VOLUME_NAME_DOS 0x0
+#endif
+
+int _plibc_native_symlinks = 0;
+
+static TCreateSymbolicLinkW pCreateSymbolicLinkW = NULL;
+static TGetFinalPathNameByHandleW pGetFinalPathNameByHandleW = NULL;
+static BOOL bUnprivilegedCreate = TRUE;
+
+/**
+ * @brief Set up native symbolic links
+ * @internal
+ * @param bEnable TRUE if the application asked for native symbolic links
+ */
+void __win_InitSymlinks(BOOL bEnable)
+{
+  HMODULE hKernel = GetModuleHandle("kernel32.dll");
+
+  pCreateSymbolicLinkW = (TCreateSymbolicLinkW) GetProcAddress(hKernel,
+    "CreateSymbolicLinkW");
+  pGetFinalPathNameByHandleW = (TGetFinalPathNameByHandleW)
+    GetProcAddress(hKernel, "GetFinalPathNameByHandleW");
+
+  _plibc_native_symlinks = bEnable && pCreateSymbolicLinkW &&
+    pGetFinalPathNameByHandleW;
+}
+
+/**
+ * @brief Create a symbolic link
+ * @internal
+ * @param pwszTarget contents of the link, may be relative to the directory
+ *        of the link
+ * @param pwszLink path of the new link
+ * @return 0 on success, -1 otherwise (errno is set)
+ */
+int __win_CreateSymlinkW(const wchar_t *pwszTarget, const wchar_t *pwszLink)
+{
+  wchar_t szCheck[_MAX_PATH + 1];
+  const wchar_t *pwszSep, *pwsz;
+  DWORD dwFlags, dwAttr;
+  size_t nDirLen;
+
+  if (!pCreateSymbolicLinkW)
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  /* Links to directories have to be marked as such. Relative targets are
+     relative to the directory of the link. */
+  if (pwszTarget[0] == L'\\' || pwszTarget[0] == L'/' ||
+    (pwszTarget[0] && pwszTarget[1] == L':'))
+    dwAttr = GetFileAttributesW(pwszTarget);
+  else
+  {
+    pwszSep = NULL;
+    for (pwsz = pwszLink; *pwsz; pwsz++)
+      if (*pwsz == L'\\' || *pwsz == L'/')
+        pwszSep = pwsz;
+    nDirLen = pwszSep ? pwszSep - pwszLink + 1 : 0;
+
+    if (nDirLen + wcslen(pwszTarget) > _MAX_PATH)
+      dwAttr = INVALID_FILE_ATTRIBUTES;
+    else
+    {
+      memcpy(szCheck, pwszLink, nDirLen * sizeof(wchar_t));
+      wcscpy(szCheck + nDirLen, pwszTarget);
+      dwAttr = GetFileAttributesW(szCheck);
+    }
+  }
+  dwFlags = (dwAttr != INVALID_FILE_ATTRIBUTES &&
+    (dwAttr & FILE_ATTRIBUTE_DIRECTORY)) ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0;
+
+  /* Windows 10 allows unprivileged users to create symbolic links in
+     developer mode, older versions reject the flag */
+  if (bUnprivilegedCreate)
+  {
+    if (pCreateSymbolicLinkW(pwszLink, pwszTarget,
+        dwFlags | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE))
+      return 0;
+    if (GetLastError() != ERROR_INVALID_PARAMETER)
+    {
+      SetErrnoFromWinError(GetLastError());
+      return -1;
+    }
+    bUnprivilegedCreate = FALSE;
+  }
+
+  if (!pCreateSymbolicLinkW(pwszLink, pwszTarget, dwFlags))
+  {
+    SetErrnoFromWinError(GetLastError());
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Read the contents of a symbolic link or junction
+ * @internal
+ * @param pwszTarget receives the contents
+ * @param nTargetLen size of pwszTarget in characters
+ * @return length of the contents or -1 (errno is EINVAL if the path isn't a
+ *         link)
+ */
+int __win_ReadSymlinkW(const wchar_t *pwszLink, wchar_t *pwszTarget,
+  size_t nTargetLen)
+{
+  PLIBC_REPARSE_DATA_BUFFER *pData;
+  const WCHAR *pwszName;
+  HANDLE hLink;
+  DWORD dwAttr, dwRet;
+  size_t nLen;
+  BOOL bOk;
+
+  /* Cheap check first */
+  dwAttr = GetFileAttributesW(pwszLink);
+  if (dwAttr == INVALID_FILE_ATTRIBUTES)
+  {
+    SetErrnoFromWinError(GetLastError());
+    return -1;
+  }
+  if (!(dwAttr & FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  hLink = CreateFileW(pwszLink, 0, FILE_SHARE_READ | FILE_SHARE_WRITE |
+    FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT |
+    FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (hLink == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(GetLastError());
+    return -1;
+  }
+
+  pData = (PLIBC_REPARSE_DATA_BUFFER *)
+    __win_Malloc(MAXIMUM_REPARSE_DATA_BUFFER_SIZE);
+  if (!pData)
+  {
+    CloseHandle(hLink);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  bOk = DeviceIoControl(hLink, FSCTL_GET_REPARSE_POINT, NULL, 0, pData,
+    MAXIMUM_REPARSE_DATA_BUFFER_SIZE, &dwRet, NULL);
+  if (!bOk)
+    SetErrnoFromWinError(GetLastError());
+  CloseHandle(hLink);
+  if (!bOk)
+  {
+    free(pData);
+    if (errno == ENOENT)
+      errno = EINVAL;
+    return -1;
+  }
+
+  /* Prefer the name the creator wanted to be displayed, it keeps relative
+     links relative */
+  if (pData->ReparseTag == IO_REPARSE_TAG_SYMLINK)
+  {
+    nLen = pData->u.SymbolicLinkReparseBuffer.PrintNameLength / sizeof(WCHAR);
+    pwszName = pData->u.SymbolicLinkReparseBuffer.PathBuffer +
+      pData->u.SymbolicLinkReparseBuffer.PrintNameOffset / sizeof(WCHAR);
+    if (!nLen)
+    {
+      nLen = pData->u.SymbolicLinkReparseBuffer.SubstituteNameLength /
+        sizeof(WCHAR);
+      pwszName = pData->u.SymbolicLinkReparseBuffer.PathBuffer +
+        pData->u.SymbolicLinkReparseBuffer.SubstituteNameOffset /
+        sizeof(WCHAR);
+    }
+  }
+  else if (pData->ReparseTag == IO_REPARSE_TAG_MOUNT_POINT)
+  {
+    nLen = pData->u.MountPointReparseBuffer.PrintNameLength / sizeof(WCHAR);
+    pwszName = pData->u.MountPointReparseBuffer.PathBuffer +
+      pData->u.MountPointReparseBuffer.PrintNameOffset / sizeof(WCHAR);
+    if (!nLen)
+    {
+      nLen = pData->u.MountPointReparseBuffer.SubstituteNameLength /
+        sizeof(WCHAR);
+      pwszName = pData->u.MountPointReparseBuffer.PathBuffer +
+        pData->u.MountPointReparseBuffer.SubstituteNameOffset /
+        sizeof(WCHAR);
+    }
+  }
+  else
+  {
+    /* Deduplicated files, OneDrive placeholders, ... */
+    free(pData);
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Substitute names are NT paths */
+  if (nLen >= 4 && wcsncmp(pwszName, L"\\??\\", 4) == 0)
+  {
+    pwszName += 4;
+    nLen -= 4;
+  }
+
+  if (nLen + 1 > nTargetLen)
+  {
+    free(pData);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  memcpy(pwszTarget, pwszName, nLen * sizeof(wchar_t));
+  pwszTarget[nLen] = 0;
+  free(pData);
+
+  return nLen;
+}
+
+/**
+ * @brief Read the contents of a symbolic link or junction
+ * @internal
+ * @param nTargetLen size of pszTarget in bytes
+ * @return length of the contents or -1 (errno is EINVAL if the path isn't a
+ *         link)
+ */
+int __win_ReadSymlink(const char *pszLink, char *pszTarget, size_t nTargetLen)
+{
+  wchar_t szLink[_MAX_PATH + 1], szTarget[_MAX_PATH + 1];
+
+  if (strtowchar_buf(pszLink, szLink, _MAX_PATH + 1, CP_ACP) != 0)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (__win_ReadSymlinkW(szLink, szTarget, _MAX_PATH + 1) == -1)
+    return -1;
+  if (wchartostr_buf(szTarget, pszTarget, nTargetLen, CP_ACP) < 0)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return strlen(pszTarget);
+}
+
+/**
+ * @brief Replace a path by the final path of the file it refers to
+ * @internal
+ * @param pwszPath path, receives the final path if it is a link
+ * @param nLen size of pwszPath in characters
+ * @return 0 on success (also if pwszPath isn't a link), -1 otherwise (errno
+ *         is set, ENOENT for dangling links)
+ */
+int __win_ResolveSymlinkW(wchar_t *pwszPath, size_t nLen)
+{
+  wchar_t szFinal[_MAX_PATH + 9];
+  wchar_t *pwszFinal;
+  HANDLE hFile;
+  DWORD dwAttr, dwLen;
+
+  dwAttr = GetFileAttributesW(pwszPath);
+  if (dwAttr == INVALID_FILE_ATTRIBUTES ||
+    !(dwAttr & FILE_ATTRIBUTE_REPARSE_POINT) || !pGetFinalPathNameByHandleW)
+    return 0;
+
+  /* The kernel follows the link */
+  hFile = CreateFileW(pwszPath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE |
+    FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(GetLastError());
+    return -1;
+  }
+
+  dwLen = pGetFinalPathNameByHandleW(hFile, szFinal,
+    sizeof(szFinal) / sizeof(wchar_t), FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+  if (!dwLen)
+    SetErrnoFromWinError(GetLastError());
+  CloseHandle(hFile);
+  if (!dwLen)
+    return -1;
+  if (dwLen >= sizeof(szFinal) / sizeof(wchar_t))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  /* The CRT doesn't like "\\?\" paths */
+  pwszFinal = szFinal;
+  if (wcsncmp(pwszFinal, L"\\\\?\\UNC\\", 8) == 0)
+  {
+    pwszFinal += 6;
+    *pwszFinal = L'\\';
+  }
+  else if (wcsncmp(pwszFinal, L"\\\\?\\", 4) == 0)
+    pwszFinal += 4;
+
+  if (wcslen(pwszFinal) + 1 > nLen)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  wcscpy(pwszPath, pwszFinal);
+
+  return 0;
+}
+
+/**
+ * @brief Replace a path by the final path of the file it refers to
+ * @internal
+ * @param nLen size of pszPath in bytes
+ */
+int __win_ResolveSymlink(char *pszPath, size_t nLen)
+{
+  wchar_t szPath[_MAX_PATH + 1];
+
+  if (strtowchar_buf(pszPath, szPath, _MAX_PATH + 1, CP_ACP) != 0)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (__win_ResolveSymlinkW(szPath, _MAX_PATH + 1) == -1)
+    return -1;
+  if (wchartostr_buf(szPath, pszPath, nLen, CP_ACP) < 0)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* end of reparse.c */
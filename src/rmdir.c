@@ -43,11 +43,21 @@ int _win_rmdir(const char *path)
     return -1;
   }
 
+  /* Watched directories can't be removed for good */
+  __win_CloseShortcutWatches();
+  __win_CloseStatCacheWatches();
+
   /* rmdir sets errno */
   if (_plibc_utf8_mode == 1)
-    return _wrmdir(szDir);
+    lRet = _wrmdir(szDir);
   else
-    return rmdir((char *) szDir);
+    lRet = rmdir((char *) szDir);
+
+  /* Translations may refer to the old file system state */
+  if (lRet == 0)
+    __win_InvalidatePathCache();
+
+  return lRet;
 }
 
 /* end of rmdir.c */
@@ -0,0 +1,347 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/scratch.c
+ * @brief Per-thread scratch memory
+ *
+ * Converting a path needs temporary buffers whose size depends on the
+ * path. Every thread gets an arena that is used like a stack: allocations
+ * are carved from its end and released in reverse order. The arena grows
+ * if a request doesn't fit and shrinks back to its initial size once it
+ * hasn't needed the extra space for a while, so a thread that once
+ * converted a huge path doesn't keep the memory forever.
+ *
+ * Arenas are freed when their thread exits if fiber local storage is
+ * available (Windows Vista and later), otherwise when PlibC shuts down.
+ * Allocations that don't fit into an arena which is in use, or that happen
+ * before plibc_init(), go to the heap.
+ *
+ * PlibC allocates heap memory only through __win_Malloc() and friends,
+ * which count the allocations for plibc_get_alloc_count().
+ */
+
+#include "plibc_private.h"
+
+#define SCRATCH_INITIAL  4096           /* bytes */
+#define SCRATCH_IDLE     10000          /* ms before an arena shrinks */
+#define SCRATCH_ALIGN    16
+
+#ifndef FLS_OUT_OF_INDEXES
+  #define FLS_OUT_OF_INDEXES ((DWORD) 0xFFFFFFFF)
+#endif
+
+typedef struct _TScratch
+{
+  struct _TScratch *pPrev, *pNext;      /* all arenas, for shutdown */
+  char *pBuf;
+  size_t nSize;
+  size_t nUsed;
+  DWORD dwLastLarge;                    /* last time more than the initial
+                                           size was needed */
+} TScratch;
+
+typedef VOID (WINAPI *TFlsCallback) (PVOID lpFlsData);
+typedef DWORD (WINAPI *TFlsAlloc) (TFlsCallback lpCallback);
+typedef PVOID (WINAPI *TFlsGetValue) (DWORD dwFlsIndex);
+typedef BOOL (WINAPI *TFlsSetValue) (DWORD dwFlsIndex, PVOID lpFlsData);
+typedef BOOL (WINAPI *TFlsFree) (DWORD dwFlsIndex);
+
+static TFlsAlloc pFlsAlloc;
+static TFlsGetValue pFlsGetValue;
+static TFlsSetValue pFlsSetValue;
+static TFlsFree pFlsFree;
+
+static CRITICAL_SECTION csScratch;
+static TScratch *pScratchList = NULL;
+static DWORD dwScratchIndex;
+static BOOL bScratchInit = FALSE, bScratchFls = FALSE;
+static volatile LONG lAllocs = 0;
+
+/**
+ * @brief malloc() that is counted by plibc_get_alloc_count()
+ * @internal
+ * @note Release with free()
+ */
+void *__win_Malloc(size_t nSize)
+{
+  InterlockedIncrement(&lAllocs);
+
+  return malloc(nSize);
+}
+
+/**
+ * @brief calloc() that is counted by plibc_get_alloc_count()
+ * @internal
+ */
+void *__win_Calloc(size_t nCount, size_t nSize)
+{
+  InterlockedIncrement(&lAllocs);
+
+  return calloc(nCount, nSize);
+}
+
+/**
+ * @brief realloc() that is counted by plibc_get_alloc_count()
+ * @internal
+ */
+void *__win_Realloc(void *pMem, size_t nSize)
+{
+  InterlockedIncrement(&lAllocs);
+
+  return realloc(pMem, nSize);
+}
+
+/**
+ * @brief strdup() that is counted by plibc_get_alloc_count()
+ * @internal
+ */
+char *__win_StrDup(const char *pszSrc)
+{
+  InterlockedIncrement(&lAllocs);
+
+  return strdup(pszSrc);
+}
+
+/**
+ * @brief wcsdup() that is counted by plibc_get_alloc_count()
+ * @internal
+ */
+wchar_t *__win_WcsDup(const wchar_t *pwszSrc)
+{
+  InterlockedIncrement(&lAllocs);
+
+  return wcsdup(pwszSrc);
+}
+
+static void __win_DestroyScratch(TScratch *pScratch)
+{
+  EnterCriticalSection(&csScratch);
+  if (pScratch->pPrev)
+    pScratch->pPrev->pNext = pScratch->pNext;
+  else
+    pScratchList = pScratch->pNext;
+  if (pScratch->pNext)
+    pScratch->pNext->pPrev = pScratch->pPrev;
+  LeaveCriticalSection(&csScratch);
+
+  free(pScratch->pBuf);
+  free(pScratch);
+}
+
+/**
+ * @brief Free the arena of an exiting thread
+ * @internal
+ */
+static VOID WINAPI __win_ScratchThreadExit(PVOID lpFlsData)
+{
+  if (lpFlsData && bScratchInit)
+    __win_DestroyScratch((TScratch *) lpFlsData);
+}
+
+/**
+ * @brief Set up per-thread scratch memory
+ * @internal
+ */
+void __win_InitScratch()
+{
+  HMODULE hKernel32;
+
+  InitializeCriticalSection(&csScratch);
+
+  hKernel32 = GetModuleHandle("kernel32.dll");
+  pFlsAlloc = (TFlsAlloc) GetProcAddress(hKernel32, "FlsAlloc");
+  pFlsGetValue = (TFlsGetValue) GetProcAddress(hKernel32, "FlsGetValue");
+  pFlsSetValue = (TFlsSetValue) GetProcAddress(hKernel32, "FlsSetValue");
+  pFlsFree = (TFlsFree) GetProcAddress(hKernel32, "FlsFree");
+
+  if (pFlsAlloc && pFlsGetValue && pFlsSetValue && pFlsFree)
+  {
+    dwScratchIndex = pFlsAlloc(__win_ScratchThreadExit);
+    bScratchFls = dwScratchIndex != FLS_OUT_OF_INDEXES;
+  }
+  if (!bScratchFls)
+  {
+    dwScratchIndex = TlsAlloc();
+    if (dwScratchIndex == TLS_OUT_OF_INDEXES)
+    {
+      DeleteCriticalSection(&csScratch);
+      return;
+    }
+  }
+
+  bScratchInit = TRUE;
+}
+
+/**
+ * @brief Free all arenas
+ * @internal
+ * @note Threads must not use scratch memory anymore
+ */
+void __win_FreeScratch()
+{
+  if (!bScratchInit)
+    return;
+
+  /* FlsFree() runs the callback for the arenas it knows */
+  if (bScratchFls)
+    pFlsFree(dwScratchIndex);
+  else
+    TlsFree(dwScratchIndex);
+  bScratchInit = FALSE;
+
+  while (pScratchList)
+    __win_DestroyScratch(pScratchList);
+
+  DeleteCriticalSection(&csScratch);
+}
+
+/**
+ * @brief Get the arena of the calling thread, create it if necessary
+ * @internal
+ */
+static TScratch *__win_GetScratch()
+{
+  TScratch *pScratch;
+
+  pScratch = (TScratch *) (bScratchFls ? pFlsGetValue(dwScratchIndex) :
+    TlsGetValue(dwScratchIndex));
+  if (pScratch)
+    return pScratch;
+
+  pScratch = (TScratch *) __win_Calloc(1, sizeof(TScratch));
+  if (!pScratch)
+    return NULL;
+
+  if (!(bScratchFls ? pFlsSetValue(dwScratchIndex, pScratch) :
+    TlsSetValue(dwScratchIndex, pScratch)))
+  {
+    free(pScratch);
+    return NULL;
+  }
+
+  EnterCriticalSection(&csScratch);
+  pScratch->pNext = pScratchList;
+  if (pScratchList)
+    pScratchList->pPrev = pScratch;
+  pScratchList = pScratch;
+  LeaveCriticalSection(&csScratch);
+
+  return pScratch;
+}
+
+/**
+ * @brief Allocate temporary memory
+ * @internal
+ * @return NULL if out of memory
+ * @note Release with __win_ScratchFree() in reverse order of allocation,
+ *       before returning to the application
+ */
+void *__win_ScratchAlloc(size_t nSize)
+{
+  TScratch *pScratch;
+  size_t nNeeded;
+  char *pBuf;
+  void *pRet;
+
+  pScratch = bScratchInit ? __win_GetScratch() : NULL;
+  if (!pScratch)
+    return __win_Malloc(nSize);
+
+  /* Every allocation gets its own address */
+  nSize = nSize ? (nSize + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1) :
+    SCRATCH_ALIGN;
+  nNeeded = pScratch->nUsed + nSize;
+
+  if (nNeeded > SCRATCH_INITIAL)
+    pScratch->dwLastLarge = GetTickCount();
+
+  if (nNeeded > pScratch->nSize)
+  {
+    /* Memory handed out before can't move */
+    if (pScratch->nUsed)
+      return __win_Malloc(nSize);
+
+    if (nNeeded < SCRATCH_INITIAL)
+      nNeeded = SCRATCH_INITIAL;
+    pBuf = (char *) __win_Malloc(nNeeded);
+    if (!pBuf)
+      return NULL;
+
+    free(pScratch->pBuf);
+    pScratch->pBuf = pBuf;
+    pScratch->nSize = nNeeded;
+  }
+  else if (!pScratch->nUsed && pScratch->nSize > SCRATCH_INITIAL &&
+    nNeeded <= SCRATCH_INITIAL &&
+    GetTickCount() - pScratch->dwLastLarge > SCRATCH_IDLE)
+  {
+    /* Idle, give the extra memory back */
+    pBuf = (char *) __win_Malloc(SCRATCH_INITIAL);
+    if (pBuf)
+    {
+      free(pScratch->pBuf);
+      pScratch->pBuf = pBuf;
+      pScratch->nSize = SCRATCH_INITIAL;
+    }
+  }
+
+  pRet = pScratch->pBuf + pScratch->nUsed;
+  pScratch->nUsed += nSize;
+
+  return pRet;
+}
+
+/**
+ * @brief Release temporary memory and everything allocated after it
+ * @internal
+ */
+void __win_ScratchFree(void *pMem)
+{
+  TScratch *pScratch;
+
+  if (!pMem)
+    return;
+
+  pScratch = NULL;
+  if (bScratchInit)
+    pScratch = (TScratch *) (bScratchFls ? pFlsGetValue(dwScratchIndex) :
+      TlsGetValue(dwScratchIndex));
+
+  if (pScratch && (char *) pMem >= pScratch->pBuf &&
+    (char *) pMem < pScratch->pBuf + pScratch->nSize)
+    pScratch->nUsed = (char *) pMem - pScratch->pBuf;
+  else
+    free(pMem);
+}
+
+/**
+ * @brief Get the number of heap allocations made by PlibC
+ * @note Compare two values to verify that a loop of file system calls
+ *       runs without touching the heap once the caches are warm
+ * @note Allocations made inside the C runtime and Windows on behalf of
+ *       PlibC (e.g. by _wfopen() or FindFirstFileW()) and the nodes of
+ *       tsearch() trees aren't counted
+ */
+unsigned long plibc_get_alloc_count()
+{
+  return (unsigned long) lAllocs;
+}
+
+/* end of scratch.c */
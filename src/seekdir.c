@@ -0,0 +1,111 @@
+/*
+     This file is part of PlibC.
+     (C) 2005 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+	
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+	
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+/**
+ * @file src/seekdir.c
+ * @brief rewinddir(), telldir(), seekdir()
+ */
+
+#include "plibc_private.h"
+
+/**
+ * @brief Reset the position of a directory stream to the beginning
+ * @note The directory is enumerated again, so changes made since it was
+ *       opened show up
+ */
+void _win_rewinddir(DIR *dirp)
+{
+  struct plibc_WDIR *pwd;
+  DWORD dwErr;
+  int iErr;
+
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd)
+  {
+    errno = EINVAL;
+    return;
+  }
+
+  if (pwd->hFind != INVALID_HANDLE_VALUE)
+    FindClose(pwd->hFind);
+
+  dwErr = __win_RestartDirStream(pwd);
+  if (dwErr != ERROR_SUCCESS)
+  {
+    /* rewinddir() can't fail, report the error with the next read */
+    iErr = errno;
+    if (dwErr == ERROR_DIRECTORY)
+      errno = ENOTDIR;
+    else
+      SetErrnoFromWinError(dwErr);
+    pwd->iError = errno;
+    errno = iErr;
+  }
+}
+
+/**
+ * @brief Get the position of a directory stream
+ * @return number of entries read so far
+ */
+long _win_telldir(DIR *dirp)
+{
+  struct plibc_WDIR *pwd;
+
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return pwd->lPos;
+}
+
+/**
+ * @brief Set the position of a directory stream
+ * @param loc value returned by telldir()
+ * @note FindNextFileW() can't seek, the stream is rewound if necessary and
+ *       the entries up to loc are skipped
+ */
+void _win_seekdir(DIR *dirp, long loc)
+{
+  struct plibc_WDIR *pwd;
+  int iErr;
+
+  pwd = (struct plibc_WDIR *) dirp;
+  if (pwd->self != pwd || loc < 0)
+  {
+    errno = EINVAL;
+    return;
+  }
+
+  if (loc < pwd->lPos)
+    _win_rewinddir(dirp);
+
+  iErr = errno;
+  errno = 0;
+  while (pwd->lPos < loc && __win_NextDirEntry(pwd))
+    ;
+  if (errno)
+    pwd->iError = errno;
+  errno = iErr;
+}
+
+/* end of seekdir.c */
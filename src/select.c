@@ -32,36 +32,326 @@
 
 #include "plibc_private.h"
 
+typedef BOOL (WINAPI *TCancelSynchronousIo) (HANDLE hThread);
+typedef BOOL (WINAPI *TCancelIoEx) (HANDLE hFile, LPOVERLAPPED lpOverlapped);
+
+static TCancelSynchronousIo pCancelSynchronousIo;
+static TCancelIoEx pCancelIoEx;
+
+#define SELECT_PIPE_POLL_MAX 16         /* ms between pipe checks */
+
+typedef struct
+{
+  fd_set *rfds, *wfds, *efds;
+  fd_set sock_read, sock_write, sock_except;
+  fd_set sock_closed;   /* FD_CLOSE seen */
+  int sock_max_fd;
+  SOCKET sockets[FD_SETSIZE];
+  int n_sockets;
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  int handle_slot_to_fd[MAXIMUM_WAIT_OBJECTS];
+  int n_handles;
+  TPipeWaiter pipes[MAXIMUM_WAIT_OBJECTS];
+  int iPipes;
+  THandleInfo writers[MAXIMUM_WAIT_OBJECTS];  /* made by plibc_pipe_ex() */
+  int iWriters;
+} TSelect;
+
+#define SAFE_FD_ISSET(fd, set)	(set != NULL && FD_ISSET(fd, set))
+
+/**
+ * @brief Set up select()
+ * @internal
+ */
+void __win_InitSelect()
+{
+  pCancelSynchronousIo = (TCancelSynchronousIo) GetProcAddress(
+    GetModuleHandle("kernel32.dll"), "CancelSynchronousIo");
+  pCancelIoEx = (TCancelIoEx) GetProcAddress(GetModuleHandle("kernel32.dll"),
+    "CancelIoEx");
+}
+
+static DWORD WINAPI __win_PipeWaiter(LPVOID lpParam)
+{
+  TPipeWaiter *pWaiter = (TPipeWaiter *) lpParam;
+  DWORD dwRead;
+  char c;
+
+  /* A read of 0 bytes returns once there is data, without consuming it, or
+     when the pipe breaks */
+  if (pWaiter->bOverlapped)
+  {
+    ZeroMemory(&pWaiter->ovRead, sizeof(OVERLAPPED));
+    pWaiter->ovRead.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (pWaiter->ovRead.hEvent)
+    {
+      if (!pWaiter->lStop && (ReadFile((HANDLE) pWaiter->iFD, &c, 0, &dwRead,
+        &pWaiter->ovRead) || GetLastError() == ERROR_IO_PENDING))
+        GetOverlappedResult((HANDLE) pWaiter->iFD, &pWaiter->ovRead, &dwRead,
+          TRUE);
+      CloseHandle(pWaiter->ovRead.hEvent);
+    }
+  }
+  else if (!pWaiter->lStop)
+    ReadFile((HANDLE) pWaiter->iFD, &c, 0, &dwRead, NULL);
+  if (pWaiter->hReady)
+    SetEvent(pWaiter->hReady);
+
+  /* Unless __win_StopPipeWaiter() came first */
+  if (pWaiter->hPort && !InterlockedExchange(&pWaiter->lStop, TRUE))
+    PostQueuedCompletionStatus(pWaiter->hPort, 0, 0, pWaiter->pOverlapped);
+
+  return 0;
+}
+
+/**
+ * @brief Check whether pipes can be waited for
+ * @internal
+ * @return FALSE if they have to be polled
+ */
+BOOL __win_CanWaitForPipes()
+{
+  return pCancelSynchronousIo != NULL && pCancelIoEx != NULL;
+}
+
+/**
+ * @brief Start waiting for data in a pipe
+ * @internal
+ * @note pWaiter->hReady is set and, if pWaiter->hPort isn't NULL,
+ *       pWaiter->pOverlapped is posted to that completion port when the pipe
+ *       has data or breaks. Does nothing if the waiter is running already.
+ */
+void __win_StartPipeWaiter(TPipeWaiter *pWaiter)
+{
+  DWORD dwTID; /* Last ptr of CreateThread my not be NULL under Win9x */
+
+  if (pWaiter->hThread)
+    return;
+
+  if (pWaiter->hReady)
+    ResetEvent(pWaiter->hReady);
+  pWaiter->lStop = FALSE;
+  pWaiter->hThread = CreateThread(NULL, 0, __win_PipeWaiter, pWaiter, 0,
+    &dwTID);
+  if (!pWaiter->hThread)
+  {
+    /* Let the caller check the pipe itself */
+    pWaiter->lStop = TRUE;
+    if (pWaiter->hReady)
+      SetEvent(pWaiter->hReady);
+    if (pWaiter->hPort)
+      PostQueuedCompletionStatus(pWaiter->hPort, 0, 0, pWaiter->pOverlapped);
+  }
+}
+
+/**
+ * @brief Stop waiting for a pipe
+ * @internal
+ * @return TRUE if pWaiter->pOverlapped was posted to pWaiter->hPort since
+ *         __win_StartPipeWaiter()
+ */
+BOOL __win_StopPipeWaiter(TPipeWaiter *pWaiter)
+{
+  BOOL bPosted;
+
+  if (!pWaiter->hThread)
+    return pWaiter->hPort && pWaiter->lStop;
+
+  /* The thread may not have entered ReadFile() yet, keep trying */
+  bPosted = InterlockedExchange(&pWaiter->lStop, TRUE) && pWaiter->hPort;
+  while (WaitForSingleObject(pWaiter->hThread, 0) == WAIT_TIMEOUT)
+  {
+    if (pWaiter->bOverlapped)
+      pCancelIoEx((HANDLE) pWaiter->iFD, &pWaiter->ovRead);
+    else
+      pCancelSynchronousIo(pWaiter->hThread);
+    WaitForSingleObject(pWaiter->hThread, 1);
+  }
+
+  CloseHandle(pWaiter->hThread);
+  pWaiter->hThread = NULL;
+
+  return bPosted;
+}
+
+/**
+ * @brief Undo WSAEventSelect()
+ * @internal
+ * @note Restores the blocking mode recorded in the handle registry
+ */
+void __win_UnbindSocketEvent(intptr_t s)
+{
+  WSAEventSelect(s, NULL, 0);
+  if (__win_IsHandleMarkedAsBlocking(s))
+  {
+    u_long l = 0;
+
+    ioctlsocket(s, FIONBIO, &l);
+  }
+}
+
+/**
+ * @brief Check all descriptors once
+ * @internal
+ * @return number of ready descriptors, -1 on error
+ */
+static int __win_SelectCheck(TSelect *pSel, fd_set *aread, fd_set *awrite,
+  fd_set *aexcept)
+{
+  struct timeval tvZero;
+  int i, retcode;
+
+  FD_ZERO(aread);
+  FD_ZERO(awrite);
+  FD_ZERO(aexcept);
+  retcode = 0;
+
+  if (pSel->sock_max_fd >= 0)
+  {
+    /* overwrite the zero'd sets here; the select call
+     * will clear those that are not active */
+    *aread = pSel->sock_read;
+    *awrite = pSel->sock_write;
+    *aexcept = pSel->sock_except;
+
+    tvZero.tv_sec = 0;
+    tvZero.tv_usec = 0;
+
+    if ((retcode = select(pSel->sock_max_fd + 1, aread, awrite, aexcept,
+                          &tvZero)) == SOCKET_ERROR)
+    {
+      SetErrnoFromWinsockError(WSAGetLastError());
+      if (errno == ENOTSOCK)
+        errno = EBADF;
+
+      return -1;
+    }
+  }
+
+  /* check handles */
+  for (i = 0; i < pSel->n_handles; i++)
+  {
+    if (WAIT_OBJECT_0 == WaitForSingleObject(pSel->handles[i], 0))
+    {
+      if (SAFE_FD_ISSET(pSel->handle_slot_to_fd[i], pSel->rfds))
+        FD_SET(pSel->handle_slot_to_fd[i], aread);
+
+      if (SAFE_FD_ISSET(pSel->handle_slot_to_fd[i], pSel->wfds))
+        FD_SET(pSel->handle_slot_to_fd[i], awrite);
+
+      if (SAFE_FD_ISSET(pSel->handle_slot_to_fd[i], pSel->efds))
+        FD_SET(pSel->handle_slot_to_fd[i], aexcept);
+
+      retcode++;
+    }
+  }
+
+  /* Poll Pipes */
+  for (i = 0; i < pSel->iPipes; i++)
+  {
+    DWORD dwBytes;
+
+    if (!PeekNamedPipe((HANDLE) pSel->pipes[i].iFD, NULL, 0, NULL, &dwBytes,
+      NULL))
+    {
+      DWORD dwErr = GetLastError();
+
+      /* Writer closed its end, read() returns 0 */
+      if (dwErr != ERROR_BROKEN_PIPE)
+      {
+        SetErrnoFromWinError(dwErr);
+        return -1;
+      }
+      dwBytes = 1;
+    }
+
+    if (dwBytes)
+    {
+      FD_SET(pSel->pipes[i].iFD, aread);
+      retcode++;
+    }
+  }
+
+  /* A pipe whose reader is gone is writable, write() fails with EPIPE */
+  for (i = 0; i < pSel->iWriters; i++)
+  {
+    if (__win_PipeWritable(&pSel->writers[i]))
+    {
+      FD_SET(pSel->writers[i].dwHandle, awrite);
+      retcode++;
+    }
+  }
+
+  /* Closed sockets are readable */
+  for (i = 0; i < (int) pSel->sock_closed.fd_count; i++)
+  {
+    if (!FD_ISSET(pSel->sock_closed.fd_array[i], aread))
+    {
+      FD_SET(pSel->sock_closed.fd_array[i], aread);
+      retcode++;
+    }
+  }
+
+  return retcode;
+}
+
+/**
+ * @brief Note the sockets of the read set whose connection was closed
+ * @internal
+ * @note Only called when the socket event was signaled, an idle wait
+ *       doesn't touch the sockets
+ */
+static void __win_SelectClosed(TSelect *pSel)
+{
+  WSANETWORKEVENTS events;
+  int i;
+
+  for (i = 0; i < pSel->n_sockets; i++)
+  {
+    SOCKET s = pSel->sockets[i];
+
+    if (FD_ISSET(s, &pSel->sock_read) && !FD_ISSET(s, &pSel->sock_closed) &&
+      WSAEnumNetworkEvents(s, NULL, &events) == 0 &&
+      (events.lNetworkEvents & FD_CLOSE))
+      FD_SET(s, &pSel->sock_closed);
+  }
+}
+
 /**
  * Win32 select() will only work with sockets, so we roll our own
  * implementation here.
- * - If you supply only sockets, this simply passes through to winsock select().
+ * - If you supply only sockets, this waits for their network events.
  * - If you supply file handles, there is no way to distinguish between
  *   ready for read/write or OOB, so any set in which the handle is found will
  *   be marked as ready.
- * - If you supply a mixture of handles and sockets, the system will interleave
- *   calls between select() and WaitForMultipleObjects(). The time slicing may
- *   cause this function call to take up to 100 ms longer than you specified.
- * - Pipes are not checked for writability or errors (errno = ENOSYS)
+ * - Sockets, handles and pipes are waited for in a single wait, which returns
+ *   as soon as any of them becomes ready. Sockets are bound to an event with
+ *   WSAEventSelect() for the duration of the call. This makes them
+ *   non-blocking, so afterwards they are put back into the mode recorded with
+ *   __win_SetHandleBlockingMode().
+ * - Sockets in the read set are reported as readable once FD_CLOSE was
+ *   recorded for them.
+ * - A thread per pipe waits for data. Without CancelSynchronousIo()
+ *   (Windows XP and earlier), pipes are polled at intervals of up to 16 ms
+ *   instead. A pipe whose writer is gone is readable.
+ * - Write ends created by plibc_pipe_ex() are writable while no write is
+ *   outstanding or once the reader is gone. Other pipes are not checked for
+ *   writability (errno = ENOSYS).
+ * - Pipes never have exceptional conditions
+ * - At most MAXIMUM_WAIT_OBJECTS - 1 handles and pipes (errno = EINVAL),
+ *   a pipe in the read and the write set counts twice
  */
 int _win_select(int max_fd, fd_set * rfds, fd_set * wfds, fd_set * efds,
                 const struct timeval *tv)
 {
-  DWORD ms_total, limit;
-  HANDLE handles[MAXIMUM_WAIT_OBJECTS], hPipes[MAXIMUM_WAIT_OBJECTS];
-  int handle_slot_to_fd[MAXIMUM_WAIT_OBJECTS];
-  int n_handles, i, iPipes;
-  fd_set sock_read, sock_write, sock_except;
+  TSelect *pSel;
+  DWORD ms_total, dwStart, dwElapsed, dwWait, dwPoll, wret;
+  HANDLE ahWait[MAXIMUM_WAIT_OBJECTS];
+  WSAEVENT hSockEvent;
   fd_set aread, awrite, aexcept;
-  int sock_max_fd;
-  struct timeval tvslice;
-  int retcode;
-
-#define SAFE_FD_ISSET(fd, set)	(set != NULL && FD_ISSET(fd, set))
-
-  n_handles = 0;
-  sock_max_fd = -1;
-  iPipes = 0;
+  int i, nWait, retcode;
+  long lEvents;
+  BOOL bPipeThreads;
 
   /* calculate how long we need to wait in milliseconds */
   if(tv == NULL)
@@ -80,178 +370,256 @@ int _win_select(int max_fd, fd_set * rfds, fd_set * wfds, fd_set * efds,
     return 0;
   }
 
-  FD_ZERO(&sock_read);
-  FD_ZERO(&sock_write);
-  FD_ZERO(&sock_except);
-
-  /* build an array of handles for non-sockets */
-  for(i = 0; i < max_fd; i++)
+  /* Too big for the stack of some threads */
+  pSel = (TSelect *) __win_Malloc(sizeof(TSelect));
+  if (!pSel)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  pSel->rfds = rfds;
+  pSel->wfds = wfds;
+  pSel->efds = efds;
+  pSel->n_handles = 0;
+  pSel->n_sockets = 0;
+  pSel->sock_max_fd = -1;
+  pSel->iPipes = 0;
+  pSel->iWriters = 0;
+  FD_ZERO(&pSel->sock_read);
+  FD_ZERO(&pSel->sock_write);
+  FD_ZERO(&pSel->sock_except);
+  FD_ZERO(&pSel->sock_closed);
+
+  /* build arrays of sockets, handles and pipes */
+  retcode = 0;
+  for(i = 0; i < max_fd && retcode == 0; i++)
   {
-    if(SAFE_FD_ISSET(i, rfds) || SAFE_FD_ISSET(i, wfds) ||
-       SAFE_FD_ISSET(i, efds))
+    THandleInfo info;
+    THandleType eType;
+
+    if (!(SAFE_FD_ISSET(i, rfds) || SAFE_FD_ISSET(i, wfds) ||
+       SAFE_FD_ISSET(i, efds)))
+      continue;
+
+    if (!__win_GetHandleInfo(i, &info))
     {
+      info.eType = UNKNOWN_HANDLE;
+      info.pPipe = NULL;
+    }
+    eType = info.eType;
+    if (eType == SOCKET_HANDLE && pSel->n_sockets >= FD_SETSIZE)
+    {
+      errno = EINVAL;
+      retcode = -1;
+    }
+    else if (eType == SOCKET_HANDLE)
+    {
+      /* socket */
+      if(SAFE_FD_ISSET(i, rfds))
+        FD_SET(i, &pSel->sock_read);
 
-      if (__win_GetHandleType(i) == SOCKET_HANDLE) 
-      {
-        /* socket */
-        if(SAFE_FD_ISSET(i, rfds))
-          FD_SET(i, &sock_read);
+      if(SAFE_FD_ISSET(i, wfds))
+        FD_SET(i, &pSel->sock_write);
 
-        if(SAFE_FD_ISSET(i, wfds))
-          FD_SET(i, &sock_write);
+      if(SAFE_FD_ISSET(i, efds))
+        FD_SET(i, &pSel->sock_except);
 
-        if(SAFE_FD_ISSET(i, efds))
-          FD_SET(i, &sock_except);
+      if(i > pSel->sock_max_fd)
+        pSel->sock_max_fd = i;
 
-        if(i > sock_max_fd)
-          sock_max_fd = i;
+      pSel->sockets[pSel->n_sockets++] = i;
+    }
+    else if (pSel->n_handles + pSel->iPipes + pSel->iWriters >=
+      MAXIMUM_WAIT_OBJECTS - 1 || (eType == PIPE_HANDLE &&
+      SAFE_FD_ISSET(i, rfds) && SAFE_FD_ISSET(i, wfds) &&
+      pSel->n_handles + pSel->iPipes + pSel->iWriters + 2 >
+      MAXIMUM_WAIT_OBJECTS - 1))
+    {
+      /* One slot is left for the sockets */
+      errno = EINVAL;
+      retcode = -1;
+    }
+    else if (eType == PIPE_HANDLE)
+    {
+      if (SAFE_FD_ISSET(i, wfds) && !__win_GetPipeWriteEvent(&info))
+      {
+        errno = ENOSYS;
+        retcode = -1;  /* Not implemented */
       }
       else
       {
-        if (__win_GetHandleType(i) == PIPE_HANDLE)
-          hPipes[iPipes++] = (HANDLE) (intptr_t) i;  /* Pipe */
-        else
+        if (SAFE_FD_ISSET(i, rfds))
         {
-          handles[n_handles] = (HANDLE) _get_osfhandle(i);
-          if (handles[n_handles] == (HANDLE)(intptr_t) -1)
-            handles[n_handles] = (HANDLE)(intptr_t) i;
-          handle_slot_to_fd[n_handles] = i;
-          n_handles++;
+          TPipeWaiter *pWaiter = &pSel->pipes[pSel->iPipes++];
+
+          pWaiter->iFD = i;
+          pWaiter->bOverlapped = info.pPipe != NULL;
+          pWaiter->hThread = NULL;
+          pWaiter->hReady = NULL;
+          pWaiter->hPort = NULL;
         }
+
+        if (SAFE_FD_ISSET(i, wfds))
+          pSel->writers[pSel->iWriters++] = info;
       }
     }
+    else
+    {
+      pSel->handles[pSel->n_handles] = (HANDLE) _get_osfhandle(i);
+      if (pSel->handles[pSel->n_handles] == (HANDLE)(intptr_t) -1)
+        pSel->handles[pSel->n_handles] = (HANDLE)(intptr_t) i;
+      pSel->handle_slot_to_fd[pSel->n_handles] = i;
+      pSel->n_handles++;
+    }
+  }
+  if (retcode == -1)
+  {
+    free(pSel);
+    return -1;
   }
 
-  /* multiplex between winsock select() and waiting on the handles */
-
-  FD_ZERO(&aread);
-  FD_ZERO(&awrite);
-  FD_ZERO(&aexcept);
-
-  limit = GetTickCount() + ms_total;
-  do
+  /* Bind the sockets to an event */
+  hSockEvent = WSA_INVALID_EVENT;
+  if (pSel->n_sockets)
   {
-    retcode = 0;
+    hSockEvent = WSACreateEvent();
+    if (hSockEvent == WSA_INVALID_EVENT)
+    {
+      SetErrnoFromWinsockError(WSAGetLastError());
+      free(pSel);
+      return -1;
+    }
 
-    if(sock_max_fd >= 0)
+    for (i = 0; i < pSel->n_sockets; i++)
     {
-      /* overwrite the zero'd sets here; the select call
-       * will clear those that are not active */
-      aread = sock_read;
-      awrite = sock_write;
-      aexcept = sock_except;
+      SOCKET s = pSel->sockets[i];
 
-      tvslice.tv_sec = 0;
-      tvslice.tv_usec = 100000;
+      lEvents = 0;
+      if (FD_ISSET(s, &pSel->sock_read))
+        lEvents |= FD_READ | FD_ACCEPT | FD_CLOSE;
+      if (FD_ISSET(s, &pSel->sock_write))
+        lEvents |= FD_WRITE | FD_CONNECT;
+      if (FD_ISSET(s, &pSel->sock_except))
+        lEvents |= FD_OOB | FD_CONNECT;
 
-      if ((retcode = select(sock_max_fd + 1, &aread, &awrite, &aexcept,
-                            &tvslice)) == SOCKET_ERROR)
+      if (WSAEventSelect(s, hSockEvent, lEvents) == SOCKET_ERROR)
       {
         SetErrnoFromWinsockError(WSAGetLastError());
         if (errno == ENOTSOCK)
           errno = EBADF;
-
-        return retcode;
+        pSel->n_sockets = i;
+        retcode = -1;
+        break;
       }
     }
+  }
 
-    if(n_handles > 0)
-    {
-      /* check handles */
-      DWORD wret;
-
-      wret =
-        MsgWaitForMultipleObjects(n_handles, handles, FALSE,
-                                  retcode > 0 ? 0 : 100, QS_ALLEVENTS);
+  /* Everything we wait for */
+  memcpy(ahWait, pSel->handles, pSel->n_handles * sizeof(HANDLE));
+  nWait = pSel->n_handles;
+  if (hSockEvent != WSA_INVALID_EVENT)
+    ahWait[nWait++] = hSockEvent;
+  for (i = 0; i < pSel->iWriters; i++)
+    ahWait[nWait++] = __win_GetPipeWriteEvent(&pSel->writers[i]);
+  bPipeThreads = __win_CanWaitForPipes();
+  for (i = 0; bPipeThreads && i < pSel->iPipes; i++)
+  {
+    pSel->pipes[i].hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!pSel->pipes[i].hReady)
+      bPipeThreads = FALSE;
+  }
+  if (bPipeThreads)
+  {
+    for (i = 0; i < pSel->iPipes; i++)
+      ahWait[nWait++] = pSel->pipes[i].hReady;
+  }
 
-      if(wret == WAIT_TIMEOUT)
-      {
-        /* set retcode to 0; this is the default.
-         * select() may have set it to something else,
-         * in which case we leave it alone, so this branch
-         * does nothing */
-        ;
-      }
-      else if(wret == WAIT_FAILED)
-      {
-        SetErrnoFromWinError(GetLastError());
+  FD_ZERO(&aread);
+  FD_ZERO(&awrite);
+  FD_ZERO(&aexcept);
 
-        return -1;
-      }
-      else
-      {
-        for(i = 0; i < n_handles; i++)
-        {
-          if(WAIT_OBJECT_0 == WaitForSingleObject(handles[i], 0))
-          {
-            if(SAFE_FD_ISSET(handle_slot_to_fd[i], rfds))
-            {
-              FD_SET(handle_slot_to_fd[i], &aread);
-            }
+  dwStart = GetTickCount();
+  dwPoll = 1;
+  while (retcode == 0)
+  {
+    /* Reset before checking, so that nothing gets lost */
+    if (hSockEvent != WSA_INVALID_EVENT)
+    {
+      BOOL bSignaled = WaitForSingleObject(hSockEvent, 0) == WAIT_OBJECT_0;
 
-            if(SAFE_FD_ISSET(handle_slot_to_fd[i], wfds))
-              FD_SET(handle_slot_to_fd[i], &awrite);
+      WSAResetEvent(hSockEvent);
+      if (bSignaled)
+        __win_SelectClosed(pSel);
+    }
 
-            if(SAFE_FD_ISSET(handle_slot_to_fd[i], efds))
-              FD_SET(handle_slot_to_fd[i], &aexcept);
+    retcode = __win_SelectCheck(pSel, &aread, &awrite, &aexcept);
+    if (retcode != 0)
+      break;
 
-            retcode++;
-          }
-        }
-      }
+    if (ms_total == INFINITE)
+      dwWait = INFINITE;
+    else
+    {
+      dwElapsed = GetTickCount() - dwStart;
+      if (dwElapsed >= ms_total)
+        break;
+      dwWait = ms_total - dwElapsed;
     }
 
-    /* Poll Pipes */
-    for(i = 0; i < iPipes; i++)
+    if (pSel->iPipes)
     {
-      DWORD dwBytes;
-      if(SAFE_FD_ISSET(hPipes[i], rfds))
+      if (bPipeThreads)
       {
-	    if (! PeekNamedPipe(hPipes[i], NULL, 0, NULL, &dwBytes, NULL))
-	    {
-	      retcode = -1;
-	      SetErrnoFromWinError(GetLastError());
-	    }
-	    else if (dwBytes)
-	    {
-	      FD_SET((intptr_t)hPipes[i], &aread);
-	      retcode++;
-	    }
+        for (i = 0; i < pSel->iPipes; i++)
+          __win_StartPipeWaiter(&pSel->pipes[i]);
       }
-      else if (SAFE_FD_ISSET(hPipes[i], wfds) || SAFE_FD_ISSET(hPipes[i], efds))
+      else
       {
-        errno = ENOSYS;
-        return -1;  /* Not implemented */
+        if (dwWait > dwPoll)
+          dwWait = dwPoll;
+        if (dwPoll < SELECT_PIPE_POLL_MAX)
+          dwPoll *= 2;
       }
     }
-    
-    /* Check for closed sockets */
-    for(i = 0; i < sock_max_fd; i++)
+
+    if (nWait)
+      wret = WaitForMultipleObjects(nWait, ahWait, FALSE, dwWait);
+    else
     {
-      if(FD_ISSET(i, &sock_read))
-      {
-        struct sockaddr addr;
-        int len;
+      /* Only polled pipes */
+      Sleep(dwWait);
+      wret = WAIT_TIMEOUT;
+    }
+    if (wret == WAIT_FAILED)
+    {
+      SetErrnoFromWinError(GetLastError());
+      retcode = -1;
+      break;
+    }
 
-        if (getpeername(i, &addr, &len) == SOCKET_ERROR)
-        {
-          int err, len;
-
-          len = sizeof(err);          
-          if (getsockopt(i, SOL_SOCKET, SO_ERROR, (char *) &err, &len) == 0 &&
-                err == WSAENOTCONN)
-          {
-            if (! FD_ISSET(i, &aread))
-            {
-              FD_SET(i, &aread);
-              retcode++;
-            }
-          }
-        }
-      }
+    /* Waiters that returned are restarted if the pipe isn't ready */
+    for (i = 0; bPipeThreads && i < pSel->iPipes; i++)
+    {
+      if (WaitForSingleObject(pSel->pipes[i].hReady, 0) == WAIT_OBJECT_0)
+        __win_StopPipeWaiter(&pSel->pipes[i]);
     }
   }
-  while(retcode == 0 && (ms_total == INFINITE || GetTickCount() < limit));
+
+  /* Clean up */
+  for (i = 0; i < pSel->iPipes; i++)
+  {
+    __win_StopPipeWaiter(&pSel->pipes[i]);
+    if (pSel->pipes[i].hReady)
+      CloseHandle(pSel->pipes[i].hReady);
+  }
+  for (i = 0; i < pSel->n_sockets; i++)
+    __win_UnbindSocketEvent(pSel->sockets[i]);
+  if (hSockEvent != WSA_INVALID_EVENT)
+    WSACloseEvent(hSockEvent);
+  free(pSel);
+
+  if (retcode == -1)
+    return -1;
 
   if(rfds)
     *rfds = aread;
@@ -264,3 +632,5 @@ int _win_select(int max_fd, fd_set * rfds, fd_set * wfds, fd_set * efds,
 
   return retcode;
 }
+
+/* end of select.c */
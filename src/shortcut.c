@@ -78,7 +78,7 @@ _plibc_CreateShortcutW(const wchar_t *pwszSrc, const wchar_t *pwszDest)
     }
 
     /* shortcuts have the extension .lnk */
-    pwszFileLnk = (wchar_t *) malloc((wcslen(pwszDest) + 5) * sizeof (wchar_t));
+    pwszFileLnk = (wchar_t *) __win_Malloc((wcslen(pwszDest) + 5) * sizeof (wchar_t));
     swprintf(pwszFileLnk, L"%s.lnk", pwszDest);
   
     /* Save shortcut */
@@ -136,28 +136,91 @@ _plibc_CreateShortcut(const char *pszSrc, const char *pszDest)
   return result;
 }
 
-BOOL
-_plibc_DereferenceShortcutW(wchar_t *pwszShortcut)
+/* Direct mapped cache of shortcut resolutions. Without it, every stat() and
+   every path translation with dereferencing would load the shell link COM
+   object, even for files that are no shortcuts at all.
+   A directory is watched for changes once it had two misses. Watches keep
+   the directory from being removed by other processes, so they are closed
+   when they weren't used for SHORTCUT_WATCH_IDLE. Entries without a watch
+   are validated by the time stamps of the file and of its directory. */
+#define SHORTCUT_CACHE_SLOTS 512    /* power of 2 */
+#define SHORTCUT_WATCHES     16
+#define SHORTCUT_WATCH_IDLE  5000   /* ms */
+#define SHORTCUT_MISS_DIRS   64     /* power of 2 */
+
+typedef struct
+{
+  DWORD dwAttributes;
+  FILETIME ftLastWrite;
+  DWORD dwSizeHigh, dwSizeLow;
+} TShortcutStamp;
+
+typedef struct
+{
+  unsigned int uiHash;
+  LONG lGeneration;
+  int iWatch;                   /* directory watch or -1 */
+  LONG lEpoch;                  /* epoch of the watch when resolved */
+  BOOL bAppended;               /* ".lnk" was appended to find the file */
+  TShortcutStamp stamp;         /* of the file that was examined */
+  BOOL bDirStamp;               /* ftDir is valid */
+  FILETIME ftDir;               /* last write of the directory */
+  wchar_t *pwszTarget;          /* NULL if the path isn't a shortcut */
+  size_t nPathLen;
+  wchar_t data[1];              /* path, then target */
+} TShortcutEntry;
+
+typedef struct
+{
+  HANDLE hChange;
+  LONG lEpoch;
+  DWORD dwLastUse;
+  DWORD dwLastTick;             /* GetTickCount() when last used */
+  size_t nDirLen;
+  wchar_t szDir[_MAX_PATH + 1];
+} TShortcutWatch;
+
+static CRITICAL_SECTION csShortcuts;
+static TShortcutEntry *pShortcuts[SHORTCUT_CACHE_SLOTS];
+static TShortcutWatch watches[SHORTCUT_WATCHES];
+static LONG lWatchEpoch = 0;
+static DWORD dwWatchClock = 0;
+static DWORD dwWatchSweep = 0;
+static unsigned int auiMissDirs[SHORTCUT_MISS_DIRS];
+static BOOL bShortcutCacheInit = FALSE;
+
+/**
+ * @brief Convert an ANSI string from a shell link
+ * @internal
+ * @note The shell writes these in the ANSI code page
+ */
+static size_t __win_LnkAnsiToWide(const char *pszAnsi, size_t nLen,
+  wchar_t *pwszDest, size_t nDestLen)
+{
+  int iLen;
+
+  iLen = MultiByteToWideChar(CP_ACP, 0, pszAnsi, nLen, pwszDest, nDestLen);
+
+  return iLen > 0 ? iLen : 0;
+}
+
+/**
+ * @brief Read the target of a shortcut through the shell
+ * @internal
+ * @param pwszLnk path of the .lnk file
+ * @param hLink open handle of pwszLnk or INVALID_HANDLE_VALUE (errno is set)
+ * @note This is slow and needs COM, it's only used for links that
+ *       __win_ParseShortcut() doesn't understand
+ */
+static BOOL __win_LoadShortcutW(const wchar_t *pwszLnk, HANDLE hLink,
+  wchar_t *pwszTarget)
 {
   IShellLinkW *pLink;
-  wchar_t *pwszLnk;
-  wchar_t szTarget[_MAX_PATH + 1];
   IPersistFile *pFile;
-  int iErr, iLen;
   HRESULT hRes;
-  HANDLE hLink;
-
-  if (! *pwszShortcut)
-    return TRUE;
-
-  if (GetFileAttributesW (pwszShortcut) & (FILE_ATTRIBUTE_DEVICE | FILE_ATTRIBUTE_DIRECTORY))
-  {
-    errno = EINVAL;
-    return FALSE;
-  }
 
   CoInitialize(NULL);
-  szTarget[0] = 0;
+  pwszTarget[0] = 0;
   
   /* Create Shortcut-Object */
   if (CoCreateInstance(&CLSID_ShellLink, NULL, CLSCTX_INPROC_SERVER,
@@ -179,18 +242,108 @@ _plibc_DereferenceShortcutW(wchar_t *pwszShortcut)
     return FALSE;
   }
 
+  /* Open shortcut */
+  if (FAILED(hRes = pFile->lpVtbl->Load(pFile, (LPCOLESTR) pwszLnk, STGM_READ)))
+  {
+    pLink->lpVtbl->Release(pLink);
+    pFile->lpVtbl->Release(pFile);
+    CoUninitialize();
+    
+    /* For some reason, opening an invalid link sometimes fails with ACCESSDENIED.
+       Since we have opened the file previously, insufficient priviledges
+       are rather not the problem. */
+    if (hRes == E_FAIL || hRes == E_ACCESSDENIED)
+    {
+      /* The file magic was checked by __win_ParseShortcut() */
+      if (hLink != INVALID_HANDLE_VALUE)
+        SetErrnoFromHRESULT(hRes);
+      /* else: errno was set above! */
+    }
+    else
+      SetErrnoFromHRESULT(hRes);
+          
+    return FALSE;
+  }
+  
+  /* Get target file */
+  if (FAILED(hRes = pLink->lpVtbl->GetPath(pLink, pwszTarget, _MAX_PATH, NULL, 0)))
+  {
+    pLink->lpVtbl->Release(pLink);
+    pFile->lpVtbl->Release(pFile);
+    CoUninitialize();
+    
+    if (hRes == E_FAIL)
+      errno = EINVAL; /* Not a symlink */
+    else
+      SetErrnoFromHRESULT(hRes);
+    
+    return FALSE;
+  }
+
+  pFile->lpVtbl->Release(pFile);
+  pLink->lpVtbl->Release(pLink);
+  CoUninitialize();
+  errno = 0;
+  
+  if (pwszTarget[0] != 0)
+  	return TRUE;
+  else
+  {
+    /* GetPath() did not return a valid path */
+    errno = EINVAL;
+    return FALSE;
+  }
+}
+
+/**
+ * @brief Read the target of a shortcut
+ * @internal
+ * @param pwszShortcut path of the shortcut, with or without ".lnk"
+ * @param pwszTarget receives the target, _MAX_PATH + 1 characters
+ * @param pbAppended set to TRUE if ".lnk" had to be appended
+ * @param pStamp receives attributes, size and modification time of the file
+ *        that was examined
+ * @return TRUE if the path is a shortcut. Otherwise, errno is EINVAL if the
+ *         path isn't a shortcut.
+ */
+static BOOL __win_ResolveShortcutW(const wchar_t *pwszShortcut,
+  wchar_t *pwszTarget, BOOL *pbAppended, TShortcutStamp *pStamp)
+{
+  wchar_t *pwszLnk;
+  unsigned char pData[LNK_READ_SIZE];
+  int iLen, iKind;
+  DWORD dwRead;
+  HANDLE hLink;
+  BOOL bRet;
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  BY_HANDLE_FILE_INFORMATION lnkInfo;
+
+  *pbAppended = FALSE;
+  pStamp->dwAttributes = INVALID_FILE_ATTRIBUTES;
+
+  if (!GetFileAttributesExW(pwszShortcut, GetFileExInfoStandard, &attrs) ||
+    (attrs.dwFileAttributes & (FILE_ATTRIBUTE_DEVICE | FILE_ATTRIBUTE_DIRECTORY)))
+  {
+    errno = EINVAL;
+    return FALSE;
+  }
+
+  pStamp->dwAttributes = attrs.dwFileAttributes;
+  pStamp->ftLastWrite = attrs.ftLastWriteTime;
+  pStamp->dwSizeHigh = attrs.nFileSizeHigh;
+  pStamp->dwSizeLow = attrs.nFileSizeLow;
+
   /* Shortcuts have the extension .lnk
      If it isn't there, append it */
   iLen = wcslen(pwszShortcut);
   if (iLen > 4 && (wcscmp(pwszShortcut + iLen - 4, L".lnk") != 0))
   {
-    HANDLE hLink;
-    
-    pwszLnk = (wchar_t *) malloc((iLen + 5) * sizeof (wchar_t));
+    pwszLnk = (wchar_t *) __win_Malloc((iLen + 5) * sizeof (wchar_t));
     swprintf(pwszLnk, L"%s.lnk", pwszShortcut);
+    *pbAppended = TRUE;
   }
   else
-    pwszLnk = wcsdup(pwszShortcut);
+    pwszLnk = __win_WcsDup(pwszShortcut);
 
   /* Make sure the path refers to a file */
   hLink = CreateFileW(pwszLnk, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
@@ -204,106 +357,574 @@ _plibc_DereferenceShortcutW(wchar_t *pwszShortcut)
     {
       /* There's no path with the ".lnk" extension.
          We don't quit here, because we have to decide whether the path doesn't
-         exist or the path isn't a link. */
-
-      /* Is it a directory? */
-      if (GetFileAttributesW(pwszShortcut) & FILE_ATTRIBUTE_DIRECTORY)
-      {
-        errno = EINVAL;
-        
-        pLink->lpVtbl->Release(pLink);
-        pFile->lpVtbl->Release(pFile);
-        CoUninitialize();
-        
-        return FALSE;
-      }
-
-      pwszLnk = wcsdup(pwszShortcut);
+         exist or the path isn't a link. We know that it isn't a directory. */
+      pwszLnk = __win_WcsDup(pwszShortcut);
+      *pbAppended = FALSE;
       
       hLink = CreateFileW(pwszLnk, GENERIC_READ, FILE_SHARE_READ |
                 FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
       SetErrnoFromWinError(GetLastError());
     }
     else
-    {
-      pLink->lpVtbl->Release(pLink);
-      pFile->lpVtbl->Release(pFile);
-      CoUninitialize();
-      
       return FALSE; /* File/link is there but unaccessible */
+  }
+  else if (*pbAppended)
+  {
+    /* The result depends on the shortcut, not on pwszShortcut */
+    if (GetFileInformationByHandle(hLink, &lnkInfo))
+    {
+      pStamp->dwAttributes = lnkInfo.dwFileAttributes;
+      pStamp->ftLastWrite = lnkInfo.ftLastWriteTime;
+      pStamp->dwSizeHigh = lnkInfo.nFileSizeHigh;
+      pStamp->dwSizeLow = lnkInfo.nFileSizeLow;
     }
+    else
+      pStamp->dwAttributes = INVALID_FILE_ATTRIBUTES;
   }
-  free(pwszShortcut);
-  pwszShortcut = pwszLnk;
-  
-  /* Open shortcut */
-  if (FAILED(hRes = pFile->lpVtbl->Load(pFile, (LPCOLESTR) pwszShortcut, STGM_READ)))
+
+  /* Links to files keep their target in the first few hundred bytes */
+  if (hLink != INVALID_HANDLE_VALUE)
   {
-    pLink->lpVtbl->Release(pLink);
-    pFile->lpVtbl->Release(pFile);
-    free(pwszShortcut);
-    CoUninitialize();
-    
-    /* For some reason, opening an invalid link sometimes fails with ACCESSDENIED.
-       Since we have opened the file previously, insufficient priviledges
-       are rather not the problem. */
-    if (hRes == E_FAIL || hRes == E_ACCESSDENIED)
+    if (!ReadFile(hLink, pData, sizeof(pData), &dwRead, NULL))
+      dwRead = 0;
+    iKind = __win_ParseShortcut(pData, dwRead, pwszTarget, _MAX_PATH + 1,
+      __win_LnkAnsiToWide);
+    if (iKind != LNK_UNKNOWN)
     {
-      /* Check file magic */
-      if (hLink != INVALID_HANDLE_VALUE)
+      CloseHandle(hLink);
+      free(pwszLnk);
+
+      if (iKind == LNK_NONE)
       {
-        DWORD dwRead;
-        char pMagic[4] = {0, 0, 0, 0};
-        
-        ReadFile(hLink, pMagic, 4, &dwRead, NULL);
-        if (memcmp(pMagic, "L\0\0\0", 4) == 0)
-          SetErrnoFromHRESULT(hRes);
-        else
-          errno = EINVAL; /* No link */
+        errno = EINVAL; /* No link */
+        return FALSE;
       }
-      /* else: errno was set above! */
+
+      errno = 0;
+      return TRUE;
     }
-    else
-      SetErrnoFromHRESULT(hRes);
-          
-    CloseHandle(hLink);
-    return FALSE;
   }
-  
+
+  bRet = __win_LoadShortcutW(pwszLnk, hLink, pwszTarget);
+
   CloseHandle(hLink);
-  free(pwszShortcut);
-  
-  /* Get target file */
-  if (FAILED(hRes = pLink->lpVtbl->GetPath(pLink, szTarget, _MAX_PATH, NULL, 0)))
+  free(pwszLnk);
+
+  return bRet;
+}
+
+/**
+ * @brief Set up the shortcut cache
+ * @internal
+ */
+void __win_InitShortcutCache()
+{
+  if (bShortcutCacheInit)
+    return;
+
+  InitializeCriticalSection(&csShortcuts);
+  memset(pShortcuts, 0, sizeof(pShortcuts));
+  memset(watches, 0, sizeof(watches));
+  memset(auiMissDirs, 0, sizeof(auiMissDirs));
+  bShortcutCacheInit = TRUE;
+}
+
+/**
+ * @brief Stop watching directories for changes
+ * @internal
+ * @note A watched directory can't be removed for good, so call this before
+ *       removing or renaming directories. Cached results are then validated
+ *       by their time stamps until the directories are watched again.
+ */
+void __win_CloseShortcutWatches()
+{
+  int i;
+
+  if (!bShortcutCacheInit)
+    return;
+
+  EnterCriticalSection(&csShortcuts);
+  for (i = 0; i < SHORTCUT_WATCHES; i++)
   {
-    pLink->lpVtbl->Release(pLink);
-    pFile->lpVtbl->Release(pFile);
-    CoUninitialize();
-    
-    if (hRes == E_FAIL)
-      errno = EINVAL; /* Not a symlink */
-    else
-      SetErrnoFromHRESULT(hRes);
-    
+    if (watches[i].hChange)
+    {
+      FindCloseChangeNotification(watches[i].hChange);
+      watches[i].hChange = NULL;
+    }
+  }
+  LeaveCriticalSection(&csShortcuts);
+}
+
+/**
+ * @brief Free the shortcut cache
+ * @internal
+ */
+void __win_FreeShortcutCache()
+{
+  int i;
+
+  if (!bShortcutCacheInit)
+    return;
+
+  __win_CloseShortcutWatches();
+  for (i = 0; i < SHORTCUT_CACHE_SLOTS; i++)
+  {
+    free(pShortcuts[i]);
+    pShortcuts[i] = NULL;
+  }
+
+  DeleteCriticalSection(&csShortcuts);
+  bShortcutCacheInit = FALSE;
+}
+
+static unsigned int __win_HashShortcut(const wchar_t *pwszPath, size_t nLen)
+{
+  unsigned int uiHash = 2166136261U;
+
+  while (nLen--)
+  {
+    uiHash ^= *pwszPath++;
+    uiHash *= 16777619U;
+  }
+
+  return uiHash;
+}
+
+/**
+ * @brief Check whether a directory watch still vouches for an entry
+ * @internal
+ * @note csShortcuts has to be held
+ */
+static BOOL __win_IsShortcutWatchValid(int iWatch, LONG lEpoch)
+{
+  TShortcutWatch *pWatch;
+
+  if (iWatch < 0)
     return FALSE;
+
+  pWatch = &watches[iWatch];
+  if (!pWatch->hChange || pWatch->lEpoch != lEpoch)
+    return FALSE;
+
+  if (WaitForSingleObject(pWatch->hChange, 0) == WAIT_TIMEOUT)
+  {
+    pWatch->dwLastTick = GetTickCount();
+    return TRUE;
   }
 
-  pFile->lpVtbl->Release(pFile);
-  pLink->lpVtbl->Release(pLink);
-  CoUninitialize();
-  errno = 0;
-  
-  if (szTarget[0] != 0)
+  /* Something in the directory changed, all entries that depend on the
+     watch are stale */
+  pWatch->lEpoch = ++lWatchEpoch;
+  if (!FindNextChangeNotification(pWatch->hChange))
   {
-  	wcscpy(pwszShortcut, szTarget);
-  	return TRUE;
+    FindCloseChangeNotification(pWatch->hChange);
+    pWatch->hChange = NULL;
+  }
+
+  return FALSE;
+}
+
+/**
+ * @brief Close watches that weren't used for a while
+ * @internal
+ * @note csShortcuts has to be held
+ */
+static void __win_CloseIdleShortcutWatches()
+{
+  DWORD dwNow;
+  int i;
+
+  dwNow = GetTickCount();
+  if (dwNow - dwWatchSweep < SHORTCUT_WATCH_IDLE / 4)
+    return;
+  dwWatchSweep = dwNow;
+
+  for (i = 0; i < SHORTCUT_WATCHES; i++)
+  {
+    if (watches[i].hChange &&
+      dwNow - watches[i].dwLastTick > SHORTCUT_WATCH_IDLE)
+    {
+      FindCloseChangeNotification(watches[i].hChange);
+      watches[i].hChange = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Get the length of the directory part of a path
+ * @internal
+ * @return length including the separator or 0
+ */
+static size_t __win_ShortcutDirLen(const wchar_t *pwszPath)
+{
+  const wchar_t *pwszSep, *pwszEnd;
+  size_t nDirLen;
+
+  pwszSep = NULL;
+  for (pwszEnd = pwszPath; *pwszEnd; pwszEnd++)
+    if (*pwszEnd == L'\\' || *pwszEnd == L'/')
+      pwszSep = pwszEnd;
+  if (!pwszSep)
+    return 0;
+
+  nDirLen = pwszSep - pwszPath + 1;
+
+  return nDirLen > _MAX_PATH ? 0 : nDirLen;
+}
+
+/**
+ * @brief Copy the directory part of a path
+ * @internal
+ * @param pwszDir receives the directory (_MAX_PATH + 1 characters)
+ */
+static void __win_ShortcutDirName(const wchar_t *pwszPath, size_t nDirLen,
+  wchar_t *pwszDir)
+{
+  memcpy(pwszDir, pwszPath, nDirLen * sizeof(wchar_t));
+  /* "C:\" needs its separator, "C:\dir\" must not have one */
+  pwszDir[nDirLen > 3 ? nDirLen - 1 : nDirLen] = 0;
+}
+
+/**
+ * @brief Get the last write time of the directory of a path
+ * @internal
+ * @note Creating, removing or renaming a file in the directory changes it,
+ *       so a "<name>.lnk" that appears next to "<name>" is noticed
+ */
+static BOOL __win_GetShortcutDirStamp(const wchar_t *pwszPath,
+  FILETIME *pftDir)
+{
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  wchar_t szDir[_MAX_PATH + 1];
+  size_t nDirLen;
+
+  nDirLen = __win_ShortcutDirLen(pwszPath);
+  if (!nDirLen)
+    return FALSE;
+
+  __win_ShortcutDirName(pwszPath, nDirLen, szDir);
+  if (!GetFileAttributesExW(szDir, GetFileExInfoStandard, &attrs))
+    return FALSE;
+
+  *pftDir = attrs.ftLastWriteTime;
+
+  return TRUE;
+}
+
+/**
+ * @brief Watch the directory of a path for changes
+ * @internal
+ * @param plEpoch receives the current epoch of the watch
+ * @return index of the watch or -1
+ * @note A directory is only watched after its second miss, so that paths
+ *       looked at once don't replace useful watches
+ */
+static int __win_WatchShortcutDir(const wchar_t *pwszPath, LONG *plEpoch)
+{
+  TShortcutWatch *pWatch;
+  wchar_t szDir[_MAX_PATH + 1];
+  unsigned int uiDirHash, *puiMiss;
+  size_t nDirLen;
+  int i, iFree;
+
+  nDirLen = __win_ShortcutDirLen(pwszPath);
+  if (!nDirLen)
+    return -1;
+
+  EnterCriticalSection(&csShortcuts);
+
+  __win_CloseIdleShortcutWatches();
+
+  iFree = -1;
+  for (i = 0; i < SHORTCUT_WATCHES; i++)
+  {
+    pWatch = &watches[i];
+    if (pWatch->hChange && pWatch->nDirLen == nDirLen &&
+      _wcsnicmp(pWatch->szDir, pwszPath, nDirLen) == 0)
+    {
+      /* Consume pending notifications */
+      __win_IsShortcutWatchValid(i, pWatch->lEpoch);
+      if (pWatch->hChange)
+      {
+        pWatch->dwLastUse = ++dwWatchClock;
+        pWatch->dwLastTick = GetTickCount();
+        *plEpoch = pWatch->lEpoch;
+        LeaveCriticalSection(&csShortcuts);
+
+        return i;
+      }
+    }
+
+    /* Prefer unused watches, then the least recently used one */
+    if (!pWatch->hChange)
+    {
+      if (iFree == -1 || watches[iFree].hChange)
+        iFree = i;
+    }
+    else if (iFree == -1 || (watches[iFree].hChange &&
+      pWatch->dwLastUse < watches[iFree].dwLastUse))
+      iFree = i;
+  }
+
+  uiDirHash = __win_HashShortcut(pwszPath, nDirLen);
+  puiMiss = &auiMissDirs[uiDirHash & (SHORTCUT_MISS_DIRS - 1)];
+  if (*puiMiss != uiDirHash)
+  {
+    *puiMiss = uiDirHash;
+    LeaveCriticalSection(&csShortcuts);
+
+    return -1;
+  }
+
+  pWatch = &watches[iFree];
+  if (pWatch->hChange)
+    FindCloseChangeNotification(pWatch->hChange);
+
+  __win_ShortcutDirName(pwszPath, nDirLen, szDir);
+  pWatch->hChange = FindFirstChangeNotificationW(szDir, FALSE,
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+    FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+    FILE_NOTIFY_CHANGE_LAST_WRITE);
+  if (pWatch->hChange == INVALID_HANDLE_VALUE)
+  {
+    pWatch->hChange = NULL;
+    iFree = -1;
+  }
+  else
+  {
+    memcpy(pWatch->szDir, pwszPath, nDirLen * sizeof(wchar_t));
+    pWatch->nDirLen = nDirLen;
+    pWatch->lEpoch = ++lWatchEpoch;
+    pWatch->dwLastUse = ++dwWatchClock;
+    pWatch->dwLastTick = GetTickCount();
+    *plEpoch = pWatch->lEpoch;
+  }
+
+  LeaveCriticalSection(&csShortcuts);
+
+  return iFree;
+}
+
+/**
+ * @brief Find the cache entry of a path
+ * @internal
+ * @note csShortcuts has to be held
+ */
+static TShortcutEntry *__win_FindShortcutEntry(const wchar_t *pwszPath,
+  size_t nLen, unsigned int uiHash)
+{
+  TShortcutEntry *pEntry;
+
+  pEntry = pShortcuts[uiHash & (SHORTCUT_CACHE_SLOTS - 1)];
+  if (!pEntry || pEntry->uiHash != uiHash || pEntry->nPathLen != nLen ||
+    memcmp(pEntry->data, pwszPath, nLen * sizeof(wchar_t)) != 0 ||
+    pEntry->lGeneration != __win_GetPathCacheGeneration())
+    return NULL;
+
+  return pEntry;
+}
+
+/**
+ * @brief Copy the result of a cache entry
+ * @internal
+ */
+static void __win_CopyShortcutResult(const TShortcutEntry *pEntry,
+  wchar_t *pwszPath, BOOL *pbRet)
+{
+  if (pEntry->pwszTarget)
+  {
+    wcscpy(pwszPath, pEntry->pwszTarget);
+    errno = 0;
+    *pbRet = TRUE;
   }
   else
   {
-    /* GetPath() did not return a valid path */
     errno = EINVAL;
+    *pbRet = FALSE;
+  }
+}
+
+/**
+ * @brief Look up the resolution of a shortcut
+ * @internal
+ * @param pwszPath path, receives the target on a hit
+ * @param pbRet receives the result of _plibc_DereferenceShortcutW()
+ * @return TRUE on a hit
+ * @note Entries whose directory is watched are valid until the directory
+ *       changes. Otherwise, the time stamps of the file and of its directory
+ *       are checked.
+ */
+static BOOL __win_ShortcutCacheLookup(wchar_t *pwszPath, size_t nLen,
+  unsigned int uiHash, BOOL *pbRet)
+{
+  TShortcutEntry *pEntry;
+  WIN32_FILE_ATTRIBUTE_DATA attrs;
+  wchar_t szFile[_MAX_PATH + 5];
+  FILETIME ftDir;
+  BOOL bAppended;
+
+  EnterCriticalSection(&csShortcuts);
+  __win_CloseIdleShortcutWatches();
+  pEntry = __win_FindShortcutEntry(pwszPath, nLen, uiHash);
+  if (!pEntry)
+  {
+    LeaveCriticalSection(&csShortcuts);
+    return FALSE;
+  }
+  if (__win_IsShortcutWatchValid(pEntry->iWatch, pEntry->lEpoch))
+  {
+    __win_CopyShortcutResult(pEntry, pwszPath, pbRet);
+    LeaveCriticalSection(&csShortcuts);
+    return TRUE;
+  }
+  bAppended = pEntry->bAppended;
+  LeaveCriticalSection(&csShortcuts);
+
+  /* Don't query the file system while holding the lock */
+  memcpy(szFile, pwszPath, nLen * sizeof(wchar_t));
+  wcscpy(szFile + nLen, bAppended ? L".lnk" : L"");
+  if (!GetFileAttributesExW(szFile, GetFileExInfoStandard, &attrs) ||
+    !__win_GetShortcutDirStamp(pwszPath, &ftDir))
     return FALSE;
+
+  /* The entry may have been replaced in the meantime */
+  EnterCriticalSection(&csShortcuts);
+  pEntry = __win_FindShortcutEntry(pwszPath, nLen, uiHash);
+  if (pEntry && pEntry->bAppended == bAppended && pEntry->bDirStamp &&
+    pEntry->ftDir.dwLowDateTime == ftDir.dwLowDateTime &&
+    pEntry->ftDir.dwHighDateTime == ftDir.dwHighDateTime &&
+    pEntry->stamp.dwAttributes == attrs.dwFileAttributes &&
+    pEntry->stamp.ftLastWrite.dwLowDateTime ==
+      attrs.ftLastWriteTime.dwLowDateTime &&
+    pEntry->stamp.ftLastWrite.dwHighDateTime ==
+      attrs.ftLastWriteTime.dwHighDateTime &&
+    pEntry->stamp.dwSizeHigh == attrs.nFileSizeHigh &&
+    pEntry->stamp.dwSizeLow == attrs.nFileSizeLow)
+    __win_CopyShortcutResult(pEntry, pwszPath, pbRet);
+  else
+    pEntry = NULL;
+  LeaveCriticalSection(&csShortcuts);
+
+  return pEntry != NULL;
+}
+
+/**
+ * @brief Remember the resolution of a shortcut
+ * @internal
+ * @param pftDir last write time of the directory or NULL
+ * @param pwszTarget target or NULL if the path isn't a shortcut
+ */
+static void __win_ShortcutCacheInsert(const wchar_t *pwszPath, size_t nLen,
+  unsigned int uiHash, LONG lGeneration, int iWatch, LONG lEpoch,
+  BOOL bAppended, const TShortcutStamp *pStamp, const FILETIME *pftDir,
+  const wchar_t *pwszTarget)
+{
+  TShortcutEntry *pEntry, **ppSlot;
+  size_t nTargetLen;
+
+  nTargetLen = pwszTarget ? wcslen(pwszTarget) + 1 : 0;
+  pEntry = (TShortcutEntry *) __win_Malloc(sizeof(TShortcutEntry) +
+    (nLen + nTargetLen) * sizeof(wchar_t));
+  if (!pEntry)
+    return;
+
+  pEntry->uiHash = uiHash;
+  pEntry->lGeneration = lGeneration;
+  pEntry->iWatch = iWatch;
+  pEntry->lEpoch = lEpoch;
+  pEntry->bAppended = bAppended;
+  pEntry->stamp = *pStamp;
+  pEntry->bDirStamp = pftDir != NULL;
+  if (pftDir)
+    pEntry->ftDir = *pftDir;
+  pEntry->nPathLen = nLen;
+  memcpy(pEntry->data, pwszPath, nLen * sizeof(wchar_t));
+  if (pwszTarget)
+  {
+    pEntry->pwszTarget = pEntry->data + nLen;
+    memcpy(pEntry->pwszTarget, pwszTarget, nTargetLen * sizeof(wchar_t));
+  }
+  else
+    pEntry->pwszTarget = NULL;
+
+  EnterCriticalSection(&csShortcuts);
+
+  /* The file system changed while the shortcut was resolved */
+  if (lGeneration != __win_GetPathCacheGeneration())
+  {
+    LeaveCriticalSection(&csShortcuts);
+    free(pEntry);
+    return;
+  }
+
+  ppSlot = &pShortcuts[uiHash & (SHORTCUT_CACHE_SLOTS - 1)];
+  free(*ppSlot);
+  *ppSlot = pEntry;
+
+  LeaveCriticalSection(&csShortcuts);
+}
+
+/**
+ * @brief Dereference a shortcut
+ * @param pwszShortcut path, receives the target (_MAX_PATH + 1 characters)
+ * @return TRUE if the path was a shortcut. Otherwise, errno is EINVAL if the
+ *         path isn't a shortcut.
+ * @note Results for absolute paths are cached
+ */
+BOOL
+_plibc_DereferenceShortcutW(wchar_t *pwszShortcut)
+{
+  wchar_t szTarget[_MAX_PATH + 1];
+  TShortcutStamp stamp;
+  FILETIME ftDir;
+  unsigned int uiHash;
+  size_t nLen;
+  LONG lGeneration, lEpoch;
+  int iWatch, iErr;
+  BOOL bRet, bAppended, bAbsolute, bDirStamp;
+
+  if (! *pwszShortcut)
+    return TRUE;
+
+  /* Relative paths depend on the working directory */
+  nLen = wcslen(pwszShortcut);
+  bAbsolute = (pwszShortcut[0] && pwszShortcut[1] == L':' &&
+      (pwszShortcut[2] == L'\\' || pwszShortcut[2] == L'/')) ||
+    (pwszShortcut[0] == L'\\' && pwszShortcut[1] == L'\\');
+  if (!bShortcutCacheInit || !bAbsolute || nLen > _MAX_PATH)
+  {
+    bRet = __win_ResolveShortcutW(pwszShortcut, szTarget, &bAppended, &stamp);
+    if (bRet)
+      wcscpy(pwszShortcut, szTarget);
+
+    return bRet;
   }
+
+  uiHash = __win_HashShortcut(pwszShortcut, nLen);
+  if (__win_ShortcutCacheLookup(pwszShortcut, nLen, uiHash, &bRet))
+    return bRet;
+
+  /* Watch the directory before looking at the file, so that changes made
+     in the meantime invalidate the result */
+  lGeneration = __win_GetPathCacheGeneration();
+  lEpoch = 0;
+  iWatch = __win_WatchShortcutDir(pwszShortcut, &lEpoch);
+  bDirStamp = __win_GetShortcutDirStamp(pwszShortcut, &ftDir);
+
+  bRet = __win_ResolveShortcutW(pwszShortcut, szTarget, &bAppended, &stamp);
+  iErr = errno;
+
+  /* Other errors may be temporary */
+  if (bRet || iErr == EINVAL)
+    __win_ShortcutCacheInsert(pwszShortcut, nLen, uiHash, lGeneration, iWatch,
+      lEpoch, bAppended, &stamp, bDirStamp ? &ftDir : NULL,
+      bRet ? szTarget : NULL);
+
+  if (bRet)
+    wcscpy(pwszShortcut, szTarget);
+  errno = iErr;
+
+  return bRet;
 }
 
 BOOL _plibc_DereferenceShortcut(char *pszShortcut)
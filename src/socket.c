@@ -36,7 +36,12 @@ intptr_t _win_accept(intptr_t s, struct sockaddr *addr, int *addrlen)
   SetErrnoFromWinsockError(WSAGetLastError());
 
   if (r == INVALID_SOCKET)
+  {
+    if (errno == EWOULDBLOCK)
+      __win_EpollRearm(s);
+
     return -1;
+  }
 
   __win_SetHandleType(r, SOCKET_HANDLE);
 
@@ -70,6 +75,8 @@ int _win_connect(intptr_t s, const struct sockaddr *name, int namelen)
   iWSErr = WSAGetLastError();
 
   SetErrnoFromWinsockError(iWSErr);
+  if (iRet == SOCKET_ERROR && errno == EWOULDBLOCK)
+    __win_EpollRearm(s);
 
   return iRet;
 }
@@ -134,6 +141,8 @@ int _win_recv(intptr_t s, char *buf, int len, int flags)
   int iRet = recv(s, buf, len, flags);
 
   SetErrnoFromWinsockError(WSAGetLastError());
+  if (iRet == SOCKET_ERROR && errno == EWOULDBLOCK)
+    __win_EpollRearm(s);
 
   return iRet;
 }
@@ -147,6 +156,8 @@ int _win_recvfrom(intptr_t s, void *buf, int len, int flags,
   int iRet = recvfrom(s, buf, len, flags, from, fromlen);
 
   SetErrnoFromWinsockError(WSAGetLastError());
+  if (iRet == SOCKET_ERROR && errno == EWOULDBLOCK)
+    __win_EpollRearm(s);
 
   return iRet;
 }
@@ -159,6 +170,8 @@ int _win_send(intptr_t s, const char *buf, int len, int flags)
   int iRet = send(s, buf, len, flags);
 
   SetErrnoFromWinsockError(WSAGetLastError());
+  if (iRet == SOCKET_ERROR && errno == EWOULDBLOCK)
+    __win_EpollRearm(s);
 
   return iRet;
 }
@@ -172,6 +185,8 @@ int _win_sendto(intptr_t s, const char *buf, int len, int flags,
   int iRet = sendto(s, buf, len, flags, to, tolen);
 
   SetErrnoFromWinsockError(WSAGetLastError());
+  if (iRet == SOCKET_ERROR && errno == EWOULDBLOCK)
+    __win_EpollRearm(s);
 
   return iRet;
 }
@@ -24,16 +24,242 @@
 
 #include "plibc_private.h"
 
+/**
+ * @brief Get the size of a symbolic link as reported by lstat()
+ * @internal
+ * @param pFile Windows path (wide in UTF-8 mode)
+ * @return length of the contents as returned by readlink() or -1 if the
+ *         path isn't a link
+ */
+static long __win_GetSymlinkSize(const wchar_t *pFile)
+{
+  wchar_t szTarget[_MAX_PATH + 1];
+  int iLen;
+
+  if (_plibc_utf8_mode == 1)
+  {
+    iLen = __win_ReadSymlinkW(pFile, szTarget, _MAX_PATH + 1);
+    if (iLen > 0)
+      iLen = WideCharToMultiByte(CP_UTF8, 0, szTarget, iLen, NULL, 0, NULL,
+        NULL);
+  }
+  else
+    iLen = __win_ReadSymlink((const char *) pFile, (char *) szTarget,
+      sizeof(szTarget));
+
+  return iLen;
+}
+
+/**
+ * @brief Compute st_mode from file attributes the way _stat() does
+ * @internal
+ * @param dwAttributes FILE_ATTRIBUTE_*
+ * @param pwszName name of the file, its extension decides about S_IEXEC
+ */
+unsigned short __win_AttributesToMode(DWORD dwAttributes,
+  const wchar_t *pwszName)
+{
+  unsigned short usMode;
+  const wchar_t *pwszExt;
+
+  usMode = S_IREAD;
+  if (!(dwAttributes & FILE_ATTRIBUTE_READONLY))
+    usMode |= S_IWRITE;
+  if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    usMode |= S_IFDIR | S_IEXEC;
+  else
+  {
+    usMode |= S_IFREG;
+    pwszExt = wcsrchr(pwszName, L'.');
+    if (pwszExt && (_wcsicmp(pwszExt, L".exe") == 0 ||
+      _wcsicmp(pwszExt, L".com") == 0 || _wcsicmp(pwszExt, L".bat") == 0 ||
+      _wcsicmp(pwszExt, L".cmd") == 0))
+      usMode |= S_IEXEC;
+  }
+
+  /* _stat() copies the owner permissions to group and others */
+  usMode |= (usMode & 0700) >> 3;
+  usMode |= (usMode & 0700) >> 6;
+
+  return usMode;
+}
+
+/**
+ * @brief Get status information on a file whose Windows path is longer
+ *        than MAX_PATH
+ * @internal
+ * @param pBuffer struct stat64 if b64 is TRUE, struct _stat otherwise
+ * @note The CRT can't handle \\?\ paths, so the information comes from the
+ *       file system directly. The stat cache is bypassed.
+ */
+static int __win_StatLong(const char *path, void *pBuffer, BOOL b64,
+  int iDeref)
+{
+  BY_HANDLE_FILE_INFORMATION fileInfo;
+  wchar_t *pwszPath;
+  HANDLE hFile;
+  unsigned short usMode;
+  __int64 llSize;
+  long lRet;
+  short sDrive;
+
+  lRet = plibc_conv_to_win_path_long(path, &pwszPath, iDeref);
+  if (lRet != ERROR_SUCCESS)
+  {
+    SetErrnoFromWinError(lRet);
+    return -1;
+  }
+
+  hFile = CreateFileW(pwszPath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ |
+    FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS | (iDeref ? 0 : FILE_FLAG_OPEN_REPARSE_POINT),
+    NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    SetErrnoFromWinError(GetLastError());
+    free(pwszPath);
+    return -1;
+  }
+  if (!GetFileInformationByHandle(hFile, &fileInfo))
+  {
+    SetErrnoFromWinError(GetLastError());
+    CloseHandle(hFile);
+    free(pwszPath);
+    return -1;
+  }
+  CloseHandle(hFile);
+
+  usMode = __win_AttributesToMode(fileInfo.dwFileAttributes, pwszPath);
+  llSize = ((__int64) fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+  if (!iDeref && _plibc_native_symlinks &&
+    (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+  {
+    lRet = __win_GetSymlinkSize(pwszPath);
+    if (lRet != -1)
+    {
+      usMode = (usMode & ~S_IFMT) | S_IFLNK;
+      llSize = lRet;
+    }
+  }
+
+  /* Drive number, 0 = A: */
+  sDrive = 0;
+  if (iswalpha(pwszPath[4]) && pwszPath[5] == L':')
+    sDrive = (short) (towupper(pwszPath[4]) - L'A');
+  free(pwszPath);
+
+  if (b64)
+  {
+    struct stat64 *pStat = (struct stat64 *) pBuffer;
+
+    memset(pStat, 0, sizeof(*pStat));
+    pStat->st_mode = usMode;
+    pStat->st_nlink = (short) fileInfo.nNumberOfLinks;
+    pStat->st_size = llSize;
+    pStat->st_atime = __win_FileTimeToUnix(&fileInfo.ftLastAccessTime);
+    pStat->st_mtime = __win_FileTimeToUnix(&fileInfo.ftLastWriteTime);
+    pStat->st_ctime = __win_FileTimeToUnix(&fileInfo.ftCreationTime);
+    pStat->st_dev = pStat->st_rdev = sDrive;
+  }
+  else
+  {
+    struct _stat *pStat = (struct _stat *) pBuffer;
+
+    if (llSize > LONG_MAX)
+    {
+      errno = EOVERFLOW;
+      return -1;
+    }
+
+    memset(pStat, 0, sizeof(*pStat));
+    pStat->st_mode = usMode;
+    pStat->st_nlink = (short) fileInfo.nNumberOfLinks;
+    pStat->st_size = (long) llSize;
+    pStat->st_atime = __win_FileTimeToUnix(&fileInfo.ftLastAccessTime);
+    pStat->st_mtime = __win_FileTimeToUnix(&fileInfo.ftLastWriteTime);
+    pStat->st_ctime = __win_FileTimeToUnix(&fileInfo.ftCreationTime);
+    pStat->st_dev = pStat->st_rdev = sDrive;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Dereference symlinks in a translated path
+ * @internal
+ * @param szFile wide or narrow path, _MAX_PATH + 1 wide characters
+ * @param nKeyLen length of szFile in bytes
+ * @param pTicket the stat cache ticket of szFile
+ * @return 0 on success, -1 otherwise (errno is set)
+ * @note The cache is looked up before, keyed by the link itself. Results
+ *       for links aren't cached because changes in the directory of the
+ *       target don't invalidate them.
+ */
+static int __win_StatDeref(wchar_t *szFile, size_t nKeyLen,
+  TStatCacheTicket *pTicket)
+{
+  wchar_t szKey[_MAX_PATH + 1];
+  size_t nLen;
+
+  if (pTicket->bCache)
+    memcpy(szKey, szFile, nKeyLen);
+
+  if (_plibc_native_symlinks)
+  {
+    /* The CRT looks at the link itself */
+    if (_plibc_utf8_mode == 1)
+    {
+      if (__win_ResolveSymlinkW(szFile, _MAX_PATH + 1) == -1)
+        return -1;
+    }
+    else
+    {
+      if (__win_ResolveSymlink((char *) szFile,
+        (_MAX_PATH + 1) * sizeof(wchar_t)) == -1)
+        return -1;
+    }
+  }
+  else if (_plibc_utf8_mode == 1)
+  {
+    if (__win_derefw(szFile) == -1 && errno != EINVAL)
+      return -1;
+  }
+  else
+  {
+    if (__win_deref((char *) szFile) == -1 && errno != EINVAL)
+      return -1;
+  }
+
+  if (pTicket->bCache)
+  {
+    if (_plibc_utf8_mode == 1)
+      nLen = wcslen(szFile) * sizeof(wchar_t);
+    else
+      nLen = strlen((char *) szFile);
+    if (nLen != nKeyLen || memcmp(szKey, szFile, nKeyLen) != 0)
+      pTicket->bCache = FALSE;
+  }
+
+  return 0;
+}
+
 /**
  * @brief Get status information on a file
  */
 int __win_stat(const char *path, struct _stat *buffer, int iDeref)
 {
   wchar_t szFile[_MAX_PATH + 1];
+  TStatCacheTicket ticket;
+  size_t nKeyLen;
+  int iKind, iRet;
   long lRet;
 
   if (_plibc_utf8_mode == 1)
+  {
     lRet = plibc_conv_to_win_pathwconv(path, szFile, _MAX_PATH);
+    if (lRet == ERROR_BUFFER_OVERFLOW)
+      return __win_StatLong(path, buffer, FALSE, iDeref);
+  }
   else
     lRet = plibc_conv_to_win_path(path, (char *) szFile, _MAX_PATH);
   if (lRet != ERROR_SUCCESS)
@@ -56,26 +282,43 @@ int __win_stat(const char *path, struct _stat *buffer, int iDeref)
       ((char *) szFile)[lRet] = 0;
   }
 
-  /* Dereference symlinks */
-  if (iDeref)
+  /* Cached result? */
+  iKind = iDeref ? 0 : STAT_CACHE_LSTAT;
+  if (_plibc_utf8_mode == 1)
   {
-    if (_plibc_utf8_mode == 1)
-    {
-      if (__win_derefw(szFile) == -1 && errno != EINVAL)
-        return -1;
-    }
-    else
-    {
-      if (__win_deref((char *) szFile) == -1 && errno != EINVAL)
-        return -1;
-    }
+    iKind |= STAT_CACHE_WIDE;
+    nKeyLen = wcslen(szFile) * sizeof(wchar_t);
   }
+  else
+    nKeyLen = strlen((char *) szFile);
+  if (__win_StatCacheLookup(iKind, szFile, nKeyLen, buffer, sizeof(*buffer),
+      &iRet, &ticket))
+    return iRet;
+
+  if (iDeref && __win_StatDeref(szFile, nKeyLen, &ticket) == -1)
+    return -1;
 
   /* stat sets errno */
   if (_plibc_utf8_mode == 1)
-    return _wstat(szFile, buffer);
+    lRet = _wstat(szFile, buffer);
   else
-    return _stat((char *) szFile, buffer);
+    lRet = _stat((char *) szFile, buffer);
+
+  if (lRet == 0 && !iDeref && _plibc_native_symlinks)
+  {
+    lRet = __win_GetSymlinkSize(szFile);
+    if (lRet != -1)
+    {
+      buffer->st_mode = (buffer->st_mode & ~S_IFMT) | S_IFLNK;
+      buffer->st_size = lRet;
+    }
+    lRet = 0;
+  }
+
+  __win_StatCacheInsert(&ticket, iKind, szFile, nKeyLen, buffer,
+    sizeof(*buffer), lRet);
+
+  return lRet;
 }
 
 /**
@@ -100,10 +343,17 @@ int _win_lstat(const char *path, struct _stat *buf)
 int __win_stat64(const char *path, struct stat64 *buffer, int iDeref)
 {
   wchar_t szFile[_MAX_PATH + 1];
+  TStatCacheTicket ticket;
+  size_t nKeyLen;
+  int iKind, iRet;
   long lRet;
 
   if (_plibc_utf8_mode == 1)
+  {
     lRet = plibc_conv_to_win_pathwconv(path, szFile, _MAX_PATH);
+    if (lRet == ERROR_BUFFER_OVERFLOW)
+      return __win_StatLong(path, buffer, TRUE, iDeref);
+  }
   else
     lRet = plibc_conv_to_win_path(path, (char *) szFile, _MAX_PATH);
   if (lRet != ERROR_SUCCESS)
@@ -126,21 +376,6 @@ int __win_stat64(const char *path, struct stat64 *buffer, int iDeref)
       ((char *) szFile)[lRet] = 0;
   }
 
-  /* Dereference symlinks */
-  if (iDeref)
-  {
-    if (_plibc_utf8_mode == 1)
-    {
-      if (__win_derefw(szFile) == -1 && errno != EINVAL)
-        return -1;
-    }
-    else
-    {
-      if (__win_deref((char *) szFile) == -1 && errno != EINVAL)
-        return -1;
-    }
-  }
-
   if (_plibc_utf8_mode == 1 ? !_plibc_wstat64 : !_plibc_stat64)
   {
     /* not supported under Windows 9x */
@@ -165,11 +400,43 @@ int __win_stat64(const char *path, struct stat64 *buffer, int iDeref)
   }
   else
   {
+    /* Cached result? */
+    iKind = STAT_CACHE_64 | (iDeref ? 0 : STAT_CACHE_LSTAT);
+    if (_plibc_utf8_mode == 1)
+    {
+      iKind |= STAT_CACHE_WIDE;
+      nKeyLen = wcslen(szFile) * sizeof(wchar_t);
+    }
+    else
+      nKeyLen = strlen((char *) szFile);
+    if (__win_StatCacheLookup(iKind, szFile, nKeyLen, buffer, sizeof(*buffer),
+        &iRet, &ticket))
+      return iRet;
+
+    if (iDeref && __win_StatDeref(szFile, nKeyLen, &ticket) == -1)
+      return -1;
+
     /* stat sets errno */
     if (_plibc_utf8_mode == 1)
-      return _plibc_wstat64(szFile, buffer);
+      lRet = _plibc_wstat64(szFile, buffer);
     else
-      return _plibc_stat64((char *) szFile, buffer);
+      lRet = _plibc_stat64((char *) szFile, buffer);
+
+    if (lRet == 0 && !iDeref && _plibc_native_symlinks)
+    {
+      lRet = __win_GetSymlinkSize(szFile);
+      if (lRet != -1)
+      {
+        buffer->st_mode = (buffer->st_mode & ~S_IFMT) | S_IFLNK;
+        buffer->st_size = lRet;
+      }
+      lRet = 0;
+    }
+
+    __win_StatCacheInsert(&ticket, iKind, szFile, nKeyLen, buffer,
+      sizeof(*buffer), lRet);
+
+    return lRet;
   }
 }
 
@@ -0,0 +1,722 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/statcache.c
+ * @brief Cache for stat() results
+ *
+ * The cache is off by default, see plibc_stat_cache_enable(). Results are
+ * keyed by the translated path. The directory of every cached path is
+ * watched with ReadDirectoryChangesW(), all watches complete to one I/O
+ * completion port that is drained before each lookup. A notification
+ * invalidates all results for its directory. If a directory can't be
+ * watched (too many watches, some network file systems), its results expire
+ * after a configurable time instead.
+ * Every watch holds an open directory handle with an outstanding request,
+ * so there are few of them and they are released when their directory
+ * wasn't looked at for STAT_CACHE_WATCH_IDLE. The idle watches are found
+ * by the next lookup.
+ * NTFS updates sizes and modification times of files that are still open
+ * lazily, so results for files other processes are writing to may lag
+ * behind.
+ */
+
+#include "plibc_private.h"
+
+#define STAT_CACHE_BUCKETS 4096     /* power of 2 */
+#define STAT_CACHE_WATCHES 32
+#define STAT_CACHE_WATCH_IDLE 10000 /* ms */
+#define STAT_CACHE_MAX_KEY 1024     /* bytes, longer paths aren't cached */
+#define STAT_CACHE_DEFAULT_ENTRIES 16384
+
+#define STAT_CACHE_NOTIFY (FILE_NOTIFY_CHANGE_FILE_NAME | \
+  FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES | \
+  FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | \
+  FILE_NOTIFY_CHANGE_CREATION | FILE_NOTIFY_CHANGE_SECURITY)
+
+typedef struct _TStatEntry
+{
+  struct _TStatEntry *pNextHash;
+  struct _TStatEntry *pPrev, *pNext;    /* LRU list, most recent first */
+  unsigned int uiHash;
+  int iKind;
+  LONG lGeneration;
+  int iWatch;                           /* -1 if the entry expires */
+  LONG lEpoch;
+  DWORD dwExpires;
+  int iRet, iErrno;
+  size_t nKeyLen;
+  size_t nStatLen;
+  char data[1];                         /* key, then the stat structure */
+} TStatEntry;
+
+typedef struct
+{
+  OVERLAPPED ov;
+  HANDLE hDir;
+  BOOL bPending;                        /* ov is in use */
+  LONG lEpoch;
+  DWORD dwLastUse;                      /* GetTickCount() */
+  size_t nDirLen;
+  wchar_t szDir[_MAX_PATH + 1];         /* including the separator */
+  DWORD adwNotify[1024];
+} TStatWatch;
+
+static CRITICAL_SECTION csStatCache;
+static BOOL bStatCacheInit = FALSE;
+static volatile BOOL bStatCacheEnabled = FALSE;
+static HANDLE hStatPort = NULL;
+static TStatEntry *pStatBuckets[STAT_CACHE_BUCKETS];
+static TStatEntry *pStatHead = NULL, *pStatTail = NULL;
+static unsigned int uiStatEntries = 0, uiStatMaxEntries = 0;
+static DWORD dwStatTTL = 0;
+static TStatWatch *pStatWatches[STAT_CACHE_WATCHES];
+static LONG lStatEpoch = 0;
+static DWORD dwStatSweep = 0;
+static unsigned long ulStatHits = 0, ulStatMisses = 0,
+  ulStatInvalidations = 0;
+
+static unsigned int __win_HashStat(int iKind, const void *pKey, size_t nLen)
+{
+  const unsigned char *p = (const unsigned char *) pKey;
+  unsigned int uiHash = 2166136261U ^ iKind;
+
+  while (nLen--)
+  {
+    uiHash ^= *p++;
+    uiHash *= 16777619U;
+  }
+
+  return uiHash;
+}
+
+static void __win_UnlinkStatEntry(TStatEntry *pEntry)
+{
+  TStatEntry **ppLink;
+
+  ppLink = &pStatBuckets[pEntry->uiHash & (STAT_CACHE_BUCKETS - 1)];
+  while (*ppLink != pEntry)
+    ppLink = &(*ppLink)->pNextHash;
+  *ppLink = pEntry->pNextHash;
+
+  if (pEntry->pPrev)
+    pEntry->pPrev->pNext = pEntry->pNext;
+  else
+    pStatHead = pEntry->pNext;
+  if (pEntry->pNext)
+    pEntry->pNext->pPrev = pEntry->pPrev;
+  else
+    pStatTail = pEntry->pPrev;
+
+  uiStatEntries--;
+  free(pEntry);
+}
+
+static void __win_PushStatEntry(TStatEntry *pEntry)
+{
+  pEntry->pPrev = NULL;
+  pEntry->pNext = pStatHead;
+  if (pStatHead)
+    pStatHead->pPrev = pEntry;
+  else
+    pStatTail = pEntry;
+  pStatHead = pEntry;
+}
+
+static TStatEntry *__win_FindStatEntry(int iKind, const void *pKey,
+  size_t nKeyLen, unsigned int uiHash)
+{
+  TStatEntry *pEntry;
+
+  pEntry = pStatBuckets[uiHash & (STAT_CACHE_BUCKETS - 1)];
+  while (pEntry)
+  {
+    if (pEntry->uiHash == uiHash && pEntry->iKind == iKind &&
+      pEntry->nKeyLen == nKeyLen && memcmp(pEntry->data, pKey, nKeyLen) == 0)
+      break;
+    pEntry = pEntry->pNextHash;
+  }
+
+  return pEntry;
+}
+
+/**
+ * @brief Wait for the next change in a watched directory
+ * @internal
+ */
+static BOOL __win_IssueStatWatch(TStatWatch *pWatch)
+{
+  memset(&pWatch->ov, 0, sizeof(pWatch->ov));
+  pWatch->bPending = ReadDirectoryChangesW(pWatch->hDir, pWatch->adwNotify,
+    sizeof(pWatch->adwNotify), FALSE, STAT_CACHE_NOTIFY, NULL, &pWatch->ov,
+    NULL);
+
+  return pWatch->bPending;
+}
+
+/**
+ * @brief Process change notifications
+ * @internal
+ * @param dwTimeout time to wait for the first notification
+ * @note csStatCache has to be held
+ */
+static void __win_DrainStatWatches(DWORD dwTimeout)
+{
+  TStatWatch *pWatch;
+  LPOVERLAPPED pOv;
+  ULONG_PTR ulKey;
+  DWORD dwBytes;
+  BOOL bOk;
+
+  if (!hStatPort)
+    return;
+
+  while (TRUE)
+  {
+    bOk = GetQueuedCompletionStatus(hStatPort, &dwBytes, &ulKey, &pOv,
+      dwTimeout);
+    if (!pOv)
+      break;
+
+    pWatch = pStatWatches[ulKey];
+    pWatch->bPending = FALSE;
+    if (!pWatch->hDir)
+      continue; /* Closed in the meantime */
+
+    /* Something changed or the notification buffer overflowed, either way
+       all results for the directory are stale */
+    pWatch->lEpoch = ++lStatEpoch;
+    ulStatInvalidations++;
+
+    /* The directory may have been removed */
+    if (!bOk || !__win_IssueStatWatch(pWatch))
+    {
+      CloseHandle(pWatch->hDir);
+      pWatch->hDir = NULL;
+    }
+  }
+}
+
+/**
+ * @brief Get the watch of a directory, set one up if necessary
+ * @internal
+ * @param pwszPath path of a file in the directory
+ * @param plEpoch receives the current epoch of the watch
+ * @return index of the watch or -1
+ * @note csStatCache has to be held
+ */
+static int __win_WatchStatDir(const wchar_t *pwszPath, LONG *plEpoch)
+{
+  TStatWatch *pWatch;
+  const wchar_t *pwszSep, *pwszEnd;
+  wchar_t szDir[_MAX_PATH + 1];
+  size_t nDirLen;
+  int i, iFree;
+
+  pwszSep = NULL;
+  for (pwszEnd = pwszPath; *pwszEnd; pwszEnd++)
+    if (*pwszEnd == L'\\' || *pwszEnd == L'/')
+      pwszSep = pwszEnd;
+  if (!pwszSep)
+    return -1;
+
+  nDirLen = pwszSep - pwszPath + 1;
+  if (nDirLen > _MAX_PATH)
+    return -1;
+
+  iFree = -1;
+  for (i = 0; i < STAT_CACHE_WATCHES; i++)
+  {
+    pWatch = pStatWatches[i];
+    if (!pWatch || (!pWatch->hDir && !pWatch->bPending))
+    {
+      if (iFree == -1)
+        iFree = i;
+    }
+    else if (pWatch->hDir && pWatch->nDirLen == nDirLen &&
+      _wcsnicmp(pWatch->szDir, pwszPath, nDirLen) == 0)
+    {
+      pWatch->dwLastUse = GetTickCount();
+      *plEpoch = pWatch->lEpoch;
+      return i;
+    }
+  }
+
+  /* All watches in use, results expire instead */
+  if (iFree == -1)
+    return -1;
+
+  pWatch = pStatWatches[iFree];
+  if (!pWatch)
+  {
+    pWatch = (TStatWatch *) __win_Malloc(sizeof(TStatWatch));
+    if (!pWatch)
+      return -1;
+    pWatch->hDir = NULL;
+    pWatch->bPending = FALSE;
+    pStatWatches[iFree] = pWatch;
+  }
+
+  /* "C:\" needs its separator, "C:\dir\" must not have one */
+  memcpy(szDir, pwszPath, nDirLen * sizeof(wchar_t));
+  szDir[nDirLen > 3 ? nDirLen - 1 : nDirLen] = 0;
+
+  pWatch->hDir = CreateFileW(szDir, FILE_LIST_DIRECTORY, FILE_SHARE_READ |
+    FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  if (pWatch->hDir == INVALID_HANDLE_VALUE)
+  {
+    pWatch->hDir = NULL;
+    return -1;
+  }
+
+  if (!CreateIoCompletionPort(pWatch->hDir, hStatPort, (ULONG_PTR) iFree, 0) ||
+    !__win_IssueStatWatch(pWatch))
+  {
+    CloseHandle(pWatch->hDir);
+    pWatch->hDir = NULL;
+    return -1;
+  }
+
+  memcpy(pWatch->szDir, pwszPath, nDirLen * sizeof(wchar_t));
+  pWatch->nDirLen = nDirLen;
+  pWatch->lEpoch = ++lStatEpoch;
+  pWatch->dwLastUse = GetTickCount();
+  *plEpoch = pWatch->lEpoch;
+
+  return iFree;
+}
+
+/**
+ * @brief Release watches whose directories weren't looked at for a while
+ * @internal
+ * @note csStatCache has to be held
+ */
+static void __win_ReleaseIdleStatWatches()
+{
+  TStatWatch *pWatch;
+  DWORD dwNow;
+  int i;
+
+  dwNow = GetTickCount();
+  if (dwNow - dwStatSweep < STAT_CACHE_WATCH_IDLE / 4)
+    return;
+  dwStatSweep = dwNow;
+
+  for (i = 0; i < STAT_CACHE_WATCHES; i++)
+  {
+    pWatch = pStatWatches[i];
+    if (pWatch && pWatch->hDir &&
+      dwNow - pWatch->dwLastUse > STAT_CACHE_WATCH_IDLE)
+    {
+      /* The cancelled request completes to the port, the slot is reused
+         after that */
+      CloseHandle(pWatch->hDir);
+      pWatch->hDir = NULL;
+      pWatch->lEpoch = ++lStatEpoch;
+    }
+  }
+}
+
+/**
+ * @brief Stop watching directories
+ * @internal
+ * @note csStatCache has to be held
+ */
+static void __win_UnwatchStatDirs()
+{
+  TStatWatch *pWatch;
+  int i;
+
+  for (i = 0; i < STAT_CACHE_WATCHES; i++)
+  {
+    pWatch = pStatWatches[i];
+    if (pWatch && pWatch->hDir)
+    {
+      /* This cancels the pending ReadDirectoryChangesW() */
+      CloseHandle(pWatch->hDir);
+      pWatch->hDir = NULL;
+      pWatch->lEpoch = ++lStatEpoch;
+    }
+  }
+}
+
+/**
+ * @brief Set up the stat cache
+ * @internal
+ */
+void __win_InitStatCache()
+{
+  if (bStatCacheInit)
+    return;
+
+  InitializeCriticalSection(&csStatCache);
+  memset(pStatBuckets, 0, sizeof(pStatBuckets));
+  memset(pStatWatches, 0, sizeof(pStatWatches));
+  bStatCacheInit = TRUE;
+}
+
+/**
+ * @brief Free the stat cache
+ * @internal
+ */
+void __win_FreeStatCache()
+{
+  if (!bStatCacheInit)
+    return;
+
+  plibc_stat_cache_disable();
+  DeleteCriticalSection(&csStatCache);
+  bStatCacheInit = FALSE;
+}
+
+/**
+ * @brief Stop watching directories for changes
+ * @internal
+ * @note Watched directories can't be removed for good, so call this before
+ *       removing or renaming directories. They are watched again on the
+ *       next miss.
+ */
+void __win_CloseStatCacheWatches()
+{
+  if (!bStatCacheEnabled)
+    return;
+
+  EnterCriticalSection(&csStatCache);
+  __win_UnwatchStatDirs();
+  LeaveCriticalSection(&csStatCache);
+}
+
+/**
+ * @brief Look up a stat() result
+ * @internal
+ * @param iKind distinguishes the variants of stat()
+ * @param pKey translated path
+ * @param nKeyLen length of pKey in bytes
+ * @param pStat receives the stat structure on a hit
+ * @param nStatLen size of the stat structure
+ * @param piRet receives the return value of stat() on a hit, errno is set
+ * @param pTicket pass this to __win_StatCacheInsert() on a miss
+ * @return TRUE on a hit
+ */
+BOOL __win_StatCacheLookup(int iKind, const void *pKey, size_t nKeyLen,
+  void *pStat, size_t nStatLen, int *piRet, TStatCacheTicket *pTicket)
+{
+  TStatEntry *pEntry;
+  wchar_t szPath[_MAX_PATH + 1];
+  const wchar_t *pwszPath;
+  const char *pszKey;
+  unsigned int uiHash;
+  BOOL bValid;
+
+  pTicket->bCache = FALSE;
+  if (!bStatCacheEnabled || nKeyLen > STAT_CACHE_MAX_KEY)
+    return FALSE;
+
+  /* Relative paths depend on the working directory */
+  pszKey = (const char *) pKey;
+  if (iKind & STAT_CACHE_WIDE)
+  {
+    pwszPath = (const wchar_t *) pKey;
+    if (!((pwszPath[0] && pwszPath[1] == L':' && pwszPath[2] == L'\\') ||
+      (pwszPath[0] == L'\\' && pwszPath[1] == L'\\')))
+      return FALSE;
+  }
+  else
+  {
+    if (!((pszKey[0] && pszKey[1] == ':' && pszKey[2] == '\\') ||
+      (pszKey[0] == '\\' && pszKey[1] == '\\')))
+      return FALSE;
+    if (strtowchar_buf(pszKey, szPath, _MAX_PATH + 1, CP_ACP) != 0)
+      return FALSE;
+    pwszPath = szPath;
+  }
+
+  uiHash = __win_HashStat(iKind, pKey, nKeyLen);
+
+  EnterCriticalSection(&csStatCache);
+  if (!bStatCacheEnabled)
+  {
+    LeaveCriticalSection(&csStatCache);
+    return FALSE;
+  }
+
+  __win_DrainStatWatches(0);
+  __win_ReleaseIdleStatWatches();
+
+  pEntry = __win_FindStatEntry(iKind, pKey, nKeyLen, uiHash);
+  if (pEntry)
+  {
+    if (pEntry->lGeneration != __win_GetPathCacheGeneration())
+      bValid = FALSE;
+    else if (pEntry->iWatch >= 0)
+    {
+      bValid = pStatWatches[pEntry->iWatch]->hDir &&
+        pStatWatches[pEntry->iWatch]->lEpoch == pEntry->lEpoch;
+      if (bValid)
+        pStatWatches[pEntry->iWatch]->dwLastUse = GetTickCount();
+    }
+    else
+      bValid = (LONG) (GetTickCount() - pEntry->dwExpires) < 0;
+
+    if (bValid && pEntry->nStatLen == nStatLen)
+    {
+      memcpy(pStat, pEntry->data + nKeyLen, nStatLen);
+      *piRet = pEntry->iRet;
+
+      /* Move to front */
+      if (pEntry != pStatHead)
+      {
+        pEntry->pPrev->pNext = pEntry->pNext;
+        if (pEntry->pNext)
+          pEntry->pNext->pPrev = pEntry->pPrev;
+        else
+          pStatTail = pEntry->pPrev;
+        __win_PushStatEntry(pEntry);
+      }
+
+      ulStatHits++;
+      errno = pEntry->iErrno;
+      LeaveCriticalSection(&csStatCache);
+
+      return TRUE;
+    }
+
+    __win_UnlinkStatEntry(pEntry);
+  }
+  ulStatMisses++;
+
+  /* Watch the directory before stat() looks at the file, so that changes
+     made in the meantime invalidate the result */
+  pTicket->lGeneration = __win_GetPathCacheGeneration();
+  pTicket->lEpoch = 0;
+  pTicket->iWatch = __win_WatchStatDir(pwszPath, &pTicket->lEpoch);
+  pTicket->bCache = pTicket->iWatch >= 0 || dwStatTTL > 0;
+
+  LeaveCriticalSection(&csStatCache);
+
+  return FALSE;
+}
+
+/**
+ * @brief Remember a stat() result
+ * @internal
+ * @param pTicket filled by __win_StatCacheLookup()
+ * @param iRet return value of stat(), errno has to be set accordingly
+ */
+void __win_StatCacheInsert(const TStatCacheTicket *pTicket, int iKind,
+  const void *pKey, size_t nKeyLen, const void *pStat, size_t nStatLen,
+  int iRet)
+{
+  TStatEntry *pEntry, *pOld;
+  unsigned int uiHash, uiBucket;
+  int iErr;
+
+  iErr = errno;
+
+  /* Other errors may be temporary */
+  if (!pTicket->bCache || (iRet != 0 && iErr != ENOENT))
+    return;
+
+  pEntry = (TStatEntry *) __win_Malloc(sizeof(TStatEntry) + nKeyLen + nStatLen);
+  if (!pEntry)
+  {
+    errno = iErr;
+    return;
+  }
+
+  uiHash = __win_HashStat(iKind, pKey, nKeyLen);
+  uiBucket = uiHash & (STAT_CACHE_BUCKETS - 1);
+  pEntry->uiHash = uiHash;
+  pEntry->iKind = iKind;
+  pEntry->lGeneration = pTicket->lGeneration;
+  pEntry->iWatch = pTicket->iWatch;
+  pEntry->lEpoch = pTicket->lEpoch;
+  pEntry->dwExpires = GetTickCount() + dwStatTTL;
+  pEntry->iRet = iRet;
+  pEntry->iErrno = iRet == 0 ? 0 : iErr;
+  pEntry->nKeyLen = nKeyLen;
+  pEntry->nStatLen = nStatLen;
+  memcpy(pEntry->data, pKey, nKeyLen);
+  memcpy(pEntry->data + nKeyLen, pStat, nStatLen);
+
+  EnterCriticalSection(&csStatCache);
+
+  /* Notifications about changes made while stat() ran */
+  __win_DrainStatWatches(0);
+
+  if (!bStatCacheEnabled ||
+    pTicket->lGeneration != __win_GetPathCacheGeneration() ||
+    (pTicket->iWatch >= 0 &&
+      (!pStatWatches[pTicket->iWatch]->hDir ||
+      pStatWatches[pTicket->iWatch]->lEpoch != pTicket->lEpoch)))
+  {
+    LeaveCriticalSection(&csStatCache);
+    free(pEntry);
+    errno = iErr;
+    return;
+  }
+
+  /* Another thread may have been faster */
+  pOld = __win_FindStatEntry(iKind, pKey, nKeyLen, uiHash);
+  if (pOld)
+    __win_UnlinkStatEntry(pOld);
+
+  if (uiStatEntries >= uiStatMaxEntries)
+    __win_UnlinkStatEntry(pStatTail);
+
+  pEntry->pNextHash = pStatBuckets[uiBucket];
+  pStatBuckets[uiBucket] = pEntry;
+  __win_PushStatEntry(pEntry);
+  uiStatEntries++;
+
+  LeaveCriticalSection(&csStatCache);
+
+  errno = iErr;
+}
+
+/**
+ * @brief Cache the results of stat() and friends
+ * @param uiEntries maximum number of cached results, 0 for the default
+ * @param uiTTL milliseconds after which results expire if their directory
+ *        can't be watched, 0 not to cache them at all
+ * @return Error code from winerror.h, ERROR_SUCCESS on success
+ * @note Can be called again to change the parameters
+ */
+int plibc_stat_cache_enable(unsigned int uiEntries, unsigned int uiTTL)
+{
+  if (!bStatCacheInit)
+    return ERROR_NOT_READY;
+
+  EnterCriticalSection(&csStatCache);
+
+  if (!hStatPort)
+  {
+    hStatPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!hStatPort)
+    {
+      LeaveCriticalSection(&csStatCache);
+      return GetLastError();
+    }
+  }
+
+  uiStatMaxEntries = uiEntries ? uiEntries : STAT_CACHE_DEFAULT_ENTRIES;
+  while (uiStatEntries > uiStatMaxEntries)
+    __win_UnlinkStatEntry(pStatTail);
+
+  /* Results that were cached with the old TTL keep their expiry time */
+  dwStatTTL = uiTTL;
+  bStatCacheEnabled = TRUE;
+
+  LeaveCriticalSection(&csStatCache);
+
+  return ERROR_SUCCESS;
+}
+
+/**
+ * @brief Stop caching stat() results and free the cache
+ */
+void plibc_stat_cache_disable()
+{
+  TStatWatch *pWatch;
+  BOOL bPending;
+  int i, iTries;
+
+  if (!bStatCacheInit)
+    return;
+
+  EnterCriticalSection(&csStatCache);
+
+  bStatCacheEnabled = FALSE;
+  while (pStatHead)
+    __win_UnlinkStatEntry(pStatHead);
+
+  /* The cancelled requests still complete to the port and may write to
+     their buffers until then */
+  __win_UnwatchStatDirs();
+  iTries = 5;
+  do
+  {
+    bPending = FALSE;
+    for (i = 0; i < STAT_CACHE_WATCHES; i++)
+      if (pStatWatches[i] && pStatWatches[i]->bPending)
+        bPending = TRUE;
+    if (bPending)
+      __win_DrainStatWatches(1000);
+  } while (bPending && --iTries);
+
+  for (i = 0; i < STAT_CACHE_WATCHES; i++)
+  {
+    pWatch = pStatWatches[i];
+    if (pWatch && !pWatch->bPending)
+    {
+      free(pWatch);
+      pStatWatches[i] = NULL;
+    }
+  }
+
+  /* Otherwise, the port and the remaining watches are leaked */
+  if (hStatPort && !bPending)
+  {
+    CloseHandle(hStatPort);
+    hStatPort = NULL;
+  }
+
+  LeaveCriticalSection(&csStatCache);
+}
+
+/**
+ * @brief Drop all cached stat() results
+ */
+void plibc_stat_cache_flush()
+{
+  if (!bStatCacheInit)
+    return;
+
+  EnterCriticalSection(&csStatCache);
+  while (pStatHead)
+    __win_UnlinkStatEntry(pStatHead);
+  ulStatInvalidations++;
+  LeaveCriticalSection(&csStatCache);
+}
+
+/**
+ * @brief Get statistics of the stat cache
+ */
+void plibc_stat_cache_stats(struct plibc_stat_cache_stats *pStats)
+{
+  int i;
+
+  if (bStatCacheInit)
+    EnterCriticalSection(&csStatCache);
+
+  pStats->hits = ulStatHits;
+  pStats->misses = ulStatMisses;
+  pStats->invalidations = ulStatInvalidations;
+  pStats->entries = uiStatEntries;
+  pStats->watches = 0;
+  for (i = 0; i < STAT_CACHE_WATCHES; i++)
+    if (pStatWatches[i] && pStatWatches[i]->hDir)
+      pStats->watches++;
+
+  if (bStatCacheInit)
+    LeaveCriticalSection(&csStatCache);
+}
+
+/* end of statcache.c */
@@ -33,7 +33,7 @@
 char *strndup (const char *s, size_t n)
 {
   size_t len = strnlen (s, n);
-  char *new = (char *) malloc (len + 1);
+  char *new = (char *) __win_Malloc (len + 1);
 
   if (new == NULL)
     return NULL;
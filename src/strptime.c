@@ -132,7 +132,7 @@ void conv_winpic(char *win, char **posix)
   char *src, *dst;
   
   src = win;
-  *posix = dst = malloc(strlen(src) * 2 + 1);
+  *posix = dst = __win_Malloc(strlen(src) * 2 + 1);
   while(*src)
   {
     if (src[0] == 'y')
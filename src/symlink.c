@@ -24,12 +24,60 @@
 
 #include "plibc_private.h"
 
+/**
+ * @brief Make a native symbolic link
+ * @internal
+ * @note Like on POSIX systems, path1 is stored as given. Relative paths are
+ *       relative to the directory of the link.
+ */
+static int __win_symlink_native(const char *path1, const char *path2)
+{
+  wchar_t szFile1[_MAX_PATH + 1], szFile2[_MAX_PATH + 1];
+  long lRet;
+
+  if (_plibc_utf8_mode == 1)
+  {
+    lRet = plibc_conv_to_win_pathwconv_ex(path1, szFile1, _MAX_PATH, 0);
+    if (lRet == ERROR_SUCCESS)
+      lRet = plibc_conv_to_win_pathwconv_ex(path2, szFile2, _MAX_PATH, 0);
+  }
+  else
+  {
+    char szNarrow1[_MAX_PATH + 1], szNarrow2[_MAX_PATH + 1];
+
+    lRet = plibc_conv_to_win_path_ex(path1, szNarrow1, _MAX_PATH, 0);
+    if (lRet == ERROR_SUCCESS)
+      lRet = plibc_conv_to_win_path_ex(path2, szNarrow2, _MAX_PATH, 0);
+    if (lRet == ERROR_SUCCESS &&
+      (strtowchar_buf(szNarrow1, szFile1, _MAX_PATH + 1, CP_ACP) != 0 ||
+      strtowchar_buf(szNarrow2, szFile2, _MAX_PATH + 1, CP_ACP) != 0))
+      lRet = ERROR_BUFFER_OVERFLOW;
+  }
+  if (lRet != ERROR_SUCCESS)
+  {
+    SetErrnoFromWinError(lRet);
+    return -1;
+  }
+
+  /* __win_CreateSymlinkW sets errno */
+  if (__win_CreateSymlinkW(szFile1, szFile2) == -1)
+    return -1;
+
+  __win_InvalidatePathCache();
+
+  return 0;
+}
+
 /***
  * @brief Make a link to a file
  **/
 int _win_symlink(const char *path1, const char *path2)
 {
   long lRet;
+
+  if (_plibc_native_symlinks)
+    return __win_symlink_native(path1, path2);
+
   if (_plibc_utf8_mode == 1)
   {
     wchar_t szFile1[_MAX_PATH + 1], szFile2[_MAX_PATH + 1];
@@ -64,7 +112,13 @@ int _win_symlink(const char *path1, const char *path2)
     /* CreateShortcut sets errno */
     lRet = _plibc_CreateShortcut(szFile1, szFile2);
   }
-  return lRet ? 0 : -1;
+  if (!lRet)
+    return -1;
+
+  /* "path2" may have been translated to "path2.lnk" before */
+  __win_InvalidatePathCache();
+
+  return 0;
 }
 
 /* end of symlink.c */
@@ -45,9 +45,15 @@ int _win_unlink(const char *filename)
 
   /* unlink sets errno */
   if (_plibc_utf8_mode == 1)
-    return _wunlink(szFile);
+    lRet = _wunlink(szFile);
   else
-    return unlink((char *) szFile);
+    lRet = unlink((char *) szFile);
+
+  /* Translations may refer to the old file system state */
+  if (lRet == 0)
+    __win_InvalidatePathCache();
+
+  return lRet;
 }
 
 /* end of unlink.c */
@@ -0,0 +1,472 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/utf8.c
+ * @brief UTF-8 <-> UTF-16 conversion
+ *
+ * MultiByteToWideChar() and WideCharToMultiByte() have to be called twice
+ * to convert into a buffer of unknown sufficiency, once to measure and once
+ * to convert. In UTF-8 mode, every path and every directory entry is
+ * converted, so these converters do it in a single pass that stops when
+ * the buffer is full. Callers that need the whole string size the buffer
+ * for the worst case: UTF-8 never needs more UTF-16 units than it has
+ * bytes, UTF-16 never needs more than 3 bytes per unit.
+ *
+ * File names are mostly ASCII. Runs of ASCII are copied by a kernel that
+ * uses SSE2 or AVX2 if the CPU has it, everything else is decoded one
+ * character at a time. Ill-formed input is not an error: each maximal
+ * ill-formed subsequence and each unpaired surrogate becomes U+FFFD, like
+ * the Windows functions do on Windows Vista and later.
+ *
+ * Only the wchar_t wrappers at the end depend on Windows, contrib/test
+ * builds the rest on other platforms to compare it with iconv.
+ */
+
+#ifdef _WIN32
+  #include "plibc_private.h"
+#else
+  #include <string.h>
+  #include "plibc_utf8.h"
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+  (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+  #define PLIBC_SIMD_KERNELS 1
+  #include <cpuid.h>
+  #include <immintrin.h>
+#endif
+
+/* Copy ASCII, return the number of characters copied */
+typedef size_t (*TAsciiToUtf16) (const unsigned char *pSrc, size_t nLen,
+  unsigned short *pDest);
+typedef size_t (*TUtf16ToAscii) (const unsigned short *pSrc, size_t nLen,
+  unsigned char *pDest);
+
+static size_t __win_AsciiToUtf16(const unsigned char *pSrc, size_t nLen,
+  unsigned short *pDest)
+{
+  size_t nIdx;
+
+  for (nIdx = 0; nIdx < nLen && pSrc[nIdx] < 0x80; nIdx++)
+    pDest[nIdx] = pSrc[nIdx];
+
+  return nIdx;
+}
+
+static size_t __win_Utf16ToAscii(const unsigned short *pSrc, size_t nLen,
+  unsigned char *pDest)
+{
+  size_t nIdx;
+
+  for (nIdx = 0; nIdx < nLen && pSrc[nIdx] < 0x80; nIdx++)
+    pDest[nIdx] = (unsigned char) pSrc[nIdx];
+
+  return nIdx;
+}
+
+#ifdef PLIBC_SIMD_KERNELS
+
+__attribute__((target("sse2")))
+static size_t __win_AsciiToUtf16SSE2(const unsigned char *pSrc, size_t nLen,
+  unsigned short *pDest)
+{
+  __m128i v, zero;
+  size_t nIdx;
+
+  zero = _mm_setzero_si128();
+  for (nIdx = 0; nLen - nIdx >= 16; nIdx += 16)
+  {
+    v = _mm_loadu_si128((const __m128i *) (pSrc + nIdx));
+    if (_mm_movemask_epi8(v))
+      break;
+    _mm_storeu_si128((__m128i *) (pDest + nIdx), _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128((__m128i *) (pDest + nIdx + 8),
+      _mm_unpackhi_epi8(v, zero));
+  }
+
+  return nIdx + __win_AsciiToUtf16(pSrc + nIdx, nLen - nIdx, pDest + nIdx);
+}
+
+__attribute__((target("sse2")))
+static size_t __win_Utf16ToAsciiSSE2(const unsigned short *pSrc, size_t nLen,
+  unsigned char *pDest)
+{
+  __m128i v1, v2, mask, zero;
+  size_t nIdx;
+
+  mask = _mm_set1_epi16((short) 0xFF80);
+  zero = _mm_setzero_si128();
+  for (nIdx = 0; nLen - nIdx >= 16; nIdx += 16)
+  {
+    v1 = _mm_loadu_si128((const __m128i *) (pSrc + nIdx));
+    v2 = _mm_loadu_si128((const __m128i *) (pSrc + nIdx + 8));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(v1, v2),
+      mask), zero)) != 0xFFFF)
+      break;
+    _mm_storeu_si128((__m128i *) (pDest + nIdx), _mm_packus_epi16(v1, v2));
+  }
+
+  return nIdx + __win_Utf16ToAscii(pSrc + nIdx, nLen - nIdx, pDest + nIdx);
+}
+
+__attribute__((target("avx2")))
+static size_t __win_AsciiToUtf16AVX2(const unsigned char *pSrc, size_t nLen,
+  unsigned short *pDest)
+{
+  __m256i v;
+  size_t nIdx;
+
+  for (nIdx = 0; nLen - nIdx >= 32; nIdx += 32)
+  {
+    v = _mm256_loadu_si256((const __m256i *) (pSrc + nIdx));
+    if (_mm256_movemask_epi8(v))
+      break;
+    _mm256_storeu_si256((__m256i *) (pDest + nIdx),
+      _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+    _mm256_storeu_si256((__m256i *) (pDest + nIdx + 16),
+      _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+  }
+
+  return nIdx + __win_AsciiToUtf16(pSrc + nIdx, nLen - nIdx, pDest + nIdx);
+}
+
+__attribute__((target("avx2")))
+static size_t __win_Utf16ToAsciiAVX2(const unsigned short *pSrc, size_t nLen,
+  unsigned char *pDest)
+{
+  __m256i v1, v2, mask;
+  size_t nIdx;
+
+  mask = _mm256_set1_epi16((short) 0xFF80);
+  for (nIdx = 0; nLen - nIdx >= 32; nIdx += 32)
+  {
+    v1 = _mm256_loadu_si256((const __m256i *) (pSrc + nIdx));
+    v2 = _mm256_loadu_si256((const __m256i *) (pSrc + nIdx + 16));
+    if (!_mm256_testz_si256(_mm256_or_si256(v1, v2), mask))
+      break;
+    /* packus works on 128 bit lanes, put the quarters back in order */
+    _mm256_storeu_si256((__m256i *) (pDest + nIdx),
+      _mm256_permute4x64_epi64(_mm256_packus_epi16(v1, v2), 0xD8));
+  }
+
+  return nIdx + __win_Utf16ToAscii(pSrc + nIdx, nLen - nIdx, pDest + nIdx);
+}
+
+/**
+ * @brief Check whether the CPU and the OS support AVX2
+ * @internal
+ */
+static int __win_HaveAVX2()
+{
+  unsigned int uiEAX, uiEBX, uiECX, uiEDX, uiXCR0;
+
+  if (!__get_cpuid(1, &uiEAX, &uiEBX, &uiECX, &uiEDX))
+    return 0;
+  /* OSXSAVE and AVX */
+  if ((uiECX & ((1 << 27) | (1 << 28))) != ((1 << 27) | (1 << 28)))
+    return 0;
+  /* The OS saves the YMM registers */
+  __asm__ __volatile__ ("xgetbv" : "=a" (uiXCR0), "=d" (uiEDX) : "c" (0));
+  if ((uiXCR0 & 6) != 6)
+    return 0;
+
+  if (__get_cpuid_max(0, NULL) < 7)
+    return 0;
+  __cpuid_count(7, 0, uiEAX, uiEBX, uiECX, uiEDX);
+
+  return (uiEBX & (1 << 5)) != 0;
+}
+
+#endif /* PLIBC_SIMD_KERNELS */
+
+static TAsciiToUtf16 pfnAsciiToUtf16 = __win_AsciiToUtf16;
+static TUtf16ToAscii pfnUtf16ToAscii = __win_Utf16ToAscii;
+
+/**
+ * @brief Select the conversion kernels for this CPU
+ * @internal
+ * @note Conversions before this use the portable kernels
+ */
+void __win_InitTranscoder()
+{
+#ifdef PLIBC_SIMD_KERNELS
+  unsigned int uiEAX, uiEBX, uiECX, uiEDX;
+
+  if (__win_HaveAVX2())
+  {
+    pfnAsciiToUtf16 = __win_AsciiToUtf16AVX2;
+    pfnUtf16ToAscii = __win_Utf16ToAsciiAVX2;
+  }
+  else if (__get_cpuid(1, &uiEAX, &uiEBX, &uiECX, &uiEDX) &&
+    (uiEDX & (1 << 26)))
+  {
+    pfnAsciiToUtf16 = __win_AsciiToUtf16SSE2;
+    pfnUtf16ToAscii = __win_Utf16ToAsciiSSE2;
+  }
+#endif
+}
+
+/**
+ * @brief Convert UTF-16 to UTF-8
+ * @internal
+ * @param pSrc UTF-16 code units
+ * @param nSrcLen number of units in pSrc
+ * @param pszDest receives the NUL terminated UTF-8 string
+ * @param nDestLen size of pszDest in bytes
+ * @return length of the result without the terminator, -1 if it doesn't
+ *         fit
+ */
+int __win_Utf16ToUtf8N(const unsigned short *pSrc, size_t nSrcLen,
+  char *pszDest, size_t nDestLen)
+{
+  const unsigned short *pSrcEnd;
+  unsigned char *pDest, *pEnd;
+  unsigned long ulChar;
+  size_t nRun;
+
+  if (!nDestLen)
+    return -1;
+
+  pSrcEnd = pSrc + nSrcLen;
+  pDest = (unsigned char *) pszDest;
+  pEnd = pDest + nDestLen - 1;    /* room for the terminator */
+
+  while (pSrc < pSrcEnd)
+  {
+    /* ASCII */
+    nRun = pSrcEnd - pSrc;
+    if (nRun > (size_t) (pEnd - pDest))
+      nRun = pEnd - pDest;
+    nRun = pfnUtf16ToAscii(pSrc, nRun, pDest);
+    pSrc += nRun;
+    pDest += nRun;
+
+    /* Everything else up to the next ASCII character */
+    while (pSrc < pSrcEnd && *pSrc >= 0x80)
+    {
+      ulChar = *pSrc++;
+      if (ulChar >= 0xD800 && ulChar <= 0xDFFF)
+      {
+        if (ulChar <= 0xDBFF && pSrc < pSrcEnd && *pSrc >= 0xDC00 &&
+          *pSrc <= 0xDFFF)
+          ulChar = 0x10000 + ((ulChar - 0xD800) << 10) + (*pSrc++ - 0xDC00);
+        else
+          ulChar = 0xFFFD;
+      }
+
+      if (ulChar < 0x800)
+      {
+        if (pEnd - pDest < 2)
+          return -1;
+        *pDest++ = (unsigned char) (0xC0 | (ulChar >> 6));
+      }
+      else if (ulChar < 0x10000)
+      {
+        if (pEnd - pDest < 3)
+          return -1;
+        *pDest++ = (unsigned char) (0xE0 | (ulChar >> 12));
+        *pDest++ = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+      }
+      else
+      {
+        if (pEnd - pDest < 4)
+          return -1;
+        *pDest++ = (unsigned char) (0xF0 | (ulChar >> 18));
+        *pDest++ = (unsigned char) (0x80 | ((ulChar >> 12) & 0x3F));
+        *pDest++ = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+      }
+      *pDest++ = (unsigned char) (0x80 | (ulChar & 0x3F));
+    }
+
+    /* The ASCII kernel stopped because the buffer is full */
+    if (pSrc < pSrcEnd && pDest == pEnd)
+      return -1;
+  }
+
+  *pDest = 0;
+
+  return (int) (pDest - (unsigned char *) pszDest);
+}
+
+/**
+ * @brief Convert UTF-8 to UTF-16
+ * @internal
+ * @param pszSrc UTF-8 string
+ * @param nSrcLen number of bytes in pszSrc
+ * @param pDest receives the NUL terminated UTF-16 string
+ * @param nDestLen size of pDest in units
+ * @return length of the result without the terminator, -1 if it doesn't
+ *         fit
+ */
+int __win_Utf8ToUtf16N(const char *pszSrc, size_t nSrcLen,
+  unsigned short *pDest, size_t nDestLen)
+{
+  const unsigned char *pSrc, *pSrcEnd;
+  unsigned short *pStart, *pEnd;
+  unsigned long ulChar;
+  unsigned char ucLow, ucHigh;
+  size_t nRun;
+  int iCont;
+
+  if (!nDestLen)
+    return -1;
+
+  pSrc = (const unsigned char *) pszSrc;
+  pSrcEnd = pSrc + nSrcLen;
+  pStart = pDest;
+  pEnd = pDest + nDestLen - 1;    /* room for the terminator */
+
+  while (pSrc < pSrcEnd)
+  {
+    /* ASCII */
+    nRun = pSrcEnd - pSrc;
+    if (nRun > (size_t) (pEnd - pDest))
+      nRun = pEnd - pDest;
+    nRun = pfnAsciiToUtf16(pSrc, nRun, pDest);
+    pSrc += nRun;
+    pDest += nRun;
+
+    /* Everything else up to the next ASCII character */
+    while (pSrc < pSrcEnd && *pSrc >= 0x80)
+    {
+      ulChar = *pSrc++;
+
+      /* Lead byte, allowed range of the first continuation byte */
+      ucLow = 0x80;
+      ucHigh = 0xBF;
+      if (ulChar >= 0xC2 && ulChar <= 0xDF)
+      {
+        iCont = 1;
+        ulChar &= 0x1F;
+      }
+      else if (ulChar >= 0xE0 && ulChar <= 0xEF)
+      {
+        iCont = 2;
+        if (ulChar == 0xE0)
+          ucLow = 0xA0;       /* overlong */
+        else if (ulChar == 0xED)
+          ucHigh = 0x9F;      /* surrogates */
+        ulChar &= 0x0F;
+      }
+      else if (ulChar >= 0xF0 && ulChar <= 0xF4)
+      {
+        iCont = 3;
+        if (ulChar == 0xF0)
+          ucLow = 0x90;       /* overlong */
+        else if (ulChar == 0xF4)
+          ucHigh = 0x8F;      /* > U+10FFFF */
+        ulChar &= 0x07;
+      }
+      else
+        iCont = -1;
+
+      for (; iCont > 0; iCont--)
+      {
+        if (pSrc == pSrcEnd || *pSrc < ucLow || *pSrc > ucHigh)
+          break;
+        ulChar = (ulChar << 6) | (*pSrc++ & 0x3F);
+        ucLow = 0x80;
+        ucHigh = 0xBF;
+      }
+      if (iCont)
+        ulChar = 0xFFFD;
+
+      if (ulChar >= 0x10000)
+      {
+        if (pEnd - pDest < 2)
+          return -1;
+        ulChar -= 0x10000;
+        *pDest++ = (unsigned short) (0xD800 | (ulChar >> 10));
+        *pDest++ = (unsigned short) (0xDC00 | (ulChar & 0x3FF));
+      }
+      else
+      {
+        if (pDest == pEnd)
+          return -1;
+        *pDest++ = (unsigned short) ulChar;
+      }
+    }
+
+    /* The ASCII kernel stopped because the buffer is full */
+    if (pSrc < pSrcEnd && pDest == pEnd)
+      return -1;
+  }
+
+  *pDest = 0;
+
+  return (int) (pDest - pStart);
+}
+
+#ifdef _WIN32
+
+/**
+ * @brief Convert a UTF-16 string to UTF-8
+ * @internal
+ * @param pwszSrc NUL terminated UTF-16 string
+ * @param pszDest receives the NUL terminated UTF-8 string
+ * @param nDestLen size of pszDest in bytes
+ * @return length of the result without the terminator, -1 if it doesn't
+ *         fit
+ */
+int __win_Utf16ToUtf8(const wchar_t *pwszSrc, char *pszDest, size_t nDestLen)
+{
+  return __win_Utf16ToUtf8N((const unsigned short *) pwszSrc,
+    wcslen(pwszSrc), pszDest, nDestLen);
+}
+
+/**
+ * @brief Convert a UTF-8 string to UTF-16
+ * @internal
+ * @param pszSrc NUL terminated UTF-8 string
+ * @param pwszDest receives the NUL terminated UTF-16 string
+ * @param nDestLen size of pwszDest in characters
+ * @return length of the result without the terminator, -1 if it doesn't
+ *         fit
+ */
+int __win_Utf8ToUtf16(const char *pszSrc, wchar_t *pwszDest, size_t nDestLen)
+{
+  return __win_Utf8ToUtf16N(pszSrc, strlen(pszSrc),
+    (unsigned short *) pwszDest, nDestLen);
+}
+
+/**
+ * @brief Convert a UTF-16 string to the encoding of the caller
+ * @internal
+ * @return length of the result without the terminator, -1 if it doesn't
+ *         fit
+ * @note UTF-8 in UTF-8 mode. Characters that don't exist in the ANSI code
+ *       page get placeholders, like FindFirstFileA() does.
+ */
+int __win_Utf16ToLocal(const wchar_t *pwszSrc, char *pszDest, size_t nDestLen)
+{
+  int iLen;
+
+  if (_plibc_utf8_mode == 1)
+    return __win_Utf16ToUtf8(pwszSrc, pszDest, nDestLen);
+
+  iLen = WideCharToMultiByte(CP_ACP, 0, pwszSrc, -1, pszDest, nDestLen, NULL,
+    NULL);
+
+  return iLen > 0 ? iLen - 1 : -1;
+}
+
+#endif /* _WIN32 */
+
+/* end of utf8.c */
@@ -0,0 +1,790 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/walk.c
+ * @brief nftw(), plibc_walk()
+ *
+ * Directories are enumerated with FindFirstFileExW() and the stat
+ * information of every entry is taken from the enumeration, so walking a
+ * tree doesn't stat() anything but the root. A directory's own callback is
+ * delivered by the thread that scans it, which is where FTW_DNR is known.
+ *
+ * In parallel mode, every scanner owns a bounded deque of directories. The
+ * owner pushes and pops at the bottom, which keeps it depth-first, idle
+ * scanners steal from the top, where the largest subtrees are. If the
+ * deque is full, the subdirectory is scanned right away by the thread that
+ * found it. Every directory counts its unfinished subdirectories, the last
+ * one to finish delivers FTW_DP and releases the parent.
+ */
+
+#include "plibc_private.h"
+
+#define WALK_MAX_THREADS    64
+#define WALK_QUEUE_DEFAULT  256
+
+typedef struct _TWalkDir
+{
+  struct _TWalkDir *pParent;
+  volatile LONG lPending;       /* own scan + unfinished subdirectories */
+  int iLevel;
+  int iBase;
+  BOOL bReadable;
+  struct _stat st;
+  wchar_t *pwszPath;            /* Windows path */
+  char *pszPath;                /* path passed to the callback */
+} TWalkDir;
+
+typedef struct
+{
+  CRITICAL_SECTION cs;
+  TWalkDir **ppDirs;            /* ring buffer */
+  unsigned int uiHead, uiCount;
+} TWalkQueue;
+
+typedef struct
+{
+  TWalkProc fn;
+  void *cls;
+  int iFlags;
+  BOOL bSorted;
+  short sDev;
+  unsigned int uiThreads;
+  unsigned int uiQueueLimit;
+  TWalkQueue *pQueues;
+  HANDLE hWake;
+  volatile LONG lOutstanding;   /* queued or running scans */
+  volatile LONG lIdle;          /* scanners waiting for work */
+  volatile LONG lStop;
+  volatile LONG lResult;        /* first nonzero callback result */
+} TWalk;
+
+typedef struct
+{
+  TWalk *pWalk;
+  unsigned int uiIndex;
+} TWalkWorker;
+
+typedef struct
+{
+  DWORD dwAttributes;
+  DWORD dwReparseTag;
+  FILETIME ftCreationTime, ftLastAccessTime, ftLastWriteTime;
+  DWORD nFileSizeHigh, nFileSizeLow;
+  size_t nName;                 /* offset of the name in the name pool */
+  const wchar_t *pwszName;
+} TWalkEntry;
+
+typedef struct
+{
+  TNftwProc fn;
+} TNftwClosure;
+
+static void __win_WalkScan(TWalk *pWalk, TWalkDir *pDir,
+  unsigned int uiWorker);
+
+/**
+ * @brief Invoke the callback
+ * @internal
+ * @note The first nonzero result stops the walk
+ */
+static void __win_WalkCall(TWalk *pWalk, const char *pszPath,
+  const struct _stat *pStat, int iType, int iBase, int iLevel)
+{
+  struct FTW ftw;
+  int iRet;
+
+  if (pWalk->lStop)
+    return;
+
+  ftw.base = iBase;
+  ftw.level = iLevel;
+  iRet = pWalk->fn(pszPath, pStat, iType, &ftw, pWalk->cls);
+  if (iRet)
+  {
+    InterlockedCompareExchange(&pWalk->lResult, iRet, 0);
+    InterlockedExchange(&pWalk->lStop, TRUE);
+  }
+}
+
+/**
+ * @brief Fill a stat structure from enumeration data
+ * @internal
+ * @return FALSE if the size doesn't fit
+ */
+static BOOL __win_WalkStat(TWalk *pWalk, const TWalkEntry *pEntry,
+  struct _stat *pStat)
+{
+  memset(pStat, 0, sizeof(*pStat));
+  if (pEntry->nFileSizeHigh || pEntry->nFileSizeLow > LONG_MAX)
+    return FALSE;
+
+  pStat->st_mode = __win_AttributesToMode(pEntry->dwAttributes,
+    pEntry->pwszName);
+  pStat->st_nlink = 1;
+  pStat->st_size = pEntry->nFileSizeLow;
+  pStat->st_atime = __win_FileTimeToUnix(&pEntry->ftLastAccessTime);
+  pStat->st_mtime = __win_FileTimeToUnix(&pEntry->ftLastWriteTime);
+  pStat->st_ctime = __win_FileTimeToUnix(&pEntry->ftCreationTime);
+  pStat->st_dev = pStat->st_rdev = pWalk->sDev;
+
+  return TRUE;
+}
+
+static int __win_WalkCompare(const void *p1, const void *p2)
+{
+  return wcscmp(((const TWalkEntry *) p1)->pwszName,
+    ((const TWalkEntry *) p2)->pwszName);
+}
+
+/**
+ * @brief Allocate a directory node, including its paths
+ * @internal
+ */
+static TWalkDir *__win_WalkNewDir(TWalkDir *pParent, const wchar_t *pwszPath,
+  size_t nPathLenW, const char *pszPath, size_t nPathLen, int iBase)
+{
+  TWalkDir *pDir;
+
+  pDir = (TWalkDir *) __win_Malloc(sizeof(TWalkDir) +
+    (nPathLenW + 1) * sizeof(wchar_t) + nPathLen + 1);
+  if (!pDir)
+    return NULL;
+
+  pDir->pParent = pParent;
+  pDir->lPending = 1;
+  pDir->iLevel = pParent ? pParent->iLevel + 1 : 0;
+  pDir->iBase = iBase;
+  pDir->bReadable = FALSE;
+  pDir->pwszPath = (wchar_t *) (pDir + 1);
+  memcpy(pDir->pwszPath, pwszPath, nPathLenW * sizeof(wchar_t));
+  pDir->pwszPath[nPathLenW] = 0;
+  pDir->pszPath = (char *) (pDir->pwszPath + nPathLenW + 1);
+  memcpy(pDir->pszPath, pszPath, nPathLen);
+  pDir->pszPath[nPathLen] = 0;
+
+  if (pParent)
+    InterlockedIncrement(&pParent->lPending);
+
+  return pDir;
+}
+
+/**
+ * @brief Finish a directory and, recursively, parents that have no
+ *        unfinished subdirectories left
+ * @internal
+ */
+static void __win_WalkRelease(TWalk *pWalk, TWalkDir *pDir)
+{
+  TWalkDir *pParent;
+
+  while (pDir && InterlockedDecrement(&pDir->lPending) == 0)
+  {
+    pParent = pDir->pParent;
+
+    if ((pWalk->iFlags & FTW_DEPTH) && pDir->bReadable)
+    {
+      if ((pWalk->iFlags & FTW_CHDIR) && pParent)
+        SetCurrentDirectoryW(pParent->pwszPath);
+      __win_WalkCall(pWalk, pDir->pszPath, &pDir->st, FTW_DP, pDir->iBase,
+        pDir->iLevel);
+    }
+
+    free(pDir);
+    pDir = pParent;
+  }
+}
+
+/**
+ * @brief Queue a directory for any scanner
+ * @internal
+ * @return FALSE if the caller has to scan it itself
+ */
+static BOOL __win_WalkPush(TWalk *pWalk, unsigned int uiWorker,
+  TWalkDir *pDir)
+{
+  TWalkQueue *pQueue;
+  BOOL bRet;
+
+  if (pWalk->uiThreads < 2)
+    return FALSE;
+
+  pQueue = &pWalk->pQueues[uiWorker];
+  bRet = FALSE;
+
+  EnterCriticalSection(&pQueue->cs);
+  if (pQueue->uiCount < pWalk->uiQueueLimit)
+  {
+    InterlockedIncrement(&pWalk->lOutstanding);
+    pQueue->ppDirs[(pQueue->uiHead + pQueue->uiCount) %
+      pWalk->uiQueueLimit] = pDir;
+    pQueue->uiCount++;
+    bRet = TRUE;
+  }
+  LeaveCriticalSection(&pQueue->cs);
+
+  if (bRet && pWalk->lIdle)
+    ReleaseSemaphore(pWalk->hWake, 1, NULL);
+
+  return bRet;
+}
+
+/**
+ * @brief Get the next directory to scan, stealing from other scanners if
+ *        the own queue is empty
+ * @internal
+ */
+static TWalkDir *__win_WalkPop(TWalk *pWalk, unsigned int uiWorker)
+{
+  TWalkQueue *pQueue;
+  TWalkDir *pDir;
+  unsigned int uiVictim;
+
+  pDir = NULL;
+
+  /* Own queue, newest first */
+  pQueue = &pWalk->pQueues[uiWorker];
+  EnterCriticalSection(&pQueue->cs);
+  if (pQueue->uiCount)
+  {
+    pQueue->uiCount--;
+    pDir = pQueue->ppDirs[(pQueue->uiHead + pQueue->uiCount) %
+      pWalk->uiQueueLimit];
+  }
+  LeaveCriticalSection(&pQueue->cs);
+
+  /* Other queues, oldest first */
+  for (uiVictim = 1; !pDir && uiVictim < pWalk->uiThreads; uiVictim++)
+  {
+    pQueue = &pWalk->pQueues[(uiWorker + uiVictim) % pWalk->uiThreads];
+    EnterCriticalSection(&pQueue->cs);
+    if (pQueue->uiCount)
+    {
+      pDir = pQueue->ppDirs[pQueue->uiHead];
+      pQueue->uiHead = (pQueue->uiHead + 1) % pWalk->uiQueueLimit;
+      pQueue->uiCount--;
+    }
+    LeaveCriticalSection(&pQueue->cs);
+  }
+
+  return pDir;
+}
+
+/**
+ * @brief Run a queued scan
+ * @internal
+ */
+static void __win_WalkRun(TWalk *pWalk, TWalkDir *pDir, unsigned int uiWorker)
+{
+  __win_WalkScan(pWalk, pDir, uiWorker);
+
+  /* Wake everybody up to terminate */
+  if (InterlockedDecrement(&pWalk->lOutstanding) == 0)
+    ReleaseSemaphore(pWalk->hWake, pWalk->uiThreads, NULL);
+}
+
+static DWORD WINAPI __win_WalkWorker(LPVOID lpParam)
+{
+  TWalkWorker *pWorker = (TWalkWorker *) lpParam;
+  TWalk *pWalk = pWorker->pWalk;
+  TWalkDir *pDir;
+
+  while (TRUE)
+  {
+    pDir = __win_WalkPop(pWalk, pWorker->uiIndex);
+    if (!pDir)
+    {
+      if (!pWalk->lOutstanding)
+        break;
+
+      /* Look again after announcing that we're idle, a push may have
+         missed us */
+      InterlockedIncrement(&pWalk->lIdle);
+      pDir = __win_WalkPop(pWalk, pWorker->uiIndex);
+      if (!pDir && pWalk->lOutstanding)
+        WaitForSingleObject(pWalk->hWake, INFINITE);
+      InterlockedDecrement(&pWalk->lIdle);
+    }
+
+    if (pDir)
+      __win_WalkRun(pWalk, pDir, pWorker->uiIndex);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Read all entries of a directory
+ * @internal
+ * @param ppEntries receives the entries, free with free()
+ * @param ppwszNames receives the name pool, free with free()
+ * @return number of entries or -1 if the directory can't be read
+ */
+static long __win_WalkRead(TWalk *pWalk, const wchar_t *pwszPath,
+  TWalkEntry **ppEntries, wchar_t **ppwszNames)
+{
+  struct plibc_WDIR *pwd;
+  TWalkEntry *pEntries, *pEntry;
+  wchar_t *pwszNames;
+  size_t nEntries, nEntriesSize, nNames, nNamesSize, nLen, nIdx;
+  const wchar_t *pwszName;
+  BOOL bOK;
+
+  pwd = __win_OpenDirStreamW(pwszPath);
+  if (!pwd)
+    return -1;
+
+  pEntries = NULL;
+  pwszNames = NULL;
+  nEntries = nEntriesSize = nNames = nNamesSize = 0;
+  bOK = TRUE;
+
+  errno = 0;
+  while (bOK && !pWalk->lStop && __win_NextDirEntry(pwd))
+  {
+    pwszName = pwd->findData.cFileName;
+    if (pwszName[0] == L'.' && (!pwszName[1] ||
+      (pwszName[1] == L'.' && !pwszName[2])))
+      continue;
+
+    nLen = wcslen(pwszName) + 1;
+    if (nEntries == nEntriesSize)
+    {
+      nEntriesSize = nEntriesSize ? nEntriesSize * 2 : 64;
+      pEntry = (TWalkEntry *) __win_Realloc(pEntries,
+        nEntriesSize * sizeof(TWalkEntry));
+      bOK = pEntry != NULL;
+      if (!bOK)
+        break;
+      pEntries = pEntry;
+    }
+    if (nNames + nLen > nNamesSize)
+    {
+      wchar_t *pwszNew;
+
+      nNamesSize = (nNamesSize ? nNamesSize * 2 : 2048) + nLen;
+      pwszNew = (wchar_t *) __win_Realloc(pwszNames, nNamesSize * sizeof(wchar_t));
+      bOK = pwszNew != NULL;
+      if (!bOK)
+        break;
+      pwszNames = pwszNew;
+    }
+
+    pEntry = &pEntries[nEntries++];
+    pEntry->dwAttributes = pwd->findData.dwFileAttributes;
+    pEntry->dwReparseTag = pwd->findData.dwReserved0;
+    pEntry->ftCreationTime = pwd->findData.ftCreationTime;
+    pEntry->ftLastAccessTime = pwd->findData.ftLastAccessTime;
+    pEntry->ftLastWriteTime = pwd->findData.ftLastWriteTime;
+    pEntry->nFileSizeHigh = pwd->findData.nFileSizeHigh;
+    pEntry->nFileSizeLow = pwd->findData.nFileSizeLow;
+    pEntry->nName = nNames;
+    memcpy(pwszNames + nNames, pwszName, nLen * sizeof(wchar_t));
+    nNames += nLen;
+  }
+  if (errno)
+    bOK = FALSE;
+
+  if (pwd->hFind != INVALID_HANDLE_VALUE)
+    FindClose(pwd->hFind);
+  __win_ReleaseDirStream(pwd);
+
+  if (!bOK)
+  {
+    free(pEntries);
+    free(pwszNames);
+    return -1;
+  }
+
+  /* The pool doesn't move anymore */
+  for (nIdx = 0; nIdx < nEntries; nIdx++)
+    pEntries[nIdx].pwszName = pwszNames + pEntries[nIdx].nName;
+
+  if (pWalk->bSorted && nEntries > 1)
+    qsort(pEntries, nEntries, sizeof(TWalkEntry), __win_WalkCompare);
+
+  *ppEntries = pEntries;
+  *ppwszNames = pwszNames;
+
+  return (long) nEntries;
+}
+
+/**
+ * @brief Scan a directory and deliver its entries
+ * @internal
+ */
+static void __win_WalkScan(TWalk *pWalk, TWalkDir *pDir,
+  unsigned int uiWorker)
+{
+  TWalkEntry *pEntries, *pEntry, target;
+  TWalkDir *pChild;
+  WIN32_FILE_ATTRIBUTE_DATA attrData;
+  struct _stat st;
+  wchar_t *pwszNames, *pwszChild;
+  char *pszChild;
+  size_t nDirLenW, nDirLen, nNameLenW;
+  long lEntries, lIdx;
+  int iNameLen, iType;
+  BOOL bLink;
+
+  if (pWalk->lStop)
+  {
+    __win_WalkRelease(pWalk, pDir);
+    return;
+  }
+
+  pEntries = NULL;
+  pwszNames = NULL;
+  lEntries = __win_WalkRead(pWalk, pDir->pwszPath, &pEntries, &pwszNames);
+  pDir->bReadable = lEntries >= 0;
+
+  if ((pWalk->iFlags & FTW_CHDIR) && pDir->pParent)
+    SetCurrentDirectoryW(pDir->pParent->pwszPath);
+  if (!pDir->bReadable)
+    __win_WalkCall(pWalk, pDir->pszPath, &pDir->st, FTW_DNR, pDir->iBase,
+      pDir->iLevel);
+  else if (!(pWalk->iFlags & FTW_DEPTH))
+    __win_WalkCall(pWalk, pDir->pszPath, &pDir->st, FTW_D, pDir->iBase,
+      pDir->iLevel);
+
+  /* Room for every name of this directory */
+  nDirLenW = wcslen(pDir->pwszPath);
+  nDirLen = strlen(pDir->pszPath);
+  pwszChild = (wchar_t *) __win_Malloc((nDirLenW + MAX_PATH + 2) * sizeof(wchar_t));
+  pszChild = (char *) __win_Malloc(nDirLen + FILENAME_MAX * 3 + 2);
+  if (lEntries > 0 && (!pwszChild || !pszChild))
+  {
+    errno = ENOMEM;
+    InterlockedCompareExchange(&pWalk->lResult, -1, 0);
+    InterlockedExchange(&pWalk->lStop, TRUE);
+    lEntries = 0;
+  }
+
+  if (lEntries > 0)
+  {
+    memcpy(pwszChild, pDir->pwszPath, nDirLenW * sizeof(wchar_t));
+    if (nDirLenW && pwszChild[nDirLenW - 1] != L'\\')
+      pwszChild[nDirLenW++] = L'\\';
+    memcpy(pszChild, pDir->pszPath, nDirLen);
+    if (nDirLen && pszChild[nDirLen - 1] != '/' && pszChild[nDirLen - 1] != '\\')
+      pszChild[nDirLen++] = '/';
+
+    if (pWalk->iFlags & FTW_CHDIR)
+      SetCurrentDirectoryW(pDir->pwszPath);
+  }
+
+  for (lIdx = 0; lIdx < lEntries && !pWalk->lStop; lIdx++)
+  {
+    pEntry = &pEntries[lIdx];
+
+    nNameLenW = wcslen(pEntry->pwszName);
+    memcpy(pwszChild + nDirLenW, pEntry->pwszName,
+      (nNameLenW + 1) * sizeof(wchar_t));
+    iNameLen = __win_Utf16ToLocal(pEntry->pwszName, pszChild + nDirLen,
+      FILENAME_MAX * 3 + 1);
+    if (iNameLen < 0)
+      continue;
+
+    bLink = (pEntry->dwAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+      (pEntry->dwReparseTag == IO_REPARSE_TAG_SYMLINK ||
+      pEntry->dwReparseTag == IO_REPARSE_TAG_MOUNT_POINT);
+
+    if (bLink && _plibc_native_symlinks && (pWalk->iFlags & FTW_PHYS))
+    {
+      /* The link itself */
+      __win_WalkStat(pWalk, pEntry, &st);
+      st.st_mode = (st.st_mode & ~S_IFMT) | S_IFLNK;
+      st.st_size = 0;
+      iType = FTW_SL;
+    }
+    else if (bLink)
+    {
+      /* The target, linked directories are not entered so that there are
+         no cycles */
+      if (GetFileAttributesExW(pwszChild, GetFileExInfoStandard, &attrData))
+      {
+        target.dwAttributes = attrData.dwFileAttributes;
+        target.ftCreationTime = attrData.ftCreationTime;
+        target.ftLastAccessTime = attrData.ftLastAccessTime;
+        target.ftLastWriteTime = attrData.ftLastWriteTime;
+        target.nFileSizeHigh = attrData.nFileSizeHigh;
+        target.nFileSizeLow = attrData.nFileSizeLow;
+        target.pwszName = pEntry->pwszName;
+        if (__win_WalkStat(pWalk, &target, &st))
+          iType = (target.dwAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FTW_D :
+            FTW_F;
+        else
+          iType = FTW_NS;
+      }
+      else
+      {
+        __win_WalkStat(pWalk, pEntry, &st);
+        iType = FTW_SLN;
+      }
+    }
+    else if (pEntry->dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+      pChild = __win_WalkNewDir(pDir, pwszChild, nDirLenW + nNameLenW,
+        pszChild, nDirLen + iNameLen, (int) nDirLen);
+      if (!pChild)
+      {
+        errno = ENOMEM;
+        InterlockedCompareExchange(&pWalk->lResult, -1, 0);
+        InterlockedExchange(&pWalk->lStop, TRUE);
+        break;
+      }
+      __win_WalkStat(pWalk, pEntry, &pChild->st);
+
+      if (!__win_WalkPush(pWalk, uiWorker, pChild))
+      {
+        __win_WalkScan(pWalk, pChild, uiWorker);
+        if (pWalk->iFlags & FTW_CHDIR)
+          SetCurrentDirectoryW(pDir->pwszPath);
+      }
+      continue;
+    }
+    else
+      iType = __win_WalkStat(pWalk, pEntry, &st) ? FTW_F : FTW_NS;
+
+    __win_WalkCall(pWalk, pszChild, &st, iType, (int) nDirLen,
+      pDir->iLevel + 1);
+  }
+
+  free(pwszChild);
+  free(pszChild);
+  free(pEntries);
+  free(pwszNames);
+
+  __win_WalkRelease(pWalk, pDir);
+}
+
+/**
+ * @brief Walk a file tree
+ * @param path root of the tree
+ * @param options NULL for a serial walk without flags
+ * @param fn called for every file and directory, a nonzero return value
+ *        stops the walk
+ * @param cls closure passed to fn
+ * @return 0 after walking the whole tree, the value returned by fn if it
+ *         stopped the walk, -1 on error
+ * @note With options->threads > 1, fn is called concurrently by several
+ *       threads. Entries of one directory are always delivered by the same
+ *       thread and, with options->sorted, ordered by name. A directory is
+ *       delivered before its entries, or after them with FTW_DEPTH. The
+ *       stat information comes from the directory enumeration, st_ino is 0
+ *       and st_nlink is 1. Linked directories are reported, but not
+ *       entered. FTW_CHDIR is only supported in serial walks.
+ */
+int plibc_walk(const char *path, const struct plibc_walk_options *options,
+  TWalkProc fn, void *cls)
+{
+  TWalk walk;
+  TWalkDir *pRoot;
+  TWalkWorker workers[WALK_MAX_THREADS];
+  HANDLE hThreads[WALK_MAX_THREADS];
+  wchar_t szRoot[_MAX_PATH + 1], *pwszCwd;
+  struct _stat st;
+  unsigned int uiIdx, uiStarted, uiQueues;
+  BOOL bQueues;
+  const char *pszBase;
+  size_t nLen;
+  long lRet;
+  int iRet;
+
+  memset(&walk, 0, sizeof(walk));
+  walk.fn = fn;
+  walk.cls = cls;
+  walk.uiThreads = 1;
+  if (options)
+  {
+    walk.iFlags = options->flags;
+    walk.bSorted = options->sorted != 0;
+    if (options->threads > 1)
+      walk.uiThreads = options->threads > WALK_MAX_THREADS ?
+        WALK_MAX_THREADS : options->threads;
+    walk.uiQueueLimit = options->queue_limit;
+  }
+  if (!walk.uiQueueLimit)
+    walk.uiQueueLimit = WALK_QUEUE_DEFAULT;
+
+  /* The working directory is shared by all threads */
+  if ((walk.iFlags & FTW_CHDIR) && walk.uiThreads > 1)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (_plibc_utf8_mode == 1)
+    lRet = plibc_conv_to_win_pathwconv(path, szRoot, _MAX_PATH);
+  else
+  {
+    char szAnsi[_MAX_PATH + 1];
+
+    lRet = plibc_conv_to_win_path(path, szAnsi, _MAX_PATH);
+    if (lRet == ERROR_SUCCESS &&
+      strtowchar_buf(szAnsi, szRoot, _MAX_PATH + 1, CP_ACP) != 0)
+      lRet = ERROR_FILENAME_EXCED_RANGE;
+  }
+  if (lRet != ERROR_SUCCESS)
+  {
+    SetErrnoFromWinError(lRet);
+    return -1;
+  }
+
+  iRet = (walk.iFlags & FTW_PHYS) ? _win_lstat(path, &st) :
+    _win_stat(path, &st);
+  if (iRet != 0)
+    return -1;
+
+  /* Offset of the last component */
+  nLen = strlen(path);
+  while (nLen > 1 && (path[nLen - 1] == '/' || path[nLen - 1] == '\\'))
+    nLen--;
+  for (pszBase = path + nLen; pszBase > path && pszBase[-1] != '/' &&
+    pszBase[-1] != '\\'; pszBase--)
+    ;
+
+  if (!S_ISDIR(st.st_mode))
+  {
+    __win_WalkCall(&walk, path, &st, S_ISLNK(st.st_mode) ? FTW_SL : FTW_F,
+      (int) (pszBase - path), 0);
+    return walk.lResult;
+  }
+
+  if (iswalpha(szRoot[0]) && szRoot[1] == L':')
+    walk.sDev = (short) (towupper(szRoot[0]) - L'A');
+
+  pRoot = __win_WalkNewDir(NULL, szRoot, wcslen(szRoot), path, strlen(path),
+    (int) (pszBase - path));
+  if (!pRoot)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  pRoot->st = st;
+
+  pwszCwd = NULL;
+  if (walk.iFlags & FTW_CHDIR)
+  {
+    DWORD dwLen = GetCurrentDirectoryW(0, NULL);
+
+    pwszCwd = (wchar_t *) __win_Malloc(dwLen * sizeof(wchar_t));
+    if (pwszCwd)
+      GetCurrentDirectoryW(dwLen, pwszCwd);
+  }
+
+  if (walk.uiThreads < 2)
+    __win_WalkScan(&walk, pRoot, 0);
+  else
+  {
+    /* walk.uiThreads may drop to 1 below, the queues are freed by count */
+    uiQueues = walk.uiThreads;
+    walk.pQueues = (TWalkQueue *) __win_Calloc(uiQueues, sizeof(TWalkQueue));
+    walk.hWake = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    bQueues = walk.pQueues && walk.hWake;
+    for (uiIdx = 0; walk.pQueues && uiIdx < uiQueues; uiIdx++)
+    {
+      InitializeCriticalSection(&walk.pQueues[uiIdx].cs);
+      walk.pQueues[uiIdx].ppDirs = (TWalkDir **) __win_Malloc(walk.uiQueueLimit *
+        sizeof(TWalkDir *));
+      if (!walk.pQueues[uiIdx].ppDirs)
+        bQueues = FALSE;
+    }
+
+    if (!bQueues)
+    {
+      /* Not enough resources for the threads, walk serially */
+      walk.uiThreads = 1;
+      __win_WalkScan(&walk, pRoot, 0);
+    }
+    else
+    {
+      walk.lOutstanding = 1;
+      walk.pQueues[0].ppDirs[0] = pRoot;
+      walk.pQueues[0].uiCount = 1;
+
+      uiStarted = 0;
+      for (uiIdx = 0; uiIdx < walk.uiThreads; uiIdx++)
+      {
+        workers[uiIdx].pWalk = &walk;
+        workers[uiIdx].uiIndex = uiIdx;
+      }
+      for (uiIdx = 1; uiIdx < walk.uiThreads; uiIdx++)
+      {
+        DWORD dwTID; /* Last ptr of CreateThread my not be NULL under Win9x */
+
+        hThreads[uiStarted] = CreateThread(NULL, 0, __win_WalkWorker,
+          &workers[uiIdx], 0, &dwTID);
+        if (hThreads[uiStarted])
+          uiStarted++;
+      }
+
+      /* The calling thread scans, too */
+      __win_WalkWorker(&workers[0]);
+
+      for (uiIdx = 0; uiIdx < uiStarted; uiIdx++)
+      {
+        WaitForSingleObject(hThreads[uiIdx], INFINITE);
+        CloseHandle(hThreads[uiIdx]);
+      }
+    }
+
+    for (uiIdx = 0; walk.pQueues && uiIdx < uiQueues; uiIdx++)
+    {
+      DeleteCriticalSection(&walk.pQueues[uiIdx].cs);
+      free(walk.pQueues[uiIdx].ppDirs);
+    }
+    free(walk.pQueues);
+    if (walk.hWake)
+      CloseHandle(walk.hWake);
+  }
+
+  if (pwszCwd)
+  {
+    SetCurrentDirectoryW(pwszCwd);
+    free(pwszCwd);
+  }
+
+  return walk.lResult;
+}
+
+static int __win_NftwCall(const char *path, const struct _stat *sb,
+  int type, struct FTW *ftwbuf, void *cls)
+{
+  return ((TNftwClosure *) cls)->fn(path, sb, type, ftwbuf);
+}
+
+/**
+ * @brief Walk a file tree
+ * @note fd_limit is ignored, directories are read completely and closed
+ *       before their entries are delivered
+ */
+int _win_nftw(const char *path, TNftwProc fn, int fd_limit, int flags)
+{
+  struct plibc_walk_options options;
+  TNftwClosure closure;
+
+  memset(&options, 0, sizeof(options));
+  options.flags = flags;
+  closure.fn = fn;
+
+  return plibc_walk(path, &options, __win_NftwCall, &closure);
+}
+
+/* end of walk.c */
@@ -24,71 +24,129 @@
 
 #include "plibc_private.h"
 
-DWORD WINAPI __win_Write(TReadWriteInfo *pInfo)
+/**
+ * @brief Carry out a write
+ * @internal
+ */
+int __win_Write(TReadWriteInfo *pInfo)
 {
-  int iRet;
-  
-  if (__win_GetHandleType((DWORD) pInfo->fildes) == FD_HANDLE)
+  if (pInfo->eType == FD_HANDLE)
   {
     _setmode(pInfo->fildes, _O_BINARY);
 		errno = 0;
-		iRet = _write(pInfo->fildes, pInfo->buf, pInfo->nbyte);
-    free(pInfo);
-    
-    return iRet;
+		return _write(pInfo->fildes, pInfo->buf, pInfo->nbyte);
 	}
 	else
 	{
     DWORD dwWritten;
+
+    errno = 0;
     if (!WriteFile((HANDLE) pInfo->fildes, pInfo->buf, pInfo->nbyte,
       &dwWritten, NULL))
     {
       SetErrnoFromWinError(GetLastError());
-      free(pInfo);
-      
       return -1;
     }
     else
-    {
-      free(pInfo);      
       return dwWritten;
-    }
 	}
 }
 
 /**
  * @brief Write on a file
- *        If the handle is in non-blocking mode, this function
- *        always returns 1 for non-sockets.
+ *        If the handle is in non-blocking mode, the data is queued and
+ *        written in the background. The number of bytes accepted may be
+ *        less than nbyte; if the queue is full, this function fails with
+ *        EAGAIN. Errors of queued writes are reported by a later call.
  */
 int _win_write(int fildes, const void *buf, size_t nbyte)
 {
-  if (__win_GetHandleType((DWORD) fildes) == SOCKET_HANDLE)
+  THandleInfo info;
+
+  if (!__win_GetHandleInfo(fildes, &info))
+  {
+    info.dwHandle = fildes;
+    info.eType = UNKNOWN_HANDLE;
+    info.bBlocking = TRUE;
+    info.pAio = NULL;
+    info.pPipe = NULL;
+  }
+
+  if (info.eType == SOCKET_HANDLE)
   {
     return _win_send(fildes, buf, nbyte, 0);
   }
+  else if (info.pPipe)
+    return __win_PipeWrite(&info, buf, nbyte);
+  else if (info.bBlocking)
+  {
+    TReadWriteInfo rwInfo;
+    int iRet;
+
+    /* Don't overtake writes queued while the handle was non-blocking */
+    __win_AioFlush(&info);
+
+    rwInfo.fildes = fildes;
+    rwInfo.eType = info.eType;
+    rwInfo.buf = (void *) buf;
+    rwInfo.nbyte = nbyte;
+
+    return __win_Write(&rwInfo);
+  }
   else
+    return __win_AioWrite(&info, buf, nbyte, NULL);
+}
+
+/**
+ * @brief Write a buffer and hand it over to PlibC
+ * @param free_fn called with buf once the data has been written
+ * @return number of bytes written or queued, -1 on error.
+ *         If all nbyte bytes were written or queued, buf belongs to PlibC
+ *         and the caller must not touch it anymore. Otherwise, including
+ *         errors, buf still belongs to the caller, who may send the rest
+ *         again.
+ * @note On non-blocking files and pipes made by pipe(), buf is queued
+ *       without being copied. Other descriptors are written synchronously
+ *       until all data is written, an error occurs or, on non-blocking
+ *       sockets and pipes made by plibc_pipe_ex(), nothing more fits.
+ */
+int plibc_write_owned(int fildes, void *buf, size_t nbyte, TFreeProc free_fn)
+{
+  THandleInfo info;
+  size_t nDone;
+
+  if (!__win_GetHandleInfo(fildes, &info))
   {
-    TReadWriteInfo *pInfo;
-    
-    pInfo = malloc(sizeof(TReadWriteInfo));
-    pInfo->fildes = fildes;
-    pInfo->buf = malloc(nbyte);
-    memcpy(pInfo->buf, buf, nbyte);
-    pInfo->nbyte = nbyte;
-
-    if (__win_IsHandleMarkedAsBlocking(fildes))
-      return __win_Write(pInfo);
-    else
+    info.dwHandle = fildes;
+    info.eType = UNKNOWN_HANDLE;
+    info.bBlocking = TRUE;
+    info.pAio = NULL;
+    info.pPipe = NULL;
+  }
+
+  if (info.eType != SOCKET_HANDLE && !info.pPipe && !info.bBlocking)
+    return __win_AioWrite(&info, buf, nbyte, free_fn);
+
+  nDone = 0;
+  while (nDone < nbyte)
+  {
+    int iRet;
+
+    iRet = _win_write(fildes, (char *) buf + nDone, nbyte - nDone);
+    if (iRet <= 0)
     {
-      DWORD dwTID; /* Last ptr of CreateThread my not be NULL under Win9x */
-      HANDLE h;
-      
-      h = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) __win_Write, pInfo, 0, &dwTID);
-      CloseHandle(h);
-      return nbyte;
+      if (!nDone)
+        return -1;
+      break;
     }
+    nDone += iRet;
   }
+
+  /* The caller still needs the rest */
+  if (nDone == nbyte)
+    free_fn(buf);
+
+  return nDone;
 }
 
 /* end of write.c */
@@ -0,0 +1,144 @@
+/*
+     This file is part of PlibC.
+     (C) 2005, 2006, 2007, 2008 Nils Durner (and other contributing authors)
+
+	   This library is free software; you can redistribute it and/or
+	   modify it under the terms of the GNU Lesser General Public
+	   License as published by the Free Software Foundation; either
+	   version 2.1 of the License, or (at your option) any later version.
+
+	   This library is distributed in the hope that it will be useful,
+	   but WITHOUT ANY WARRANTY; without even the implied warranty of
+	   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	   Lesser General Public License for more details.
+
+	   You should have received a copy of the GNU Lesser General Public
+	   License along with this library; if not, write to the Free Software
+	   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/**
+ * @file src/writev.c
+ * @brief writev() and pwritev()
+ */
+
+#include "plibc_private.h"
+
+/**
+ * @brief Concatenate the buffers of an I/O vector
+ * @internal
+ * @return malloc()ed buffer or NULL (errno is set)
+ */
+static char *__win_GatherIov(const struct iovec *iov, int iovcnt,
+  size_t nTotal)
+{
+  char *pBuf, *pDest;
+  int i;
+
+  pBuf = (char *) __win_Malloc(nTotal);
+  if (!pBuf)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  pDest = pBuf;
+  for (i = 0; i < iovcnt; i++)
+  {
+    memcpy(pDest, iov[i].iov_base, iov[i].iov_len);
+    pDest += iov[i].iov_len;
+  }
+
+  return pBuf;
+}
+
+/**
+ * @brief Write data from multiple buffers
+ * @note Sockets use a single WSASend(). For other descriptors, the buffers
+ *       are gathered and handed to the write path in one piece, so there is
+ *       a single WriteFile() per call. WriteFileGather() is not used because
+ *       it requires unbuffered handles and page aligned buffers.
+ */
+int _win_writev(int fildes, const struct iovec *iov, int iovcnt)
+{
+  size_t nTotal;
+  char *pBuf;
+  int iRet;
+
+  if (__win_GetIovLength(iov, iovcnt, &nTotal) == -1)
+    return -1;
+
+  if (__win_GetHandleType(fildes) == SOCKET_HANDLE)
+  {
+    WSABUF stackBufs[IOV_STACK_BUFS];
+    LPWSABUF pBufs;
+    DWORD dwWritten;
+
+    pBufs = __win_IovToWSABuf(iov, iovcnt, stackBufs);
+    if (!pBufs)
+      return -1;
+
+    if (WSASend(fildes, pBufs, iovcnt, &dwWritten, 0, NULL, NULL) ==
+      SOCKET_ERROR)
+    {
+      SetErrnoFromWinsockError(WSAGetLastError());
+      if (errno == EWOULDBLOCK)
+        __win_EpollRearm(fildes);
+      iRet = -1;
+    }
+    else
+      iRet = dwWritten;
+
+    if (pBufs != stackBufs)
+      free(pBufs);
+
+    return iRet;
+  }
+
+  if (!nTotal)
+    return 0;
+  if (iovcnt == 1)
+    return _win_write(fildes, iov[0].iov_base, iov[0].iov_len);
+
+  pBuf = __win_GatherIov(iov, iovcnt, nTotal);
+  if (!pBuf)
+    return -1;
+
+  /* Non-blocking descriptors queue pBuf itself instead of another copy. It
+     stays ours unless everything was written or queued. */
+  iRet = plibc_write_owned(fildes, pBuf, nTotal, free);
+  if (iRet != (int) nTotal)
+    free(pBuf);
+
+  return iRet;
+}
+
+/**
+ * @brief Write data from multiple buffers, starting at the given offset
+ * @note Like pwrite(), this doesn't move the file pointer
+ */
+int _win_pwritev(int fildes, const struct iovec *iov, int iovcnt,
+  off_t offset)
+{
+  size_t nTotal;
+  char *pBuf;
+  int iRet;
+
+  if (__win_GetIovLength(iov, iovcnt, &nTotal) == -1)
+    return -1;
+
+  if (iovcnt == 1 || !nTotal)
+    return _win_pwrite(fildes, iovcnt ? iov[0].iov_base : NULL, nTotal,
+      offset);
+
+  pBuf = __win_GatherIov(iov, iovcnt, nTotal);
+  if (!pBuf)
+    return -1;
+
+  iRet = _win_pwrite(fildes, pBuf, nTotal, offset);
+  free(pBuf);
+
+  return iRet;
+}
+
+/* end of writev.c */